@@ -5,15 +5,22 @@
 
 
 
+/* Slope of the (leaky) RELU for negative inputs */
+#define RELU_NEGATIVE_SLOPE     0.01f
+
+
+
 /* Enum containing all the activation functions */
 typedef enum { RELU, SIGMOID, SOFTMAX, LINEAR } activation_function;
 
 
 
+/* Whole-tensor kernels of an activation (vectorised, see simd.h) */
 typedef struct Activation {
 
-    void (*forward_inplace)(Tensor*);           // Forward fuction
-    Tensor* (*backward)(Tensor*);       // The derivative function
+    void (*forward_inplace)(Tensor*);           // Forward fuction, a = act(z) in place
+    int (*backward_inplace)(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums);    // grad = dL/da becomes dL/dz in place (z and a from the forward pass),
+                                                                                                // col_sums (1 x cols, NULL for none) receives its column sums in the same sweep
     activation_function func;           // For debugging?
     
 } Activation;
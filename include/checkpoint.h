@@ -0,0 +1,107 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+
+
+/* State of one of the two snapshot buffers of a Checkpointer */
+typedef enum { SNAPSHOT_FREE, SNAPSHOT_FILLING, SNAPSHOT_PENDING, SNAPSHOT_WRITING } snapshot_state;
+
+
+
+/* Writes snapshots (complete file images) to one path from a background thread, with two buffers:
+   while the writer thread saves one, the trainer fills the other, so taking a snapshot costs a memcpy and never waits for the disk */
+typedef struct Checkpointer {
+
+    char* path;                         // File the snapshots are written to (through path.tmp and a rename)
+
+    char* buffers[2];                   // Snapshot images
+    size_t capacities[2];               // Allocated bytes of each buffer
+    size_t sizes[2];                    // Bytes of the image held by each buffer
+    snapshot_state states[2];           // Who owns each buffer
+
+    int n_written;                      // Snapshots written to disk
+    int n_failed;                       // Snapshots that could not be written
+    int stop;                           // Set when the checkpointer is being destroyed
+
+    pthread_t writer;                   // Background thread writing the pending snapshot
+    pthread_mutex_t lock;               // Guards states, the counters and stop
+    pthread_cond_t cond;                // Signalled when a snapshot is submitted or written
+
+} Checkpointer;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new checkpointer writing to path, and starts its writer thread.
+ * Returns NULL if any error.
+ *
+ * @param path File the snapshots are written to.
+*/
+Checkpointer* create_checkpointer(const char* path);
+
+
+
+/**
+ * Waits for the pending snapshot to be written, stops the writer thread and completely frees the checkpointer.
+*/
+void free_checkpointer(Checkpointer** ckpt);
+
+
+
+// ==========================================
+//             Snapshots
+// ==========================================
+
+/**
+ * Returns a buffer of at least size bytes to build the next snapshot in. It is one the writer thread is not reading,
+ * so this never waits for the disk (a snapshot still waiting to be written is dropped for the newer one).
+ * The buffer must be handed back with checkpointer_submit.
+ * Returns NULL if any error.
+ *
+ * @param ckpt The checkpointer.
+ * @param size Size of the snapshot in bytes.
+*/
+char* checkpointer_acquire(Checkpointer* ckpt, size_t size);
+
+
+
+/**
+ * Queues a buffer returned by checkpointer_acquire (now holding a complete image of size bytes) for the writer thread.
+ *
+ * @param ckpt The checkpointer.
+ * @param buffer The buffer returned by checkpointer_acquire.
+ * @param size Size of the snapshot in bytes.
+*/
+void checkpointer_submit(Checkpointer* ckpt, char* buffer, size_t size);
+
+
+
+/**
+ * Waits until every submitted snapshot is on disk.
+ * Returns 0 if any snapshot could not be written since the checkpointer was created.
+*/
+int checkpointer_wait(Checkpointer* ckpt);
+
+
+
+/**
+ * Writes size bytes to path.tmp, flushes them to the disk and renames the file to path, so path always holds
+ * either the previous or the new complete file, even if the process is killed while writing.
+ * Returns 0 if any error.
+ *
+ * @param path File to write.
+ * @param data Bytes to write.
+ * @param size Number of bytes.
+*/
+int checkpoint_write_file(const char* path, const void* data, size_t size);
+
+
+
+#endif
\ No newline at end of file
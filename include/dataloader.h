@@ -0,0 +1,120 @@
+#ifndef DATALOADER_H
+#define DATALOADER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "tensor.h"
+
+
+
+/* Batches assembled ahead of the one being trained on, and background threads assembling them (if n_workers <= 0) */
+#define DATALOADER_SLOTS            4
+#define DATALOADER_DEFAULT_WORKERS  1
+
+
+
+/* One buffer of the ring: holds the batch at one position of the stream */
+typedef struct DataLoaderSlot {
+
+    Tensor x;                   // Batch inputs handed out (rows of x_buffer, or a view of the source when not shuffling)
+    Tensor y;                   // Batch targets handed out
+    float* x_buffer;            // (batch_size x features) gathered rows, NULL when not shuffling
+    float* y_buffer;            // (batch_size x outputs) gathered rows, NULL when not shuffling
+    long position;              // Position in the stream (epoch * n_batches + batch) of the batch it holds, -1 if none
+    int ready;                  // 1 once the batch is assembled
+
+} DataLoaderSlot;
+
+
+
+/* Serves mini-batches of a pair of matrices (inputs, targets), reshuffled every epoch, assembled by background threads
+   into a ring of reusable buffers while the current batch trains */
+typedef struct DataLoader {
+
+    const Tensor* x;            // (n_samples x features) inputs, not owned
+    const Tensor* y;            // (n_samples x outputs) targets, not owned
+    int n_samples;
+    int batch_size;
+    int n_batches;              // Batches per epoch, the last one holds the remainder if n_samples is not a multiple of batch_size
+    int shuffle;                // 1 to draw a new order of the samples every epoch
+    uint64_t seed;              // The order of epoch e only depends on (seed, e), so a resumed run sees the same batches
+
+    int* orders[2];             // Sample orders of two consecutive epochs (epoch e uses orders[e % 2])
+    long order_epochs[2];       // Epoch each order was drawn for, -1 if none
+
+    DataLoaderSlot slots[DATALOADER_SLOTS];
+    long next_fill;             // Next position a worker assembles
+    long next_take;             // Next position handed out by dataloader_next
+    int holding;                // 1 while the consumer holds the slot of position next_take - 1
+    int in_flight;              // Batches being assembled right now
+
+    int n_workers;
+    pthread_t* workers;
+    int stop;                   // Set when the loader is being destroyed
+    pthread_mutex_t lock;       // Guards every field above that changes
+    pthread_cond_t cond;        // Signalled when a batch is ready, a slot is freed or the stream is moved
+
+} DataLoader;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new data loader over the rows of x and y (which must outlive it) and starts its worker threads on epoch 0.
+ * Rows are never copied out of x and y except into the batches being assembled, so x and y can be views of a mapped dataset.
+ * Returns NULL if any error.
+ *
+ * @param x (n_samples x features) inputs.
+ * @param y (n_samples x outputs) targets.
+ * @param batch_size Samples per batch.
+ * @param shuffle 1 to reshuffle the samples every epoch, 0 to serve them in order (the batches are then views of x and y).
+ * @param seed Seed of the shuffles, pass the same one to resume a run.
+ * @param n_workers Background threads assembling batches, DATALOADER_DEFAULT_WORKERS if <= 0.
+*/
+DataLoader* create_dataloader(const Tensor* x, const Tensor* y, int batch_size, int shuffle, uint64_t seed, int n_workers);
+
+
+
+/**
+ * Stops and joins the workers, then completely frees the loader. Batches handed out become invalid.
+*/
+void free_dataloader(DataLoader** loader);
+
+
+
+// ==========================================
+//             Iteration
+// ==========================================
+
+/**
+ * Moves the loader to a batch of an epoch: the next dataloader_next returns that batch. Batches assembled in advance
+ * for another position are dropped. network_train calls it to start (or resume) training.
+ * Returns 0 if any error.
+ *
+ * @param loader The loader.
+ * @param epoch Epoch (its order is drawn from the seed and the epoch).
+ * @param batch Batch within the epoch (n_batches is the first batch of the next epoch).
+*/
+int dataloader_seek(DataLoader* loader, int epoch, int batch);
+
+
+
+/**
+ * Returns the next batch (inputs in *x, targets in *y), waiting if the workers have not assembled it yet.
+ * The batch stays valid until the next call, which hands its buffer back to the workers. After the last batch of an
+ * epoch comes the first batch of the next one.
+ * Returns 0 if any error.
+ *
+ * @param loader The loader.
+ * @param x Receives the batch inputs.
+ * @param y Receives the batch targets.
+*/
+int dataloader_next(DataLoader* loader, Tensor** x, Tensor** y);
+
+
+
+#endif
\ No newline at end of file
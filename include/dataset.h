@@ -0,0 +1,116 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+
+#include "tensor.h"
+
+
+
+/* Native dataset files (dataset_save / dataset_load): header, then the feature matrix and the target matrix as float32,
+   each starting on a multiple of DATASET_FILE_ALIGNMENT so they can be used in place once the file is mapped */
+#define DATASET_FILE_MAGIC      "NNDATA"
+#define DATASET_FILE_VERSION    1
+#define DATASET_FILE_ALIGNMENT  64
+
+
+
+/* A whole dataset as two row-aligned matrices: sample i is row i of x and row i of y */
+typedef struct Dataset {
+
+    Tensor* x;                  // (n_samples x n_features) inputs
+    Tensor* y;                  // (n_samples x n_outputs) targets (one-hot rows for classification)
+    int n_samples;
+    int n_features;
+    int n_outputs;
+
+    void* mapping;              // Native file mapped by dataset_load (x and y point into it), NULL if the data was decoded into memory
+    size_t mapping_size;        // Bytes of the mapping
+
+} Dataset;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Completely frees the dataset (and unmaps its file). Views taken from it become invalid.
+*/
+void free_dataset(Dataset** ds);
+
+
+
+// ==========================================
+//             Loading
+// ==========================================
+
+/**
+ * Loads a native dataset file by mapping it in memory: x and y point straight into the mapping, nothing is parsed,
+ * converted or copied, and pages are only read from disk (or shared from the page cache) when a batch touches them.
+ * Returns NULL if any error (bad magic, version or sizes).
+ *
+ * @param path Path of the dataset file (written by dataset_save or dataset_convert_csv).
+*/
+Dataset* dataset_load(const char* path);
+
+
+
+/**
+ * Loads a classification dataset stored as a pair of IDX files (the format MNIST is distributed in): an unsigned byte
+ * tensor of samples (N x d1 x d2 ...) and an unsigned byte vector of N labels. Both files are mapped and decoded in one
+ * pass: pixels become floats scaled by feature_scale, labels become one-hot rows of n_classes.
+ * Returns NULL if any error.
+ *
+ * @param images_path Path of the IDX file of the samples (e.g. train-images-idx3-ubyte).
+ * @param labels_path Path of the IDX file of the labels (e.g. train-labels-idx1-ubyte).
+ * @param n_classes Number of classes (width of the one-hot targets).
+ * @param feature_scale Factor applied to every byte of the samples (1/255 maps pixels to [0, 1]).
+*/
+Dataset* dataset_load_idx(const char* images_path, const char* labels_path, int n_classes, float feature_scale);
+
+
+
+/**
+ * Loads a classification dataset from a CSV file with one sample per line: the label first, then the features.
+ * A first line that does not start with a number is taken as a header and skipped. Lines may be of any length.
+ * Returns NULL if any error (the line of a malformed row is printed).
+ *
+ * @param path Path of the CSV file.
+ * @param n_classes Number of classes (width of the one-hot targets).
+ * @param feature_scale Factor applied to every feature (1/255 maps pixels to [0, 1]).
+*/
+Dataset* dataset_load_csv(const char* path, int n_classes, float feature_scale);
+
+
+
+// ==========================================
+//             Saving
+// ==========================================
+
+/**
+ * Writes the dataset as a native dataset file, which dataset_load maps without any parsing.
+ * Returns 0 if any error.
+ *
+ * @param ds The dataset.
+ * @param path Path of the dataset file.
+*/
+int dataset_save(const Dataset* ds, const char* path);
+
+
+
+/**
+ * One-shot conversion of a CSV dataset (see dataset_load_csv) to a native dataset file, so later runs load it with dataset_load.
+ * Returns 0 if any error.
+ *
+ * @param csv_path Path of the CSV file.
+ * @param out_path Path of the dataset file written.
+ * @param n_classes Number of classes (width of the one-hot targets).
+ * @param feature_scale Factor applied to every feature.
+*/
+int dataset_convert_csv(const char* csv_path, const char* out_path, int n_classes, float feature_scale);
+
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/* Processes of a group meet on a local socket at PROCESS_GROUP_SOCKET_DIR/neural-<name>.sock, then share the segment
+   /neural-<name>. A process waiting longer than PROCESS_GROUP_TIMEOUT seconds for the others (one died) gives up */
+#define PROCESS_GROUP_SOCKET_DIR    "/tmp"
+#define PROCESS_GROUP_TIMEOUT       60
+#define PROCESS_GROUP_ALIGNMENT     64
+
+
+
+/* Start of the shared segment, followed by one buffer per rank (each starting on a multiple of PROCESS_GROUP_ALIGNMENT) */
+typedef struct ProcessGroupShared {
+
+    atomic_uint arrived;        // Ranks waiting in the current barrier
+    atomic_uint generation;     // Barriers completed, bumped by the last rank to arrive
+    atomic_uint failed;         // Set by a rank that gave up waiting, the others then give up too
+
+} ProcessGroupShared;
+
+
+
+/* One process of a group of world_size processes on this host, each with a buffer of n_floats floats in a shared
+   segment. process_group_allreduce sums the buffers of all the ranks with a ring all-reduce */
+typedef struct ProcessGroup {
+
+    int rank;                   // 0 to world_size - 1, rank 0 creates the segment and runs the rendezvous
+    int world_size;
+    size_t n_floats;            // Floats of the buffer of a rank
+
+    void* mapping;              // The shared segment
+    size_t mapping_size;
+    ProcessGroupShared* shared;
+    float* buffers;             // Buffer of rank r at buffers + r * buffer_stride
+    size_t buffer_stride;       // Floats between two buffers (n_floats rounded up to the alignment)
+
+} ProcessGroup;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Joins (creates, for rank 0) the group called name. Every process of the group calls it with its own rank and the
+ * same world_size and n_floats. Rank 0 creates the shared segment, then accepts the others on a local socket and
+ * checks that the ranks are distinct and agree on the sizes. The call returns once every rank has mapped the segment.
+ * The segment and socket are unlinked once everyone is in, so nothing is left behind if a process dies.
+ * Returns NULL if any error (a rank missing after PROCESS_GROUP_TIMEOUT seconds included).
+ *
+ * @param name Name of the group, shared by its processes (letters, digits, '-' and '_').
+ * @param rank Rank of the calling process (0 to world_size - 1).
+ * @param world_size Number of processes in the group.
+ * @param n_floats Size of the buffer of every rank.
+*/
+ProcessGroup* create_process_group(const char* name, int rank, int world_size, size_t n_floats);
+
+
+
+/**
+ * Unmaps the shared segment and completely frees the group (the other ranks keep their own mapping).
+*/
+void free_process_group(ProcessGroup** pg);
+
+
+
+// ==========================================
+//             Collectives
+// ==========================================
+
+/**
+ * Returns the buffer of the calling rank, which it fills before a collective and reads the result from after.
+ *
+ * @param pg The group.
+*/
+float* process_group_buffer(const ProcessGroup* pg);
+
+
+
+/**
+ * Waits until every rank of the group has called it.
+ * Returns 0 if a rank did not come within PROCESS_GROUP_TIMEOUT seconds (or another rank gave up).
+ *
+ * @param pg The group.
+*/
+int process_group_barrier(ProcessGroup* pg);
+
+
+
+/**
+ * Replaces the buffer of every rank with the sum of the buffers of all the ranks. Ring all-reduce: the buffers are cut
+ * into world_size chunks; in world_size - 1 steps every rank adds the chunk its left neighbour holds into its own
+ * (reduce-scatter), then in world_size - 1 more steps the summed chunks go round the ring (all-gather). Every rank
+ * reads and writes 2 * (world_size - 1) / world_size buffers whatever the number of ranks.
+ * Every rank must call it. Returns 0 if any error.
+ *
+ * @param pg The group.
+*/
+int process_group_allreduce(ProcessGroup* pg);
+
+
+
+/**
+ * Copies the buffer of rank root into the buffer of every other rank. Every rank must call it.
+ * Returns 0 if any error.
+ *
+ * @param pg The group.
+ * @param root Rank whose buffer is copied.
+*/
+int process_group_broadcast(ProcessGroup* pg, int root);
+
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "activations.h"
+
+
+
+/* Whether an operand of gemm is used as stored or transposed */
+typedef enum { GEMM_NO_TRANS, GEMM_TRANS } gemm_transpose;
+
+
+
+/* Work done on a tile of C after its last KC slice, while the tile is still in registers */
+typedef struct GemmEpilogue {
+
+    const float* bias;          // (1 x N) row added to every row of C, NULL for none
+    float* z;                   // If not NULL, receives C + bias before the activation
+    int ldz;                    // Distance (in floats) between two consecutive rows of z
+    activation_function act;    // Element wise activation applied last (RELU or LINEAR, anything else is LINEAR)
+
+} GemmEpilogue;
+
+
+
+// ==========================================
+//          General Matrix Multiply
+// ==========================================
+
+/**
+ * C = op(A) @ op(B) on raw row-major buffers, op(X) being X or X^T.
+ * op(A) is (M x K), op(B) is (K x N), C is (M x N). C is overwritten.
+ * Transposed operands are read in place, no transposed copy is made.
+ *
+ * Cache-blocked (L1/L2/L3 blocking sized for the host on first use) with packed panels of A and B
+ * and a register-tiled micro-kernel doing the inner products.
+ *
+ * @param trans_a GEMM_TRANS to use A^T instead of A
+ * @param trans_b GEMM_TRANS to use B^T instead of B
+ * @param M rows of op(A) and C
+ * @param N cols of op(B) and C
+ * @param K cols of op(A) and rows of op(B)
+ * @param A pointer to the first element of A
+ * @param lda distance (in floats) between two consecutive rows of A as stored
+ * @param B pointer to the first element of B
+ * @param ldb distance (in floats) between two consecutive rows of B as stored
+ * @param C pointer to the first element of C
+ * @param ldc distance (in floats) between two consecutive rows of C
+ */
+void gemm(gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc);
+
+
+
+/**
+ * Same as gemm, then the epilogue is applied in the store of every tile of C while it is still in registers:
+ * C = act(op(A) @ op(B) + bias), and z = op(A) @ op(B) + bias if z is not NULL.
+ * Fuses a dense layer forward pass into a single pass over the output.
+ *
+ * @param epilogue The work done on the output tiles, NULL is the same as gemm
+ */
+void gemm_fused(gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue* epilogue);
+
+
+
+/**
+ * Same as gemm_fused with A stored in floats or 16-bit floats (mixed precision). A 16-bit A is widened to floats while
+ * its blocks are packed, so the products still accumulate in float; A is only read at half the bytes.
+ *
+ * @param precision_a Storage of A (PRECISION_FP32 is gemm_fused)
+ * @param A pointer to the first element of A (float or uint16_t values depending on precision_a)
+ * @param lda distance (in values) between two consecutive rows of A as stored
+ */
+void gemm_mixed(storage_precision precision_a, gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const void* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue* epilogue);
+
+
+
+#endif
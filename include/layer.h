@@ -3,6 +3,12 @@
 
 #include "tensor.h"
 #include "activations.h"
+#include "workspace.h"
+
+
+
+/* Rows of the 16-bit output cache widened to floats at once by a mixed precision backward_pass (the block stays in cache) */
+#define LAYER_HALF_BLOCK_ROWS   32
 
 
 
@@ -19,8 +25,14 @@ typedef struct Layer {
     Tensor* d_weights;                // Gradient of weights (Kept for the optimiser to optimise after a backward pass)
     Tensor* d_biases;                 // Gradient of biases  (Kept for the optimiser to optimise after a backward pass)
 
-    Tensor* input_transpose_cache;    // Stores 'XT' 
-    Tensor* z_cache;                  // Stores 'Z' = W @ X + B
+    /* Only references, valid until the workspace given to forward_pass is reset */
+    Tensor* input_cache;              // Stores 'X' (belongs to the caller of forward_pass)
+    Tensor* z_cache;                  // Stores 'Z' = X @ W + B (in the workspace)
+    Tensor* output_cache;             // Stores 'A' = act(Z), the tensor returned by forward_pass (in the workspace)
+
+    /* Caches of forward_pass_half instead (NULL after forward_pass), also only references */
+    const HalfTensor* input_half;     // Stores 'X' in 16 bits (output of the previous layer), NULL if X is the float input_cache
+    HalfTensor* output_half;          // Stores 'A' in 16 bits (in the workspace), Z is not kept
 
 } Layer;
 
@@ -41,6 +53,19 @@ Layer* create_layer(int n_neurons, int n_neurons_prev, activation_function func)
 
 
 
+/**
+ * Returns a new layer built around existing parameters (e.g. views into a loaded model file), which it takes ownership of.
+ * weights is (n_neurons_prev x n_neurons) and biases (1 x n_neurons), the shapes give the size of the layer.
+ * Returns NULL if any error (the tensors are not freed then).
+ * 
+ * @param weights Weights of the layer.
+ * @param biases Biases of the layer.
+ * @param func Name of the activation functions out of the available ones.
+*/
+Layer* create_layer_from_tensors(Tensor* weights, Tensor* biases, activation_function func);
+
+
+
 /**
  * Completely frees the layer
  * 
@@ -53,25 +78,83 @@ void free_layer(Layer** layer);
 //          Training and Prediction
 // ==========================================
 
+/**
+ * Returns the number of workspace bytes one forward_pass and backward_pass of this layer take for a given batch size.
+ * 
+ * @param layer The layer
+ * @param batch_size Number of samples in the batch
+*/
+size_t layer_workspace_bytes(const Layer* layer, int batch_size);
+
+
+
+/**
+ * Returns the number of workspace bytes one forward_pass_half and backward_pass of this layer take for a given batch size.
+ * 
+ * @param layer The layer
+ * @param batch_size Number of samples in the batch
+*/
+size_t layer_workspace_bytes_half(const Layer* layer, int batch_size);
+
+
+
 /**
  * Returns the output of the forward pass performed on the layer with a given input.
+ * Z and the output are allocated from ws (do not free them), they stay valid until ws is reset.
+ * The input is referenced by the layer for the backward pass, so it must stay alive until then.
  * Returns NULL if fails.
  * 
  * @param layer The layer on which the forward pass is performed
  * @param input The input tensor (batch_size x n_neurons_prev) on which the forward pass is performed
+ * @param ws The workspace holding the temporaries of the current step
+*/
+Tensor* forward_pass(Layer* layer, Tensor* input, Workspace* ws);
+
+
+
+/**
+ * Mixed precision forward pass: out = act(X @ W + B) computed in float, then rounded to 16 bits into a tensor allocated
+ * from ws, which is returned and kept for the backward pass. X is the float input or the 16-bit output of the previous
+ * layer, which the gemm reads as it is. Z is not kept, the derivative of every activation is computed from A
+ * (RELU only needs the sign of Z, which A has). out is free to be overwritten once the call returns.
+ * Returns NULL if fails.
+ * 
+ * @param layer The layer on which the forward pass is performed
+ * @param input The float input (batch_size x n_neurons_prev), must stay alive until the backward pass. NULL if input_half is given
+ * @param input_half The 16-bit input (batch_size x n_neurons_prev), NULL if input is given
+ * @param out Destination of the float output (batch_size x n_neurons)
+ * @param precision Storage of the cache (PRECISION_BF16 or PRECISION_FP16)
+ * @param ws The workspace holding the temporaries of the current step
+*/
+HalfTensor* forward_pass_half(Layer* layer, Tensor* input, const HalfTensor* input_half, Tensor* out, storage_precision precision, Workspace* ws);
+
+
+
+/**
+ * Forward pass for inference: out = act(X @ W + B) with no backward caches (Z is never stored) and the layer left untouched.
+ * Writes into a caller-provided tensor, so several threads can run the same layer at once.
+ * Returns 0 if any error.
+ * 
+ * @param layer The layer on which the forward pass is performed (read only)
+ * @param input The input tensor (batch_size x n_neurons_prev)
+ * @param out Destination of the output (batch_size x n_neurons), must not share memory with input
 */
-Tensor* forward_pass(Layer* layer, Tensor* input);
+int forward_pass_inference(const Layer* layer, const Tensor* input, Tensor* out);
 
 
 
 /**
  * Returns the gradient of output this layer so it can be used by the previous layer to perform it's backward pass.
+ * The returned gradient is allocated from ws (do not free it), it stays valid until ws is reset.
+ * output_gradient is overwritten with dZ (no separate act'(Z) or dZ tensor is built).
+ * Works from the caches of the last forward_pass or forward_pass_half (all the arithmetic is in float either way).
  * Returns NULL if fails.
  *  
  * @param layer The layer on which the backward pass is performed
- * @param output_gradient The gradient tensor of output of this layer
+ * @param output_gradient The gradient tensor of output of this layer, overwritten
+ * @param ws The workspace holding the temporaries of the current step
 */
-Tensor* backward_pass(Layer* layer, Tensor* output_gradient);
+Tensor* backward_pass(Layer* layer, Tensor* output_gradient, Workspace* ws);
 
 
 
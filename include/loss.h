@@ -13,7 +13,7 @@ typedef enum { MSE, CATEGORICAL_CROSSENTROPY } loss_function_type;
 typedef struct Loss {
     
     float (*loss)(Tensor* pred, Tensor* target);                // Calculates loss for the given prediction and target
-    Tensor* (*derivative)(Tensor* pred, Tensor* target);        // Calculates gradient wrt prediction
+    int (*derivative)(Tensor* out, Tensor* pred, Tensor* target);   // Writes gradient wrt prediction into out (same shape as pred)
     loss_function_type type;                                    // type of the loss function
 
 } Loss;
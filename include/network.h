@@ -4,6 +4,34 @@
 #include "layer.h"
 #include "loss.h"
 #include "optimiser.h"
+#include "checkpoint.h"
+#include "dataloader.h"
+#include "distributed.h"
+
+#include <stddef.h>
+
+
+
+/* The parameters of all the layers live in one slab and their gradients in another of the same layout: the weights
+   then the biases of every layer, each block starting on a multiple of NETWORK_SLAB_ALIGNMENT bytes. That is also how
+   the parameters sit in a model file, so a mapped model is used as the slab in place */
+#define NETWORK_SLAB_ALIGNMENT  MODEL_FILE_ALIGNMENT
+
+
+
+/* A replica of data-parallel training: runs the forward and backward pass of its share of every batch */
+typedef struct TrainReplica {
+
+    Layer* layers;              // Copies of the layers of the network: same weights, biases and activation, own caches and gradients
+    int n_layers;               // Layers copied (the copies are made again if layers are added to the network)
+    float* gradients;           // Gradient slab of the replica (the gradients of its layers are views into it)
+    Workspace* workspace;       // Temporaries of the replica's share of the step
+    float loss;                 // Loss of its rows in the last data-parallel step (weighted by their share of the batch),
+                                // or summed over the batches it ran in a Hogwild epoch
+    Tensor* x_batch;            // Hogwild: copy of the batch the replica took from a data loader
+    Tensor* y_batch;
+
+} TrainReplica;
 
 
 
@@ -17,21 +45,79 @@ typedef struct Network {
     Loss* loss_func;            // Loss function of the Network
     Optimiser* optimiser;       // The contains it's optimiser
 
+    Workspace* workspace;       // Arena for the temporaries of a step (activations, gradients), sized from the layers and batch size on the first step
+
+    float* parameters;          // Parameter slab (the weights and biases of the layers are views into it), NULL without layers
+    float* gradients;           // Gradient slab, same layout (d_weights and d_biases of the layers are views into it)
+    size_t slab_size;           // Floats of each slab, padding included
+    int owns_parameters;        // 0 if the parameter slab is the mapping of a loaded model
+
+    void* mapping;              // Model file mapped by network_load (the parameter slab points into it), NULL otherwise
+    size_t mapping_size;        // Bytes of the mapping
+
+    int epoch;                  // Training cursor: epoch and batch network_train runs next (set by network_load_checkpoint, 0 otherwise)
+    int batch;
+    float epoch_loss;           // Loss summed over the batches of the current epoch already run
+
+    Checkpointer* checkpointer; // Writes checkpoints in the background while training (see network_set_checkpoint), NULL if not checkpointing
+    int checkpoint_interval;    // Batches between two checkpoints
+
+    int n_replicas;             // Threads every batch is split over while training (1 = serial, see network_set_data_parallel)
+    TrainReplica* replicas;     // One per replica, NULL until the first data-parallel step (replica 0 is the network itself, its entry has no layers)
+    int hogwild;                // 1 if the replicas train asynchronously on batches of their own (see network_set_hogwild)
+    long hogwild_updates;       // Layer updates applied by the last Hogwild training
+    long hogwild_collisions;    // Of those, updates that started while another replica was updating the same layer
+
+    ProcessGroup* process_group;    // Processes training this network together (see network_set_process_group), NULL if training alone
+
+    storage_precision precision;    // Storage of the activations kept for the backward pass while training (see network_set_precision)
+
 } Network;
 
 
 
+/* Model files (network_save / network_load): header, one entry per layer, then the weights and biases of every layer,
+   each block starting on a multiple of MODEL_FILE_ALIGNMENT so they can be used in place once the file is mapped */
+#define MODEL_FILE_MAGIC        "NNMODEL"
+#define MODEL_FILE_VERSION      1
+#define MODEL_FILE_ALIGNMENT    64
+
+
+
+/* Per-call state of inference, owned by the caller. One context per thread lets any number of threads share a (read only) Network */
+typedef struct InferenceContext {
+
+    float* buffers;             // Two ping-pong buffers of hidden activations, back to back
+    size_t capacity;            // Floats of one buffer
+    int width;                  // Widest hidden layer of the network the context was made for
+
+} InferenceContext;
+
+
+
+/* Scores of a network over a dataset (see network_evaluate) */
+typedef struct Evaluation {
+
+    int n_samples;              // Number of samples scored
+    int n_correct;              // Samples whose predicted class (argmax) is the target class
+    float accuracy;             // n_correct / n_samples
+    float loss;                 // Mean loss (loss function of the network) over the samples
+
+} Evaluation;
+
+
+
 // ==========================================
 //             Object Management
 // ==========================================
 
 /**
  * Creates a new network with the loss function and optimiser as it's internal details.
- * Will later add more parameters to include optimiser hyperparameters
+ * The optimiser hyperparameters other than the learning rate can be set on net->optimiser before training
  * 
  * @param input_feature_size Number of features of a single sample
  * @param loss_type Type of the loss function for this network
- * @param opt_type Type of the optimiser (right now only SGD is functional)
+ * @param opt_type Type of the optimiser (SGD, SGD_MOMENTUM or ADAM)
  * @param lr Learning rate of the optimiser
 */
 Network* create_network(int input_feature_size, loss_function_type loss_type, OptimiserType opt_type, float lr);
@@ -62,23 +148,103 @@ int network_add_layer(Network* net, int n_neurons, activation_function func);
 
 
 
+/**
+ * Makes network_train split every batch over n_replicas threads of the library pool (data-parallel training).
+ * Each replica runs the forward and backward pass of a contiguous share of the rows with its own caches and gradients,
+ * the gradients are summed by a tree reduction and the optimiser then takes a single step, so the update is the
+ * one of the whole batch (up to the order of the float additions).
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param n_replicas Number of replicas, 1 to train serially, <= 0 for the number of threads of the library pool.
+*/
+int network_set_data_parallel(Network* net, int n_replicas);
+
+
+
+/**
+ * Makes network_train run Hogwild-style asynchronous SGD: n_workers threads of the library pool each take the next
+ * batch of the epoch, run its forward and backward pass with their own caches and gradients, and apply the SGD update
+ * straight to the shared weights. There is no lock and no barrier between steps (only at the end of an epoch), so a
+ * worker may compute its gradient on weights other workers are updating, and two updates of a layer may interleave.
+ * Stale gradients are traded for throughput. The updates that overlapped with another update of the same layer are
+ * counted (see network_hogwild_stats) to judge the trade-off.
+ * Only the SGD optimiser is supported. Checkpoints are only taken at the end of an epoch in this mode.
+ * Training is no longer reproducible from run to run. network_set_data_parallel switches back to synchronous training.
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param n_workers Number of workers, <= 0 for the number of threads of the library pool.
+*/
+int network_set_hogwild(Network* net, int n_workers);
+
+
+
+/**
+ * Gives the counters of the last Hogwild training of the network (0 if it has never trained in that mode).
+ * 
+ * @param net The network.
+ * @param updates Receives the number of layer updates applied, can be NULL.
+ * @param collisions Receives the number of updates that overlapped with an update of the same layer by another worker, can be NULL.
+*/
+void network_hogwild_stats(const Network* net, long* updates, long* collisions);
+
+
+
+/**
+ * Makes this process rank `rank` of world_size processes on the host that train the network together, each on its own
+ * share of the data (multi-process data parallelism). After every local step the gradients of the ranks are averaged
+ * with a ring all-reduce over shared memory, then every rank applies the same optimiser step. The parameters of rank 0
+ * are copied to every rank when the group is joined, so all the copies start (and stay) identical.
+ * Every rank must build the same network, call this with the same name and world_size, and run the same number of
+ * batches of the same size; the loss reported is the mean over the ranks. Only one rank should checkpoint.
+ * The processes meet on a local socket, the call returns once all of them are in. Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param name Name of the group (letters, digits, '-' and '_'), NULL to leave the current group.
+ * @param rank Rank of this process (0 to world_size - 1).
+ * @param world_size Number of processes.
+*/
+int network_set_process_group(Network* net, const char* name, int rank, int world_size);
+
+
+
+/**
+ * Sets how training stores the activations kept from the forward to the backward pass (mixed precision training).
+ * With PRECISION_BF16 or PRECISION_FP16 every layer keeps its output A rounded to 16 bits and no Z at all, so the
+ * caches take a quarter of the float ones; the next layer and the backward pass read the 16-bit values directly.
+ * Products and sums are still done in float, and the parameters, gradients and optimiser state stay float.
+ * bf16 has the range of a float with 8 bits of mantissa. fp16 has 11 bits of mantissa but overflows past 65504,
+ * so it only suits activations that stay bounded (sigmoid, softmax, normalised inputs).
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param precision PRECISION_FP32 (the default), PRECISION_BF16 or PRECISION_FP16.
+*/
+int network_set_precision(Network* net, storage_precision precision);
+
+
+
 // ==========================================
 //                Utilites
 // ==========================================
 
 /**
  * Gives new prediction tensor based on the input passed to the network.
+ * Runs in inference mode: no backward cache is kept and the network is only read.
  * Returns NULL if any error.
  * 
  * @param net The network which is trained.
  * @param input Input tensor (number_of_inputs x features of single input).
 */
-Tensor* network_predict(Network* net, Tensor* input);
+Tensor* network_predict(const Network* net, const Tensor* input);
 
 
 
 /**
  * Trains the network.
+ * Training starts from the cursor of the network (epoch and batch), which is 0 unless the network was loaded with
+ * network_load_checkpoint: a resumed run then goes on from the batch after the checkpoint. Once the epochs are done the cursor goes back to 0.
  * Returns 0 if any error.
  * 
  * @param net The network which is trained.
@@ -91,4 +257,146 @@ int network_train(Network* net, Tensor* *x_train, Tensor* *y_train, int number_o
 
 
 
+/**
+ * Trains the network on the batches served by a data loader, which reshuffles the samples every epoch and assembles
+ * the next batches in the background. Resumes from the cursor of the network like network_train (the loader draws
+ * the same order for an epoch as long as it has the same seed).
+ * Returns 0 if any error.
+ * 
+ * @param net The network which is trained.
+ * @param loader The data loader serving the batches.
+ * @param epochs Total number of epochs to train on.
+*/
+int network_train_loader(Network* net, DataLoader* loader, int epochs);
+
+
+
+/**
+ * Returns the largest number of bytes the workspace of the network has had in use at once (0 if it has none yet).
+ * Useful to size the memory of containers running the network.
+ * 
+ * @param net The network.
+*/
+size_t network_workspace_high_water(const Network* net);
+
+
+
+/**
+ * Returns the number of trainable parameters (weights and biases of every layer) of the network.
+ * 
+ * @param net The network.
+*/
+size_t network_parameter_count(const Network* net);
+
+
+
+// ==========================================
+//             Inference
+// ==========================================
+
+/**
+ * Returns a new inference context for net, sized for batches of up to max_batch samples (it grows if a larger batch comes).
+ * Returns NULL if any error.
+ * 
+ * @param net The network the context is used with.
+ * @param max_batch Largest number of samples expected in one call.
+*/
+InferenceContext* create_inference_context(const Network* net, int max_batch);
+
+
+
+/**
+ * Completely frees an inference context.
+*/
+void free_inference_context(InferenceContext** ctx);
+
+
+
+/**
+ * Writes the prediction of the network for input into out, using only the memory of ctx for the hidden activations.
+ * The network is strictly read only, so several threads may call this on the same network at once as long as
+ * each uses its own context and output. Nothing is allocated unless input has more rows than the context has seen.
+ * Returns 0 if any error.
+ * 
+ * @param net The network which is trained.
+ * @param ctx Context of the calling thread (created for net).
+ * @param input Input tensor (number_of_inputs x features of single input).
+ * @param out Destination (number_of_inputs x neurons of the last layer).
+*/
+int network_predict_into(const Network* net, InferenceContext* ctx, const Tensor* input, Tensor* out);
+
+
+
+/**
+ * Scores the network on a whole dataset: accuracy (argmax of the prediction against argmax of the target) and mean loss.
+ * The samples are cut into batches of batch_size rows which are viewed in place and spread over the default thread pool,
+ * each task running read-only inference with its own context. The result does not depend on the number of threads.
+ * Returns 0 if any error.
+ * 
+ * @param net The network which is trained.
+ * @param x Inputs, one sample per row (number_of_samples x features of single input).
+ * @param y Targets, one sample per row (number_of_samples x neurons of the last layer).
+ * @param batch_size Number of samples scored at once (large batches turn the products into real matrix-matrix ones).
+ * @param result Receives the accuracy and loss.
+*/
+int network_evaluate(const Network* net, const Tensor* x, const Tensor* y, int batch_size, Evaluation* result);
+
+
+
+// ==========================================
+//             Saving and Loading
+// ==========================================
+
+/**
+ * Writes the network (input size, loss, optimiser type and learning rate, layer shapes, activations, weights and biases)
+ * to a versioned binary model file. The file is written under a temporary name and renamed, so an existing model
+ * is never left half written.
+ * Returns 0 if any error.
+ * 
+ * @param net The network to save.
+ * @param path Path of the model file.
+*/
+int network_save(const Network* net, const char* path);
+
+
+
+/**
+ * Loads a model file written by network_save by mapping it in memory: the weights and biases of the layers point
+ * straight into the mapping, nothing is parsed or copied. Processes loading the same file share one page cache copy
+ * of the parameters (the mapping is private, so training the loaded network copies only the pages it writes).
+ * Checkpoints load too, as the network they were taken from (the training state is ignored).
+ * Returns NULL if any error (bad magic, version, sizes or shapes).
+ * 
+ * @param path Path of the model file.
+*/
+Network* network_load(const char* path);
+
+
+
+/**
+ * Makes network_train write a checkpoint to path every every_n_batches batches and when training completes.
+ * A checkpoint is the model file plus the training state (epoch and batch reached, optimiser state, random number
+ * generator state). Taking one costs a copy of the parameters into a buffer, a background thread writes it to disk
+ * while training goes on. network_train waits for the last one to be on disk before returning.
+ * Returns 0 if any error.
+ * 
+ * @param net The network to checkpoint.
+ * @param path Path of the checkpoint file, NULL to stop checkpointing.
+ * @param every_n_batches Number of batches (training steps) between two checkpoints.
+*/
+int network_set_checkpoint(Network* net, const char* path, int every_n_batches);
+
+
+
+/**
+ * Loads a checkpoint written while training (see network_set_checkpoint) to resume it: the network comes back with
+ * its parameters, optimiser state and training cursor, and the random number generator of the library is restored.
+ * Calling network_train with the same data and epochs then goes on from the batch after the checkpoint.
+ * Returns NULL if any error, or if the file is a model without training state.
+ * 
+ * @param path Path of the checkpoint file.
+*/
+Network* network_load_checkpoint(const char* path);
+
+
 #endif
\ No newline at end of file
@@ -1,31 +1,47 @@
 #ifndef OPTIMISER_H
 #define OPTIMISER_H
 
-#include "tensor.h"
-#include "layer.h"
+#include <stddef.h>
 
 
 
-typedef enum { 
-    SGD,                    
-    SGD_MOMENTUM,           // Later
-    ADAM                    // Later
+/* Default hyperparameters set by create_optimiser, the fields can be changed before training */
+#define OPTIMISER_DEFAULT_BETA1     0.9f        // Momentum of SGD+M, decay of the first moment of Adam
+#define OPTIMISER_DEFAULT_BETA2     0.999f      // Decay of the second moment of Adam
+#define OPTIMISER_DEFAULT_EPSILON   1e-8f
+
+/* Floats updated by one task of the thread pool, smaller buffers are updated inline */
+#define OPTIMISER_PARALLEL_GRAIN    (1 << 15)
+
+/* The moment buffers start on a multiple of this many bytes */
+#define OPTIMISER_ALIGNMENT         64
+
+
+
+typedef enum {
+    SGD,
+    SGD_MOMENTUM,           // v = beta1 * v + g, w = w - lr * v
+    ADAM                    // Bias corrected first and second moments
 } OptimiserType;
 
 
 
 typedef struct Optimiser {
-    
+
     OptimiserType type;         // Type of the optimiser available in the enum
     float learning_rate;        // Learning rate of the optimiser
 
-    /* Parameters to be later used by SGD+M and Adam */
+    /* Parameters of SGD+M and Adam */
     float beta1;                // Used by SGD+M and Adam
     float beta2;                // Used by Adam
     float epsilon;              // Used by Adam
-    int time_step;              // Used by Adam
+    int time_step;              // Used by Adam, steps taken
 
-    /* Will add internal caches for SGD+M and Adam later */
+    /* Moment buffers, one float per float of the parameters, allocated (zeroed) on the first step.
+       m is the velocity of SGD+M or the first moment of Adam, v the second moment of Adam (NULL otherwise) */
+    float* m;
+    float* v;
+    size_t n_floats;            // Floats of each moment buffer
 
 } Optimiser;
 
@@ -37,8 +53,8 @@ typedef struct Optimiser {
 // ==========================================
 
 /**
- * Creates the optimizer object with the only the learning rate, will later add methods to set other hyperparameters for SGD+M and Adam.
- * 
+ * Creates the optimizer object with the learning rate; beta1, beta2 and epsilon get the OPTIMISER_DEFAULT_* values.
+ *
  * @param type Type of the optimiser out of the available in the enum.
  * @param lr Learning rate
  */
@@ -47,24 +63,49 @@ Optimiser* create_optimiser(OptimiserType type, float lr);
 
 
 /**
- * Completely frees the optimiser.
+ * Completely frees the optimiser and its moment buffers.
  */
 void free_optimiser(Optimiser** opt);
 
 
 
+/**
+ * Returns the number of moment buffers the optimiser keeps (0 for SGD, 1 for SGD+M, 2 for Adam).
+ *
+ * @param type Type of the optimiser.
+ */
+int optimiser_moment_count(OptimiserType type);
+
+
+
+/**
+ * Makes the moment buffers n_floats long, zeroed, unless they already are that long (optimiser_step does it on the
+ * first step, so the moments start over if the parameters change size).
+ * Returns 0 if any error.
+ *
+ * @param opt The optimizer
+ * @param n_floats Floats of the parameters the optimiser steps
+ */
+int optimiser_prepare(Optimiser* opt, size_t n_floats);
+
+
+
 // ==========================================
 //             Update Logic
 // ==========================================
 
 /**
- * Performs the weight update on a SINGLE layer.
- * 
+ * Performs the update of all the parameters at once, from gradients laid out the same way. Every update is one fused
+ * SIMD pass over the parameters, the gradients and the moments, spread over the default thread pool for large buffers.
+ * SGD keeps no state, so any part of the parameters can be stepped on its own. SGD+M and Adam keep one moment per
+ * float and count the steps (Adam), so they must be given the whole parameter buffer once per step.
+ *
  * @param opt The optimizer
- * @param layer The layer to update
- * @param layer_idx Index of the layer in the network, used by SGD+M and Adam
+ * @param parameters The parameters to update
+ * @param gradients Their gradients
+ * @param n_floats Floats of both buffers
  */
-void optimiser_update(Optimiser* opt, Layer* layer, int layer_index);
+void optimiser_step(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats);
 
 
 
@@ -0,0 +1,228 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "network.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+/* Output columns of one packed panel of int8 weights (two AVX-512 registers of int32 sums), and inputs summed per
+   int32 lane by one VNNI instruction. Weight matrices are zero padded to multiples of both */
+#define QUANTIZED_PANEL_COLS    32
+#define QUANTIZED_GROUP         4
+
+/* Calibration runs the float network over this many samples at once */
+#define QUANTIZE_CALIBRATION_BATCH  256
+
+/* Quantized model files (quantized_network_save / quantized_network_load) */
+#define QUANTIZED_FILE_MAGIC    "NNQUANT"
+#define QUANTIZED_FILE_VERSION  1
+
+
+
+/* A dense layer with int8 weights. Its input comes quantized to uint8: x ~ input_scale * (q - input_zero_point).
+   Weights are quantized symmetrically per output neuron: w ~ weight_scales[j] * q. The int32 sums of the products are
+   turned back into floats with scales[j] = input_scale * weight_scales[j], and biases[j] also removes the zero point
+   of the input (input_zero_point * sum of column j of the int8 weights) */
+typedef struct QuantizedLayer {
+
+    int n_neurons;              // Outputs
+    int n_neurons_prev;         // Inputs
+    int k_padded;               // n_neurons_prev rounded up to QUANTIZED_GROUP
+    int n_padded;               // n_neurons rounded up to QUANTIZED_PANEL_COLS
+
+    int8_t* weights;            // (k_padded x n_padded) packed in panels of QUANTIZED_PANEL_COLS cols, QUANTIZED_GROUP inputs of a col contiguous
+    float* weight_scales;       // (n_neurons) scale of each output neuron
+    float* float_biases;        // (n_neurons) biases of the float layer
+    float* scales;              // (n_padded) int32 sum to float
+    float* biases;              // (n_padded) bias of the float layer minus the zero point correction
+
+    float input_scale;          // Picked by calibration
+    int input_zero_point;       // uint8 value of 0 (0 for inputs that were never negative in calibration)
+
+    activation_function activation;
+
+} QuantizedLayer;
+
+
+
+/* An int8 copy of a trained network for inference (see network_quantize) */
+typedef struct QuantizedNetwork {
+
+    int input_feature_size;     // Number of features of a single sample
+    int n_layers;
+    QuantizedLayer* layers;
+    Loss* loss_func;            // Loss of the float network, to score predictions
+
+} QuantizedNetwork;
+
+
+
+/* Per-call buffers of quantized inference, owned by the caller. One context per thread lets any number of threads share a QuantizedNetwork */
+typedef struct QuantizedContext {
+
+    uint8_t* activations;       // Two ping-pong buffers of quantized activations, back to back
+    float* scratch;             // Float output of a hidden layer whose activation is applied after the product (sigmoid, softmax)
+    int rows;                   // Rows the buffers hold
+    int width;                  // Widest k_padded of the network (bytes of a row of activations)
+    int float_width;            // Widest hidden layer (floats of a row of scratch)
+
+} QuantizedContext;
+
+
+
+/* Float network against its quantized copy on a dataset (see quantized_network_report) */
+typedef struct QuantizationReport {
+
+    int n_samples;
+    Evaluation fp32;            // Accuracy and mean loss of the float network
+    Evaluation int8;            // Same for the quantized one
+    float accuracy_delta;       // int8.accuracy - fp32.accuracy
+    float agreement;            // Share of the samples both networks predict the same class for
+    float max_abs_error;        // Largest difference between an output of the two networks
+    size_t fp32_bytes;          // Bytes of the parameters of each network
+    size_t int8_bytes;
+    double fp32_seconds;        // Time taken to predict every sample, batch after batch
+    double int8_seconds;
+
+} QuantizationReport;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Quantizes a trained network for inference (post-training quantization). The weights of every neuron are rounded
+ * to int8 with a scale of their own. The float network is then run on the calibration samples to record the range
+ * of the input of every layer, which gives the scale of its uint8 activations. The network itself is not changed.
+ * Returns NULL if any error.
+ *
+ * @param net The trained network.
+ * @param calibration A few hundred representative inputs (number_of_samples x features of single input).
+*/
+QuantizedNetwork* network_quantize(const Network* net, const Tensor* calibration);
+
+
+
+/**
+ * Completely frees a quantized network.
+*/
+void free_quantized_network(QuantizedNetwork** qnet);
+
+
+
+/**
+ * Returns the number of bytes of the parameters of the quantized network (int8 weights, padding included, and float scales and biases).
+ *
+ * @param qnet The quantized network.
+*/
+size_t quantized_network_bytes(const QuantizedNetwork* qnet);
+
+
+
+// ==========================================
+//             Inference
+// ==========================================
+
+/**
+ * Returns a new context for quantized inference with qnet, sized for batches of up to max_batch samples (it grows if a larger batch comes).
+ * Returns NULL if any error.
+ *
+ * @param qnet The quantized network the context is used with.
+ * @param max_batch Largest number of samples expected in one call.
+*/
+QuantizedContext* create_quantized_context(const QuantizedNetwork* qnet, int max_batch);
+
+
+
+/**
+ * Completely frees a quantized inference context.
+*/
+void free_quantized_context(QuantizedContext** ctx);
+
+
+
+/**
+ * Writes the prediction of the quantized network for input into out. The input is quantized to uint8, every layer is
+ * an int8 x uint8 product summed in int32 (AVX-512 VNNI when the CPU has it), whose result is scaled back, biased,
+ * activated and quantized again for the next layer in the same pass. The last layer writes floats.
+ * The network is read only, so several threads may call this at once with their own context and output.
+ * Returns 0 if any error.
+ *
+ * @param qnet The quantized network.
+ * @param ctx Context of the calling thread (created for qnet).
+ * @param input Input tensor (number_of_inputs x features of single input).
+ * @param out Destination (number_of_inputs x neurons of the last layer).
+*/
+int quantized_network_predict_into(const QuantizedNetwork* qnet, QuantizedContext* ctx, const Tensor* input, Tensor* out);
+
+
+
+/**
+ * Gives new prediction tensor of the quantized network for the input.
+ * Returns NULL if any error.
+ *
+ * @param qnet The quantized network.
+ * @param input Input tensor (number_of_inputs x features of single input).
+*/
+Tensor* quantized_network_predict(const QuantizedNetwork* qnet, const Tensor* input);
+
+
+
+/**
+ * Scores a float network and its quantized copy on the same dataset: accuracy and loss of both, how often they agree,
+ * the largest difference between their outputs, the size of their parameters and the time each takes to predict
+ * the whole dataset in batches of batch_size rows.
+ * Returns 0 if any error.
+ *
+ * @param net The float network.
+ * @param qnet Its quantized copy.
+ * @param x Inputs, one sample per row.
+ * @param y Targets, one sample per row.
+ * @param batch_size Number of samples predicted at once.
+ * @param report Receives the comparison.
+*/
+int quantized_network_report(const Network* net, const QuantizedNetwork* qnet, const Tensor* x, const Tensor* y, int batch_size, QuantizationReport* report);
+
+
+
+/**
+ * Prints a report of quantized_network_report on STDOUT.
+ *
+ * @param report The report.
+*/
+void print_quantization_report(const QuantizationReport* report);
+
+
+
+// ==========================================
+//             Saving and Loading
+// ==========================================
+
+/**
+ * Writes the quantized network to a versioned binary file (the int8 weights as packed, a quarter of the float model).
+ * The file is written under a temporary name and renamed, so an existing file is never left half written.
+ * Returns 0 if any error.
+ *
+ * @param qnet The quantized network.
+ * @param path Path of the file.
+*/
+int quantized_network_save(const QuantizedNetwork* qnet, const char* path);
+
+
+
+/**
+ * Loads a file written by quantized_network_save.
+ * Returns NULL if any error (bad magic, version or sizes, or a loss other than MSE).
+ *
+ * @param path Path of the file.
+*/
+QuantizedNetwork* quantized_network_load(const char* path);
+
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+
+
+
+/* Environment variable that caps the instruction set picked at load time (scalar, sse2, avx2 or avx512) */
+#define SIMD_ENV_VAR            "NEURAL_SIMD"
+
+/* Set when the target has the x86 vector extensions the kernels are written for */
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86                1
+#else
+#define SIMD_X86                0
+#endif
+
+
+
+/* Instruction sets the kernels exist for, in increasing order of vector width */
+typedef enum { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 } simd_level;
+
+
+
+/* Bound on the relative error of the vectorised exp for -87.6 <= x <= 88.3 (measured: 8.3e-8), smaller inputs flush to 0 */
+#define SIMD_EXP_MAX_REL_ERROR  2e-7f
+
+
+
+/* Element wise kernels over contiguous float arrays, all resolved for one instruction set.
+   The *_backward kernels turn g (gradient of the output) into the gradient of the input, and add the result to sums if it is not NULL */
+typedef struct SimdKernels {
+
+    simd_level level;                                                       // Instruction set of the kernels
+
+    void (*add)(float* out, const float* a, const float* b, int n);         // out = a + b
+    void (*sub)(float* out, const float* a, const float* b, int n);         // out = a - b
+    void (*mul)(float* out, const float* a, const float* b, int n);         // out = a * b
+    void (*axpy)(float* y, float alpha, const float* x, int n);             // y = y + alpha * x
+    void (*scale)(float* x, float alpha, int n);                            // x = x * alpha
+
+    /* Optimiser steps, one pass reading and writing the parameter w, its gradient g and its moments once */
+    void (*momentum)(float* w, const float* g, float* v, float lr, float mu, int n);       // v = mu * v + g, w = w - lr * v
+    void (*adam)(float* w, const float* g, float* m, float* v, float beta1, float beta2,    // m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g^2,
+                 float step, float correction, float epsilon, int n);                       // w = w - step * m / (sqrt(v) * correction + epsilon)
+
+    void (*exp)(float* out, const float* x, int n);                                         // out = exp(x) (input clamped to +-88.37)
+    void (*relu)(float* x, float slope, int n);                                             // x = (x > 0) ? x : slope * x
+    void (*relu_backward)(float* g, const float* z, float slope, float* sums, int n);       // g = g * relu'(z)
+    void (*sigmoid)(float* x, int n);                                                       // x = 1 / (1 + exp(-x))
+    void (*sigmoid_backward)(float* g, const float* s, float* sums, int n);                 // g = g * s * (1 - s), s being the output
+    void (*softmax)(float* x, int n);                                                       // x = exp(x - max(x)) / sum, over one row
+    void (*softmax_backward)(float* g, const float* s, float* sums, int n);                 // g = s * (g - dot(g, s)), over one row
+
+    /* 16-bit storage of the mixed precision caches, rounded to nearest even. bf16 is the top half of a float (same range),
+       fp16 is IEEE half precision (past 65504 becomes infinity, below 6e-8 becomes 0). Denormal floats become 0 in bf16,
+       NaNs stay quiet NaNs; every level gives the same bits */
+    void (*to_bf16)(uint16_t* out, const float* x, int n);
+    void (*from_bf16)(float* out, const uint16_t* x, int n);
+    void (*to_fp16)(uint16_t* out, const float* x, int n);
+    void (*from_fp16)(float* out, const uint16_t* x, int n);
+
+} SimdKernels;
+
+
+
+// ==========================================
+//             Dispatch
+// ==========================================
+
+/**
+ * Returns the kernels of the widest instruction set the CPU (and OS) supports, capped by NEURAL_SIMD if set.
+ * They are selected from CPUID once, when the library is loaded. out may alias a or b in every kernel.
+ */
+const SimdKernels* simd_kernels();
+
+
+
+/**
+ * Returns the instruction set the kernels were selected for.
+ */
+simd_level simd_get_level();
+
+
+
+/**
+ * Returns the name of an instruction set ("scalar", "sse2", "avx2" or "avx512").
+ */
+const char* simd_level_name(simd_level level);
+
+
+
+#endif
@@ -1,16 +1,36 @@
 #ifndef TENSOR_H
 #define TENSOR_H
 
+#include <stdint.h>
+
 
 
 typedef struct Tensor {
     float *data;           // Matrix of floats
     int rows;              // Rows of matrix 
     int cols;              // Columns of matrix 
+    int stride;            // Floats between the starts of two consecutive rows (cols unless the tensor is a view of a wider matrix)
+    int owns_data;         // 1 if free_tensor frees data, 0 if data belongs to someone else (a mapped model file, a workspace)
 } Tensor;
 
 
 
+/* Storage formats of the caches of training (see network_set_precision). Arithmetic is always done in float */
+typedef enum { PRECISION_FP32, PRECISION_BF16, PRECISION_FP16 } storage_precision;
+
+
+
+/* Matrix of 16-bit floats, a cache of mixed precision training. Never owns its data (it lives in a workspace) */
+typedef struct HalfTensor {
+    uint16_t* data;                 // bf16 or fp16 values
+    int rows;
+    int cols;
+    int stride;                     // Values between the starts of two consecutive rows
+    storage_precision precision;    // PRECISION_BF16 or PRECISION_FP16
+} HalfTensor;
+
+
+
 // ==========================================
 //             Object Management
 // ==========================================
@@ -22,6 +42,31 @@ void init_tensor_api();
 
 
 
+/**
+ * Seeds the random number generator of the library (weight initialisation, create_tensor_random), for reproducible runs.
+ * 
+ * @param seed Any value, 0 included.
+*/
+void tensor_rng_seed(uint64_t seed);
+
+
+
+/**
+ * Returns the current state of the random number generator (to save it in a checkpoint).
+*/
+uint64_t tensor_rng_get_state();
+
+
+
+/**
+ * Restores a state returned by tensor_rng_get_state, the generator then continues the same sequence.
+ * 
+ * @param state A state returned by tensor_rng_get_state (0 is not a valid state and is ignored).
+*/
+void tensor_rng_set_state(uint64_t state);
+
+
+
 /**
  * Returns pointer to a tensor of (rows x cols) with the values initialised to the value given.
  * Returns NULL if any error.
@@ -47,6 +92,55 @@ Tensor* create_tensor_random(int rows, int cols, float min, float max);
 
 
 
+/**
+ * Returns a (rows x cols) tensor whose data is the given memory, which is neither copied nor freed by free_tensor.
+ * The memory must stay valid for as long as the tensor is used.
+ * Returns NULL if any error.
+ * 
+ * @param data memory holding rows * cols floats, row-major
+ * @param rows number of rows of tensor
+ * @param cols number of cols of tensor 
+ */
+Tensor* create_tensor_view(float* data, int rows, int cols);
+
+
+
+/**
+ * Returns a (rows x cols) view of the block of tensor starting at (row, col): no data is copied, the view keeps the
+ * stride of tensor and is not freed by free_tensor (tensor must outlive it). Writing to the view writes to tensor.
+ * Returns NULL if any error (block out of bounds).
+ * 
+ * @param tensor the tensor sliced (can itself be a view)
+ * @param row first row of the block
+ * @param col first col of the block
+ * @param rows number of rows of the block
+ * @param cols number of cols of the block
+ */
+Tensor* tensor_slice(const Tensor* tensor, int row, int col, int rows, int cols);
+
+
+
+/**
+ * Same as tensor_slice for a block of whole rows, returned by value so slicing a batch in a loop allocates nothing.
+ * Returns an empty tensor (0 rows) if any error (block out of bounds).
+ * 
+ * @param tensor the tensor sliced
+ * @param first first row of the block
+ * @param rows number of rows of the block
+ */
+Tensor tensor_slice_rows(const Tensor* tensor, int first, int rows);
+
+
+
+/**
+ * Returns 1 if the rows of the tensor follow each other in memory (stride == cols), so it is one block of rows * cols floats.
+ * 
+ * @param tensor the tensor
+ */
+int tensor_is_contiguous(const Tensor* tensor);
+
+
+
 /**
  * Creates and returns deepcopy of the tensor input.
  * 
@@ -57,13 +151,26 @@ Tensor* tensor_deepcopy(const Tensor* tensor);
 
 
 /**
- * Frees the tensor pointer and sets it to NULL
+ * Frees the tensor pointer (and its data if the tensor owns it) and sets it to NULL
  * 
  */
 void free_tensor(Tensor** tensor);
 
 
 
+/**
+ * Returns *buffer if it is already (rows x cols), otherwise replaces it with a new tensor of that shape.
+ * Used to keep buffers alive across calls, the values are left as they are (garbage for a new tensor).
+ * Returns NULL if any error.
+ * 
+ * @param buffer the buffer, *buffer can be NULL
+ * @param rows number of rows needed
+ * @param cols number of cols needed
+ */
+Tensor* tensor_ensure_shape(Tensor** buffer, int rows, int cols);
+
+
+
 // ==========================================
 //             Operations (new object)
 // ==========================================
@@ -93,7 +200,7 @@ Tensor* tensor_subtraction(const Tensor* t1, const Tensor* t2);
 /**
  * Returns a new Tensor (t1->rows x t2->cols) which is the result of matrix multiplication of t1 and t2 (t1 @ t2).
  * Returns NULL if the number of cols of t1 and rows of t2 do not match.
- * Simple Matrix multiplication (will optimise later)
+ * Cache-blocked, register-tiled GEMM (see gemm.h)
  * 
  * @param t1 the first tensor
  * @param t2 the second tensor
@@ -102,6 +209,20 @@ Tensor* tensor_multiplication(const Tensor* t1, const Tensor* t2);
 
 
 
+/**
+ * Returns a new Tensor which is the result of op(t1) @ op(t2), where op(t) is t or its transpose.
+ * The transposes are never materialised, the operands are read in place.
+ * Returns NULL if the inner dimensions of op(t1) and op(t2) do not match.
+ * 
+ * @param t1 the first tensor
+ * @param transpose_t1 non zero to use the transpose of t1
+ * @param t2 the second tensor
+ * @param transpose_t2 non zero to use the transpose of t2
+ */
+Tensor* tensor_multiplication_transposed(const Tensor* t1, int transpose_t1, const Tensor* t2, int transpose_t2);
+
+
+
 /**
  * Returns a new Tensor which is the result of matrix hadamard multiplication of t1 and t2 (element wise multiplication).
  * Returns NULL if the number of rows and cols do not match.
@@ -133,6 +254,127 @@ Tensor* tensor_add_cols(const Tensor* tensor);
 
 
 
+// ==========================================
+//     Operations (into a given destination)
+// ==========================================
+// Same as the operations above but the result is written into out, which must already have the right shape.
+// They return 1 on success and 0 (after printing the cause) on any error.
+
+/**
+ * out = t1 + t2
+ * out may be t1 or t2.
+ * 
+ * @param out the destination tensor (same shape as t1)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_addition_into(Tensor* out, const Tensor* t1, const Tensor* t2);
+
+
+
+/**
+ * out = t1 - t2
+ * out may be t1 or t2.
+ * 
+ * @param out the destination tensor (same shape as t1)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_subtraction_into(Tensor* out, const Tensor* t1, const Tensor* t2);
+
+
+
+/**
+ * out = t1 @ t2
+ * out must not be t1 or t2.
+ * 
+ * @param out the destination tensor (t1->rows x t2->cols)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_multiplication_into(Tensor* out, const Tensor* t1, const Tensor* t2);
+
+
+
+/**
+ * out = op(t1) @ op(t2), where op(t) is t or its transpose (read in place).
+ * out must not be t1 or t2.
+ * 
+ * @param out the destination tensor
+ * @param t1 the first tensor
+ * @param transpose_t1 non zero to use the transpose of t1
+ * @param t2 the second tensor
+ * @param transpose_t2 non zero to use the transpose of t2
+ */
+int tensor_multiplication_transposed_into(Tensor* out, const Tensor* t1, int transpose_t1, const Tensor* t2, int transpose_t2);
+
+
+
+/**
+ * out[i][j] = t1[i][j] * t2[i][j]
+ * out may be t1 or t2.
+ * 
+ * @param out the destination tensor (same shape as t1)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_multiplication_hadamard_into(Tensor* out, const Tensor* t1, const Tensor* t2);
+
+
+
+/**
+ * out = transpose of tensor
+ * out must not be tensor.
+ * 
+ * @param out the destination tensor (tensor->cols x tensor->rows)
+ * @param tensor the tensor
+ */
+int tensor_transpose_into(Tensor* out, const Tensor* tensor);
+
+
+
+/**
+ * out = sum of all rows of tensor (rows x cols ---> 1 x cols)
+ * 
+ * @param out the destination tensor (1 x tensor->cols)
+ * @param tensor the tensor
+ */
+int tensor_add_cols_into(Tensor* out, const Tensor* tensor);
+
+
+
+/**
+ * out = tensor (the buffer version of tensor_deepcopy)
+ * 
+ * @param out the destination tensor (same shape as tensor)
+ * @param tensor the tensor copied
+ */
+int tensor_copy_into(Tensor* out, const Tensor* tensor);
+
+
+
+/**
+ * out = tensor rounded (to nearest even) to the 16-bit format of out
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination 16-bit tensor
+ * @param tensor the tensor rounded
+ */
+int tensor_to_half(HalfTensor* out, const Tensor* tensor);
+
+
+
+/**
+ * out = half widened to floats (exact)
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination tensor
+ * @param half the 16-bit tensor widened
+ */
+int tensor_from_half(Tensor* out, const HalfTensor* half);
+
+
+
 // ==========================================
 //      Operations (in-place, modify t1)
 // ==========================================
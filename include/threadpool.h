@@ -0,0 +1,121 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+
+/* Environment variable that overrides the number of threads of the library-owned pool */
+#define THREADPOOL_ENV_VAR      "NEURAL_NUM_THREADS"
+
+
+
+/* A chunk [begin, end) of a parallel-for, queued on one of the work-stealing deques */
+typedef struct Task {
+
+    void (*func)(int begin, int end, void* arg);    // Body of the parallel-for
+    void* arg;                                      // Passed through to func
+    int begin;                                      // First index of the chunk
+    int end;                                        // One past the last index of the chunk
+    atomic_int* remaining;                          // Chunks of the parallel-for still not finished
+
+} Task;
+
+
+
+/* Ring buffer of tasks. The owner pushes and pops at the tail, thieves take from the head */
+typedef struct WorkDeque {
+
+    pthread_mutex_t lock;       // Guards head, tail and tasks
+    Task* tasks;                // Ring buffer (capacity entries)
+    int capacity;               // Maximum number of queued tasks
+    int head;                   // Index of the oldest task (stolen first)
+    int tail;                   // One past the index of the newest task (popped first by the owner)
+
+} WorkDeque;
+
+
+
+typedef struct ThreadPool {
+
+    int n_threads;              // Threads taking part in a parallel-for (the workers + the calling thread)
+    int n_workers;              // Background threads owned by the pool (n_threads - 1)
+    pthread_t* workers;         // Handles of the background threads
+
+    WorkDeque* deques;          // One deque per worker
+    atomic_int queued;          // Tasks sitting in any of the deques
+    atomic_uint next_deque;     // Round robin cursor used by threads that don't own a deque (unsigned, so it wraps to 0)
+    atomic_int stop;            // Set when the pool is being destroyed
+
+    pthread_mutex_t sleep_lock; // Idle workers sleep on sleep_cond while nothing is queued
+    pthread_cond_t sleep_cond;
+
+} ThreadPool;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new thread pool in which n_threads threads take part in every parallel-for (n_threads - 1 workers are spawned, the calling thread is the last one).
+ * If n_threads <= 0, the value of NEURAL_NUM_THREADS is used, or the number of online cores if it is not set.
+ * Returns NULL if any error.
+ *
+ * @param n_threads Number of threads of the pool
+ */
+ThreadPool* create_threadpool(int n_threads);
+
+
+
+/**
+ * Stops and joins the workers, then completely frees the pool.
+ */
+void free_threadpool(ThreadPool** pool);
+
+
+
+/**
+ * Returns the library-owned pool used by the tensor operations, creating it on the first call.
+ * Its size comes from NEURAL_NUM_THREADS, or the number of online cores if it is not set.
+ */
+ThreadPool* get_default_threadpool();
+
+
+
+/**
+ * Replaces the library-owned pool with one of n_threads threads (n_threads <= 0 means the same as for create_threadpool).
+ * Must not be called while any tensor operation is running.
+ * Returns 0 if any error.
+ *
+ * @param n_threads Number of threads of the new default pool
+ */
+int set_default_threadpool_threads(int n_threads);
+
+
+
+// ==========================================
+//             Parallel Primitives
+// ==========================================
+
+/**
+ * Calls func(begin, end, arg) over disjoint chunks covering [start, end) and returns once all of them are done.
+ * Chunks are at least grain indices long (except the last one) and are spread over the deques of the workers,
+ * idle threads steal from each other. The calling thread executes chunks too while it waits.
+ * Can be called from inside a chunk (nested parallel-for) and from several threads at once.
+ * Runs inline if pool is NULL, has a single thread or the range is smaller than grain.
+ *
+ * @param pool The pool to run on
+ * @param start First index
+ * @param end One past the last index
+ * @param grain Minimum number of indices per chunk
+ * @param func Body executed for every chunk
+ * @param arg Passed through to func
+ */
+void threadpool_parallel_for(ThreadPool* pool, int start, int end, int grain, void (*func)(int begin, int end, void* arg), void* arg);
+
+
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stddef.h>
+
+#include "tensor.h"
+
+
+
+/* Every allocation of a workspace starts on a multiple of this (cache line, also fine for any vector load) */
+#define WORKSPACE_ALIGNMENT     64
+
+
+
+/* Bump (arena) allocator for the temporaries of one step: allocation is a pointer increment, freeing everything is O(1) */
+typedef struct Workspace {
+
+    char* memory;               // One WORKSPACE_ALIGNMENT aligned block
+    size_t capacity;            // Size of memory in bytes
+    size_t offset;              // Bytes in use since the last reset
+    size_t high_water;          // Largest offset ever reached (to size the workspace of later runs)
+
+} Workspace;
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new workspace able to hold capacity bytes of allocations (alignment padding included).
+ * Returns NULL if any error.
+ *
+ * @param capacity Size of the workspace in bytes
+ */
+Workspace* create_workspace(size_t capacity);
+
+
+
+/**
+ * Completely frees the workspace. Every tensor allocated from it becomes invalid.
+ */
+void free_workspace(Workspace** ws);
+
+
+
+// ==========================================
+//             Allocation
+// ==========================================
+
+/**
+ * Returns WORKSPACE_ALIGNMENT aligned memory of the given size taken from the workspace.
+ * Returns NULL if the workspace is full.
+ *
+ * @param ws The workspace
+ * @param bytes Number of bytes needed
+ */
+void* workspace_alloc(Workspace* ws, size_t bytes);
+
+
+
+/**
+ * Returns an uninitialised (rows x cols) tensor whose header and data both live in the workspace.
+ * It stays valid until the next workspace_reset and must NOT be passed to free_tensor.
+ * Returns NULL if any error.
+ *
+ * @param ws The workspace
+ * @param rows number of rows of tensor
+ * @param cols number of cols of tensor
+ */
+Tensor* workspace_tensor(Workspace* ws, int rows, int cols);
+
+
+
+/**
+ * Returns the number of workspace bytes taken by workspace_tensor(ws, rows, cols), padding included.
+ * Used to size a workspace up front.
+ */
+size_t workspace_tensor_bytes(int rows, int cols);
+
+
+
+/**
+ * Returns an uninitialised (rows x cols) 16-bit tensor whose header and data both live in the workspace.
+ * It stays valid until the next workspace_reset.
+ * Returns NULL if any error.
+ *
+ * @param ws The workspace
+ * @param rows number of rows of tensor
+ * @param cols number of cols of tensor
+ * @param precision PRECISION_BF16 or PRECISION_FP16
+ */
+HalfTensor* workspace_half_tensor(Workspace* ws, int rows, int cols, storage_precision precision);
+
+
+
+/**
+ * Returns the number of workspace bytes taken by workspace_half_tensor(ws, rows, cols, precision), padding included.
+ */
+size_t workspace_half_tensor_bytes(int rows, int cols);
+
+
+
+/**
+ * Releases every allocation of the workspace at once (O(1), the memory is kept for reuse).
+ */
+void workspace_reset(Workspace* ws);
+
+
+
+/**
+ * Returns the largest number of bytes that were in use at once since the workspace was created.
+ */
+size_t workspace_high_water(const Workspace* ws);
+
+
+
+#endif
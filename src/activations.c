@@ -1,7 +1,9 @@
 #include "activations.h"
+#include "simd.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 
 
@@ -10,20 +12,18 @@
 // ==========================================
 
 void _relu_inplace(Tensor* t);
-float _apply_relu_to_element(float x);
-Tensor* _d_relu(Tensor* t);
-float _apply_d_relu_to_element(float x);
+int _d_relu(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums);
 
-/* Will implement later */ 
 void _sigmoid_inplace(Tensor* t);
-Tensor* _d_sigmoid(Tensor* t);
-void _softmax_inplace(Tensor* t);
-Tensor* _d_softmax(Tensor* t);
+int _d_sigmoid(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums);
 
+void _softmax_inplace(Tensor* t);
+int _d_softmax(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums);
 
 void _linear_inplace(Tensor* t);
-float _apply_d_linear_element(float x);
-Tensor* _d_linear(Tensor* t);
+int _d_linear(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums);
+
+int _check_backward_args(const Tensor* grad, const Tensor* ref, Tensor* col_sums);
 
 
 
@@ -46,28 +46,29 @@ Activation* create_activation(activation_function func) {
     {
     case RELU:
         new_activation->forward_inplace = _relu_inplace;
-        new_activation->backward = _d_relu;
+        new_activation->backward_inplace = _d_relu;
         break;
 
-    // case SIGMOID:
-    //     new_activation->forward_inplace = _sigmoid_inplace;
-    //     new_activation->backward = _d_sigmoid;
-    //     break;
+    case SIGMOID:
+        new_activation->forward_inplace = _sigmoid_inplace;
+        new_activation->backward_inplace = _d_sigmoid;
+        break;
         
-    // case SOFTMAX:
-    //     new_activation->forward_inplace = _softmax_inplace;
-    //     new_activation->backward = _d_softmax;
-    //     break;
+    case SOFTMAX:
+        new_activation->forward_inplace = _softmax_inplace;
+        new_activation->backward_inplace = _d_softmax;
+        break;
 
     case LINEAR:
         new_activation->forward_inplace = _linear_inplace;
-        new_activation->backward = _d_linear;
+        new_activation->backward_inplace = _d_linear;
         break;
 
     default:    /* RELU is default */
         printf("Unknown activation type, defaulting to ReLU\n");
+        new_activation->func = RELU;
         new_activation->forward_inplace = _relu_inplace;
-        new_activation->backward = _d_relu;
+        new_activation->backward_inplace = _d_relu;
         break;
     }
 
@@ -88,32 +89,41 @@ void free_activation(Activation** act) {
 
 
 
+/**
+ * Checks the arguments of a backward kernel: grad and ref (z or a) of the same shape, col_sums (1 x cols) or NULL.
+ * Zeroes col_sums. Returns 0 if any error.
+ */
+int _check_backward_args(const Tensor* grad, const Tensor* ref, Tensor* col_sums) {
+    if (!grad || !ref) {printf("Tensor received is NULL\n"); return 0;}
+    if (grad->rows != ref->rows || grad->cols != ref->cols) {printf("Shape of gradient tensor does not match\n"); return 0;}
+    if (col_sums && (col_sums->rows != 1 || col_sums->cols != grad->cols)) {printf("Shape of col_sums tensor does not match\n"); return 0;}
+
+    if (col_sums) memset(col_sums->data, 0, (size_t)col_sums->cols * sizeof(float));
+    return 1;
+}
+
+
+
 // ===================================
 //              Relu
 // ===================================
 
 void _relu_inplace(Tensor* t) {
     if (!t) {printf("Tensor received is NULL\n"); return;}
-    tensor_apply_func_inplace(t, _apply_relu_to_element);
-}
-
-
-float _apply_relu_to_element(float x) {
-    return (x > 0.0f) ? x : 0.01f * x;
-}
-
-float _apply_d_relu_to_element(float x) {
-    return (x > 0.0f) ? 1.0f : 0.01f;
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t)) k->relu(t->data, RELU_NEGATIVE_SLOPE, t->rows * t->cols);
+    else for (int i = 0; i < t->rows; i++) k->relu(&t->data[i*t->stride], RELU_NEGATIVE_SLOPE, t->cols);
 }
 
-Tensor* _d_relu(Tensor* t) {
-    if (!t) {printf("Tensor received is NULL\n"); return NULL;}
-
-    Tensor* res = tensor_deepcopy(t);
-    if (!res) {printf("Tensor deepcopy failed\n"); return NULL;}
+int _d_relu(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums) {
+    (void)a;
+    if (!_check_backward_args(grad, z, col_sums)) return 0;
 
-    tensor_apply_func_inplace(res, _apply_d_relu_to_element);
-    return res;
+    const SimdKernels* k = simd_kernels();
+    for (int i = 0; i < grad->rows; i++) {
+        k->relu_backward(&grad->data[i*grad->stride], &z->data[i*z->stride], RELU_NEGATIVE_SLOPE, col_sums ? col_sums->data : NULL, grad->cols);
+    }
+    return 1;
 }
 
 
@@ -123,11 +133,22 @@ Tensor* _d_relu(Tensor* t) {
 // ===================================
 
 void _sigmoid_inplace(Tensor* t) {
-    printf("Sigmoid Forward not implemented yet.\n");
+    if (!t) {printf("Tensor received is NULL\n"); return;}
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t)) k->sigmoid(t->data, t->rows * t->cols);
+    else for (int i = 0; i < t->rows; i++) k->sigmoid(&t->data[i*t->stride], t->cols);
 }
-Tensor* _d_sigmoid(Tensor* t) {
-    printf("Sigmoid Backward not implemented yet.\n");
-    return NULL;
+
+/* sigmoid'(z) = a * (1 - a), read from the output so exp is not evaluated again */
+int _d_sigmoid(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums) {
+    (void)z;
+    if (!_check_backward_args(grad, a, col_sums)) return 0;
+
+    const SimdKernels* k = simd_kernels();
+    for (int i = 0; i < grad->rows; i++) {
+        k->sigmoid_backward(&grad->data[i*grad->stride], &a->data[i*a->stride], col_sums ? col_sums->data : NULL, grad->cols);
+    }
+    return 1;
 }
 
 
@@ -136,12 +157,24 @@ Tensor* _d_sigmoid(Tensor* t) {
 //              Softmax
 // ===================================
 
+/* Every row (one sample) is normalised on its own */
 void _softmax_inplace(Tensor* t) {
-    printf("Softmax Forward not implemented yet.\n");
+    if (!t) {printf("Tensor received is NULL\n"); return;}
+
+    const SimdKernels* k = simd_kernels();
+    for (int i = 0; i < t->rows; i++) k->softmax(&t->data[i*t->stride], t->cols);
 }
-Tensor* _d_softmax(Tensor* t) {
-    printf("Softmax Backward not implemented yet.\n");
-    return NULL;
+
+/* The Jacobian of softmax is not diagonal: dz = a * (da - dot(da, a)) row by row, never built as a matrix */
+int _d_softmax(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums) {
+    (void)z;
+    if (!_check_backward_args(grad, a, col_sums)) return 0;
+
+    const SimdKernels* k = simd_kernels();
+    for (int i = 0; i < grad->rows; i++) {
+        k->softmax_backward(&grad->data[i*grad->stride], &a->data[i*a->stride], col_sums ? col_sums->data : NULL, grad->cols);
+    }
+    return 1;
 }
 
 
@@ -151,19 +184,17 @@ Tensor* _d_softmax(Tensor* t) {
 // ===================================
 
 void _linear_inplace(Tensor* t) {
+    (void)t;
     return;
 }
 
-float _apply_d_linear_element(float x) {
-    return 1.0f;
-}
-
-Tensor* _d_linear(Tensor* t) {
-    if (!t) return NULL;
-    
-    Tensor* res = tensor_deepcopy(t);
-    if (!res) return NULL;
+/* linear'(z) = 1, grad is already dz and only the column sums are left */
+int _d_linear(Tensor* grad, const Tensor* z, const Tensor* a, Tensor* col_sums) {
+    (void)a;
+    if (!_check_backward_args(grad, z, col_sums)) return 0;
+    if (!col_sums) return 1;
 
-    tensor_apply_func_inplace(res, _apply_d_linear_element);
-    return res;
+    const SimdKernels* k = simd_kernels();
+    for (int i = 0; i < grad->rows; i++) k->add(col_sums->data, col_sums->data, &grad->data[i*grad->stride], grad->cols);
+    return 1;
 }
\ No newline at end of file
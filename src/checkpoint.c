@@ -0,0 +1,252 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+void* _checkpointer_writer_main(void* arg);
+int _checkpointer_take_pending(Checkpointer* ckpt);
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new checkpointer writing to path, and starts its writer thread.
+ * Returns NULL if any error.
+ *
+ * @param path File the snapshots are written to.
+*/
+Checkpointer* create_checkpointer(const char* path) {
+    if (!path) {printf("The path passed is NULL\n"); return NULL;}
+
+    Checkpointer* ckpt = (Checkpointer*) calloc(1, sizeof(Checkpointer));
+    if (!ckpt) {printf("Malloc failed for checkpointer\n"); return NULL;}
+
+    ckpt->path = strdup(path);
+    if (!ckpt->path) {printf("Malloc failed for checkpoint path\n"); free(ckpt); return NULL;}
+
+    pthread_mutex_init(&ckpt->lock, NULL);
+    pthread_cond_init(&ckpt->cond, NULL);
+
+    if (pthread_create(&ckpt->writer, NULL, _checkpointer_writer_main, ckpt) != 0) {
+        printf("Could not start the checkpoint writer thread\n");
+        pthread_cond_destroy(&ckpt->cond);
+        pthread_mutex_destroy(&ckpt->lock);
+        free(ckpt->path);
+        free(ckpt);
+        return NULL;
+    }
+
+    return ckpt;
+}
+
+
+
+/**
+ * Waits for the pending snapshot to be written, stops the writer thread and completely frees the checkpointer.
+*/
+void free_checkpointer(Checkpointer** ckpt) {
+    if (ckpt && *ckpt) {
+        Checkpointer* c = *ckpt;
+
+        pthread_mutex_lock(&c->lock);
+        c->stop = 1;    /* The writer still writes the pending snapshot before leaving */
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+
+        pthread_join(c->writer, NULL);
+
+        pthread_cond_destroy(&c->cond);
+        pthread_mutex_destroy(&c->lock);
+        free(c->buffers[0]);
+        free(c->buffers[1]);
+        free(c->path);
+
+        free(c);
+        *ckpt = NULL;
+    }
+}
+
+
+
+// ==========================================
+//             Snapshots
+// ==========================================
+
+/**
+ * Returns a buffer of at least size bytes to build the next snapshot in. It is one the writer thread is not reading,
+ * so this never waits for the disk (a snapshot still waiting to be written is dropped for the newer one).
+ * The buffer must be handed back with checkpointer_submit.
+ * Returns NULL if any error.
+ *
+ * @param ckpt The checkpointer.
+ * @param size Size of the snapshot in bytes.
+*/
+char* checkpointer_acquire(Checkpointer* ckpt, size_t size) {
+    if (!ckpt) {printf("The checkpointer passed is NULL\n"); return NULL;}
+
+    /* The writer holds at most one buffer, and checkpointer_submit leaves at most one pending: one of the two is always free or pending */
+    pthread_mutex_lock(&ckpt->lock);
+    int idx = -1;
+    for (int i = 0; i < 2 && idx < 0; i++) if (ckpt->states[i] == SNAPSHOT_FREE) idx = i;
+    for (int i = 0; i < 2 && idx < 0; i++) if (ckpt->states[i] == SNAPSHOT_PENDING) idx = i;
+    if (idx >= 0) ckpt->states[idx] = SNAPSHOT_FILLING;
+    pthread_mutex_unlock(&ckpt->lock);
+
+    if (idx < 0) {printf("Both snapshot buffers are in use, a snapshot was acquired and not submitted\n"); return NULL;}
+
+    /* The buffer is ours while it is FILLING, grow it outside the lock (only happens on the first snapshots) */
+    if (ckpt->capacities[idx] < size) {
+        char* temp = (char*) realloc(ckpt->buffers[idx], size);
+        if (!temp) {
+            printf("Malloc failed for a snapshot of %zu bytes\n", size);
+            pthread_mutex_lock(&ckpt->lock);
+            ckpt->states[idx] = SNAPSHOT_FREE;
+            pthread_mutex_unlock(&ckpt->lock);
+            return NULL;
+        }
+
+        ckpt->buffers[idx] = temp;
+        ckpt->capacities[idx] = size;
+    }
+
+    return ckpt->buffers[idx];
+}
+
+
+
+/**
+ * Queues a buffer returned by checkpointer_acquire (now holding a complete image of size bytes) for the writer thread.
+ *
+ * @param ckpt The checkpointer.
+ * @param buffer The buffer returned by checkpointer_acquire.
+ * @param size Size of the snapshot in bytes.
+*/
+void checkpointer_submit(Checkpointer* ckpt, char* buffer, size_t size) {
+    if (!ckpt || !buffer) return;
+
+    int idx = (buffer == ckpt->buffers[0]) ? 0 : 1;
+
+    pthread_mutex_lock(&ckpt->lock);
+    if (ckpt->states[1 - idx] == SNAPSHOT_PENDING) ckpt->states[1 - idx] = SNAPSHOT_FREE;    /* Superseded before it was written */
+    ckpt->sizes[idx] = size;
+    ckpt->states[idx] = SNAPSHOT_PENDING;
+    pthread_cond_broadcast(&ckpt->cond);
+    pthread_mutex_unlock(&ckpt->lock);
+}
+
+
+
+/**
+ * Waits until every submitted snapshot is on disk.
+ * Returns 0 if any snapshot could not be written since the checkpointer was created.
+*/
+int checkpointer_wait(Checkpointer* ckpt) {
+    if (!ckpt) return 0;
+
+    pthread_mutex_lock(&ckpt->lock);
+    while (ckpt->states[0] == SNAPSHOT_PENDING || ckpt->states[0] == SNAPSHOT_WRITING ||
+           ckpt->states[1] == SNAPSHOT_PENDING || ckpt->states[1] == SNAPSHOT_WRITING) {
+        pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+    }
+    int ok = (ckpt->n_failed == 0);
+    pthread_mutex_unlock(&ckpt->lock);
+
+    return ok;
+}
+
+
+
+/**
+ * Writes size bytes to path.tmp, flushes them to the disk and renames the file to path, so path always holds
+ * either the previous or the new complete file, even if the process is killed while writing.
+ * Returns 0 if any error.
+ *
+ * @param path File to write.
+ * @param data Bytes to write.
+ * @param size Number of bytes.
+*/
+int checkpoint_write_file(const char* path, const void* data, size_t size) {
+    if (!path || !data) {
+        if (!path) printf("The path passed is NULL\n");
+        if (!data) printf("The data passed is NULL\n");
+        return 0;
+    }
+
+    size_t tmp_len = strlen(path) + 5;
+    char* tmp_path = (char*) malloc(tmp_len);
+    if (!tmp_path) {printf("Malloc failed for file name\n"); return 0;}
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (!file) {printf("Error opening %s\n", tmp_path); free(tmp_path); return 0;}
+
+    int ok = fwrite(data, 1, size, file) == size;
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+
+    if (ok && rename(tmp_path, path) != 0) {printf("Could not rename %s to %s\n", tmp_path, path); ok = 0;}
+    if (!ok) {
+        printf("Error writing %s\n", path);
+        remove(tmp_path);
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+
+
+/**
+ * Returns the index of the pending buffer (marked WRITING), or -1 if there is none. Called with the lock held.
+ */
+int _checkpointer_take_pending(Checkpointer* ckpt) {
+    for (int i = 0; i < 2; i++) {
+        if (ckpt->states[i] == SNAPSHOT_PENDING) {
+            ckpt->states[i] = SNAPSHOT_WRITING;
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+
+/**
+ * Body of the writer thread: writes the pending snapshot whenever there is one, until stop is set and nothing is pending.
+ */
+void* _checkpointer_writer_main(void* arg) {
+    Checkpointer* ckpt = (Checkpointer*) arg;
+
+    pthread_mutex_lock(&ckpt->lock);
+    for (;;) {
+        int idx = _checkpointer_take_pending(ckpt);
+        if (idx < 0) {
+            if (ckpt->stop) break;
+            pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&ckpt->lock);
+        int ok = checkpoint_write_file(ckpt->path, ckpt->buffers[idx], ckpt->sizes[idx]);    /* The trainer only touches the other buffer meanwhile */
+        pthread_mutex_lock(&ckpt->lock);
+
+        ckpt->states[idx] = SNAPSHOT_FREE;
+        if (ok) ckpt->n_written++;
+        else ckpt->n_failed++;
+        pthread_cond_broadcast(&ckpt->cond);
+    }
+    pthread_mutex_unlock(&ckpt->lock);
+
+    return NULL;
+}
\ No newline at end of file
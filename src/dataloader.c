@@ -0,0 +1,318 @@
+#include "dataloader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+void* _dataloader_worker_main(void* arg);
+int _dataloader_can_fill(const DataLoader* loader);
+void _dataloader_draw_order(int* order, int n, uint64_t seed, long epoch);
+void _dataloader_assemble(DataLoader* loader, DataLoaderSlot* slot, long position);
+uint64_t _splitmix64(uint64_t* state);
+
+
+
+/**
+ * Advances a splitmix64 stream and returns 64 random bits.
+ */
+uint64_t _splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+
+/**
+ * Writes the order of the samples for an epoch: a Fisher-Yates shuffle driven by a stream that only depends on (seed, epoch).
+ */
+void _dataloader_draw_order(int* order, int n, uint64_t seed, long epoch) {
+    uint64_t state = seed ^ ((uint64_t)epoch * 0xD1B54A32D192ED03ull);
+
+    for (int i = 0; i < n; i++) order[i] = i;
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)(((_splitmix64(&state) >> 32) * (uint64_t)(i + 1)) >> 32);    /* Uniform in [0, i] */
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+
+
+/**
+ * Returns 1 if a worker may start assembling position next_fill. Called with the lock held.
+ * The ring must have a free slot, and the position must be at most one epoch ahead of the consumer
+ * (only the orders of two epochs are kept).
+ */
+int _dataloader_can_fill(const DataLoader* loader) {
+    long g = loader->next_fill;
+    if (g - (loader->next_take - loader->holding) >= DATALOADER_SLOTS) return 0;
+    if (g / loader->n_batches > loader->next_take / loader->n_batches + 1) return 0;
+    return 1;
+}
+
+
+
+/**
+ * Fills a slot with the batch at a position of the stream. Called without the lock, the slot belongs to the caller.
+ */
+void _dataloader_assemble(DataLoader* loader, DataLoaderSlot* slot, long position) {
+    long epoch = position / loader->n_batches;
+    int start = (int)(position % loader->n_batches) * loader->batch_size;
+    int rows = (loader->n_samples - start < loader->batch_size) ? loader->n_samples - start : loader->batch_size;
+    int features = loader->x->cols;
+    int outputs = loader->y->cols;
+
+    if (!loader->shuffle) {
+        /* In order, a batch is just consecutive rows */
+        slot->x = tensor_slice_rows(loader->x, start, rows);
+        slot->y = tensor_slice_rows(loader->y, start, rows);
+        return;
+    }
+
+    const int* order = loader->orders[epoch % 2];
+    for (int r = 0; r < rows; r++) {
+        int src = order[start + r];
+        memcpy(&slot->x_buffer[(size_t)r * features], &loader->x->data[(size_t)src * loader->x->stride], features * sizeof(float));
+        memcpy(&slot->y_buffer[(size_t)r * outputs], &loader->y->data[(size_t)src * loader->y->stride], outputs * sizeof(float));
+    }
+
+    slot->x = (Tensor){slot->x_buffer, rows, features, features, 0};
+    slot->y = (Tensor){slot->y_buffer, rows, outputs, outputs, 0};
+}
+
+
+
+/**
+ * Body of the worker threads: assemble the next position of the stream whenever the ring has room, until stop is set.
+ */
+void* _dataloader_worker_main(void* arg) {
+    DataLoader* loader = (DataLoader*) arg;
+
+    pthread_mutex_lock(&loader->lock);
+    while (!loader->stop) {
+        if (!_dataloader_can_fill(loader)) {
+            pthread_cond_wait(&loader->cond, &loader->lock);
+            continue;
+        }
+
+        long position = loader->next_fill++;
+        long epoch = position / loader->n_batches;
+
+        /* First batch of an epoch: draw its order over the one of two epochs ago, which nothing uses any more */
+        if (loader->shuffle && loader->order_epochs[epoch % 2] != epoch) {
+            _dataloader_draw_order(loader->orders[epoch % 2], loader->n_samples, loader->seed, epoch);
+            loader->order_epochs[epoch % 2] = epoch;
+        }
+
+        DataLoaderSlot* slot = &loader->slots[position % DATALOADER_SLOTS];
+        slot->position = position;
+        slot->ready = 0;
+        loader->in_flight++;
+
+        pthread_mutex_unlock(&loader->lock);
+        _dataloader_assemble(loader, slot, position);
+        pthread_mutex_lock(&loader->lock);
+
+        loader->in_flight--;
+        slot->ready = 1;
+        pthread_cond_broadcast(&loader->cond);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    return NULL;
+}
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new data loader over the rows of x and y (which must outlive it) and starts its worker threads on epoch 0.
+ * Rows are never copied out of x and y except into the batches being assembled, so x and y can be views of a mapped dataset.
+ * Returns NULL if any error.
+ *
+ * @param x (n_samples x features) inputs.
+ * @param y (n_samples x outputs) targets.
+ * @param batch_size Samples per batch.
+ * @param shuffle 1 to reshuffle the samples every epoch, 0 to serve them in order (the batches are then views of x and y).
+ * @param seed Seed of the shuffles, pass the same one to resume a run.
+ * @param n_workers Background threads assembling batches, DATALOADER_DEFAULT_WORKERS if <= 0.
+*/
+DataLoader* create_dataloader(const Tensor* x, const Tensor* y, int batch_size, int shuffle, uint64_t seed, int n_workers) {
+    if (!x || !y || batch_size <= 0) {
+        if (!x) printf("x passed is NULL\n");
+        if (!y) printf("y passed is NULL\n");
+        if (batch_size <= 0) printf("Batch size needs to be a non zero positive integer\n");
+        return NULL;
+    }
+
+    if (x->rows != y->rows) {printf("x and y do not have the same number of samples (%d and %d)\n", x->rows, y->rows); return NULL;}
+
+    DataLoader* loader = (DataLoader*) calloc(1, sizeof(DataLoader));
+    if (!loader) {printf("Malloc failed for data loader\n"); return NULL;}
+
+    loader->x = x;
+    loader->y = y;
+    loader->n_samples = x->rows;
+    loader->batch_size = (batch_size < x->rows) ? batch_size : x->rows;
+    loader->n_batches = (x->rows + loader->batch_size - 1) / loader->batch_size;
+    loader->shuffle = shuffle ? 1 : 0;
+    loader->seed = seed;
+    loader->order_epochs[0] = -1;
+    loader->order_epochs[1] = -1;
+    loader->n_workers = (n_workers > 0) ? n_workers : DATALOADER_DEFAULT_WORKERS;
+
+    int ok = 1;
+    if (loader->shuffle) {
+        ok = ok && (loader->orders[0] = (int*) malloc(loader->n_samples * sizeof(int)));
+        ok = ok && (loader->orders[1] = (int*) malloc(loader->n_samples * sizeof(int)));
+    }
+    for (int s = 0; s < DATALOADER_SLOTS; s++) {
+        loader->slots[s].position = -1;
+        if (loader->shuffle) {
+            ok = ok && (loader->slots[s].x_buffer = (float*) malloc((size_t)loader->batch_size * x->cols * sizeof(float)));
+            ok = ok && (loader->slots[s].y_buffer = (float*) malloc((size_t)loader->batch_size * y->cols * sizeof(float)));
+        }
+    }
+    ok = ok && (loader->workers = (pthread_t*) malloc(loader->n_workers * sizeof(pthread_t)));
+
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+
+    int started = 0;
+    while (ok && started < loader->n_workers) {
+        ok = (pthread_create(&loader->workers[started], NULL, _dataloader_worker_main, loader) == 0);
+        if (ok) started++;
+    }
+
+    if (!ok) {
+        printf("Could not create the data loader (buffers or worker threads)\n");
+        loader->n_workers = started;
+        free_dataloader(&loader);
+        return NULL;
+    }
+
+    return loader;
+}
+
+
+
+/**
+ * Stops and joins the workers, then completely frees the loader. Batches handed out become invalid.
+*/
+void free_dataloader(DataLoader** loader) {
+    if (loader && *loader) {
+        DataLoader* l = *loader;
+
+        pthread_mutex_lock(&l->lock);
+        l->stop = 1;
+        pthread_cond_broadcast(&l->cond);
+        pthread_mutex_unlock(&l->lock);
+
+        for (int w = 0; l->workers && w < l->n_workers; w++) pthread_join(l->workers[w], NULL);
+
+        pthread_cond_destroy(&l->cond);
+        pthread_mutex_destroy(&l->lock);
+
+        for (int s = 0; s < DATALOADER_SLOTS; s++) {
+            free(l->slots[s].x_buffer);
+            free(l->slots[s].y_buffer);
+        }
+        free(l->orders[0]);
+        free(l->orders[1]);
+        free(l->workers);
+
+        free(l);
+        *loader = NULL;
+    }
+}
+
+
+
+// ==========================================
+//             Iteration
+// ==========================================
+
+/**
+ * Moves the loader to a batch of an epoch: the next dataloader_next returns that batch. Batches assembled in advance
+ * for another position are dropped. network_train calls it to start (or resume) training.
+ * Returns 0 if any error.
+ *
+ * @param loader The loader.
+ * @param epoch Epoch (its order is drawn from the seed and the epoch).
+ * @param batch Batch within the epoch (n_batches is the first batch of the next epoch).
+*/
+int dataloader_seek(DataLoader* loader, int epoch, int batch) {
+    if (!loader || epoch < 0 || batch < 0 || batch > loader->n_batches) {
+        if (!loader) printf("The loader passed is NULL\n");
+        else printf("Cannot seek to epoch %d, batch %d (%d batches per epoch)\n", epoch, batch, loader->n_batches);
+        return 0;
+    }
+
+    long position = (long)epoch * loader->n_batches + batch;
+
+    pthread_mutex_lock(&loader->lock);
+    if (position != loader->next_take) {
+        while (loader->in_flight > 0) pthread_cond_wait(&loader->cond, &loader->lock);    /* Slots being filled cannot be reused yet */
+
+        for (int s = 0; s < DATALOADER_SLOTS; s++) {
+            loader->slots[s].position = -1;
+            loader->slots[s].ready = 0;
+        }
+        loader->next_take = position;
+        loader->next_fill = position;
+        loader->holding = 0;
+        pthread_cond_broadcast(&loader->cond);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    return 1;
+}
+
+
+
+/**
+ * Returns the next batch (inputs in *x, targets in *y), waiting if the workers have not assembled it yet.
+ * The batch stays valid until the next call, which hands its buffer back to the workers. After the last batch of an
+ * epoch comes the first batch of the next one.
+ * Returns 0 if any error.
+ *
+ * @param loader The loader.
+ * @param x Receives the batch inputs.
+ * @param y Receives the batch targets.
+*/
+int dataloader_next(DataLoader* loader, Tensor** x, Tensor** y) {
+    if (!loader || !x || !y) {printf("The loader or the outputs passed are NULL\n"); return 0;}
+
+    pthread_mutex_lock(&loader->lock);
+    if (loader->holding) {
+        DataLoaderSlot* held = &loader->slots[(loader->next_take - 1) % DATALOADER_SLOTS];
+        held->position = -1;
+        held->ready = 0;
+        loader->holding = 0;
+        pthread_cond_broadcast(&loader->cond);
+    }
+
+    DataLoaderSlot* slot = &loader->slots[loader->next_take % DATALOADER_SLOTS];
+    while (!(slot->ready && slot->position == loader->next_take)) pthread_cond_wait(&loader->cond, &loader->lock);
+
+    *x = &slot->x;
+    *y = &slot->y;
+    loader->holding = 1;
+    loader->next_take++;
+    pthread_cond_broadcast(&loader->cond);
+    pthread_mutex_unlock(&loader->lock);
+
+    return 1;
+}
\ No newline at end of file
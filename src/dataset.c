@@ -0,0 +1,635 @@
+#include "dataset.h"
+#include "threadpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+char* _dataset_map_file(const char* path, size_t* size);
+size_t _dataset_align(size_t offset);
+Dataset* _create_dataset(int n_samples, int n_features, int n_outputs);
+const unsigned char* _idx_parse_header(const char* path, const unsigned char* base, size_t size, int* n_dims, uint32_t* dims);
+const char* _csv_skip_header(const char* p, const char* end);
+int _csv_scan_number(const char** p, const char* end, double* value);
+int _csv_is_blank(const char* p, const char* end);
+int _csv_parse_row(const char* p, const char* line_end, float* x_row, float* y_row, int n_features, int n_classes, float feature_scale);
+void _csv_count_chunks(int begin, int end, void* arg);
+void _csv_parse_chunks(int begin, int end, void* arg);
+
+/* Fixed size header at the start of a native dataset file (fields in the byte order of the host that wrote it) */
+typedef struct DatasetFileHeader {
+    char magic[8];                      // DATASET_FILE_MAGIC
+    uint32_t version;                   // DATASET_FILE_VERSION
+    uint32_t byte_order;                // DATASET_FILE_BYTE_ORDER, read back differently on a host of the other endianness
+    uint32_t header_size;               // sizeof(DatasetFileHeader)
+    uint32_t n_samples;
+    uint32_t n_features;
+    uint32_t n_outputs;
+    uint64_t x_offset;                  // From the start of the file, multiple of DATASET_FILE_ALIGNMENT
+    uint64_t y_offset;                  // From the start of the file, multiple of DATASET_FILE_ALIGNMENT
+    uint64_t file_size;                 // Total size, to catch truncated files
+} DatasetFileHeader;
+
+#define DATASET_FILE_BYTE_ORDER     0x01020304u
+#define IDX_TYPE_UBYTE              0x08
+#define IDX_MAX_DIMS                8
+#define CSV_CHUNK_BYTES             (1 << 20)
+
+/* A part of a CSV file, starting at the beginning of a line, parsed by one task */
+typedef struct CsvChunk {
+    const char* begin;
+    const char* end;
+    int n_lines;                        // Lines of the chunk (blank ones included), for error messages
+    int n_rows;                         // Lines holding a sample
+    int first_line;                     // Line number of begin in the file
+    int first_row;                      // Row of the dataset the first sample of the chunk goes to
+    int bad_line;                       // First malformed line of the chunk, 0 if none
+} CsvChunk;
+
+/* Shared by the tasks of dataset_load_csv */
+typedef struct CsvJob {
+    CsvChunk* chunks;
+    Dataset* ds;
+    float feature_scale;
+} CsvJob;
+
+
+
+/**
+ * Maps a whole file (private, copy-on-write) and returns its address, or NULL if any error. size receives its length.
+ */
+char* _dataset_map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {printf("Error opening %s\n", path); return NULL;}
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("%s is empty or cannot be read\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    char* base = (char*) mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);    /* The mapping keeps the file alive */
+    if (base == MAP_FAILED) {printf("Could not map %s\n", path); return NULL;}
+
+    return base;
+}
+
+
+
+/**
+ * Rounds offset up to a multiple of DATASET_FILE_ALIGNMENT.
+ */
+size_t _dataset_align(size_t offset) {
+    return (offset + DATASET_FILE_ALIGNMENT - 1) & ~((size_t)DATASET_FILE_ALIGNMENT - 1);
+}
+
+
+
+/**
+ * Returns a dataset owning zeroed (n_samples x n_features) and (n_samples x n_outputs) matrices, or NULL if any error.
+ */
+Dataset* _create_dataset(int n_samples, int n_features, int n_outputs) {
+    Dataset* ds = (Dataset*) calloc(1, sizeof(Dataset));
+    if (!ds) {printf("Malloc failed for dataset\n"); return NULL;}
+
+    ds->x = create_tensor_value(n_samples, n_features, 0.0f);
+    ds->y = create_tensor_value(n_samples, n_outputs, 0.0f);
+    if (!ds->x || !ds->y) {
+        free_dataset(&ds);
+        return NULL;
+    }
+
+    ds->n_samples = n_samples;
+    ds->n_features = n_features;
+    ds->n_outputs = n_outputs;
+
+    return ds;
+}
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Completely frees the dataset (and unmaps its file). Views taken from it become invalid.
+*/
+void free_dataset(Dataset** ds) {
+    if (ds && *ds) {
+        free_tensor(&((*ds)->x));
+        free_tensor(&((*ds)->y));
+
+        if ((*ds)->mapping) munmap((*ds)->mapping, (*ds)->mapping_size);    /* After the tensors, they point into it */
+
+        free(*ds);
+        *ds = NULL;
+    }
+}
+
+
+
+// ==========================================
+//             Loading
+// ==========================================
+
+/**
+ * Loads a native dataset file by mapping it in memory: x and y point straight into the mapping, nothing is parsed,
+ * converted or copied, and pages are only read from disk (or shared from the page cache) when a batch touches them.
+ * Returns NULL if any error (bad magic, version or sizes).
+ *
+ * @param path Path of the dataset file (written by dataset_save or dataset_convert_csv).
+*/
+Dataset* dataset_load(const char* path) {
+    if (!path) {printf("The path passed is NULL\n"); return NULL;}
+
+    size_t size = 0;
+    char* base = _dataset_map_file(path, &size);
+    if (!base) return NULL;
+
+    const DatasetFileHeader* header = (const DatasetFileHeader*) base;
+
+    const char* error = NULL;
+    if (size < sizeof(DatasetFileHeader)) error = "too small to be a dataset file";
+    else if (memcmp(header->magic, DATASET_FILE_MAGIC, sizeof(DATASET_FILE_MAGIC)) != 0) error = "not a dataset file (bad magic)";
+    else if (header->byte_order != DATASET_FILE_BYTE_ORDER) error = "written on a host of the other byte order";
+    else if (header->version != DATASET_FILE_VERSION) error = "unsupported version";
+    else if (header->header_size != sizeof(DatasetFileHeader)) error = "unexpected header layout";
+    else if (header->file_size != size) error = "truncated or padded (size does not match the header)";
+    else if (header->n_samples == 0 || header->n_features == 0 || header->n_outputs == 0) error = "no samples, features or outputs";
+    else if (header->n_samples > INT32_MAX || header->n_features > INT32_MAX || header->n_outputs > INT32_MAX) error = "sizes out of range";
+    else if (header->x_offset % DATASET_FILE_ALIGNMENT || header->y_offset % DATASET_FILE_ALIGNMENT) error = "misaligned matrices";
+
+    /* The sizes are bounded by the floats after each offset before they are multiplied, so a crafted header cannot wrap the product */
+    if (!error && (header->x_offset > size || header->y_offset > size)) error = "matrices past the end of the file";
+    else if (!error) {
+        uint64_t x_floats = (size - header->x_offset) / sizeof(float);
+        uint64_t y_floats = (size - header->y_offset) / sizeof(float);
+        if (header->n_features > x_floats / header->n_samples || header->n_outputs > y_floats / header->n_samples) error = "matrices past the end of the file";
+    }
+
+    if (error) {
+        printf("Cannot load %s: %s\n", path, error);
+        munmap(base, size);
+        return NULL;
+    }
+
+    Dataset* ds = (Dataset*) calloc(1, sizeof(Dataset));
+    if (!ds) {printf("Malloc failed for dataset\n"); munmap(base, size); return NULL;}
+
+    ds->mapping = base;
+    ds->mapping_size = size;
+    ds->n_samples = (int)header->n_samples;
+    ds->n_features = (int)header->n_features;
+    ds->n_outputs = (int)header->n_outputs;
+
+    ds->x = create_tensor_view((float*)(base + header->x_offset), ds->n_samples, ds->n_features);
+    ds->y = create_tensor_view((float*)(base + header->y_offset), ds->n_samples, ds->n_outputs);
+    if (!ds->x || !ds->y) {
+        free_dataset(&ds);    /* Unmaps too */
+        return NULL;
+    }
+
+    return ds;
+}
+
+
+
+/**
+ * Checks the header of an IDX file of unsigned bytes and reads its dimensions (big-endian in the file).
+ * Returns the first byte of the data, or NULL if any error.
+ */
+const unsigned char* _idx_parse_header(const char* path, const unsigned char* base, size_t size, int* n_dims, uint32_t* dims) {
+    /* Magic: two zero bytes, the type of the elements, the number of dimensions */
+    if (size < 4 || base[0] != 0 || base[1] != 0) {printf("%s is not an IDX file\n", path); return NULL;}
+    if (base[2] != IDX_TYPE_UBYTE) {printf("%s: only unsigned byte IDX files are supported (type 0x%02x)\n", path, base[2]); return NULL;}
+
+    *n_dims = base[3];
+    if (*n_dims < 1 || *n_dims > IDX_MAX_DIMS || size < 4 + 4 * (size_t)*n_dims) {printf("%s: bad number of dimensions\n", path); return NULL;}
+
+    /* Every dimension is checked against the bytes left before it is multiplied in, so the count cannot wrap */
+    size_t data_offset = 4 + 4 * (size_t)*n_dims;
+    size_t count = 1;
+    int fits = 1;
+    for (int d = 0; d < *n_dims; d++) {
+        const unsigned char* b = base + 4 + 4 * d;
+        dims[d] = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+        if (dims[d] != 0 && count > (size - data_offset) / dims[d]) fits = 0;
+        else count *= dims[d];
+    }
+
+    if (!fits || dims[0] == 0 || dims[0] > INT32_MAX || count / dims[0] > INT32_MAX || data_offset + count > size) {printf("%s: sizes do not match the file\n", path); return NULL;}
+
+    return base + data_offset;
+}
+
+
+
+/**
+ * Loads a classification dataset stored as a pair of IDX files (the format MNIST is distributed in): an unsigned byte
+ * tensor of samples (N x d1 x d2 ...) and an unsigned byte vector of N labels. Both files are mapped and decoded in one
+ * pass: pixels become floats scaled by feature_scale, labels become one-hot rows of n_classes.
+ * Returns NULL if any error.
+ *
+ * @param images_path Path of the IDX file of the samples (e.g. train-images-idx3-ubyte).
+ * @param labels_path Path of the IDX file of the labels (e.g. train-labels-idx1-ubyte).
+ * @param n_classes Number of classes (width of the one-hot targets).
+ * @param feature_scale Factor applied to every byte of the samples (1/255 maps pixels to [0, 1]).
+*/
+Dataset* dataset_load_idx(const char* images_path, const char* labels_path, int n_classes, float feature_scale) {
+    if (!images_path || !labels_path || n_classes <= 0) {
+        if (!images_path) printf("The images path passed is NULL\n");
+        if (!labels_path) printf("The labels path passed is NULL\n");
+        if (n_classes <= 0) printf("n_classes needs to be a non zero positive integer\n");
+        return NULL;
+    }
+
+    size_t images_size = 0, labels_size = 0;
+    char* images = _dataset_map_file(images_path, &images_size);
+    char* labels = images ? _dataset_map_file(labels_path, &labels_size) : NULL;
+
+    Dataset* ds = NULL;
+    if (images && labels) {
+        int image_dims = 0, label_dims = 0;
+        uint32_t image_shape[IDX_MAX_DIMS], label_shape[IDX_MAX_DIMS];
+
+        const unsigned char* pixels = _idx_parse_header(images_path, (const unsigned char*)images, images_size, &image_dims, image_shape);
+        const unsigned char* targets = _idx_parse_header(labels_path, (const unsigned char*)labels, labels_size, &label_dims, label_shape);
+
+        if (pixels && targets && (label_dims != 1 || label_shape[0] != image_shape[0])) {
+            printf("%s is not a vector of one label for each of the %u samples of %s\n", labels_path, image_shape[0], images_path);
+            targets = NULL;
+        }
+
+        if (pixels && targets) {
+            int n_samples = (int)image_shape[0];
+            int n_features = 1;
+            for (int d = 1; d < image_dims; d++) n_features *= (int)image_shape[d];
+
+            ds = _create_dataset(n_samples, n_features, n_classes);
+            for (int i = 0; ds && i < n_samples; i++) {
+                if (targets[i] >= n_classes) {
+                    printf("%s: label %d of sample %d is not below n_classes (%d)\n", labels_path, targets[i], i, n_classes);
+                    free_dataset(&ds);
+                    break;
+                }
+
+                const unsigned char* src = pixels + (size_t)i * n_features;
+                float* dst = ds->x->data + (size_t)i * n_features;
+                for (int j = 0; j < n_features; j++) dst[j] = (float)src[j] * feature_scale;
+
+                ds->y->data[(size_t)i * n_classes + targets[i]] = 1.0f;
+            }
+        }
+    }
+
+    if (images) munmap(images, images_size);
+    if (labels) munmap(labels, labels_size);
+
+    return ds;
+}
+
+
+
+/**
+ * Returns the start of the first line holding data: a first line that does not start with a number is a header.
+ */
+const char* _csv_skip_header(const char* p, const char* end) {
+    if (p < end && !((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')) {
+        const char* nl = memchr(p, '\n', end - p);
+        return nl ? nl + 1 : end;
+    }
+    return p;
+}
+
+
+
+/**
+ * Reads a decimal number ([sign] digits [. digits] [e [sign] digits]) at *p, without going past end, and moves *p after it.
+ * Leading blanks are skipped. Returns 0 if there is no number at *p.
+ */
+int _csv_scan_number(const char** p, const char* end, double* value) {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* s = *p;
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+
+    int negative = 0;
+    if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+
+    uint64_t mantissa = 0;
+    int exponent = 0, n_digits = 0;
+    for (; s < end && *s >= '0' && *s <= '9'; s++, n_digits++) {
+        if (mantissa < 1000000000000000000ull) mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+        else exponent++;    /* Digits past the 19th only scale the value */
+    }
+    if (s < end && *s == '.') {
+        for (s++; s < end && *s >= '0' && *s <= '9'; s++, n_digits++) {
+            if (mantissa < 1000000000000000000ull) {mantissa = mantissa * 10 + (uint64_t)(*s - '0'); exponent--;}
+        }
+    }
+    if (n_digits == 0) return 0;
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char* e = s + 1;
+        int e_negative = 0, e_value = 0, e_digits = 0;
+        if (e < end && (*e == '-' || *e == '+')) e_negative = (*e++ == '-');
+        for (; e < end && *e >= '0' && *e <= '9'; e++, e_digits++) if (e_value < 10000) e_value = e_value * 10 + (*e - '0');
+        if (e_digits > 0) {
+            exponent += e_negative ? -e_value : e_value;
+            s = e;
+        }
+    }
+
+    double v = (double)mantissa;
+    int a = exponent < 0 ? -exponent : exponent;
+    double scale = (a <= 22) ? powers[a] : pow(10.0, a);
+    v = (exponent < 0) ? v / scale : v * scale;
+
+    *value = negative ? -v : v;
+    *p = s;
+    return 1;
+}
+
+
+
+/**
+ * Returns 1 if [p, end) holds nothing but blanks (spaces, tabs, carriage returns).
+ */
+int _csv_is_blank(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p == end;
+}
+
+
+
+/**
+ * Parses one row [p, line_end) (label, then n_features features) straight into its row of x and its one-hot row of y.
+ * Returns 0 if the row is malformed.
+ */
+int _csv_parse_row(const char* p, const char* line_end, float* x_row, float* y_row, int n_features, int n_classes, float feature_scale) {
+    double value = 0.0;
+    if (!_csv_scan_number(&p, line_end, &value) || !(value >= 0 && value < n_classes && value == (int)value)) return 0;
+    y_row[(int)value] = 1.0f;
+
+    for (int j = 0; j < n_features; j++) {
+        while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+        if (p == line_end || *p != ',') return 0;
+        p++;
+
+        if (!_csv_scan_number(&p, line_end, &value)) return 0;
+        x_row[j] = (float)value * feature_scale;
+    }
+
+    return _csv_is_blank(p, line_end);
+}
+
+
+
+/**
+ * Body of the first parallel pass: counts the lines and the rows (lines that are not blank) of every chunk.
+ */
+void _csv_count_chunks(int begin, int end, void* arg) {
+    CsvJob* job = (CsvJob*) arg;
+
+    for (int c = begin; c < end; c++) {
+        CsvChunk* chunk = &job->chunks[c];
+        chunk->n_lines = 0;
+        chunk->n_rows = 0;
+
+        for (const char* p = chunk->begin; p < chunk->end;) {
+            const char* nl = memchr(p, '\n', chunk->end - p);
+            const char* line_end = nl ? nl : chunk->end;
+
+            chunk->n_lines++;
+            if (!_csv_is_blank(p, line_end)) chunk->n_rows++;
+
+            p = line_end + 1;
+        }
+    }
+}
+
+
+
+/**
+ * Body of the second parallel pass: parses the rows of every chunk into the dataset, from the first row of the chunk on.
+ * The first malformed line of a chunk is kept in bad_line and stops the chunk.
+ */
+void _csv_parse_chunks(int begin, int end, void* arg) {
+    CsvJob* job = (CsvJob*) arg;
+    Dataset* ds = job->ds;
+
+    for (int c = begin; c < end; c++) {
+        CsvChunk* chunk = &job->chunks[c];
+        int row = chunk->first_row;
+        int line = chunk->first_line;
+
+        for (const char* p = chunk->begin; p < chunk->end; line++) {
+            const char* nl = memchr(p, '\n', chunk->end - p);
+            const char* line_end = nl ? nl : chunk->end;
+
+            if (!_csv_is_blank(p, line_end)) {
+                float* x_row = ds->x->data + (size_t)row * ds->n_features;
+                float* y_row = ds->y->data + (size_t)row * ds->n_outputs;
+
+                if (!_csv_parse_row(p, line_end, x_row, y_row, ds->n_features, ds->n_outputs, job->feature_scale)) {
+                    chunk->bad_line = line;
+                    break;
+                }
+                row++;
+            }
+
+            p = line_end + 1;
+        }
+    }
+}
+
+
+
+/**
+ * Loads a classification dataset from a CSV file with one sample per line: the label first, then the features.
+ * A first line that does not start with a number is taken as a header and skipped. Lines may be of any length.
+ * The file is mapped and cut into chunks on line boundaries, which the thread pool parses in two passes (count the
+ * rows of every chunk, then parse every chunk straight into its rows of the matrices), with no allocation per row.
+ * Returns NULL if any error (the line of a malformed row is printed).
+ *
+ * @param path Path of the CSV file.
+ * @param n_classes Number of classes (width of the one-hot targets).
+ * @param feature_scale Factor applied to every feature (1/255 maps pixels to [0, 1]).
+*/
+Dataset* dataset_load_csv(const char* path, int n_classes, float feature_scale) {
+    if (!path || n_classes <= 0) {
+        if (!path) printf("The path passed is NULL\n");
+        if (n_classes <= 0) printf("n_classes needs to be a non zero positive integer\n");
+        return NULL;
+    }
+
+    size_t size = 0;
+    char* base = _dataset_map_file(path, &size);
+    if (!base) return NULL;
+
+    const char* end = base + size;
+    const char* data = _csv_skip_header(base, end);
+
+    /* Features are the fields of the first row minus the label */
+    int n_fields = 0;
+    for (const char* p = data; p < end && n_fields == 0;) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl ? nl : end;
+
+        if (!_csv_is_blank(p, line_end)) {
+            n_fields = 1;
+            for (const char* c = p; c < line_end; c++) n_fields += (*c == ',');
+        }
+
+        p = line_end + 1;
+    }
+
+    /* Chunks of about CSV_CHUNK_BYTES, each moved forward to start right after a newline (a chunk is empty if a line spans it) */
+    size_t data_size = (size_t)(end - data);
+    int n_chunks = (int)((data_size + CSV_CHUNK_BYTES - 1) / CSV_CHUNK_BYTES);
+    if (n_chunks == 0) n_chunks = 1;
+
+    CsvJob job = {NULL, NULL, feature_scale};
+    job.chunks = (CsvChunk*) calloc(n_chunks, sizeof(CsvChunk));
+    if (!job.chunks) {printf("Malloc failed for CSV chunks\n"); munmap(base, size); return NULL;}
+
+    for (int c = 0; c < n_chunks; c++) {
+        const char* start = data + (size_t)c * CSV_CHUNK_BYTES;
+        if (c > 0) {
+            const char* nl = memchr(start - 1, '\n', end - (start - 1));
+            start = nl ? nl + 1 : end;
+            if (start < job.chunks[c - 1].begin) start = job.chunks[c - 1].begin;
+            job.chunks[c - 1].end = start;
+        }
+        job.chunks[c].begin = start;
+        job.chunks[c].end = end;
+    }
+
+    ThreadPool* pool = get_default_threadpool();
+    threadpool_parallel_for(pool, 0, n_chunks, 1, _csv_count_chunks, &job);
+
+    int n_samples = 0;
+    int line = (data != base) ? 2 : 1;
+    for (int c = 0; c < n_chunks; c++) {
+        job.chunks[c].first_row = n_samples;
+        job.chunks[c].first_line = line;
+        n_samples += job.chunks[c].n_rows;
+        line += job.chunks[c].n_lines;
+    }
+
+    if (n_samples == 0 || n_fields < 2) {
+        printf("%s holds no samples with a label and features\n", path);
+        free(job.chunks);
+        munmap(base, size);
+        return NULL;
+    }
+
+    job.ds = _create_dataset(n_samples, n_fields - 1, n_classes);
+    if (job.ds) {
+        threadpool_parallel_for(pool, 0, n_chunks, 1, _csv_parse_chunks, &job);
+
+        for (int c = 0; c < n_chunks; c++) {
+            if (job.chunks[c].bad_line) {
+                printf("%s, line %d: expected a label below %d and %d features\n", path, job.chunks[c].bad_line, n_classes, n_fields - 1);
+                free_dataset(&job.ds);
+                break;
+            }
+        }
+    }
+
+    free(job.chunks);
+    munmap(base, size);
+    return job.ds;
+}
+
+
+
+// ==========================================
+//             Saving
+// ==========================================
+
+/**
+ * Writes the dataset as a native dataset file, which dataset_load maps without any parsing.
+ * Returns 0 if any error.
+ *
+ * @param ds The dataset.
+ * @param path Path of the dataset file.
+*/
+int dataset_save(const Dataset* ds, const char* path) {
+    if (!ds || !path) {
+        if (!ds) printf("The dataset passed is NULL\n");
+        if (!path) printf("The path passed is NULL\n");
+        return 0;
+    }
+
+    size_t x_bytes = (size_t)ds->n_samples * ds->n_features * sizeof(float);
+    size_t y_bytes = (size_t)ds->n_samples * ds->n_outputs * sizeof(float);
+
+    DatasetFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_FILE_MAGIC, sizeof(DATASET_FILE_MAGIC));
+    header.version = DATASET_FILE_VERSION;
+    header.byte_order = DATASET_FILE_BYTE_ORDER;
+    header.header_size = sizeof(DatasetFileHeader);
+    header.n_samples = ds->n_samples;
+    header.n_features = ds->n_features;
+    header.n_outputs = ds->n_outputs;
+    header.x_offset = _dataset_align(sizeof(DatasetFileHeader));
+    header.y_offset = _dataset_align(header.x_offset + x_bytes);
+    header.file_size = header.y_offset + y_bytes;
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {printf("Error opening %s\n", path); return 0;}
+
+    static const char zeros[DATASET_FILE_ALIGNMENT] = {0};
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(zeros, 1, header.x_offset - sizeof(header), file) == header.x_offset - sizeof(header);
+    ok = ok && fwrite(ds->x->data, 1, x_bytes, file) == x_bytes;
+    ok = ok && fwrite(zeros, 1, header.y_offset - header.x_offset - x_bytes, file) == header.y_offset - header.x_offset - x_bytes;
+    ok = ok && fwrite(ds->y->data, 1, y_bytes, file) == y_bytes;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok) {
+        printf("Error writing dataset file %s\n", path);
+        remove(path);
+    }
+
+    return ok;
+}
+
+
+
+/**
+ * One-shot conversion of a CSV dataset (see dataset_load_csv) to a native dataset file, so later runs load it with dataset_load.
+ * Returns 0 if any error.
+ *
+ * @param csv_path Path of the CSV file.
+ * @param out_path Path of the dataset file written.
+ * @param n_classes Number of classes (width of the one-hot targets).
+ * @param feature_scale Factor applied to every feature.
+*/
+int dataset_convert_csv(const char* csv_path, const char* out_path, int n_classes, float feature_scale) {
+    Dataset* ds = dataset_load_csv(csv_path, n_classes, feature_scale);
+    if (!ds) return 0;
+
+    int ok = dataset_save(ds, out_path);
+
+    free_dataset(&ds);
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,420 @@
+#include "distributed.h"
+#include "simd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+
+
+/* Sent by every rank but 0 once connected to the rendezvous socket */
+typedef struct ProcessGroupHello {
+    uint32_t magic;             // PROCESS_GROUP_MAGIC
+    uint32_t rank;
+    uint32_t world_size;
+    uint32_t reserved;
+    uint64_t n_floats;
+} ProcessGroupHello;
+
+#define PROCESS_GROUP_MAGIC     0x4E4E5047u    /* "NNPG" */
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+int _process_group_names(const char* name, char* socket_path, size_t socket_size, char* shm_name, size_t shm_size);
+double _process_group_now();
+int _process_group_rendezvous_root(ProcessGroup* pg, const char* socket_path);
+int _process_group_rendezvous_join(ProcessGroup* pg, const char* socket_path);
+int _process_group_map(ProcessGroup* pg, int fd);
+void _process_group_chunk(const ProcessGroup* pg, int chunk, size_t* first, size_t* count);
+
+
+
+/**
+ * Builds the socket path and segment name of a group. Returns 0 if the name is empty, too long or has other characters
+ * than letters, digits, '-' and '_'.
+ */
+int _process_group_names(const char* name, char* socket_path, size_t socket_size, char* shm_name, size_t shm_size) {
+    size_t len = strlen(name);
+    if (len == 0) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_')) return 0;
+    }
+
+    int n1 = snprintf(socket_path, socket_size, "%s/neural-%s.sock", PROCESS_GROUP_SOCKET_DIR, name);
+    int n2 = snprintf(shm_name, shm_size, "/neural-%s", name);
+    return n1 > 0 && (size_t)n1 < socket_size && n2 > 0 && (size_t)n2 < shm_size;
+}
+
+
+
+/**
+ * Returns a monotonic time in seconds.
+ */
+double _process_group_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+/**
+ * Maps the segment open on fd (already sized) and points the fields of the group into it. Returns 0 if any error.
+ */
+int _process_group_map(ProcessGroup* pg, int fd) {
+    pg->mapping = mmap(NULL, pg->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pg->mapping == MAP_FAILED) {pg->mapping = NULL; printf("Could not map the shared segment of the process group\n"); return 0;}
+
+    pg->shared = (ProcessGroupShared*) pg->mapping;
+    pg->buffers = (float*)((char*)pg->mapping + PROCESS_GROUP_ALIGNMENT);
+    return 1;
+}
+
+
+
+/**
+ * Rank 0: accepts the world_size - 1 other ranks on the socket, checks their hello (distinct ranks, same sizes) and
+ * answers every one of them with 1 if the group is consistent, 0 otherwise. The segment exists before anyone is accepted.
+ * Returns 0 if any error.
+ */
+int _process_group_rendezvous_root(ProcessGroup* pg, const char* socket_path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {printf("Could not create the rendezvous socket\n"); return 0;}
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    unlink(socket_path);    /* Left by a run that died before its rendezvous completed */
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, pg->world_size) != 0) {
+        printf("Could not listen on %s\n", socket_path);
+        close(listener);
+        return 0;
+    }
+
+    int* peers = (int*) malloc(pg->world_size * sizeof(int));
+    char* seen = (char*) calloc(pg->world_size, 1);
+    int n_peers = 0;
+    int ok = peers && seen;
+    if (!ok) printf("Malloc failed for the rendezvous\n");
+
+    double deadline = _process_group_now() + PROCESS_GROUP_TIMEOUT;
+    while (ok && n_peers < pg->world_size - 1) {
+        struct pollfd pfd = {listener, POLLIN, 0};
+        int left_ms = (int)((deadline - _process_group_now()) * 1000.0);
+        if (left_ms <= 0 || poll(&pfd, 1, left_ms) <= 0) {printf("Only %d of %d ranks joined the process group\n", n_peers + 1, pg->world_size); ok = 0; break;}
+
+        int peer = accept(listener, NULL, NULL);
+        if (peer < 0) continue;
+        peers[n_peers++] = peer;
+
+        /* The hello must come by the same deadline, a peer that connects and stays silent cannot hold the rendezvous */
+        ProcessGroupHello hello;
+        struct timeval left = {left_ms / 1000, (left_ms % 1000) * 1000};
+        setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &left, sizeof(left));
+        if (recv(peer, &hello, sizeof(hello), MSG_WAITALL) != (ssize_t)sizeof(hello) || hello.magic != PROCESS_GROUP_MAGIC) {
+            printf("Bad hello on the rendezvous socket\n");
+            ok = 0;
+        } else if (hello.world_size != (uint32_t)pg->world_size || hello.n_floats != pg->n_floats) {
+            printf("Rank %u disagrees on the group (world size %u, %llu floats, expected %d and %zu)\n",
+                   hello.rank, hello.world_size, (unsigned long long)hello.n_floats, pg->world_size, pg->n_floats);
+            ok = 0;
+        } else if (hello.rank == 0 || hello.rank >= (uint32_t)pg->world_size || seen[hello.rank]) {
+            printf("Rank %u joined twice or is out of range\n", hello.rank);
+            ok = 0;
+        } else {
+            seen[hello.rank] = 1;
+        }
+    }
+
+    /* Everyone connected so far learns the outcome, a rank that got 0 gives up instead of waiting in the first barrier */
+    char answer = ok ? 1 : 0;
+    for (int i = 0; i < n_peers; i++) {
+        if (send(peers[i], &answer, 1, MSG_NOSIGNAL) != 1) ok = 0;
+        close(peers[i]);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    free(peers);
+    free(seen);
+
+    return ok;
+}
+
+
+
+/**
+ * Ranks other than 0: connects to the socket of rank 0 (retrying until it is up), sends its hello and waits for the answer.
+ * Returns 0 if any error.
+ */
+int _process_group_rendezvous_join(ProcessGroup* pg, const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    double deadline = _process_group_now() + PROCESS_GROUP_TIMEOUT;
+    int fd = -1;
+    while (fd < 0) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {printf("Could not create a socket\n"); return 0;}
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) break;
+
+        close(fd);
+        fd = -1;
+        if (_process_group_now() > deadline) {printf("Rank 0 of the process group never came up on %s\n", socket_path); return 0;}
+        usleep(10000);
+    }
+
+    ProcessGroupHello hello = {PROCESS_GROUP_MAGIC, (uint32_t)pg->rank, (uint32_t)pg->world_size, 0, pg->n_floats};
+    char answer = 0;
+    int ok = send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) == (ssize_t)sizeof(hello);
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ok = ok && poll(&pfd, 1, PROCESS_GROUP_TIMEOUT * 1000) == 1 && recv(fd, &answer, 1, MSG_WAITALL) == 1;
+    close(fd);
+
+    if (!ok || answer != 1) {printf("Rank %d was refused by the process group\n", pg->rank); return 0;}
+    return 1;
+}
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Joins (creates, for rank 0) the group called name. Every process of the group calls it with its own rank and the
+ * same world_size and n_floats. Rank 0 creates the shared segment, then accepts the others on a local socket and
+ * checks that the ranks are distinct and agree on the sizes. The call returns once every rank has mapped the segment.
+ * The segment and socket are unlinked once everyone is in, so nothing is left behind if a process dies.
+ * Returns NULL if any error (a rank missing after PROCESS_GROUP_TIMEOUT seconds included).
+ *
+ * @param name Name of the group, shared by its processes (letters, digits, '-' and '_').
+ * @param rank Rank of the calling process (0 to world_size - 1).
+ * @param world_size Number of processes in the group.
+ * @param n_floats Size of the buffer of every rank.
+*/
+ProcessGroup* create_process_group(const char* name, int rank, int world_size, size_t n_floats) {
+    if (!name || world_size <= 0 || rank < 0 || rank >= world_size || n_floats == 0) {
+        if (!name) printf("The name passed is NULL\n");
+        if (world_size <= 0) printf("World size needs to be a non zero positive integer\n");
+        else if (rank < 0 || rank >= world_size) printf("Rank %d is not in [0, %d)\n", rank, world_size);
+        if (n_floats == 0) printf("The buffers of a process group cannot be empty\n");
+        return NULL;
+    }
+
+    char socket_path[108];
+    char shm_name[256];
+    if (!_process_group_names(name, socket_path, sizeof(socket_path), shm_name, sizeof(shm_name))) {printf("Invalid process group name '%s'\n", name); return NULL;}
+
+    ProcessGroup* pg = (ProcessGroup*) calloc(1, sizeof(ProcessGroup));
+    if (!pg) {printf("Malloc failed for process group\n"); return NULL;}
+
+    size_t per_buffer = PROCESS_GROUP_ALIGNMENT / sizeof(float);
+    pg->rank = rank;
+    pg->world_size = world_size;
+    pg->n_floats = n_floats;
+    pg->buffer_stride = (n_floats + per_buffer - 1) / per_buffer * per_buffer;
+    pg->mapping_size = PROCESS_GROUP_ALIGNMENT + (size_t)world_size * pg->buffer_stride * sizeof(float);
+
+    int ok = 1;
+    if (rank == 0) {
+        /* The segment is ready before anyone can join, so a rank that was accepted can always open it */
+        shm_unlink(shm_name);
+        int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        ok = fd >= 0 && ftruncate(fd, (off_t)pg->mapping_size) == 0 && _process_group_map(pg, fd);
+        if (fd >= 0) close(fd);
+        if (!ok) printf("Could not create the shared segment %s\n", shm_name);
+
+        if (ok) {
+            atomic_init(&pg->shared->arrived, 0);
+            atomic_init(&pg->shared->generation, 0);
+            atomic_init(&pg->shared->failed, 0);
+        }
+
+        if (world_size > 1) ok = ok && _process_group_rendezvous_root(pg, socket_path);
+    } else {
+        ok = _process_group_rendezvous_join(pg, socket_path);
+
+        if (ok) {
+            int fd = shm_open(shm_name, O_RDWR, 0600);
+            struct stat st;
+            ok = fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size == pg->mapping_size && _process_group_map(pg, fd);
+            if (fd >= 0) close(fd);
+            if (!ok) printf("Could not map the shared segment %s\n", shm_name);
+        }
+    }
+
+    /* Once everyone has it mapped, the name is no longer needed */
+    ok = ok && process_group_barrier(pg);
+    if (rank == 0) shm_unlink(shm_name);
+
+    if (!ok) {free_process_group(&pg); return NULL;}
+    return pg;
+}
+
+
+
+/**
+ * Unmaps the shared segment and completely frees the group (the other ranks keep their own mapping).
+*/
+void free_process_group(ProcessGroup** pg) {
+    if (pg && *pg) {
+        if ((*pg)->mapping) munmap((*pg)->mapping, (*pg)->mapping_size);
+
+        free(*pg);
+        *pg = NULL;
+    }
+}
+
+
+
+// ==========================================
+//             Collectives
+// ==========================================
+
+/**
+ * Returns the buffer of the calling rank, which it fills before a collective and reads the result from after.
+ *
+ * @param pg The group.
+*/
+float* process_group_buffer(const ProcessGroup* pg) {
+    if (!pg) return NULL;
+    return pg->buffers + (size_t)pg->rank * pg->buffer_stride;
+}
+
+
+
+/**
+ * Waits until every rank of the group has called it.
+ * Returns 0 if a rank did not come within PROCESS_GROUP_TIMEOUT seconds (or another rank gave up).
+ *
+ * @param pg The group.
+*/
+int process_group_barrier(ProcessGroup* pg) {
+    if (!pg || !pg->shared) return 0;
+    if (pg->world_size == 1) return 1;
+
+    ProcessGroupShared* sh = pg->shared;
+    unsigned generation = atomic_load(&sh->generation);
+
+    /* The last one in resets the count and releases the others by moving to the next generation */
+    if (atomic_fetch_add(&sh->arrived, 1) == (unsigned)pg->world_size - 1) {
+        atomic_store(&sh->arrived, 0);
+        atomic_fetch_add(&sh->generation, 1);
+        return !atomic_load(&sh->failed);
+    }
+
+    double deadline = 0.0;
+    for (long spins = 0; atomic_load(&sh->generation) == generation; spins++) {
+        if (atomic_load(&sh->failed)) return 0;
+        if (spins < 1000) continue;
+
+        /* The other ranks are behind (or on the same cores), stop burning the CPU they need */
+        sched_yield();
+        if ((spins & 1023) == 0) {
+            double now = _process_group_now();
+            if (deadline == 0.0) deadline = now + PROCESS_GROUP_TIMEOUT;
+            else if (now > deadline) {
+                printf("Rank %d waited %d s for the other ranks, giving up\n", pg->rank, PROCESS_GROUP_TIMEOUT);
+                atomic_store(&sh->failed, 1);
+                return 0;
+            }
+        }
+    }
+
+    return !atomic_load(&sh->failed);
+}
+
+
+
+/**
+ * Gives the range of floats of a chunk of the ring all-reduce (world_size chunks of nearly equal size).
+ */
+void _process_group_chunk(const ProcessGroup* pg, int chunk, size_t* first, size_t* count) {
+    size_t begin = pg->n_floats * (size_t)chunk / pg->world_size;
+    size_t end = pg->n_floats * (size_t)(chunk + 1) / pg->world_size;
+    *first = begin;
+    *count = end - begin;
+}
+
+
+
+/**
+ * Replaces the buffer of every rank with the sum of the buffers of all the ranks. Ring all-reduce: the buffers are cut
+ * into world_size chunks; in world_size - 1 steps every rank adds the chunk its left neighbour holds into its own
+ * (reduce-scatter), then in world_size - 1 more steps the summed chunks go round the ring (all-gather). Every rank
+ * reads and writes 2 * (world_size - 1) / world_size buffers whatever the number of ranks.
+ * Every rank must call it. Returns 0 if any error.
+ *
+ * @param pg The group.
+*/
+int process_group_allreduce(ProcessGroup* pg) {
+    if (!pg) {printf("The process group passed is NULL\n"); return 0;}
+    if (pg->world_size == 1) return 1;
+
+    int n = pg->world_size;
+    int left = (pg->rank + n - 1) % n;
+    float* own = process_group_buffer(pg);
+    const float* from = pg->buffers + (size_t)left * pg->buffer_stride;
+    const SimdKernels* k = simd_kernels();
+
+    if (!process_group_barrier(pg)) return 0;    /* Every buffer is filled */
+
+    /* Step s: add chunk rank - s - 1 of the left neighbour, which holds the sum of s + 1 ranks for it.
+       The neighbour is meanwhile writing its chunk rank - s - 2, never the one read */
+    for (int s = 0; s < n - 1; s++) {
+        size_t first, count;
+        _process_group_chunk(pg, (pg->rank - s - 1 + 2 * n) % n, &first, &count);
+        k->add(own + first, own + first, from + first, (int)count);
+        if (!process_group_barrier(pg)) return 0;
+    }
+
+    /* Rank r now holds the complete sum of chunk r + 1. Step s: copy chunk rank - s, complete on the left neighbour */
+    for (int s = 0; s < n - 1; s++) {
+        size_t first, count;
+        _process_group_chunk(pg, (pg->rank - s + n) % n, &first, &count);
+        memcpy(own + first, from + first, count * sizeof(float));
+        if (!process_group_barrier(pg)) return 0;
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * Copies the buffer of rank root into the buffer of every other rank. Every rank must call it.
+ * Returns 0 if any error.
+ *
+ * @param pg The group.
+ * @param root Rank whose buffer is copied.
+*/
+int process_group_broadcast(ProcessGroup* pg, int root) {
+    if (!pg || root < 0 || root >= pg->world_size) {printf("Cannot broadcast from rank %d\n", root); return 0;}
+    if (pg->world_size == 1) return 1;
+
+    if (!process_group_barrier(pg)) return 0;    /* The root buffer is filled */
+    if (pg->rank != root) memcpy(process_group_buffer(pg), pg->buffers + (size_t)root * pg->buffer_stride, pg->n_floats * sizeof(float));
+    return process_group_barrier(pg);    /* Nobody overwrites the root buffer before every copy is done */
+}
\ No newline at end of file
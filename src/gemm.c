@@ -0,0 +1,638 @@
+#include "gemm.h"
+#include "threadpool.h"
+#include "simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+
+/* Register tile computed by the micro-kernel (MR rows x NR cols of C) */
+#define GEMM_MR     6
+#define GEMM_NR     16
+
+/* Used when the host does not report its cache sizes */
+#define DEFAULT_L1_SIZE     (32 * 1024)
+#define DEFAULT_L2_SIZE     (1024 * 1024)
+#define DEFAULT_L3_SIZE     (8 * 1024 * 1024)
+
+#define PACK_ALIGNMENT      64
+
+/* Below this many multiply-adds a product is not worth splitting over the thread pool */
+#define GEMM_PARALLEL_MIN_WORK      (64 * 64 * 64)
+
+
+
+typedef float v4f __attribute__((vector_size(16)));
+typedef float v8f __attribute__((vector_size(32)));
+typedef float v8f_unaligned __attribute__((vector_size(32), aligned(4)));
+typedef int v8i __attribute__((vector_size(32)));
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+/* Packing buffers of one thread */
+typedef struct GemmBuffers {
+    float* pack_a;                   // Packed block of A (MC x KC)
+    float* pack_b;                   // Packed block of B (KC x NC)
+    float* unpack;                   // One run of a 16-bit A widened to floats before it is packed (max(MC, KC))
+} GemmBuffers;
+
+/* One sub-matrix of C per task of a parallel gemm */
+typedef struct GemmJob {
+    storage_precision precision_a;
+    gemm_transpose trans_a, trans_b;
+    int M, N, K;
+    const void* A; int lda;
+    const float* B; int ldb;
+    float* C; int ldc;
+    const GemmEpilogue* epilogue;    // NULL for a plain product
+    int row_parts;                   // C is cut in row_parts x col_parts blocks
+    int col_parts;
+} GemmJob;
+
+static int gemm_kc = 0;              // Depth of a packed panel (B micro-panel of KC x NR stays in L1)
+static int gemm_mc = 0;              // Rows of a packed A block (MC x KC stays in L2)
+static int gemm_nc = 0;              // Cols of a packed B block (KC x NC stays in L3)
+
+/* Micro-kernel compiled for the widest instruction set of the host, picked with the blocking */
+static void (*gemm_micro_kernel)(int kc, const float* a, const float* b, float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue) = NULL;
+
+static pthread_once_t gemm_once = PTHREAD_ONCE_INIT;
+static pthread_key_t gemm_buffers_key;
+
+void _gemm_init_blocking();
+void _gemm_free_buffers(void* buffers);
+GemmBuffers* _gemm_get_buffers();
+int _gemm_round_down(int value, int multiple);
+size_t _gemm_index(int ld, gemm_transpose trans, int row, int col);
+const float* _gemm_element(const float* X, int ld, gemm_transpose trans, int row, int col);
+const void* _gemm_element_a(const void* A, storage_precision precision, int lda, gemm_transpose trans, int row, int col);
+void _gemm_serial(storage_precision precision_a, gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const void* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue* epilogue);
+GemmEpilogue _gemm_offset_epilogue(const GemmEpilogue* epilogue, int row, int col);
+void _gemm_parallel_block(int begin, int end, void* arg);
+void _gemm_pack_a(gemm_transpose trans, int mc, int kc, const float* A, int lda, float* packed);
+void _gemm_pack_a_half(storage_precision precision, gemm_transpose trans, int mc, int kc, const uint16_t* A, int lda, float* packed, float* unpack);
+void _gemm_pack_b(gemm_transpose trans, int kc, int nc, const float* B, int ldb, float* packed);
+void _gemm_store_tile(float tile[GEMM_MR][GEMM_NR], float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue);
+void _gemm_micro_kernel_generic(int kc, const float* a, const float* b, float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue);
+#if SIMD_X86
+void _gemm_micro_kernel_avx2(int kc, const float* a, const float* b, float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue);
+#endif
+float _gemm_activate_scalar(float x, activation_function act);
+
+
+
+/**
+ * Rounds value down to a multiple of multiple (never below multiple).
+ */
+int _gemm_round_down(int value, int multiple) {
+    int res = (value / multiple) * multiple;
+    return (res < multiple) ? multiple : res;
+}
+
+
+
+/**
+ * Sizes KC, MC and NC from the cache sizes of the host and picks the micro-kernel for its instruction set.
+ * Runs once, on the first call to gemm.
+ *
+ * KC: one NR wide micro-panel of B plus one MR tall micro-panel of A fill about half of L1.
+ * MC: the packed block of A fills about half of L2.
+ * NC: the packed block of B fills about half of L3.
+ */
+void _gemm_init_blocking() {
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l1 <= 0) l1 = DEFAULT_L1_SIZE;
+    if (l2 <= 0) l2 = DEFAULT_L2_SIZE;
+    if (l3 <= 0) l3 = DEFAULT_L3_SIZE;
+
+    gemm_kc = _gemm_round_down((int)(l1 / 2 / ((GEMM_MR + GEMM_NR) * sizeof(float))), 8);
+    gemm_mc = _gemm_round_down((int)(l2 / 2 / (gemm_kc * sizeof(float))), GEMM_MR);
+    gemm_nc = _gemm_round_down((int)(l3 / 2 / (gemm_kc * sizeof(float))), GEMM_NR);
+
+    /* A huge NC only wastes memory for the layer sizes this library deals with */
+    if (gemm_nc > 4096) gemm_nc = 4096;
+
+    gemm_micro_kernel = _gemm_micro_kernel_generic;
+#if SIMD_X86
+    /* The tile lives in ymm registers, so AVX-512 hosts run the AVX2 copy too (AVX-512F alone does not give
+       the 32 ymm registers, that needs AVX-512VL, which some AVX-512 CPUs lack) */
+    if (simd_get_level() >= SIMD_AVX2) gemm_micro_kernel = _gemm_micro_kernel_avx2;
+#endif
+
+    /* Every thread packs into its own buffers, they are freed when the thread exits */
+    pthread_key_create(&gemm_buffers_key, _gemm_free_buffers);
+}
+
+
+
+/**
+ * Destructor of the packing buffers of a thread.
+ */
+void _gemm_free_buffers(void* buffers) {
+    GemmBuffers* b = (GemmBuffers*) buffers;
+    if (b) {
+        free(b->pack_a);
+        free(b->pack_b);
+        free(b->unpack);
+        free(b);
+    }
+}
+
+
+
+/**
+ * Returns the packing buffers of the calling thread, allocating them on its first gemm.
+ * Returns NULL if any error.
+ */
+GemmBuffers* _gemm_get_buffers() {
+    GemmBuffers* b = (GemmBuffers*) pthread_getspecific(gemm_buffers_key);
+    if (b) return b;
+
+    b = (GemmBuffers*) malloc(sizeof(GemmBuffers));
+    if (!b) {printf("Malloc failed for gemm packing buffers\n"); return NULL;}
+
+    b->pack_a = (float*) aligned_alloc(PACK_ALIGNMENT, (size_t)gemm_mc * gemm_kc * sizeof(float));
+    b->pack_b = (float*) aligned_alloc(PACK_ALIGNMENT, (size_t)gemm_kc * gemm_nc * sizeof(float));
+    b->unpack = (float*) aligned_alloc(PACK_ALIGNMENT, (size_t)((gemm_mc > gemm_kc) ? gemm_mc : gemm_kc) * sizeof(float));
+    if (!b->pack_a || !b->pack_b || !b->unpack) {
+        printf("Malloc failed for gemm packing buffers\n");
+        _gemm_free_buffers(b);
+        return NULL;
+    }
+
+    pthread_setspecific(gemm_buffers_key, b);
+    return b;
+}
+
+
+
+/**
+ * Returns the index of element (row, col) of op(X) in X as stored, where op(X) is X or X^T.
+ */
+size_t _gemm_index(int ld, gemm_transpose trans, int row, int col) {
+    return (trans == GEMM_TRANS) ? (size_t)col*ld + row : (size_t)row*ld + col;
+}
+
+
+
+/**
+ * Returns the address of element (row, col) of op(X), where op(X) is X or X^T.
+ */
+const float* _gemm_element(const float* X, int ld, gemm_transpose trans, int row, int col) {
+    return &X[_gemm_index(ld, trans, row, col)];
+}
+
+
+
+/**
+ * Same as _gemm_element for the A operand, whose values are floats or 16-bit floats depending on its precision.
+ */
+const void* _gemm_element_a(const void* A, storage_precision precision, int lda, gemm_transpose trans, int row, int col) {
+    if (precision == PRECISION_FP32) return (const float*)A + _gemm_index(lda, trans, row, col);
+    return (const uint16_t*)A + _gemm_index(lda, trans, row, col);
+}
+
+
+
+/**
+ * Packs an (mc x kc) block of op(A) into MR tall micro-panels.
+ * Inside a micro-panel the MR values of one column are contiguous, rows past mc are zero padded.
+ * For a transposed A those values are already contiguous in memory.
+ */
+void _gemm_pack_a(gemm_transpose trans, int mc, int kc, const float* A, int lda, float* packed) {
+    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+        int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+
+        for (int k = 0; k < kc; k++) {
+            if (trans == GEMM_TRANS) {
+                const float* col = &A[k*lda + ir];
+                for (int i = 0; i < mr; i++) packed[i] = col[i];
+            } else {
+                for (int i = 0; i < mr; i++) packed[i] = A[(ir + i)*lda + k];
+            }
+            for (int i = mr; i < GEMM_MR; i++) packed[i] = 0.0f;
+            packed += GEMM_MR;
+        }
+    }
+}
+
+
+
+/**
+ * Same as _gemm_pack_a for an A of 16-bit floats. Every run of contiguous values of A (a row of the block, or a column
+ * for a transposed A) is first widened to floats into unpack with one vectorised pass, then scattered into the
+ * micro-panels, so the micro-kernel only ever sees floats and A is read at half the bytes.
+ */
+void _gemm_pack_a_half(storage_precision precision, gemm_transpose trans, int mc, int kc, const uint16_t* A, int lda, float* packed, float* unpack) {
+    const SimdKernels* k = simd_kernels();
+    void (*widen)(float*, const uint16_t*, int) = (precision == PRECISION_FP16) ? k->from_fp16 : k->from_bf16;
+
+    /* Rows past mc of the last micro-panel are zero padded */
+    if (mc % GEMM_MR) {
+        float* last = &packed[(size_t)(mc / GEMM_MR) * kc * GEMM_MR];
+        for (int p = 0; p < kc; p++) for (int i = mc % GEMM_MR; i < GEMM_MR; i++) last[p*GEMM_MR + i] = 0.0f;
+    }
+
+    if (trans == GEMM_TRANS) {
+        for (int p = 0; p < kc; p++) {
+            widen(unpack, &A[(size_t)p*lda], mc);
+            for (int i = 0; i < mc; i++) packed[(size_t)(i / GEMM_MR) * kc * GEMM_MR + p*GEMM_MR + i % GEMM_MR] = unpack[i];
+        }
+        return;
+    }
+
+    for (int i = 0; i < mc; i++) {
+        widen(unpack, &A[(size_t)i*lda], kc);
+        float* dst = &packed[(size_t)(i / GEMM_MR) * kc * GEMM_MR + i % GEMM_MR];
+        for (int p = 0; p < kc; p++) dst[p*GEMM_MR] = unpack[p];
+    }
+}
+
+
+
+/**
+ * Packs a (kc x nc) block of op(B) into NR wide micro-panels.
+ * Inside a micro-panel the NR values of one row are contiguous, cols past nc are zero padded.
+ */
+void _gemm_pack_b(gemm_transpose trans, int kc, int nc, const float* B, int ldb, float* packed) {
+    for (int jr = 0; jr < nc; jr += GEMM_NR) {
+        int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+        if (trans == GEMM_TRANS) {
+            /* Walk each row of B (a column of op(B)) sequentially, scattering with a stride of NR */
+            for (int j = 0; j < nr; j++) {
+                const float* row = &B[(jr + j)*ldb];
+                for (int k = 0; k < kc; k++) packed[k*GEMM_NR + j] = row[k];
+            }
+            for (int j = nr; j < GEMM_NR; j++) for (int k = 0; k < kc; k++) packed[k*GEMM_NR + j] = 0.0f;
+            packed += kc * GEMM_NR;
+            continue;
+        }
+
+        for (int k = 0; k < kc; k++) {
+            const float* row = &B[k*ldb + jr];
+            for (int j = 0; j < nr; j++) packed[j] = row[j];
+            for (int j = nr; j < GEMM_NR; j++) packed[j] = 0.0f;
+            packed += GEMM_NR;
+        }
+    }
+}
+
+
+
+/**
+ * Applies the activation of an epilogue to a vector of 8 values in place (only element wise activations are supported).
+ * Always inlined: it is part of the micro-kernel body and must be compiled for the instruction set of each copy
+ * (taking the vector by pointer also keeps 32-byte vectors out of the baseline calling convention).
+ */
+static inline __attribute__((always_inline)) void _gemm_activate(v8f* v, activation_function act) {
+    if (act == RELU) {
+        v8i positive = *v > (v8f){0};
+        *v = (v8f)((positive & (v8i)*v) | (~positive & (v8i)(*v * RELU_NEGATIVE_SLOPE)));
+    }
+}
+
+
+
+/**
+ * Scalar version of _gemm_activate, for edge tiles.
+ */
+float _gemm_activate_scalar(float x, activation_function act) {
+    if (act == RELU) return (x > 0.0f) ? x : RELU_NEGATIVE_SLOPE * x;
+
+    return x;
+}
+
+
+
+/**
+ * Computes one (MR x NR) tile of C from a packed micro-panel of A and of B.
+ * The whole tile is held in vector registers for the kc rank-1 updates and written back once.
+ * Only the top left (mr x nr) part is stored, it is added to C if accumulate is set and overwrites it otherwise.
+ * On the last KC slice the epilogue (already offset to this tile, NULL for none) is applied before the store:
+ * bias added, pre-activation values written to z, activation applied.
+ *
+ * Written once with vector extensions and always inlined into one copy per instruction set (see below).
+ */
+static inline __attribute__((always_inline)) void _gemm_micro_kernel_body(int kc, const float* a, const float* b, float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue) {
+    v8f acc[GEMM_MR][2];
+    for (int i = 0; i < GEMM_MR; i++) {
+        acc[i][0] = (v8f){0};
+        acc[i][1] = (v8f){0};
+    }
+
+    for (int k = 0; k < kc; k++) {
+        v8f b0 = *(const v8f*)(b);
+        v8f b1 = *(const v8f*)(b + 8);
+
+        for (int i = 0; i < GEMM_MR; i++) {
+            float x = a[i];
+            v8f ai = {x, x, x, x, x, x, x, x};
+            acc[i][0] += ai * b0;
+            acc[i][1] += ai * b1;
+        }
+
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    if (mr == GEMM_MR && nr == GEMM_NR) {
+        v8f bias0 = {0}, bias1 = {0};
+        if (epilogue && epilogue->bias) {
+            bias0 = *(const v8f_unaligned*)(epilogue->bias);
+            bias1 = *(const v8f_unaligned*)(epilogue->bias + 8);
+        }
+
+        for (int i = 0; i < GEMM_MR; i++) {
+            v8f_unaligned* c_row = (v8f_unaligned*)(&C[i*ldc]);
+            v8f v0 = acc[i][0];
+            v8f v1 = acc[i][1];
+            if (accumulate) {
+                v0 += c_row[0];
+                v1 += c_row[1];
+            }
+
+            if (epilogue) {
+                v0 += bias0;
+                v1 += bias1;
+                if (epilogue->z) {
+                    v8f_unaligned* z_row = (v8f_unaligned*)(&epilogue->z[i*epilogue->ldz]);
+                    z_row[0] = v0;
+                    z_row[1] = v1;
+                }
+                _gemm_activate(&v0, epilogue->act);
+                _gemm_activate(&v1, epilogue->act);
+            }
+
+            c_row[0] = v0;
+            c_row[1] = v1;
+        }
+        return;
+    }
+
+    /* Edge tile: go through memory so only the valid part of C is touched */
+    float tile[GEMM_MR][GEMM_NR] __attribute__((aligned(PACK_ALIGNMENT)));
+    for (int i = 0; i < GEMM_MR; i++) {
+        *(v8f*)(&tile[i][0]) = acc[i][0];
+        *(v8f*)(&tile[i][8]) = acc[i][1];
+    }
+
+    _gemm_store_tile(tile, C, ldc, mr, nr, accumulate, epilogue);
+}
+
+
+
+/**
+ * Stores the top left (mr x nr) part of a tile computed in memory into C, one element at a time,
+ * adding to C if accumulate is set and applying the epilogue if not NULL.
+ */
+void _gemm_store_tile(float tile[GEMM_MR][GEMM_NR], float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue) {
+    for (int i = 0; i < mr; i++) for (int j = 0; j < nr; j++) {
+        float v = tile[i][j];
+        if (accumulate) v += C[i*ldc + j];
+
+        if (epilogue) {
+            if (epilogue->bias) v += epilogue->bias[j];
+            if (epilogue->z) epilogue->z[i*epilogue->ldz + j] = v;
+            v = _gemm_activate_scalar(v, epilogue->act);
+        }
+
+        C[i*ldc + j] = v;
+    }
+}
+
+
+
+/**
+ * Micro-kernel built for the baseline instruction set (SSE2 on x86-64, also fine for 128-bit NEON).
+ * 8-wide vectors do not fit there (the 12 accumulators would be split and spilled), so the tile is computed
+ * as two (MR x NR/2) halves of 4-wide vectors, each half keeping its 12 accumulators in registers.
+ * The result goes through memory and the epilogue is applied in scalar.
+ */
+void _gemm_micro_kernel_generic(int kc, const float* a, const float* b, float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue) {
+    float tile[GEMM_MR][GEMM_NR] __attribute__((aligned(PACK_ALIGNMENT)));
+
+    for (int half = 0; half < GEMM_NR; half += GEMM_NR / 2) {
+        v4f acc[GEMM_MR][2];
+        for (int i = 0; i < GEMM_MR; i++) {
+            acc[i][0] = (v4f){0};
+            acc[i][1] = (v4f){0};
+        }
+
+        const float* ap = a;
+        const float* bp = b + half;
+        for (int k = 0; k < kc; k++) {
+            v4f b0 = *(const v4f*)(bp);
+            v4f b1 = *(const v4f*)(bp + 4);
+
+            for (int i = 0; i < GEMM_MR; i++) {
+                float x = ap[i];
+                v4f ai = {x, x, x, x};
+                acc[i][0] += ai * b0;
+                acc[i][1] += ai * b1;
+            }
+
+            ap += GEMM_MR;
+            bp += GEMM_NR;
+        }
+
+        for (int i = 0; i < GEMM_MR; i++) {
+            *(v4f*)(&tile[i][half]) = acc[i][0];
+            *(v4f*)(&tile[i][half + 4]) = acc[i][1];
+        }
+    }
+
+    _gemm_store_tile(tile, C, ldc, mr, nr, accumulate, epilogue);
+}
+
+
+
+#if SIMD_X86
+
+/**
+ * Micro-kernel built for AVX2 + FMA: one ymm register per 8 values, the rank-1 updates become fused multiply-adds.
+ */
+__attribute__((target("avx2,fma"))) void _gemm_micro_kernel_avx2(int kc, const float* a, const float* b, float* C, int ldc, int mr, int nr, int accumulate, const GemmEpilogue* epilogue) {
+    _gemm_micro_kernel_body(kc, a, b, C, ldc, mr, nr, accumulate, epilogue);
+}
+
+#endif
+
+
+
+/**
+ * Returns a copy of the epilogue moved to the sub-matrix of C starting at (row, col).
+ */
+GemmEpilogue _gemm_offset_epilogue(const GemmEpilogue* epilogue, int row, int col) {
+    GemmEpilogue res = *epilogue;
+    if (res.bias) res.bias += col;
+    if (res.z) res.z += row * res.ldz + col;
+    return res;
+}
+
+
+
+/**
+ * Single threaded blocked product (see gemm_fused), using the packing buffers of the calling thread.
+ *
+ * Loop order (outer to inner): NC block of B, KC slice of K (B block packed), MC block of A (A block packed),
+ * NR micro-panel, MR micro-panel. The first KC slice overwrites C, the rest accumulate into it,
+ * the last one also runs the epilogue.
+ */
+void _gemm_serial(storage_precision precision_a, gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const void* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue* epilogue) {
+    GemmBuffers* buffers = _gemm_get_buffers();
+    if (!buffers) {printf("gemm has no packing buffers\n"); return;}
+
+    float* pack_a = buffers->pack_a;
+    float* pack_b = buffers->pack_b;
+
+    for (int jc = 0; jc < N; jc += gemm_nc) {
+        int nc = (N - jc < gemm_nc) ? N - jc : gemm_nc;
+
+        for (int pc = 0; pc < K; pc += gemm_kc) {
+            int kc = (K - pc < gemm_kc) ? K - pc : gemm_kc;
+
+            _gemm_pack_b(trans_b, kc, nc, _gemm_element(B, ldb, trans_b, pc, jc), ldb, pack_b);
+
+            for (int ic = 0; ic < M; ic += gemm_mc) {
+                int mc = (M - ic < gemm_mc) ? M - ic : gemm_mc;
+
+                const void* a_block = _gemm_element_a(A, precision_a, lda, trans_a, ic, pc);
+                if (precision_a == PRECISION_FP32) _gemm_pack_a(trans_a, mc, kc, (const float*) a_block, lda, pack_a);
+                else _gemm_pack_a_half(precision_a, trans_a, mc, kc, (const uint16_t*) a_block, lda, pack_a, buffers->unpack);
+
+                for (int jr = 0; jr < nc; jr += GEMM_NR) {
+                    int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+                    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+                        int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+
+                        float* c_tile = &C[(ic + ir)*ldc + jc + jr];
+
+                        if (epilogue && pc + kc == K) {
+                            GemmEpilogue tile_epilogue = _gemm_offset_epilogue(epilogue, ic + ir, jc + jr);
+                            gemm_micro_kernel(kc, &pack_a[ir*kc], &pack_b[jr*kc], c_tile, ldc, mr, nr, pc > 0, &tile_epilogue);
+                        } else {
+                            gemm_micro_kernel(kc, &pack_a[ir*kc], &pack_b[jr*kc], c_tile, ldc, mr, nr, pc > 0, NULL);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+/**
+ * Body of the parallel-for of gemm: computes the blocks [begin, end) of C.
+ * Block boundaries are multiples of MR (rows) and NR (cols) so no micro-tile is shared between two tasks.
+ */
+void _gemm_parallel_block(int begin, int end, void* arg) {
+    GemmJob* job = (GemmJob*) arg;
+
+    int row_tiles = (job->M + GEMM_MR - 1) / GEMM_MR;
+    int col_tiles = (job->N + GEMM_NR - 1) / GEMM_NR;
+
+    for (int block = begin; block < end; block++) {
+        int rb = block / job->col_parts;
+        int cb = block % job->col_parts;
+
+        int m0 = (row_tiles * rb / job->row_parts) * GEMM_MR;
+        int m1 = (row_tiles * (rb + 1) / job->row_parts) * GEMM_MR;
+        int n0 = (col_tiles * cb / job->col_parts) * GEMM_NR;
+        int n1 = (col_tiles * (cb + 1) / job->col_parts) * GEMM_NR;
+        if (m1 > job->M) m1 = job->M;
+        if (n1 > job->N) n1 = job->N;
+        if (m0 >= m1 || n0 >= n1) continue;
+
+        GemmEpilogue block_epilogue;
+        if (job->epilogue) block_epilogue = _gemm_offset_epilogue(job->epilogue, m0, n0);
+
+        _gemm_serial(job->precision_a, job->trans_a, job->trans_b, m1 - m0, n1 - n0, job->K,
+                     _gemm_element_a(job->A, job->precision_a, job->lda, job->trans_a, m0, 0), job->lda,
+                     _gemm_element(job->B, job->ldb, job->trans_b, 0, n0), job->ldb,
+                     &job->C[m0*job->ldc + n0], job->ldc, job->epilogue ? &block_epilogue : NULL);
+    }
+}
+
+
+
+// ==========================================
+//          General Matrix Multiply
+// ==========================================
+
+/**
+ * C = op(A) @ op(B) on raw row-major buffers, op(X) being X or X^T.
+ * op(A) is (M x K), op(B) is (K x N), C is (M x N). C is overwritten.
+ * Transposed operands are read in place by the packing routines, no transposed copy is made.
+ */
+void gemm(gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc) {
+    gemm_fused(trans_a, trans_b, M, N, K, A, lda, B, ldb, C, ldc, NULL);
+}
+
+
+
+/**
+ * Same as gemm, then the epilogue is applied to every tile of C while it is still in registers:
+ * C = act(op(A) @ op(B) + bias), with z receiving op(A) @ op(B) + bias if not NULL.
+ * With K <= 0 the product is zero and only the epilogue runs.
+ *
+ * Large products are cut into a grid of sub-matrices of C which are computed on the default thread pool.
+ * Columns are cut first, so that every task packs only its own part of B.
+ */
+void gemm_fused(gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue* epilogue) {
+    gemm_mixed(PRECISION_FP32, trans_a, trans_b, M, N, K, A, lda, B, ldb, C, ldc, epilogue);
+}
+
+
+
+/**
+ * Same as gemm_fused with A stored in floats or 16-bit floats (bf16 or fp16). A 16-bit A is widened to floats while its
+ * blocks are packed (one vectorised pass per run of values, O(M*K) work against the O(M*N*K) of the product), so every
+ * product and sum is done in float. Only the bytes of A read from memory are halved.
+ */
+void gemm_mixed(storage_precision precision_a, gemm_transpose trans_a, gemm_transpose trans_b, int M, int N, int K, const void* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue* epilogue) {
+    if (M <= 0 || N <= 0) return;
+
+    if (K <= 0) {
+        for (int i = 0; i < M; i++) for (int j = 0; j < N; j++) {
+            float v = 0.0f;
+            if (epilogue) {
+                if (epilogue->bias) v += epilogue->bias[j];
+                if (epilogue->z) epilogue->z[i*epilogue->ldz + j] = v;
+                v = _gemm_activate_scalar(v, epilogue->act);
+            }
+            C[i*ldc + j] = v;
+        }
+        return;
+    }
+
+    pthread_once(&gemm_once, _gemm_init_blocking);
+
+    ThreadPool* pool = get_default_threadpool();
+    if (!pool || pool->n_threads == 1 || (long)M * N * K < GEMM_PARALLEL_MIN_WORK) {
+        _gemm_serial(precision_a, trans_a, trans_b, M, N, K, A, lda, B, ldb, C, ldc, epilogue);
+        return;
+    }
+
+    int row_tiles = (M + GEMM_MR - 1) / GEMM_MR;
+    int col_tiles = (N + GEMM_NR - 1) / GEMM_NR;
+
+    GemmJob job = {precision_a, trans_a, trans_b, M, N, K, A, lda, B, ldb, C, ldc, epilogue, 1, 1};
+    job.col_parts = (col_tiles < pool->n_threads) ? col_tiles : pool->n_threads;
+    job.row_parts = (pool->n_threads + job.col_parts - 1) / job.col_parts;
+    if (job.row_parts > row_tiles) job.row_parts = row_tiles;
+
+    threadpool_parallel_for(pool, 0, job.row_parts * job.col_parts, 1, _gemm_parallel_block, &job);
+}
@@ -1,4 +1,5 @@
 #include "layer.h"
+#include "gemm.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -6,6 +7,15 @@
 
 
 
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+void _dense_forward(const Layer* layer, storage_precision precision, const void* input, int ld, Tensor* out, Tensor* z);
+Tensor* _dense_backward_half(Layer* layer, Tensor* output_gradient, Workspace* ws);
+
+
+
 // ==========================================
 //             Object Management
 // ==========================================
@@ -49,8 +59,11 @@ Layer* create_layer(int n_neurons, int prev_n_neurons, activation_function act_f
     
     new_layer->d_weights = NULL;
     new_layer->d_biases = NULL;
-    new_layer->input_transpose_cache = NULL;
+    new_layer->input_cache = NULL;
     new_layer->z_cache = NULL;
+    new_layer->output_cache = NULL;
+    new_layer->input_half = NULL;
+    new_layer->output_half = NULL;
 
     new_layer->activation = create_activation(act_func_name);
     if (!new_layer->activation) {
@@ -66,6 +79,52 @@ Layer* create_layer(int n_neurons, int prev_n_neurons, activation_function act_f
 
 
 
+/**
+ * Returns a new layer built around existing parameters (e.g. views into a loaded model file), which it takes ownership of.
+ * weights is (n_neurons_prev x n_neurons) and biases (1 x n_neurons), the shapes give the size of the layer.
+ * Returns NULL if any error (the tensors are not freed then).
+ * 
+ * @param weights Weights of the layer.
+ * @param biases Biases of the layer.
+ * @param func Name of the activation functions out of the available ones.
+*/
+Layer* create_layer_from_tensors(Tensor* weights, Tensor* biases, activation_function func) {
+    if (!weights || !biases) {
+        if (!weights) printf("weights tensor is NULL\n");
+        if (!biases) printf("biases tensor is NULL\n");
+        return NULL;
+    }
+
+    if (biases->rows != 1 || biases->cols != weights->cols) {printf("Shapes of weights (%d x %d) and biases (%d x %d) do not match\n", weights->rows, weights->cols, biases->rows, biases->cols); return NULL;}
+
+    Layer* new_layer = (Layer*) malloc(sizeof(Layer));
+    if (!new_layer) {printf("Malloc for new layer failed\n"); return NULL;}
+
+    new_layer->n_neurons = weights->cols;
+    new_layer->n_neurons_prev = weights->rows;
+    new_layer->weights = weights;
+    new_layer->biases = biases;
+
+    new_layer->d_weights = NULL;
+    new_layer->d_biases = NULL;
+    new_layer->input_cache = NULL;
+    new_layer->z_cache = NULL;
+    new_layer->output_cache = NULL;
+    new_layer->input_half = NULL;
+    new_layer->output_half = NULL;
+
+    new_layer->activation = create_activation(func);
+    if (!new_layer->activation) {
+        printf("Error in creating activation for the layer\n"); 
+        free(new_layer);
+        return NULL;
+    }
+
+    return new_layer;
+}
+
+
+
 /**
  * Completely frees the layer
  * 
@@ -78,8 +137,6 @@ void free_layer(Layer** layer) {
         if ((*layer)->d_weights) free_tensor(&((*layer)->d_weights));
         if ((*layer)->d_biases) free_tensor(&((*layer)->d_biases));
 
-        if ((*layer)->z_cache) free_tensor(&((*layer)->z_cache));
-        if ((*layer)->input_transpose_cache) free_tensor(&((*layer)->input_transpose_cache));
 
         if ((*layer)->activation) free_activation(&((*layer)->activation));
 
@@ -90,86 +147,282 @@ void free_layer(Layer** layer) {
 
 
 
+// ==========================================
+//             Dense Kernels
+// ==========================================
+
+/**
+ * out = act(X @ W + B), and z = X @ W + B if z is not NULL.
+ * RELU and LINEAR run in the store of the gemm (one pass over the output),
+ * the others are applied afterwards with forward_inplace.
+ * 
+ * @param layer The layer
+ * @param precision Storage of the input (floats, or 16-bit floats widened by the gemm)
+ * @param input The input values (out->rows x n_neurons_prev)
+ * @param ld Distance (in values) between two consecutive rows of the input
+ * @param out Destination of the activated output (batch_size x n_neurons)
+ * @param z Destination of the pre-activation (batch_size x n_neurons), NULL to not keep it
+*/
+void _dense_forward(const Layer* layer, storage_precision precision, const void* input, int ld, Tensor* out, Tensor* z) {
+    activation_function func = layer->activation->func;
+    int fused = (func == RELU || func == LINEAR);
+
+    GemmEpilogue epilogue = {layer->biases->data, z ? z->data : NULL, z ? z->stride : 0, fused ? func : LINEAR};
+    gemm_mixed(precision, GEMM_NO_TRANS, GEMM_NO_TRANS, out->rows, layer->n_neurons, layer->n_neurons_prev,
+               input, ld, layer->weights->data, layer->weights->stride, out->data, out->stride, &epilogue);
+
+    if (!fused) layer->activation->forward_inplace(out);    /* Activations the epilogue does not implement, one vectorised pass */
+}
+
+
+
 // ==========================================
 //          Training and Prediction
 // ==========================================
 
+/**
+ * Returns the number of workspace bytes one forward_pass and backward_pass of this layer take for a given batch size.
+ * Forward: Z and A (batch_size x n_neurons). Backward: dX (batch_size x n_neurons_prev), dZ overwrites the incoming gradient.
+ * 
+ * @param layer The layer
+ * @param batch_size Number of samples in the batch
+*/
+size_t layer_workspace_bytes(const Layer* layer, int batch_size) {
+    if (!layer || batch_size <= 0) return 0;
+
+    return 2 * workspace_tensor_bytes(batch_size, layer->n_neurons) + workspace_tensor_bytes(batch_size, layer->n_neurons_prev);
+}
+
+
+
+/**
+ * Returns the number of workspace bytes one forward_pass_half and backward_pass of this layer take for a given batch size.
+ * Forward: A in 16 bits (batch_size x n_neurons). Backward: a block of A widened to floats and its column sums, dX (batch_size x n_neurons_prev).
+ * 
+ * @param layer The layer
+ * @param batch_size Number of samples in the batch
+*/
+size_t layer_workspace_bytes_half(const Layer* layer, int batch_size) {
+    if (!layer || batch_size <= 0) return 0;
+
+    int block_rows = (batch_size < LAYER_HALF_BLOCK_ROWS) ? batch_size : LAYER_HALF_BLOCK_ROWS;
+    return workspace_half_tensor_bytes(batch_size, layer->n_neurons) + workspace_tensor_bytes(block_rows, layer->n_neurons)
+         + workspace_tensor_bytes(1, layer->n_neurons) + workspace_tensor_bytes(batch_size, layer->n_neurons_prev);
+}
+
+
+
 /**
  * Returns the output of the forward pass performed on the layer with a given input.
+ * Z and the output are allocated from ws (do not free them), they stay valid until ws is reset.
+ * The input is referenced by the layer for the backward pass, so it must stay alive until then.
  * Returns NULL if fails.
  * 
  * Z = X @ W + B
  * 
  * @param layer The layer on which the forward pass is performed
  * @param input The input tensor (batch_size x n_neurons_prev) on which the forward pass is performed
+ * @param ws The workspace holding the temporaries of the current step
 */
-Tensor* forward_pass(Layer* layer, Tensor* input) {
-    if (!layer || !input) {
+Tensor* forward_pass(Layer* layer, Tensor* input, Workspace* ws) {
+    if (!layer || !input || !ws) {
         if (!layer) printf("Layer is NULL\n");
         if (!input) printf("Input tensor is NULL\n");
+        if (!ws) printf("Workspace is NULL\n");
         return NULL;
     }
 
-    if (layer->input_transpose_cache) free_tensor(&(layer->input_transpose_cache));
-    Tensor* input_transpose = tensor_transpose(input);
-    if (!input_transpose) {printf("Transpose of input failed \n"); return NULL;}
-    layer->input_transpose_cache = input_transpose;
-    
+    if (input->cols != layer->n_neurons_prev) {printf("Input has %d cols, layer expects %d\n", input->cols, layer->n_neurons_prev); return NULL;}
 
-    Tensor* z = tensor_multiplication(input, layer->weights);
-    if (!z) {printf("Matrix multiplication failed\n"); return NULL;}
-    tensor_row_addition_inplace(z, layer->biases);
+    layer->input_cache = input;    /* dW = XT @ dZ reads X in place, no transposed copy */
+    layer->input_half = NULL;
+    layer->output_half = NULL;
 
-    if (layer->z_cache) free_tensor(&(layer->z_cache));
+    Tensor* z = workspace_tensor(ws, input->rows, layer->n_neurons);
+    if (!z) {printf("z could not be allocated\n"); return NULL;}
     layer->z_cache = z;
 
-    Tensor* res = tensor_deepcopy(z);
-    if (!res) {printf("Tensor deepcopy failed on a has failed\n"); return NULL;}
+    Tensor* res = workspace_tensor(ws, input->rows, layer->n_neurons);
+    if (!res) {printf("Output could not be allocated\n"); return NULL;}
+    layer->output_cache = res;
 
-    layer->activation->forward_inplace(res);    /* Apply activation function to the res tensor in place */
+    _dense_forward(layer, PRECISION_FP32, input->data, input->stride, res, z);
     
     return res;
 }
 
 
 
+/**
+ * Mixed precision forward pass: out = act(X @ W + B) computed in float, then rounded to 16 bits into a tensor allocated
+ * from ws, which is returned and kept for the backward pass. X is the float input or the 16-bit output of the previous
+ * layer, which the gemm reads as it is. Z is not kept, the derivative of every activation is computed from A
+ * (RELU only needs the sign of Z, which A has). out is free to be overwritten once the call returns.
+ * Returns NULL if fails.
+ * 
+ * @param layer The layer on which the forward pass is performed
+ * @param input The float input (batch_size x n_neurons_prev), must stay alive until the backward pass. NULL if input_half is given
+ * @param input_half The 16-bit input (batch_size x n_neurons_prev), NULL if input is given
+ * @param out Destination of the float output (batch_size x n_neurons)
+ * @param precision Storage of the cache (PRECISION_BF16 or PRECISION_FP16)
+ * @param ws The workspace holding the temporaries of the current step
+*/
+HalfTensor* forward_pass_half(Layer* layer, Tensor* input, const HalfTensor* input_half, Tensor* out, storage_precision precision, Workspace* ws) {
+    if (!layer || (!input == !input_half) || !out || !ws) {
+        if (!layer) printf("Layer is NULL\n");
+        if (!input == !input_half) printf("Exactly one of the float and the 16-bit input must be given\n");
+        if (!out) printf("Output tensor is NULL\n");
+        if (!ws) printf("Workspace is NULL\n");
+        return NULL;
+    }
+
+    int rows = input ? input->rows : input_half->rows;
+    int cols = input ? input->cols : input_half->cols;
+    if (cols != layer->n_neurons_prev) {printf("Input has %d cols, layer expects %d\n", cols, layer->n_neurons_prev); return NULL;}
+    if (out->rows != rows || out->cols != layer->n_neurons) {printf("Output is (%d x %d), expected (%d x %d)\n", out->rows, out->cols, rows, layer->n_neurons); return NULL;}
+
+    HalfTensor* res = workspace_half_tensor(ws, rows, layer->n_neurons, precision);
+    if (!res) {printf("Output could not be allocated\n"); return NULL;}
+
+    layer->input_cache = input;
+    layer->input_half = input_half;
+    layer->z_cache = NULL;
+    layer->output_cache = NULL;
+    layer->output_half = res;
+
+    if (input) _dense_forward(layer, PRECISION_FP32, input->data, input->stride, out, NULL);
+    else _dense_forward(layer, input_half->precision, input_half->data, input_half->stride, out, NULL);
+
+    tensor_to_half(res, out);
+
+    return res;
+}
+
+
+
+/**
+ * Forward pass for inference: out = act(X @ W + B) with no backward caches (Z is never stored) and the layer left untouched.
+ * Writes into a caller-provided tensor, so several threads can run the same layer at once.
+ * Returns 0 if any error.
+ * 
+ * @param layer The layer on which the forward pass is performed (read only)
+ * @param input The input tensor (batch_size x n_neurons_prev)
+ * @param out Destination of the output (batch_size x n_neurons), must not share memory with input
+*/
+int forward_pass_inference(const Layer* layer, const Tensor* input, Tensor* out) {
+    if (!layer || !input || !out) {
+        if (!layer) printf("Layer is NULL\n");
+        if (!input) printf("Input tensor is NULL\n");
+        if (!out) printf("Output tensor is NULL\n");
+        return 0;
+    }
+
+    if (input->cols != layer->n_neurons_prev) {printf("Input has %d cols, layer expects %d\n", input->cols, layer->n_neurons_prev); return 0;}
+    if (out->rows != input->rows || out->cols != layer->n_neurons) {
+        printf("Output is (%d x %d), expected (%d x %d)\n", out->rows, out->cols, input->rows, layer->n_neurons);
+        return 0;
+    }
+
+    _dense_forward(layer, PRECISION_FP32, input->data, input->stride, out, NULL);
+
+    return 1;
+}
+
+
+
 /**
  * Returns the gradient of output this layer so it can be used by the previous layer to perform it's backward pass.
+ * The returned gradient is allocated from ws (do not free it), it stays valid until ws is reset.
+ * output_gradient is overwritten with dZ (no separate act'(Z) or dZ tensor is built).
  *  
  * @param layer The layer on which the backward pass is performed
- * @param output_gradient The gradient tensor of output of this layer
+ * @param output_gradient The gradient tensor of output of this layer, overwritten
+ * @param ws The workspace holding the temporaries of the current step
 */
-Tensor* backward_pass(Layer* layer, Tensor* output_gradient) {
-    if (!layer || !output_gradient) {
+Tensor* backward_pass(Layer* layer, Tensor* output_gradient, Workspace* ws) {
+    if (!layer || !output_gradient || !ws) {
         if (!layer) printf("Layer is NULL\n");
         if (!output_gradient) printf("output_gradient tensor is NULL\n");
+        if (!ws) printf("Workspace is NULL\n");
         return NULL;
     }
     
-    if (!layer->z_cache) {printf("a_cache is NULL\n"); return NULL;}
-    Tensor* a_prime_z = layer->activation->backward(layer->z_cache);
-    if (!a_prime_z) {printf("a_prime_z could not be computed\n"); return NULL;}
-    Tensor* dz = tensor_multiplication_hadamard(output_gradient, a_prime_z); 
-    if (!dz) {printf("dz could not be computed\n"); return NULL;}
-
+    if (layer->output_half) return _dense_backward_half(layer, output_gradient, ws);
 
-    if (!layer->input_transpose_cache) {printf("input_transpose_cache is NULL\n"); return NULL;}
-    if (layer->d_weights) free_tensor(&(layer->d_weights));
-    layer->d_weights = tensor_multiplication(layer->input_transpose_cache, dz);
+    if (!layer->z_cache || !layer->output_cache) {printf("z_cache or output_cache is NULL\n"); return NULL;}
+    if (!layer->input_cache) {printf("input_cache is NULL\n"); return NULL;}
 
-    if (layer->d_biases) free_tensor(&(layer->d_biases));
-    layer->d_biases = tensor_add_cols(dz);
+    int batch_size = layer->z_cache->rows;
 
+    if (output_gradient->rows != batch_size || output_gradient->cols != layer->n_neurons) {
+        printf("output_gradient is (%d x %d), layer expects (%d x %d)\n", output_gradient->rows, output_gradient->cols, batch_size, layer->n_neurons);
+        return NULL;
+    }
 
-    Tensor* wt = tensor_transpose(layer->weights);
-    if (!wt) {printf("wt could not be computed\n"); return NULL;}
+    /* dZ = dA * act'(Z) and dB = column sums of dZ in one sweep, dZ overwrites dA */
+    if (!tensor_ensure_shape(&(layer->d_biases), 1, layer->n_neurons)) {printf("d_biases could not be allocated\n"); return NULL;}
+    if (!layer->activation->backward_inplace(output_gradient, layer->z_cache, layer->output_cache, layer->d_biases)) {printf("dz could not be computed\n"); return NULL;}
+    Tensor* dz = output_gradient;
 
-    Tensor* dx = tensor_multiplication(dz, wt);
-    if (!dx) {printf("dx could not be computed\n"); return NULL;}
+    /* Parameter gradients outlive the step (the optimiser reads them), so they stay in buffers of the layer */
+    if (!tensor_ensure_shape(&(layer->d_weights), layer->n_neurons_prev, layer->n_neurons)) {printf("d_weights could not be allocated\n"); return NULL;}
+    if (!tensor_multiplication_transposed_into(layer->d_weights, layer->input_cache, 1, dz, 0)) {printf("d_weights could not be computed\n"); return NULL;}    /* XT @ dZ */
 
-    free_tensor(&a_prime_z);
-    free_tensor(&dz);
-    free_tensor(&wt);
+    Tensor* dx = workspace_tensor(ws, batch_size, layer->n_neurons_prev);
+    if (!dx) {printf("dx could not be allocated\n"); return NULL;}
+    if (!tensor_multiplication_transposed_into(dx, dz, 0, layer->weights, 1)) {printf("dx could not be computed\n"); return NULL;}    /* dZ @ WT */
 
     return dx;
 }
+
+
+
+/**
+ * backward_pass from the caches of forward_pass_half. The 16-bit A is widened LAYER_HALF_BLOCK_ROWS rows at a time into a
+ * small float block from which dZ and the column sums of the block are computed, then dW = XT @ dZ reads a 16-bit X
+ * through the gemm. Every product and sum is done in float, only the caches are read at half the bytes.
+ */
+Tensor* _dense_backward_half(Layer* layer, Tensor* output_gradient, Workspace* ws) {
+    if (!layer->input_cache && !layer->input_half) {printf("input_cache and input_half are NULL\n"); return NULL;}
+
+    const HalfTensor* a_half = layer->output_half;
+    int batch_size = a_half->rows;
+
+    if (output_gradient->rows != batch_size || output_gradient->cols != layer->n_neurons) {
+        printf("output_gradient is (%d x %d), layer expects (%d x %d)\n", output_gradient->rows, output_gradient->cols, batch_size, layer->n_neurons);
+        return NULL;
+    }
+
+    if (!tensor_ensure_shape(&(layer->d_biases), 1, layer->n_neurons)) {printf("d_biases could not be allocated\n"); return NULL;}
+
+    int block_rows = (batch_size < LAYER_HALF_BLOCK_ROWS) ? batch_size : LAYER_HALF_BLOCK_ROWS;
+    Tensor* a_block = workspace_tensor(ws, block_rows, layer->n_neurons);
+    Tensor* block_sums = workspace_tensor(ws, 1, layer->n_neurons);
+    if (!a_block || !block_sums) {printf("Backward buffers could not be allocated\n"); return NULL;}
+
+    /* dZ = dA * act'(A) over blocks of rows, dZ overwrites dA; the first block writes dB and the others add to it */
+    for (int first = 0; first < batch_size; first += block_rows) {
+        int rows = (batch_size - first < block_rows) ? batch_size - first : block_rows;
+        HalfTensor a_rows = {a_half->data + (size_t)first * a_half->stride, rows, a_half->cols, a_half->stride, a_half->precision};
+        Tensor a = {a_block->data, rows, layer->n_neurons, layer->n_neurons, 0};
+        Tensor grad = tensor_slice_rows(output_gradient, first, rows);
+
+        if (layer->activation->func != LINEAR) tensor_from_half(&a, &a_rows);
+        Tensor* sums = (first == 0) ? layer->d_biases : block_sums;
+        if (!layer->activation->backward_inplace(&grad, &a, &a, sums)) {printf("dz could not be computed\n"); return NULL;}
+        if (first > 0) tensor_addition_inplace(layer->d_biases, block_sums);
+    }
+    Tensor* dz = output_gradient;
+
+    if (!tensor_ensure_shape(&(layer->d_weights), layer->n_neurons_prev, layer->n_neurons)) {printf("d_weights could not be allocated\n"); return NULL;}
+    if (layer->input_half) {
+        gemm_mixed(layer->input_half->precision, GEMM_TRANS, GEMM_NO_TRANS, layer->n_neurons_prev, layer->n_neurons, batch_size,
+                   layer->input_half->data, layer->input_half->stride, dz->data, dz->stride, layer->d_weights->data, layer->d_weights->stride, NULL);    /* XT @ dZ */
+    } else if (!tensor_multiplication_transposed_into(layer->d_weights, layer->input_cache, 1, dz, 0)) {printf("d_weights could not be computed\n"); return NULL;}
+
+    Tensor* dx = workspace_tensor(ws, batch_size, layer->n_neurons_prev);
+    if (!dx) {printf("dx could not be allocated\n"); return NULL;}
+    if (!tensor_multiplication_transposed_into(dx, dz, 0, layer->weights, 1)) {printf("dx could not be computed\n"); return NULL;}    /* dZ @ WT */
+
+    return dx;
+}
\ No newline at end of file
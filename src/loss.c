@@ -9,7 +9,7 @@
 // ==========================================
 
 float _mse_loss(Tensor* pred, Tensor* target);
-Tensor* _mse_derivative(Tensor* pred, Tensor* target);
+int _mse_derivative(Tensor* out, Tensor* pred, Tensor* target);
 
 
 
@@ -89,7 +89,7 @@ float _mse_loss(Tensor* pred, Tensor* target) {
     float error = 0.0f;
     
     for (int input = 0; input < pred->rows; input++) for (int output_feature = 0; output_feature < pred->cols; output_feature++) {
-        error += (target->data[input*target->cols + output_feature] - pred->data[input*pred->cols + output_feature])*(target->data[input*target->cols + output_feature] - pred->data[input*pred->cols + output_feature]);
+        error += (target->data[input*target->stride + output_feature] - pred->data[input*pred->stride + output_feature])*(target->data[input*target->stride + output_feature] - pred->data[input*pred->stride + output_feature]);
     }
 
     return error / (float)(pred->cols * pred->rows);
@@ -98,33 +98,33 @@ float _mse_loss(Tensor* pred, Tensor* target) {
 
 
 /**
- * Return gradient tensor of the mse loss wrt output of the last layer.
- * Returns NULL in case of any error.
+ * Writes the gradient of the mse loss wrt output of the last layer into out.
+ * Returns 0 in case of any error.
  * 
+ * @param out Destination of the gradient (same shape as pred)
  * @param pred The tensor predidcted by the model
  * @param target What the data indicates
 */
-Tensor* _mse_derivative(Tensor* pred, Tensor* target) {
-    if (!pred || !target) {
+int _mse_derivative(Tensor* out, Tensor* pred, Tensor* target) {
+    if (!out || !pred || !target) {
+        if (!out) printf("out is NULL"); 
         if (!pred) printf("pred is NULL"); 
         if (!target) printf("target is NULL");
-        return NULL;
+        return 0;
     }
 
-    if (pred->cols != target->cols || pred->rows != target->rows) {
+    if (pred->cols != target->cols || pred->rows != target->rows || out->cols != pred->cols || out->rows != pred->rows) {
         if (pred->cols != target->cols) printf("Mismatch between cols of pred and target\n");
         if (pred->rows != target->rows) printf("Mismatch between rows of pred and target\n");
-        return NULL;
+        if (out->cols != pred->cols || out->rows != pred->rows) printf("Mismatch between shape of out and pred\n");
+        return 0;
     }
 
-    Tensor* res = tensor_deepcopy(pred);
-    if (!res) {printf("Tensor deepcopy failed in _mse_derivative"); return NULL;}
-
     float factor = 2.0f / (float)(pred->cols * pred->rows);
     
     for (int input = 0; input < pred->rows; input++) for (int output_feature = 0; output_feature < pred->cols; output_feature++) {
-        res->data[input*pred->cols + output_feature] = factor*(pred->data[input*pred->cols + output_feature] - target->data[input*target->cols + output_feature]);
+        out->data[input*out->stride + output_feature] = factor*(pred->data[input*pred->stride + output_feature] - target->data[input*target->stride + output_feature]);
     }
 
-    return res;
+    return 1;
 }
\ No newline at end of file
@@ -1,11 +1,137 @@
 #include "network.h"
+#include "network_internal.h"
+#include "simd.h"
+#include "threadpool.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define INITIAL_NETWORK_SIZE        4
 #define NETWORK_SIZE_MULTIPLIER     1.5
 
+/* Floats of the gradient slabs one task of the data-parallel reduction adds */
+#define NETWORK_REDUCE_GRAIN        (1 << 15)
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+int _network_prepare_workspace(Network* net, Workspace** ws, int batch_size);
+Layer* _network_replica_layer(Network* net, int replica, int layer_idx);
+Workspace** _network_replica_workspace(Network* net, int replica);
+Tensor* _network_forward(Network* net, int replica, Tensor* input);
+int _network_prepare_replicas(Network* net);
+float* _network_replica_gradients(Network* net, int replica);
+void _network_free_replicas(Network* net);
+int _network_parallel_step(Network* net, Tensor* x_batch, Tensor* y_batch, float* loss);
+void _network_replica_steps(int begin, int end, void* arg);
+void _network_reduce_pairs(int begin, int end, void* arg);
+int _network_hogwild_epoch(Network* net, Tensor* *x_train, Tensor* *y_train, DataLoader* loader, int number_of_batches);
+void _network_hogwild_workers(int begin, int end, void* arg);
+int _network_allreduce_gradients(Network* net, float* loss);
+int _network_inference_width(const Network* net);
+int _network_infer(const Network* net, const Tensor* input, float* ping, float* pong, Tensor* out);
+int _argmax_row(const float* row, int n);
+int _network_append_layer(Network* net, Layer* layer);
+size_t _network_slab_align(size_t n_floats);
+float* _network_slab_alloc(size_t n_floats);
+void _network_bind_view(Tensor* tensor, float* data);
+int _network_build_slabs(Network* net, float* mapped);
+size_t _model_align(size_t offset);
+size_t _model_image(const Network* net, int with_state, char* image);
+int _network_checkpoint(Network* net);
+Network* _network_load(const char* path, int with_state);
+int _network_train(Network* net, Tensor* *x_train, Tensor* *y_train, DataLoader* loader, int number_of_batches, int epochs);
+void _network_evaluate_batches(int begin, int end, void* arg);
+
+/* Fixed size header at the start of a model file (fields in the byte order of the host that wrote it, see byte_order) */
+typedef struct ModelFileHeader {
+    char magic[8];                      // MODEL_FILE_MAGIC
+    uint32_t version;                   // MODEL_FILE_VERSION
+    uint32_t byte_order;                // MODEL_FILE_BYTE_ORDER, read back differently on a host of the other endianness
+    uint32_t header_size;               // sizeof(ModelFileHeader)
+    uint32_t layer_entry_size;          // sizeof(ModelFileLayer)
+    uint32_t n_layers;
+    uint32_t input_feature_size;
+    uint32_t loss_type;
+    uint32_t optimiser_type;
+    float learning_rate;
+    uint32_t flags;                     // MODEL_FILE_TRAINING_STATE if a ModelFileTrainingState follows the layer table
+    uint64_t file_size;                 // Total size, to catch truncated files
+} ModelFileHeader;
+
+/* One per layer, right after the header */
+typedef struct ModelFileLayer {
+    uint32_t n_neurons;
+    uint32_t n_neurons_prev;
+    uint32_t activation;
+    uint32_t reserved;
+    uint64_t weights_offset;            // From the start of the file, multiple of MODEL_FILE_ALIGNMENT
+    uint64_t biases_offset;             // From the start of the file, multiple of MODEL_FILE_ALIGNMENT
+} ModelFileLayer;
+
+/* Written by checkpoints after the layer table (at the next multiple of MODEL_FILE_ALIGNMENT) to resume training */
+typedef struct ModelFileTrainingState {
+    uint32_t epoch;                     // Epoch and batch network_train runs next
+    uint32_t batch;
+    float epoch_loss;                   // Loss summed over the batches of that epoch already run
+    float beta1;                        // Optimiser fields
+    float beta2;
+    float epsilon;
+    uint32_t time_step;
+    uint32_t n_moments;                 // Moment buffers per parameter tensor of the optimiser (optimiser_moment_count)
+    uint64_t rng_state;                 // State of the random number generator of the library
+} ModelFileTrainingState;
+
+#define MODEL_FILE_BYTE_ORDER       0x01020304u
+#define MODEL_FILE_TRAINING_STATE   0x1u
+
+/* Shared by the tasks of network_evaluate, every batch writes only its own slots of correct and loss */
+typedef struct EvaluationJob {
+    const Network* net;
+    const Tensor* x;
+    const Tensor* y;
+    int batch_size;
+    int* correct;               // Correct predictions of every batch
+    double* loss;               // Loss of every batch times its number of samples
+    atomic_int failed;          // Set if any batch could not be evaluated
+} EvaluationJob;
+
+/* Shared by the tasks of a data-parallel step: replica r trains on rows [r * rows / n_active, (r + 1) * rows / n_active) */
+typedef struct ParallelStepJob {
+    Network* net;
+    Tensor* x;
+    Tensor* y;
+    int n_active;               // Replicas given at least one row (fewer than n_replicas for a batch smaller than n_replicas)
+    int distance;               // Current level of the reduction: replica r + distance is added into replica r
+    int n_chunks;               // Chunks of NETWORK_REDUCE_GRAIN floats a gradient slab is added in
+    atomic_int failed;          // Set if any replica could not run its step
+} ParallelStepJob;
+
+/* Shared by the workers of a Hogwild epoch. Only the batch counter and the instrumentation are synchronised, never the weights */
+typedef struct HogwildJob {
+    Network* net;
+    Tensor* *x_train;
+    Tensor* *y_train;
+    DataLoader* loader;         // If not NULL, batches come from it instead of x_train and y_train
+    pthread_mutex_t loader_lock;    // dataloader_next serves one consumer, workers take a batch and copy it out under this lock
+    int number_of_batches;
+    atomic_int next_batch;      // Next batch of the epoch a worker takes
+    atomic_int* writers;        // Workers updating each layer right now (instrumentation only, nobody ever waits on it)
+    atomic_long updates;
+    atomic_long collisions;
+    atomic_int failed;          // Set if any worker could not run a step
+} HogwildJob;
+
 
 
 // ==========================================
@@ -14,12 +140,12 @@
 
 /**
  * Creates a new network with the loss function and optimiser as it's internal details.
- * Will later add more parameters to include optimiser hyperparameters
+ * The optimiser hyperparameters other than the learning rate can be set on net->optimiser before training
  * Returns NUlL if any error
  * 
  * @param input_feature_size Number of features of a single sample
  * @param loss_type Type of the loss function for this network
- * @param opt_type Type of the optimiser (right now only SGD is functional)
+ * @param opt_type Type of the optimiser (SGD, SGD_MOMENTUM or ADAM)
  * @param lr Learning rate of the optimiser
 */
 Network* create_network(int input_feature_size, loss_function_type loss_type, OptimiserType opt_type, float lr) {
@@ -31,6 +157,29 @@ Network* create_network(int input_feature_size, loss_function_type loss_type, Op
     new_net->input_feature_size = input_feature_size;
     new_net->n_layers = 0;
     new_net->capacity = INITIAL_NETWORK_SIZE;
+    new_net->workspace = NULL;
+    new_net->parameters = NULL;
+    new_net->gradients = NULL;
+    new_net->slab_size = 0;
+    new_net->owns_parameters = 1;
+    new_net->mapping = NULL;
+    new_net->mapping_size = 0;
+
+    new_net->epoch = 0;
+    new_net->batch = 0;
+    new_net->epoch_loss = 0.0f;
+
+    new_net->checkpointer = NULL;
+    new_net->checkpoint_interval = 0;
+
+    new_net->n_replicas = 1;
+    new_net->replicas = NULL;
+    new_net->hogwild = 0;
+    new_net->hogwild_updates = 0;
+    new_net->hogwild_collisions = 0;
+
+    new_net->process_group = NULL;
+    new_net->precision = PRECISION_FP32;
 
     new_net->layers = (Layer**) malloc(sizeof(Layer*) * new_net->capacity);
     if (!new_net->layers) {
@@ -69,11 +218,20 @@ void free_network(Network** net) {
         for(int i = 0; i < (*net)->n_layers; i++) free_layer(&((*net)->layers[i]));
 
         free((*net)->layers);
+        if ((*net)->owns_parameters) free((*net)->parameters);    /* After the layers, they are views into the slabs */
+        free((*net)->gradients);
 
         free_loss(&((*net)->loss_func));
 
         free_optimiser(&((*net)->optimiser));
 
+        free_workspace(&((*net)->workspace));
+        _network_free_replicas(*net);
+        free_process_group(&((*net)->process_group));
+        free_checkpointer(&((*net)->checkpointer));    /* Waits for the checkpoint being written */
+
+        if ((*net)->mapping) munmap((*net)->mapping, (*net)->mapping_size);    /* After the layers, their parameters point into it */
+
         free(*net);
         *net = NULL;
     } 
@@ -103,13 +261,34 @@ int network_add_layer(Network* net, int n_neurons, activation_function func) {
     Layer* new_layer = create_layer(n_neurons, n_prev_neurons, func);
     if (!new_layer) {printf("New layer could not be made\n"); return 0;}
 
-    if (idx_layer == net->capacity) {
+    if (!_network_append_layer(net, new_layer)) {
+        free_layer(&new_layer);
+        return 0;
+    }
+
+    if (!_network_build_slabs(net, NULL)) {
+        net->n_layers--;
+        free_layer(&new_layer);
+        return 0;
+    }
+    _network_free_replicas(net);    /* Their gradient slabs no longer match, built again on the next step */
+
+    return 1;
+}
+
+
+
+/**
+ * Appends an already built layer to the network (which then owns it), growing the array of layers if needed.
+ * Returns 0 if any error (the layer is not freed then).
+ */
+int _network_append_layer(Network* net, Layer* layer) {
+    if (net->n_layers == net->capacity) {
         int new_capacity = (int)(net->capacity * NETWORK_SIZE_MULTIPLIER);
         Layer* *temp = (Layer**)realloc(net->layers, new_capacity * sizeof(Layer*));
 
         if (!temp) {
             printf("Realloc failed\n");
-            free_layer(&new_layer);
             return 0;
         }
 
@@ -117,7 +296,7 @@ int network_add_layer(Network* net, int n_neurons, activation_function func) {
         net->capacity = new_capacity;
     }
 
-    net->layers[idx_layer] = new_layer;
+    net->layers[net->n_layers] = layer;
     net->n_layers++;
 
     return 1;
@@ -125,18 +304,301 @@ int network_add_layer(Network* net, int n_neurons, activation_function func) {
 
 
 
+/**
+ * Rounds a number of floats up to a multiple of NETWORK_SLAB_ALIGNMENT bytes.
+ */
+size_t _network_slab_align(size_t n_floats) {
+    size_t per_block = NETWORK_SLAB_ALIGNMENT / sizeof(float);
+    return (n_floats + per_block - 1) / per_block * per_block;
+}
+
+
+
+/**
+ * Returns a zeroed slab of n_floats floats (a multiple of NETWORK_SLAB_ALIGNMENT bytes) aligned on NETWORK_SLAB_ALIGNMENT.
+ * Returns NULL if any error.
+ */
+float* _network_slab_alloc(size_t n_floats) {
+    float* slab = (float*) aligned_alloc(NETWORK_SLAB_ALIGNMENT, n_floats * sizeof(float));
+    if (slab) memset(slab, 0, n_floats * sizeof(float));
+    return slab;
+}
+
+
+
+/**
+ * Makes a tensor a contiguous view of data (same shape), freeing the memory it owned.
+ */
+void _network_bind_view(Tensor* tensor, float* data) {
+    if (tensor->owns_data) free(tensor->data);
+    tensor->data = data;
+    tensor->stride = tensor->cols;
+    tensor->owns_data = 0;
+}
+
+
+
+/**
+ * Lays the parameters of every layer out in one slab and their gradients in another (see NETWORK_SLAB_ALIGNMENT), and
+ * makes the weights, biases and gradients of the layers views into them. Called whenever a layer is added: the
+ * parameters are copied into a new slab, unless mapped is not NULL, which then already holds them in the slab layout
+ * (a loaded model file) and is used in place. The gradients start at zero.
+ * Returns 0 if any error (the layers then keep their tensors as they were).
+ */
+int _network_build_slabs(Network* net, float* mapped) {
+    size_t size = 0;
+    for (int i = 0; i < net->n_layers; i++) {
+        size = _network_slab_align(size) + (size_t)net->layers[i]->n_neurons_prev * net->layers[i]->n_neurons;
+        size = _network_slab_align(size) + net->layers[i]->n_neurons;
+    }
+    size = _network_slab_align(size);
+
+    float* parameters = mapped ? mapped : _network_slab_alloc(size);
+    float* gradients = _network_slab_alloc(size);
+    int ok = parameters && gradients;
+
+    /* Gradient tensors the layers do not have yet are made first (the only step that can fail once the slabs exist) */
+    for (int i = 0; ok && i < net->n_layers; i++) {
+        Layer* layer = net->layers[i];
+        ok = tensor_ensure_shape(&(layer->d_weights), layer->n_neurons_prev, layer->n_neurons)
+          && tensor_ensure_shape(&(layer->d_biases), 1, layer->n_neurons);
+    }
+
+    if (!ok) {
+        printf("Parameter and gradient slabs of the network could not be allocated\n");
+        if (!mapped) free(parameters);
+        free(gradients);
+        return 0;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < net->n_layers; i++) {
+        Layer* layer = net->layers[i];
+        size_t weights_offset = _network_slab_align(offset);
+        size_t biases_offset = _network_slab_align(weights_offset + (size_t)layer->n_neurons_prev * layer->n_neurons);
+        offset = biases_offset + layer->n_neurons;
+
+        if (!mapped) {
+            Tensor weights = {parameters + weights_offset, layer->n_neurons_prev, layer->n_neurons, layer->n_neurons, 0};
+            Tensor biases = {parameters + biases_offset, 1, layer->n_neurons, layer->n_neurons, 0};
+            tensor_copy_into(&weights, layer->weights);
+            tensor_copy_into(&biases, layer->biases);
+        }
+
+        _network_bind_view(layer->weights, parameters + weights_offset);
+        _network_bind_view(layer->biases, parameters + biases_offset);
+        _network_bind_view(layer->d_weights, gradients + weights_offset);
+        _network_bind_view(layer->d_biases, gradients + biases_offset);
+    }
+
+    if (net->owns_parameters) free(net->parameters);
+    free(net->gradients);
+
+    net->parameters = parameters;
+    net->gradients = gradients;
+    net->slab_size = size;
+    net->owns_parameters = (mapped == NULL);
+
+    return 1;
+}
+
+
+
+/**
+ * Makes network_train split every batch over n_replicas threads of the library pool (data-parallel training).
+ * Each replica runs the forward and backward pass of a contiguous share of the rows with its own caches and gradients,
+ * the gradients are summed by a tree reduction and the optimiser then takes a single step, so the update is the
+ * one of the whole batch (up to the order of the float additions).
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param n_replicas Number of replicas, 1 to train serially, <= 0 for the number of threads of the library pool.
+*/
+int network_set_data_parallel(Network* net, int n_replicas) {
+    if (!net) {printf("The net passed is NULL\n"); return 0;}
+
+    if (n_replicas <= 0) {
+        ThreadPool* pool = get_default_threadpool();
+        n_replicas = pool ? pool->n_threads : 1;
+    }
+
+    if (n_replicas != net->n_replicas) _network_free_replicas(net);    /* Built again on the next step */
+    net->n_replicas = n_replicas;
+    net->hogwild = 0;
+
+    return 1;
+}
+
+
+
+/**
+ * Makes network_train run Hogwild-style asynchronous SGD: n_workers threads of the library pool each take the next
+ * batch of the epoch, run its forward and backward pass with their own caches and gradients, and apply the SGD update
+ * straight to the shared weights. There is no lock and no barrier between steps (only at the end of an epoch), so a
+ * worker may compute its gradient on weights other workers are updating, and two updates of a layer may interleave.
+ * Stale gradients are traded for throughput. The updates that overlapped with another update of the same layer are
+ * counted (see network_hogwild_stats) to judge the trade-off.
+ * Only the SGD optimiser is supported. Checkpoints are only taken at the end of an epoch in this mode.
+ * Training is no longer reproducible from run to run. network_set_data_parallel switches back to synchronous training.
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param n_workers Number of workers, <= 0 for the number of threads of the library pool.
+*/
+int network_set_hogwild(Network* net, int n_workers) {
+    if (!net) {printf("The net passed is NULL\n"); return 0;}
+    if (net->optimiser->type != SGD) {printf("Hogwild training only supports the SGD optimiser\n"); return 0;}
+
+    if (!network_set_data_parallel(net, n_workers)) return 0;
+    net->hogwild = 1;
+
+    return 1;
+}
+
+
+
+/**
+ * Gives the counters of the last Hogwild training of the network (0 if it has never trained in that mode).
+ * 
+ * @param net The network.
+ * @param updates Receives the number of layer updates applied, can be NULL.
+ * @param collisions Receives the number of updates that overlapped with an update of the same layer by another worker, can be NULL.
+*/
+void network_hogwild_stats(const Network* net, long* updates, long* collisions) {
+    if (updates) *updates = net ? net->hogwild_updates : 0;
+    if (collisions) *collisions = net ? net->hogwild_collisions : 0;
+}
+
+
+
+/**
+ * Makes this process rank `rank` of world_size processes on the host that train the network together, each on its own
+ * share of the data (multi-process data parallelism). After every local step the gradients of the ranks are averaged
+ * with a ring all-reduce over shared memory, then every rank applies the same optimiser step. The parameters of rank 0
+ * are copied to every rank when the group is joined, so all the copies start (and stay) identical.
+ * Every rank must build the same network, call this with the same name and world_size, and run the same number of
+ * batches of the same size; the loss reported is the mean over the ranks. Only one rank should checkpoint.
+ * The processes meet on a local socket, the call returns once all of them are in. Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param name Name of the group (letters, digits, '-' and '_'), NULL to leave the current group.
+ * @param rank Rank of this process (0 to world_size - 1).
+ * @param world_size Number of processes.
+*/
+int network_set_process_group(Network* net, const char* name, int rank, int world_size) {
+    if (!net) {printf("The net passed is NULL\n"); return 0;}
+
+    free_process_group(&(net->process_group));
+    if (!name) return 1;
+
+    if (net->n_layers == 0) {printf("Add the layers before joining a process group\n"); return 0;}
+
+    /* Room for the gradient slab and the loss of the step */
+    net->process_group = create_process_group(name, rank, world_size, net->slab_size + 1);
+    if (!net->process_group) return 0;
+
+    float* buffer = process_group_buffer(net->process_group);
+    if (rank == 0) memcpy(buffer, net->parameters, net->slab_size * sizeof(float));
+    if (!process_group_broadcast(net->process_group, 0)) {free_process_group(&(net->process_group)); return 0;}
+    if (rank != 0) memcpy(net->parameters, buffer, net->slab_size * sizeof(float));
+
+    return 1;
+}
+
+
+
+/**
+ * Sets how training stores the activations kept from the forward to the backward pass (mixed precision training).
+ * With PRECISION_BF16 or PRECISION_FP16 every layer keeps its output A rounded to 16 bits and no Z at all, so the
+ * caches take a quarter of the float ones; the next layer and the backward pass read the 16-bit values directly.
+ * Products and sums are still done in float, and the parameters, gradients and optimiser state stay float.
+ * bf16 has the range of a float with 8 bits of mantissa. fp16 has 11 bits of mantissa but overflows past 65504,
+ * so it only suits activations that stay bounded (sigmoid, softmax, normalised inputs).
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param precision PRECISION_FP32 (the default), PRECISION_BF16 or PRECISION_FP16.
+*/
+int network_set_precision(Network* net, storage_precision precision) {
+    if (!net) {printf("The net passed is NULL\n"); return 0;}
+    if (precision != PRECISION_FP32 && precision != PRECISION_BF16 && precision != PRECISION_FP16) {printf("Unknown precision %d\n", (int)precision); return 0;}
+
+    net->precision = precision;    /* The workspaces are sized again on the next step */
+
+    return 1;
+}
+
+
+
 // ==========================================
 //                Utilites
 // ==========================================
 
 /**
- * Gives new prediction tensor based on the input passed to the network.
+ * Makes sure a workspace (the one of the network or of a replica) can hold one full step (forward, loss gradient and
+ * backward) for batch_size samples. The workspace is only (re)created on the first step or when a bigger batch comes in.
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param ws The workspace, *ws can be NULL.
+ * @param batch_size Number of samples in the batch.
+*/
+int _network_prepare_workspace(Network* net, Workspace** ws, int batch_size) {
+    size_t needed = 0;
+    if (net->precision == PRECISION_FP32) {
+        for (int i = 0; i < net->n_layers; i++) needed += layer_workspace_bytes(net->layers[i], batch_size);
+    } else {
+        for (int i = 0; i < net->n_layers; i++) needed += layer_workspace_bytes_half(net->layers[i], batch_size);
+        int width = _network_inference_width(net);
+        if (width > 0) needed += workspace_tensor_bytes(batch_size, width);                        /* Float output of the hidden layers */
+        needed += workspace_tensor_bytes(batch_size, net->layers[net->n_layers - 1]->n_neurons);   /* Prediction */
+    }
+    needed += workspace_tensor_bytes(batch_size, net->layers[net->n_layers - 1]->n_neurons);    /* Loss gradient */
+
+    if (*ws && (*ws)->capacity >= needed) return 1;
+
+    free_workspace(ws);
+    *ws = create_workspace(needed);
+    if (!*ws) {printf("Workspace of the network could not be created\n"); return 0;}
+
+    return 1;
+}
+
+
+
+/**
+ * Returns layer layer_idx of a replica: the layer of the network itself for replica 0, its copy otherwise.
+ */
+Layer* _network_replica_layer(Network* net, int replica, int layer_idx) {
+    if (replica == 0) return net->layers[layer_idx];
+    return &net->replicas[replica].layers[layer_idx];
+}
+
+
+
+/**
+ * Returns the workspace of a replica (the one of the network for replica 0).
+ */
+Workspace** _network_replica_workspace(Network* net, int replica) {
+    if (replica == 0) return &net->workspace;
+    return &net->replicas[replica].workspace;
+}
+
+
+
+/**
+ * Runs the forward pass of every layer of a replica and returns the output of the last one.
+ * Everything is allocated from the workspace of the replica (prepared by the caller) and stays valid until it is reset.
+ * Every layer keeps a reference to its input for the backward pass.
+ * With a 16-bit precision (see network_set_precision) the layers run forward_pass_half: each one reads the 16-bit
+ * output of the previous one, and the float outputs of the hidden layers share one buffer, only the prediction is kept in float.
  * Returns NULL if any error.
  * 
- * @param net The network which is trained.
+ * @param net The network.
+ * @param replica The replica (0 for the network itself).
  * @param input Input tensor (number_of_inputs x features of single input).
 */
-Tensor* network_predict(Network* net, Tensor* input) {
+Tensor* _network_forward(Network* net, int replica, Tensor* input) {
     if (!net || !input) {
         if (!net) printf("The net passed is NULL\n");
         if (!input) printf("The input tensor passed is NULL\n");
@@ -150,17 +612,152 @@ Tensor* network_predict(Network* net, Tensor* input) {
     }
 
     Tensor* input_for_current_layer = input;
-    Tensor* input_for_next_layer = NULL;
+    Workspace* ws = *_network_replica_workspace(net, replica);
+
+    if (net->precision != PRECISION_FP32) {
+        int width = _network_inference_width(net);
+        Tensor* hidden = (width > 0) ? workspace_tensor(ws, input->rows, width) : NULL;
+        Tensor* pred = workspace_tensor(ws, input->rows, net->layers[net->n_layers - 1]->n_neurons);
+        if ((width > 0 && !hidden) || !pred) {printf("Outputs of the forward pass could not be allocated\n"); return NULL;}
+
+        const HalfTensor* input_half = NULL;
+        for (int layer_idx = 0; layer_idx < net->n_layers; layer_idx++) {
+            Layer* layer = _network_replica_layer(net, replica, layer_idx);
+            Tensor out = (layer_idx == net->n_layers - 1) ? *pred : (Tensor){hidden->data, input->rows, layer->n_neurons, layer->n_neurons, 0};
+
+            input_half = forward_pass_half(layer, input_half ? NULL : input, input_half, &out, net->precision, ws);
+            if (!input_half) {printf("Forward pass failed\n"); return NULL;}
+        }
+
+        return pred;
+    }
+
+    for (int layer_idx = 0; layer_idx < net->n_layers; layer_idx++) {
+        input_for_current_layer = forward_pass(_network_replica_layer(net, replica, layer_idx), input_for_current_layer, ws);
+        if (!input_for_current_layer) {printf("Forward pass failed\n"); return NULL;}
+    }
+
+    return input_for_current_layer;
+}
+
+
+
+/**
+ * Runs the forward and backward pass of a replica on a batch, leaving the gradients of the batch in the d_weights and
+ * d_biases of its layers. The loss gradient is multiplied by weight first (the share of the rows of the whole batch
+ * the replica trains on), which scales every gradient of the replica by it. The workspace of the replica is reset at the end,
+ * whether the step succeeded or not.
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param replica The replica (0 for the network itself).
+ * @param x_batch Inputs of the batch.
+ * @param y_batch Targets of the batch.
+ * @param weight Factor of the gradients (1 when a single replica trains on the whole batch).
+ * @param loss Receives the loss of the batch times weight.
+*/
+int _network_step(Network* net, int replica, Tensor* x_batch, Tensor* y_batch, float weight, float* loss) {
+    Workspace** ws = _network_replica_workspace(net, replica);
+    if (!_network_prepare_workspace(net, ws, x_batch->rows)) return 0;
+
+    int ok = 0;
+    Tensor* pred = _network_forward(net, replica, x_batch);    /* In the workspace */
+    if (!pred) {printf("Failed to get a prediction from network\n"); goto cleanup;}
+
+    *loss = weight * net->loss_func->loss(pred, y_batch);
+
+    /* Every temporary of the step comes from the workspace, nothing is allocated once it is sized */
+    Tensor* prev_grad = workspace_tensor(*ws, pred->rows, pred->cols);
+    if (!prev_grad || !net->loss_func->derivative(prev_grad, pred, y_batch)) {printf("Failed to get loss gradient of the prediction\n"); goto cleanup;}
+    if (weight != 1.0f) tensor_scale_inplace(prev_grad, weight);
+
+    for (int i = net->n_layers - 1; i >= 0; i--) {
+        prev_grad = backward_pass(_network_replica_layer(net, replica, i), prev_grad, *ws);
+        if (!prev_grad) {printf("backward pass failed\n"); goto cleanup;}
+    }
+
+    ok = 1;
+
+cleanup:
+    workspace_reset(*ws);    /* Frees all the temporaries of the step at once, also after a failure so the next step has the whole arena */
+
+    return ok;
+}
+
+
+
+/**
+ * Returns the widest hidden layer of the network, the number of cols each ping-pong buffer of inference needs (0 for a single layer).
+ */
+int _network_inference_width(const Network* net) {
+    int width = 0;
+    for (int i = 0; i < net->n_layers - 1; i++) if (net->layers[i]->n_neurons > width) width = net->layers[i]->n_neurons;
+    return width;
+}
+
+
+
+/**
+ * Inference forward pass of the whole network into out, without touching the network.
+ * Hidden activations alternate between ping and pong (each input->rows x _network_inference_width floats),
+ * the last layer writes straight into out. No backward cache is kept and nothing is allocated.
+ * Returns 0 if any error.
+ */
+int _network_infer(const Network* net, const Tensor* input, float* ping, float* pong, Tensor* out) {
+    if (net->n_layers == 0 || input->cols != net->input_feature_size) {
+        if (net->n_layers == 0) printf("There are no layers in the neural network\n");
+        if (input->cols != net->input_feature_size) printf("Mismatch between features of a single input between network and the input tensor passed\n");
+        return 0;
+    }
+
+    const Tensor* current = input;
+    Tensor hidden[2] = {{ping, input->rows, 0, 0, 0}, {pong, input->rows, 0, 0, 0}};
 
     for (int layer_idx = 0; layer_idx < net->n_layers; layer_idx++) {
-        input_for_next_layer = forward_pass(net->layers[layer_idx], input_for_current_layer);
-        if (!input_for_next_layer) {printf("Forward pass failed\n"); return NULL;}
+        const Layer* layer = net->layers[layer_idx];
+
+        Tensor* dst = out;
+        if (layer_idx < net->n_layers - 1) {
+            dst = &hidden[layer_idx % 2];
+            dst->cols = layer->n_neurons;
+            dst->stride = layer->n_neurons;
+        }
+
+        if (!forward_pass_inference(layer, current, dst)) {printf("Forward pass failed\n"); return 0;}
+        current = dst;
+    }
+
+    return 1;
+}
+
 
-        if (layer_idx != 0) free_tensor(&input_for_current_layer);
-        input_for_current_layer = input_for_next_layer;
+
+/**
+ * Gives new prediction tensor based on the input passed to the network.
+ * Runs in inference mode: no backward cache is kept and the network is only read
+ * (a temporary inference context holds the hidden activations).
+ * Returns NULL if any error.
+ * 
+ * @param net The network which is trained.
+ * @param input Input tensor (number_of_inputs x features of single input).
+*/
+Tensor* network_predict(const Network* net, const Tensor* input) {
+    if (!net || !input) {
+        if (!net) printf("The net passed is NULL\n");
+        if (!input) printf("The input tensor passed is NULL\n");
+        return NULL;
     }
 
-    return input_for_next_layer;
+    if (net->n_layers == 0) {printf("There are no layers in the neural network\n"); return NULL;}
+
+    Tensor* res = create_tensor_value(input->rows, net->layers[net->n_layers - 1]->n_neurons, 0.0f);
+    if (!res) {printf("Prediction tensor could not be allocated\n"); return NULL;}
+
+    InferenceContext* ctx = create_inference_context(net, input->rows);
+    if (!ctx || !network_predict_into(net, ctx, input, res)) free_tensor(&res);
+
+    free_inference_context(&ctx);
+    return res;
 }
 
 
@@ -186,7 +783,46 @@ int network_train(Network* net, Tensor* *x_train, Tensor* *y_train, int number_o
 
     if (net->input_feature_size != x_train[0]->cols) {printf("Mismatch between cols of x_train and network's input feature size\n"); return 0;}
 
+    return _network_train(net, x_train, y_train, NULL, number_of_batches, epochs);
+}
+
+
+
+/**
+ * Trains the network on the batches served by a data loader, which reshuffles the samples every epoch and assembles
+ * the next batches in the background. Resumes from the cursor of the network like network_train (the loader draws
+ * the same order for an epoch as long as it has the same seed).
+ * Returns 0 if any error.
+ * 
+ * @param net The network which is trained.
+ * @param loader The data loader serving the batches.
+ * @param epochs Total number of epochs to train on.
+*/
+int network_train_loader(Network* net, DataLoader* loader, int epochs) {
+    if (!net || !loader || epochs <= 0) {
+        if (!net) printf("net given is NULL\n");
+        if (!loader) printf("loader given is NULL\n");
+        if (epochs <= 0) printf("Epochs need to be non zero positive integer\n");
+        return 0;
+    }
+
+    if (net->input_feature_size != loader->x->cols) {printf("Mismatch between cols of the loader inputs and network's input feature size\n"); return 0;}
+
+    return _network_train(net, NULL, NULL, loader, loader->n_batches, epochs);
+}
+
+
+
+/**
+ * Runs the epochs from the cursor of the network, taking the batches from x_train and y_train, or from loader if it is not NULL.
+ */
+int _network_train(Network* net, Tensor* *x_train, Tensor* *y_train, DataLoader* loader, int number_of_batches, int epochs) {
+    if (net->batch > number_of_batches) {printf("Training cursor (batch %d) is past the %d batches given\n", net->batch, number_of_batches); return 0;}
+    if (net->epoch >= epochs) {printf("Nothing to train, the network is already at epoch %d of %d\n", net->epoch, epochs); return 1;}
+    if (loader && !dataloader_seek(loader, net->epoch, net->batch)) return 0;
+
     printf("Start Training... (Batches: %d, Epochs: %d)\n", number_of_batches, epochs);
+    if (net->epoch > 0 || net->batch > 0) printf("Resuming from epoch %d, batch %d\n", net->epoch + 1, net->batch + 1);
 
     int batch_print_interval = number_of_batches / 10;
     if (batch_print_interval == 0) batch_print_interval = 1;
@@ -194,48 +830,926 @@ int network_train(Network* net, Tensor* *x_train, Tensor* *y_train, int number_o
     int epoch_print_interval = epochs / 10;
     if (epoch_print_interval == 0) epoch_print_interval = 1;
 
-    for (int e = 0; e < epochs; e++) {
-        float epoch_loss = 0.0f;
-
-        for (int batch_idx = 0; batch_idx < number_of_batches; batch_idx++) {
-            if (batch_idx % batch_print_interval == 0) printf("  [Epoch %d] Processing batch %d/%d...\n", e + 1, batch_idx + 1, number_of_batches);
+    int hogwild = net->hogwild && net->n_replicas > 1;
+    if (hogwild && net->process_group) {printf("Hogwild training cannot be combined with a process group\n"); return 0;}
+    if (hogwild) {
+        net->hogwild_updates = 0;
+        net->hogwild_collisions = 0;
+    }
 
-            Tensor* pred = network_predict(net, x_train[batch_idx]);
-            if (!pred) {printf("Failed to get a prediction from network\n"); return 0;}
+    for (int e = net->epoch; e < epochs; e++) {
+        if (hogwild) {
+            /* Batches of the epoch run out of order on all the workers, the cursor only moves at the end of the epoch */
+            long first_step = (long)e * number_of_batches + net->batch;
+            if (!_network_hogwild_epoch(net, x_train, y_train, loader, number_of_batches)) return 0;
+            net->batch = number_of_batches;
 
-            float current_loss = net->loss_func->loss(pred, y_train[batch_idx]);
-            epoch_loss += current_loss;
+            long step = (long)(e + 1) * number_of_batches;
+            if (net->checkpointer && step / net->checkpoint_interval > first_step / net->checkpoint_interval && !_network_checkpoint(net)) printf("Checkpoint at the end of epoch %d failed\n", e + 1);
+        }
 
-            Tensor* prev_grad = net->loss_func->derivative(pred, y_train[batch_idx]);
-            if (!prev_grad) {printf("Failed to get loss gradient of the prediction\n"); return 0;}
+        for (int batch_idx = net->batch; batch_idx < number_of_batches; batch_idx++) {
+            if (batch_idx % batch_print_interval == 0) printf("  [Epoch %d] Processing batch %d/%d...\n", e + 1, batch_idx + 1, number_of_batches);
 
-            free_tensor(&pred);
+            Tensor* x_batch = NULL;
+            Tensor* y_batch = NULL;
+            if (loader) {
+                if (!dataloader_next(loader, &x_batch, &y_batch)) return 0;    /* The loader assembles the next batches meanwhile */
+            } else {
+                x_batch = x_train[batch_idx];
+                y_batch = y_train[batch_idx];
+            }
 
-            Tensor* grad = NULL;
+            /* Leaves the gradients of the whole batch in the layers of the network */
+            float current_loss = 0.0f;
+            int ok = (net->n_replicas > 1) ? _network_parallel_step(net, x_batch, y_batch, &current_loss)
+                                           : _network_step(net, 0, x_batch, y_batch, 1.0f, &current_loss);
+            if (!ok) return 0;
+            if (net->process_group && !_network_allreduce_gradients(net, &current_loss)) return 0;    /* Mean over the processes */
 
-            for (int i = net->n_layers - 1; i >= 0; i--) {
-                grad = backward_pass(net->layers[i], prev_grad);
-                if (!grad) {
-                    printf("backward pass failed\n");
-                    if (prev_grad) free_tensor(&prev_grad);
-                    return 0;
-                }
+            optimiser_step(net->optimiser, net->parameters, net->gradients, net->slab_size);    /* One pass over the slabs */
 
-                free_tensor(&prev_grad);
-                prev_grad = grad;
-            }
-            free_tensor(&prev_grad);
+            net->epoch_loss += current_loss;
+            net->batch = batch_idx + 1;
 
-            for (int i = 0; i < net->n_layers; i++) optimiser_update(net->optimiser, net->layers[i], i);    /* Can be refactored for security */
+            /* Counted over the whole run, so a resumed run checkpoints at the same steps */
+            long step = (long)e * number_of_batches + batch_idx + 1;
+            if (net->checkpointer && step % net->checkpoint_interval == 0 && !_network_checkpoint(net)) printf("Checkpoint at epoch %d, batch %d failed\n", e + 1, batch_idx + 1);
         }
         
         if ((e + 1) % epoch_print_interval == 0 || e == 0 || e == epochs - 1) {
-            float avg_loss = epoch_loss / number_of_batches;
+            float avg_loss = net->epoch_loss / number_of_batches;
             printf("Epoch %d/%d | Avg Loss: %.6f\n\n", e + 1, epochs, avg_loss);
         }
+
+        net->epoch = e + 1;
+        net->batch = 0;
+        net->epoch_loss = 0.0f;
+    }
+
+    if (net->checkpointer) {
+        long steps = (long)epochs * number_of_batches;
+        if (steps % net->checkpoint_interval != 0 && !_network_checkpoint(net)) printf("Final checkpoint failed\n");
+        if (!checkpointer_wait(net->checkpointer)) printf("Some checkpoints could not be written\n");
     }
 
-    printf("Training Complete.\n");
+    net->epoch = 0;    /* Training is complete, a later call starts over */
+
+    printf("Training Complete. (Workspace high-water mark: %.1f KB)\n", network_workspace_high_water(net) / 1024.0);
+    if (hogwild) printf("Hogwild: %ld layer updates, %ld collided with another update of the same layer\n", net->hogwild_updates, net->hogwild_collisions);
 
     return 1;    /* For success */
 }
+
+
+
+// ==========================================
+//          Data-Parallel Training
+// ==========================================
+
+/**
+ * Makes sure there is one replica entry per thread and that every replica has a copy of each layer of the network.
+ * A copy shares the weights, biases and activation of the layer of the network (so the optimiser step is seen by all
+ * replicas at once) and has its own caches. Its gradients are views into a gradient slab of the replica laid out like
+ * the one of the network, so the reduction adds whole slabs.
+ * Returns 0 if any error.
+ */
+int _network_prepare_replicas(Network* net) {
+    if (!net->replicas) {
+        net->replicas = (TrainReplica*) calloc(net->n_replicas, sizeof(TrainReplica));    /* Entry 0 stays empty, it is the network */
+        if (!net->replicas) {printf("Malloc failed for the replicas of the network\n"); return 0;}
+    }
+
+    for (int r = 1; r < net->n_replicas; r++) {
+        TrainReplica* rep = &net->replicas[r];
+        if (rep->layers) continue;    /* Dropped by network_add_layer, so the copies made match the network */
+
+        rep->layers = (Layer*) calloc(net->n_layers, sizeof(Layer));
+        rep->gradients = _network_slab_alloc(net->slab_size);
+        if (!rep->layers || !rep->gradients) {printf("Malloc failed for the layers of a replica\n"); _network_free_replicas(net); return 0;}
+
+        for (int i = 0; i < net->n_layers; i++) {
+            const Layer* layer = net->layers[i];
+            Layer* copy = &rep->layers[i];
+            *copy = *layer;
+            copy->input_cache = NULL;
+            copy->z_cache = NULL;
+            copy->output_cache = NULL;
+            copy->input_half = NULL;
+            copy->output_half = NULL;
+
+            copy->d_weights = create_tensor_view(rep->gradients + (layer->d_weights->data - net->gradients), layer->n_neurons_prev, layer->n_neurons);
+            copy->d_biases = create_tensor_view(rep->gradients + (layer->d_biases->data - net->gradients), 1, layer->n_neurons);
+            rep->n_layers = i + 1;    /* So that the views made so far are freed if one fails */
+            if (!copy->d_weights || !copy->d_biases) {printf("Malloc failed for the layers of a replica\n"); _network_free_replicas(net); return 0;}
+        }
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * Returns the gradient slab of a replica (the one of the network for replica 0).
+ */
+float* _network_replica_gradients(Network* net, int replica) {
+    if (replica == 0) return net->gradients;
+    return net->replicas[replica].gradients;
+}
+
+
+
+/**
+ * Frees the replicas of the network (the gradient slabs and workspaces they own, never the shared parameters).
+ */
+void _network_free_replicas(Network* net) {
+    if (!net->replicas) return;
+
+    for (int r = 1; r < net->n_replicas; r++) {
+        TrainReplica* rep = &net->replicas[r];
+        for (int i = 0; i < rep->n_layers; i++) {
+            free_tensor(&(rep->layers[i].d_weights));
+            free_tensor(&(rep->layers[i].d_biases));
+        }
+        free(rep->layers);
+        free(rep->gradients);
+        free_workspace(&(rep->workspace));
+    }
+    for (int r = 0; r < net->n_replicas; r++) {
+        free_tensor(&(net->replicas[r].x_batch));
+        free_tensor(&(net->replicas[r].y_batch));
+    }
+
+    free(net->replicas);
+    net->replicas = NULL;
+}
+
+
+
+/**
+ * Body of the first parallel-for of a data-parallel step: every replica of [begin, end) runs the forward and backward
+ * pass of its rows of the batch (views, nothing is copied), its gradients weighted by its share of the rows.
+ */
+void _network_replica_steps(int begin, int end, void* arg) {
+    ParallelStepJob* job = (ParallelStepJob*) arg;
+    int rows = job->x->rows;
+
+    for (int r = begin; r < end; r++) {
+        int first = (int)((long)r * rows / job->n_active);
+        int last = (int)((long)(r + 1) * rows / job->n_active);
+
+        Tensor x_part = tensor_slice_rows(job->x, first, last - first);
+        Tensor y_part = tensor_slice_rows(job->y, first, last - first);
+
+        if (!_network_step(job->net, r, &x_part, &y_part, (float)(last - first) / (float)rows, &job->net->replicas[r].loss)) atomic_store(&job->failed, 1);
+    }
+}
+
+
+
+/**
+ * Body of one level of the tree reduction: task t adds chunk t % n_chunks of the gradient slab of replica
+ * 2 * distance * p + distance into replica 2 * distance * p, p being t / n_chunks. The pairs of a level touch disjoint
+ * replicas and the chunks disjoint floats, so every task runs in parallel.
+ */
+void _network_reduce_pairs(int begin, int end, void* arg) {
+    ParallelStepJob* job = (ParallelStepJob*) arg;
+    const SimdKernels* k = simd_kernels();
+
+    for (int t = begin; t < end; t++) {
+        int dst = 2 * job->distance * (t / job->n_chunks);
+        int src = dst + job->distance;
+
+        size_t first = (size_t)(t % job->n_chunks) * NETWORK_REDUCE_GRAIN;
+        int n = (job->net->slab_size - first < NETWORK_REDUCE_GRAIN) ? (int)(job->net->slab_size - first) : NETWORK_REDUCE_GRAIN;
+
+        float* to = _network_replica_gradients(job->net, dst) + first;
+        k->add(to, to, _network_replica_gradients(job->net, src) + first, n);
+    }
+}
+
+
+
+/**
+ * Data-parallel step: the batch is cut into one contiguous share of rows per replica, the replicas run their forward
+ * and backward passes at once on the library pool, then their gradients are summed into the network (replica 0) by a
+ * tree reduction of log2(n_replicas) levels. Each gradient was weighted by the share of the rows of its replica, so the
+ * sum is the gradient of the mean loss over the whole batch, as in a serial step.
+ * Returns 0 if any error.
+ */
+int _network_parallel_step(Network* net, Tensor* x_batch, Tensor* y_batch, float* loss) {
+    if (!_network_prepare_replicas(net)) return 0;
+
+    ParallelStepJob job = {net, x_batch, y_batch, 0, 0, 0, 0};
+    job.n_active = (x_batch->rows < net->n_replicas) ? x_batch->rows : net->n_replicas;
+    job.n_chunks = (int)((net->slab_size + NETWORK_REDUCE_GRAIN - 1) / NETWORK_REDUCE_GRAIN);
+
+    ThreadPool* pool = get_default_threadpool();
+    threadpool_parallel_for(pool, 0, job.n_active, 1, _network_replica_steps, &job);
+    if (atomic_load(&job.failed)) {printf("A replica failed its step\n"); return 0;}
+
+    /* Reduction tree: at distance d, replica r (a multiple of 2d) takes in replica r + d. The sum ends in replica 0 */
+    for (job.distance = 1; job.distance < job.n_active; job.distance *= 2) {
+        int n_pairs = (job.n_active - job.distance + 2 * job.distance - 1) / (2 * job.distance);
+        threadpool_parallel_for(pool, 0, n_pairs * job.n_chunks, 1, _network_reduce_pairs, &job);
+    }
+
+    /* Same order every step, so a run is reproducible for a given number of replicas */
+    *loss = 0.0f;
+    for (int r = 0; r < job.n_active; r++) *loss += net->replicas[r].loss;
+
+    return 1;
+}
+
+
+
+/**
+ * Body of the workers of a Hogwild epoch: every worker of [begin, end) takes the next batch of the epoch until none is
+ * left, runs its step with its own caches and gradients, and applies the update to the shared parameters right away
+ * with plain (racy) stores. Around every layer update a worker bumps the number of writers of the layer: if someone
+ * else was already writing it, the update is counted as a collision.
+ */
+void _network_hogwild_workers(int begin, int end, void* arg) {
+    HogwildJob* job = (HogwildJob*) arg;
+    Network* net = job->net;
+
+    for (int r = begin; r < end; r++) {
+        TrainReplica* rep = &net->replicas[r];
+
+        for (;;) {
+            int batch_idx = atomic_fetch_add(&job->next_batch, 1);
+            if (batch_idx >= job->number_of_batches || atomic_load(&job->failed)) break;
+
+            Tensor* x_batch = NULL;
+            Tensor* y_batch = NULL;
+            if (job->loader) {
+                /* The batch handed out is only valid until the next call to dataloader_next, so keep a copy */
+                pthread_mutex_lock(&job->loader_lock);
+                int ok = dataloader_next(job->loader, &x_batch, &y_batch);
+                ok = ok && tensor_ensure_shape(&(rep->x_batch), x_batch->rows, x_batch->cols) && tensor_copy_into(rep->x_batch, x_batch);
+                ok = ok && tensor_ensure_shape(&(rep->y_batch), y_batch->rows, y_batch->cols) && tensor_copy_into(rep->y_batch, y_batch);
+                pthread_mutex_unlock(&job->loader_lock);
+
+                if (!ok) {atomic_store(&job->failed, 1); break;}
+                x_batch = rep->x_batch;
+                y_batch = rep->y_batch;
+            } else {
+                x_batch = job->x_train[batch_idx];
+                y_batch = job->y_train[batch_idx];
+            }
+
+            float loss = 0.0f;
+            if (!_network_step(net, r, x_batch, y_batch, 1.0f, &loss)) {atomic_store(&job->failed, 1); break;}
+            rep->loss += loss;
+
+            for (int i = 0; i < net->n_layers; i++) {
+                if (atomic_fetch_add_explicit(&job->writers[i], 1, memory_order_relaxed) > 0) atomic_fetch_add_explicit(&job->collisions, 1, memory_order_relaxed);
+                /* SGD keeps no state, so a layer (its weights and biases are one stretch of the slabs) steps on its own */
+                Layer* layer = _network_replica_layer(net, r, i);
+                size_t n_floats = (size_t)(layer->biases->data + layer->n_neurons - layer->weights->data);
+                optimiser_step(net->optimiser, layer->weights->data, layer->d_weights->data, n_floats);    /* The copy shares the weights of the network */
+                atomic_fetch_sub_explicit(&job->writers[i], 1, memory_order_relaxed);
+            }
+            atomic_fetch_add_explicit(&job->updates, net->n_layers, memory_order_relaxed);
+        }
+    }
+}
+
+
+
+/**
+ * Runs the batches of the current epoch from the cursor of the network with Hogwild workers (one per replica) and adds
+ * their losses to the loss of the epoch. Returns once every batch is done (the only barrier of the mode).
+ * Returns 0 if any error.
+ */
+int _network_hogwild_epoch(Network* net, Tensor* *x_train, Tensor* *y_train, DataLoader* loader, int number_of_batches) {
+    if (!_network_prepare_replicas(net)) return 0;
+
+    HogwildJob job;
+    job.net = net;
+    job.x_train = x_train;
+    job.y_train = y_train;
+    job.loader = loader;
+    job.number_of_batches = number_of_batches;
+    atomic_init(&job.next_batch, net->batch);
+    atomic_init(&job.updates, 0);
+    atomic_init(&job.collisions, 0);
+    atomic_init(&job.failed, 0);
+
+    job.writers = (atomic_int*) calloc(net->n_layers, sizeof(atomic_int));
+    if (!job.writers) {printf("Malloc failed for the Hogwild counters\n"); return 0;}
+    pthread_mutex_init(&job.loader_lock, NULL);
+
+    for (int r = 0; r < net->n_replicas; r++) net->replicas[r].loss = 0.0f;
+
+    threadpool_parallel_for(get_default_threadpool(), 0, net->n_replicas, 1, _network_hogwild_workers, &job);
+
+    for (int r = 0; r < net->n_replicas; r++) net->epoch_loss += net->replicas[r].loss;
+    net->hogwild_updates += atomic_load(&job.updates);
+    net->hogwild_collisions += atomic_load(&job.collisions);
+
+    pthread_mutex_destroy(&job.loader_lock);
+    free(job.writers);
+
+    if (atomic_load(&job.failed)) {printf("A Hogwild worker failed its step\n"); return 0;}
+    return 1;
+}
+
+
+
+// ==========================================
+//          Multi-Process Training
+// ==========================================
+
+/**
+ * Replaces the gradients of the network and the loss of the step with their mean over the ranks of its process group
+ * (copied into the shared buffer of this rank, summed by the ring all-reduce, copied back divided by the world size).
+ * Returns 0 if any error (a rank died or left).
+ */
+int _network_allreduce_gradients(Network* net, float* loss) {
+    ProcessGroup* pg = net->process_group;
+    float* buffer = process_group_buffer(pg);
+
+    memcpy(buffer, net->gradients, net->slab_size * sizeof(float));
+    buffer[pg->n_floats - 1] = *loss;
+
+    if (!process_group_allreduce(pg)) {printf("All-reduce of the gradients failed on rank %d\n", pg->rank); return 0;}
+
+    float scale = 1.0f / (float)pg->world_size;
+    memcpy(net->gradients, buffer, net->slab_size * sizeof(float));
+    simd_kernels()->scale(net->gradients, scale, (int)net->slab_size);
+    *loss = buffer[pg->n_floats - 1] * scale;
+
+    return 1;
+}
+
+
+
+/**
+ * Returns the largest number of bytes the workspace of the network has had in use at once (0 if it has none yet).
+ * Useful to size the memory of containers running the network.
+ * 
+ * @param net The network.
+*/
+size_t network_workspace_high_water(const Network* net) {
+    if (!net) return 0;
+    return workspace_high_water(net->workspace);
+}
+
+
+
+/**
+ * Returns the number of trainable parameters (weights and biases of every layer) of the network.
+ * 
+ * @param net The network.
+*/
+size_t network_parameter_count(const Network* net) {
+    if (!net) return 0;
+
+    size_t count = 0;
+    for (int i = 0; i < net->n_layers; i++) count += (size_t)(net->layers[i]->n_neurons_prev + 1) * net->layers[i]->n_neurons;
+    return count;
+}
+
+
+
+// ==========================================
+//             Inference
+// ==========================================
+
+/**
+ * Returns a new inference context for net, sized for batches of up to max_batch samples (it grows if a larger batch comes).
+ * Returns NULL if any error.
+ * 
+ * @param net The network the context is used with.
+ * @param max_batch Largest number of samples expected in one call.
+*/
+InferenceContext* create_inference_context(const Network* net, int max_batch) {
+    if (!net || max_batch <= 0) {
+        if (!net) printf("The net passed is NULL\n");
+        if (max_batch <= 0) printf("max_batch needs to be a non zero positive integer\n");
+        return NULL;
+    }
+
+    InferenceContext* ctx = (InferenceContext*) malloc(sizeof(InferenceContext));
+    if (!ctx) {printf("Malloc failed for inference context\n"); return NULL;}
+
+    ctx->width = _network_inference_width(net);
+    ctx->capacity = (size_t)max_batch * ctx->width;
+    ctx->buffers = NULL;
+
+    if (ctx->capacity > 0) {
+        ctx->buffers = (float*) malloc(2 * ctx->capacity * sizeof(float));
+        if (!ctx->buffers) {printf("Malloc failed for inference buffers\n"); free(ctx); return NULL;}
+    }
+
+    return ctx;
+}
+
+
+
+/**
+ * Completely frees an inference context.
+*/
+void free_inference_context(InferenceContext** ctx) {
+    if (ctx && *ctx) {
+        free((*ctx)->buffers);
+        free(*ctx);
+        *ctx = NULL;
+    }
+}
+
+
+
+/**
+ * Writes the prediction of the network for input into out, using only the memory of ctx for the hidden activations.
+ * The network is strictly read only, so several threads may call this on the same network at once as long as
+ * each uses its own context and output. Nothing is allocated unless input has more rows than the context has seen.
+ * Returns 0 if any error.
+ * 
+ * @param net The network which is trained.
+ * @param ctx Context of the calling thread (created for net).
+ * @param input Input tensor (number_of_inputs x features of single input).
+ * @param out Destination (number_of_inputs x neurons of the last layer).
+*/
+int network_predict_into(const Network* net, InferenceContext* ctx, const Tensor* input, Tensor* out) {
+    if (!net || !ctx || !input || !out) {
+        if (!net) printf("The net passed is NULL\n");
+        if (!ctx) printf("The inference context passed is NULL\n");
+        if (!input) printf("The input tensor passed is NULL\n");
+        if (!out) printf("The output tensor passed is NULL\n");
+        return 0;
+    }
+
+    if (ctx->width != _network_inference_width(net)) {printf("Inference context was created for another network\n"); return 0;}
+
+    size_t needed = (size_t)input->rows * ctx->width;
+    if (needed > ctx->capacity) {
+        float* grown = (float*) realloc(ctx->buffers, 2 * needed * sizeof(float));
+        if (!grown) {printf("Realloc failed for inference buffers\n"); return 0;}
+        ctx->buffers = grown;
+        ctx->capacity = needed;
+    }
+
+    float* ping = ctx->buffers;
+    float* pong = ctx->buffers ? ctx->buffers + ctx->capacity : NULL;
+
+    return _network_infer(net, input, ping, pong, out);
+}
+
+
+
+/**
+ * Returns the index of the largest of the n values of row (the first one on ties).
+ */
+int _argmax_row(const float* row, int n) {
+    int max_idx = 0;
+    for (int i = 1; i < n; i++) if (row[i] > row[max_idx]) max_idx = i;
+    return max_idx;
+}
+
+
+
+/**
+ * Body of the parallel-for of network_evaluate: scores the batches [begin, end).
+ * Every task has its own inference context and output buffer, batches are views into x and y (no copy).
+ */
+void _network_evaluate_batches(int begin, int end, void* arg) {
+    EvaluationJob* job = (EvaluationJob*) arg;
+    int n_classes = job->y->cols;
+
+    InferenceContext* ctx = create_inference_context(job->net, job->batch_size);
+    Tensor* out = create_tensor_value(job->batch_size, n_classes, 0.0f);
+    if (!ctx || !out) {
+        atomic_store(&job->failed, 1);
+        free_inference_context(&ctx);
+        free_tensor(&out);
+        return;
+    }
+
+    for (int b = begin; b < end; b++) {
+        int start = b * job->batch_size;
+        int rows = (job->x->rows - start < job->batch_size) ? job->x->rows - start : job->batch_size;
+
+        Tensor x_batch = tensor_slice_rows(job->x, start, rows);
+        Tensor y_batch = tensor_slice_rows(job->y, start, rows);
+        Tensor pred = tensor_slice_rows(out, 0, rows);
+
+        if (!network_predict_into(job->net, ctx, &x_batch, &pred)) {atomic_store(&job->failed, 1); continue;}
+
+        job->loss[b] = (double)job->net->loss_func->loss(&pred, &y_batch) * rows;
+
+        int correct = 0;
+        for (int i = 0; i < rows; i++) {
+            correct += (_argmax_row(&pred.data[i * n_classes], n_classes) == _argmax_row(&y_batch.data[i * y_batch.stride], n_classes));
+        }
+        job->correct[b] = correct;
+    }
+
+    free_inference_context(&ctx);
+    free_tensor(&out);
+}
+
+
+
+/**
+ * Scores the network on a whole dataset: accuracy (argmax of the prediction against argmax of the target) and mean loss.
+ * The samples are cut into batches of batch_size rows which are viewed in place and spread over the default thread pool,
+ * each task running read-only inference with its own context. Per batch results are reduced in order, so the result
+ * does not depend on the number of threads.
+ * Returns 0 if any error.
+ * 
+ * @param net The network which is trained.
+ * @param x Inputs, one sample per row (number_of_samples x features of single input).
+ * @param y Targets, one sample per row (number_of_samples x neurons of the last layer).
+ * @param batch_size Number of samples scored at once (large batches turn the products into real matrix-matrix ones).
+ * @param result Receives the accuracy and loss.
+*/
+int network_evaluate(const Network* net, const Tensor* x, const Tensor* y, int batch_size, Evaluation* result) {
+    if (!net || !x || !y || !result || batch_size <= 0) {
+        if (!net) printf("The net passed is NULL\n");
+        if (!x) printf("x passed is NULL\n");
+        if (!y) printf("y passed is NULL\n");
+        if (!result) printf("result passed is NULL\n");
+        if (batch_size <= 0) printf("batch_size needs to be a non zero positive integer\n");
+        return 0;
+    }
+
+    if (net->n_layers == 0) {printf("There are no layers in the neural network\n"); return 0;}
+    if (x->rows != y->rows || x->cols != net->input_feature_size || y->cols != net->layers[net->n_layers - 1]->n_neurons) {
+        if (x->rows != y->rows) printf("Mismatch between rows of x and y\n");
+        if (x->cols != net->input_feature_size) printf("Mismatch between cols of x and network's input feature size\n");
+        if (y->cols != net->layers[net->n_layers - 1]->n_neurons) printf("Mismatch between cols of y and neurons of the last layer\n");
+        return 0;
+    }
+
+    if (batch_size > x->rows) batch_size = x->rows;
+    int n_batches = (x->rows + batch_size - 1) / batch_size;
+
+    EvaluationJob job = {net, x, y, batch_size, NULL, NULL, 0};
+    job.correct = (int*) calloc(n_batches, sizeof(int));
+    job.loss = (double*) calloc(n_batches, sizeof(double));
+    if (!job.correct || !job.loss) {
+        printf("Malloc failed for evaluation results\n");
+        free(job.correct);
+        free(job.loss);
+        return 0;
+    }
+
+    threadpool_parallel_for(get_default_threadpool(), 0, n_batches, 1, _network_evaluate_batches, &job);
+
+    int n_correct = 0;
+    double loss = 0.0;
+    for (int b = 0; b < n_batches; b++) {
+        n_correct += job.correct[b];
+        loss += job.loss[b];
+    }
+
+    free(job.correct);
+    free(job.loss);
+
+    if (atomic_load(&job.failed)) {printf("Some batches could not be evaluated\n"); return 0;}
+
+    result->n_samples = x->rows;
+    result->n_correct = n_correct;
+    result->accuracy = (float)n_correct / x->rows;
+    result->loss = (float)(loss / x->rows);
+
+    return 1;
+}
+
+
+
+// ==========================================
+//             Saving and Loading
+// ==========================================
+
+/**
+ * Rounds offset up to a multiple of MODEL_FILE_ALIGNMENT.
+ */
+size_t _model_align(size_t offset) {
+    return (offset + MODEL_FILE_ALIGNMENT - 1) & ~((size_t)MODEL_FILE_ALIGNMENT - 1);
+}
+
+
+
+/**
+ * Lays the network out as a model file and returns its size in bytes. If image is not NULL, also writes the file
+ * into it (header, layer table, training state if with_state, padding, then the parameter slab of the network, and
+ * the moment buffers of the optimiser if with_state). Measuring first with image NULL and filling next gives the same
+ * layout. The slab starts on a multiple of MODEL_FILE_ALIGNMENT, so every block of it lands aligned in the file.
+ */
+size_t _model_image(const Network* net, int with_state, char* image) {
+    size_t offset = sizeof(ModelFileHeader) + net->n_layers * sizeof(ModelFileLayer);
+    size_t state_offset = 0;
+    if (with_state) {
+        state_offset = _model_align(offset);
+        offset = state_offset + sizeof(ModelFileTrainingState);
+    }
+
+    size_t slab_offset = _model_align(offset);
+    size_t slab_bytes = net->slab_size * sizeof(float);
+    size_t end = slab_offset + slab_bytes;
+
+    if (image) {
+        ModelFileLayer* entries = (ModelFileLayer*)(image + sizeof(ModelFileHeader));
+        for (int i = 0; i < net->n_layers; i++) {
+            const Layer* layer = net->layers[i];
+            memset(&entries[i], 0, sizeof(ModelFileLayer));
+            entries[i].n_neurons = layer->n_neurons;
+            entries[i].n_neurons_prev = layer->n_neurons_prev;
+            entries[i].activation = layer->activation->func;
+            entries[i].weights_offset = slab_offset + (size_t)(layer->weights->data - net->parameters) * sizeof(float);
+            entries[i].biases_offset = slab_offset + (size_t)(layer->biases->data - net->parameters) * sizeof(float);
+        }
+
+        memset(image + offset, 0, slab_offset - offset);
+        if (slab_bytes) memcpy(image + slab_offset, net->parameters, slab_bytes);
+    }
+
+    /* Checkpoints then hold the moment buffers of the optimiser, each laid out like the slab (zeros before the first step) */
+    const Optimiser* opt = net->optimiser;
+    int n_moments = with_state ? optimiser_moment_count(opt->type) : 0;
+    for (int b = 0; b < n_moments; b++) {
+        const float* moment = (opt->n_floats == net->slab_size) ? ((b == 0) ? opt->m : opt->v) : NULL;
+
+        if (image && moment) memcpy(image + end, moment, slab_bytes);
+        else if (image) memset(image + end, 0, slab_bytes);
+
+        end += slab_bytes;    /* Still a multiple of MODEL_FILE_ALIGNMENT */
+    }
+
+    if (!image) return end;
+
+    ModelFileHeader* header = (ModelFileHeader*) image;
+    memset(header, 0, sizeof(ModelFileHeader));
+    memcpy(header->magic, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC));
+    header->version = MODEL_FILE_VERSION;
+    header->byte_order = MODEL_FILE_BYTE_ORDER;
+    header->header_size = sizeof(ModelFileHeader);
+    header->layer_entry_size = sizeof(ModelFileLayer);
+    header->n_layers = net->n_layers;
+    header->input_feature_size = net->input_feature_size;
+    header->loss_type = net->loss_func->type;
+    header->optimiser_type = net->optimiser->type;
+    header->learning_rate = net->optimiser->learning_rate;
+    header->flags = with_state ? MODEL_FILE_TRAINING_STATE : 0;
+    header->file_size = end;
+
+    size_t table_end = sizeof(ModelFileHeader) + net->n_layers * sizeof(ModelFileLayer);
+    if (with_state) {
+        memset(image + table_end, 0, state_offset - table_end);
+
+        ModelFileTrainingState* state = (ModelFileTrainingState*)(image + state_offset);
+        memset(state, 0, sizeof(ModelFileTrainingState));
+        state->epoch = net->epoch;
+        state->batch = net->batch;
+        state->epoch_loss = net->epoch_loss;
+        state->beta1 = net->optimiser->beta1;
+        state->beta2 = net->optimiser->beta2;
+        state->epsilon = net->optimiser->epsilon;
+        state->time_step = net->optimiser->time_step;
+        state->n_moments = n_moments;
+        state->rng_state = tensor_rng_get_state();
+    }
+
+    return end;
+}
+
+
+
+/**
+ * Writes the network (input size, loss, optimiser type and learning rate, layer shapes, activations, weights and biases)
+ * to a versioned binary model file. The file is written under a temporary name and renamed, so an existing model
+ * is never left half written.
+ * Returns 0 if any error.
+ * 
+ * @param net The network to save.
+ * @param path Path of the model file.
+*/
+int network_save(const Network* net, const char* path) {
+    if (!net || !path) {
+        if (!net) printf("The net passed is NULL\n");
+        if (!path) printf("The path passed is NULL\n");
+        return 0;
+    }
+
+    if (net->n_layers == 0) {printf("There are no layers in the neural network\n"); return 0;}
+
+    size_t size = _model_image(net, 0, NULL);
+    char* image = (char*) malloc(size);
+    if (!image) {printf("Malloc failed for a model file of %zu bytes\n", size); return 0;}
+
+    _model_image(net, 0, image);
+    int ok = checkpoint_write_file(path, image, size);
+
+    free(image);
+    return ok;
+}
+
+
+
+/**
+ * Loads a model file written by network_save by mapping it in memory: the weights and biases of the layers point
+ * straight into the mapping, nothing is parsed or copied. Processes loading the same file share one page cache copy
+ * of the parameters (the mapping is private, so training the loaded network copies only the pages it writes).
+ * Checkpoints load too, as the network they were taken from (the training state is ignored).
+ * Returns NULL if any error (bad magic, version, sizes or shapes).
+ * 
+ * @param path Path of the model file.
+*/
+Network* network_load(const char* path) {
+    return _network_load(path, 0);
+}
+
+
+
+/**
+ * Makes network_train write a checkpoint to path every every_n_batches batches and when training completes.
+ * A checkpoint is the model file plus the training state (epoch and batch reached, optimiser state, random number
+ * generator state). Taking one costs a copy of the parameters into a buffer, a background thread writes it to disk
+ * while training goes on. network_train waits for the last one to be on disk before returning.
+ * Returns 0 if any error.
+ * 
+ * @param net The network to checkpoint.
+ * @param path Path of the checkpoint file, NULL to stop checkpointing.
+ * @param every_n_batches Number of batches (training steps) between two checkpoints.
+*/
+int network_set_checkpoint(Network* net, const char* path, int every_n_batches) {
+    if (!net) {printf("The net passed is NULL\n"); return 0;}
+
+    free_checkpointer(&net->checkpointer);    /* Waits for the snapshot it is writing */
+    net->checkpoint_interval = 0;
+    if (!path) return 1;
+
+    if (every_n_batches <= 0) {printf("every_n_batches needs to be a non zero positive integer\n"); return 0;}
+
+    net->checkpointer = create_checkpointer(path);
+    if (!net->checkpointer) return 0;
+
+    net->checkpoint_interval = every_n_batches;
+    return 1;
+}
+
+
+
+/**
+ * Loads a checkpoint written while training (see network_set_checkpoint) to resume it: the network comes back with
+ * its parameters, optimiser state and training cursor, and the random number generator of the library is restored.
+ * Calling network_train with the same data and epochs then goes on from the batch after the checkpoint.
+ * Returns NULL if any error, or if the file is a model without training state.
+ * 
+ * @param path Path of the checkpoint file.
+*/
+Network* network_load_checkpoint(const char* path) {
+    return _network_load(path, 1);
+}
+
+
+
+/**
+ * Snapshots the network (parameters and training state) into a free buffer of the checkpointer and queues it for writing.
+ * Returns 0 if any error.
+ */
+int _network_checkpoint(Network* net) {
+    size_t size = _model_image(net, 1, NULL);
+
+    char* image = checkpointer_acquire(net->checkpointer, size);
+    if (!image) return 0;
+
+    _model_image(net, 1, image);
+    checkpointer_submit(net->checkpointer, image, size);
+
+    return 1;
+}
+
+
+
+/**
+ * Maps a model file and builds the network around it (see network_load). If with_state, the file must hold a
+ * training state, which is restored (see network_load_checkpoint).
+ * Returns NULL if any error.
+ */
+Network* _network_load(const char* path, int with_state) {
+    if (!path) {printf("The path passed is NULL\n"); return NULL;}
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {printf("Error opening %s\n", path); return NULL;}
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ModelFileHeader)) {
+        printf("%s is too small to be a model file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char* base = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);    /* The mapping keeps the file alive */
+    if (base == MAP_FAILED) {printf("Could not map %s\n", path); return NULL;}
+
+    const ModelFileHeader* header = (const ModelFileHeader*) base;
+    const ModelFileLayer* entries = (const ModelFileLayer*) (base + sizeof(ModelFileHeader));
+    size_t table_end = sizeof(ModelFileHeader) + (size_t)header->n_layers * sizeof(ModelFileLayer);
+    const ModelFileTrainingState* state = (const ModelFileTrainingState*) (base + _model_align(table_end));
+
+    const char* error = NULL;
+    if (memcmp(header->magic, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC)) != 0) error = "not a model file (bad magic)";
+    else if (header->byte_order != MODEL_FILE_BYTE_ORDER) error = "written on a host of the other byte order";
+    else if (header->version != MODEL_FILE_VERSION) error = "unsupported version";
+    else if (header->header_size != sizeof(ModelFileHeader) || header->layer_entry_size != sizeof(ModelFileLayer)) error = "unexpected header layout";
+    else if (header->file_size != size) error = "truncated or padded (size does not match the header)";
+    else if (header->n_layers == 0 || header->input_feature_size == 0) error = "no layers or no input features";
+    else if (header->loss_type > CATEGORICAL_CROSSENTROPY || header->optimiser_type > ADAM) error = "unknown loss or optimiser";
+    else if (table_end > size) error = "layer table past the end of the file";
+    else if (with_state && !(header->flags & MODEL_FILE_TRAINING_STATE)) error = "no training state (a model file, not a checkpoint)";
+    else if ((header->flags & MODEL_FILE_TRAINING_STATE) && _model_align(table_end) + sizeof(ModelFileTrainingState) > size) error = "training state past the end of the file";
+    else if ((header->flags & MODEL_FILE_TRAINING_STATE) && state->n_moments != (uint32_t)optimiser_moment_count((OptimiserType)header->optimiser_type)) error = "wrong number of optimiser moment buffers";
+
+    for (uint32_t i = 0; !error && i < header->n_layers; i++) {
+        const ModelFileLayer* e = &entries[i];
+        uint32_t expected_prev = (i == 0) ? header->input_feature_size : entries[i - 1].n_neurons;
+
+        if (e->n_neurons == 0 || e->n_neurons > INT32_MAX || e->n_neurons_prev != expected_prev) error = "layer shapes do not chain";
+        else if (e->activation > LINEAR) error = "unknown activation";
+        else if (e->weights_offset % MODEL_FILE_ALIGNMENT || e->biases_offset % MODEL_FILE_ALIGNMENT) error = "misaligned parameters";
+        else if (e->weights_offset + (uint64_t)e->n_neurons_prev * e->n_neurons * sizeof(float) > size) error = "weights past the end of the file";
+        else if (e->biases_offset + (uint64_t)e->n_neurons * sizeof(float) > size) error = "biases past the end of the file";
+    }
+
+    /* The parameters form one slab starting at the weights of the first layer, the moment buffers (the size of the
+       slab each) follow it. A file ending right after the last biases has no room for the padding of the slab */
+    uint64_t slab_offset = error ? 0 : entries[0].weights_offset;
+    uint64_t slab_floats = 0;
+    for (uint32_t i = 0; !error && i < header->n_layers; i++) {
+        uint64_t weights_at = _network_slab_align(slab_floats);
+        uint64_t biases_at = _network_slab_align(weights_at + (uint64_t)entries[i].n_neurons_prev * entries[i].n_neurons);
+        slab_floats = biases_at + entries[i].n_neurons;
+
+        if (entries[i].weights_offset != slab_offset + weights_at * sizeof(float) || entries[i].biases_offset != slab_offset + biases_at * sizeof(float)) error = "parameters not laid out as one slab";
+    }
+    uint64_t slab_bytes = _network_slab_align(slab_floats) * sizeof(float);
+
+    int n_moments = (header->flags & MODEL_FILE_TRAINING_STATE) ? (int)state->n_moments : 0;
+    if (!error && n_moments > 0 && slab_offset + (1 + n_moments) * slab_bytes > size) error = "optimiser moments past the end of the file";
+
+    if (error) {
+        printf("Cannot load %s: %s\n", path, error);
+        munmap(base, size);
+        return NULL;
+    }
+
+    Network* net = create_network((int)header->input_feature_size, (loss_function_type)header->loss_type, (OptimiserType)header->optimiser_type, header->learning_rate);
+    if (!net) {munmap(base, size); return NULL;}
+
+    net->mapping = base;
+    net->mapping_size = size;
+
+    for (uint32_t i = 0; i < header->n_layers; i++) {
+        const ModelFileLayer* e = &entries[i];
+
+        Tensor* weights = create_tensor_view((float*)(base + e->weights_offset), (int)e->n_neurons_prev, (int)e->n_neurons);
+        Tensor* biases = create_tensor_view((float*)(base + e->biases_offset), 1, (int)e->n_neurons);
+        Layer* layer = (weights && biases) ? create_layer_from_tensors(weights, biases, (activation_function)e->activation) : NULL;
+
+        if (!layer || !_network_append_layer(net, layer)) {
+            printf("Cannot load %s: layer %u could not be built\n", path, i);
+            if (layer) free_layer(&layer);
+            else {
+                free_tensor(&weights);
+                free_tensor(&biases);
+            }
+            free_network(&net);    /* Unmaps too */
+            return NULL;
+        }
+    }
+
+    /* The mapping is the parameter slab, unless the file stops short of its padding (it is copied then) */
+    if (!_network_build_slabs(net, (slab_offset + slab_bytes <= size) ? (float*)(base + slab_offset) : NULL)) {
+        printf("Cannot load %s: the slabs could not be built\n", path);
+        free_network(&net);
+        return NULL;
+    }
+
+    if (with_state) {
+        net->epoch = (int)state->epoch;
+        net->batch = (int)state->batch;
+        net->epoch_loss = state->epoch_loss;
+
+        net->optimiser->beta1 = state->beta1;
+        net->optimiser->beta2 = state->beta2;
+        net->optimiser->epsilon = state->epsilon;
+        net->optimiser->time_step = (int)state->time_step;
+
+        if (n_moments > 0 && !optimiser_prepare(net->optimiser, net->slab_size)) {free_network(&net); return NULL;}
+        for (int b = 0; b < n_moments; b++) {
+            float* moment = (b == 0) ? net->optimiser->m : net->optimiser->v;
+            memcpy(moment, base + slab_offset + (1 + b) * slab_bytes, slab_bytes);
+        }
+
+        tensor_rng_set_state(state->rng_state);
+    }
+
+    return net;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef NETWORK_INTERNAL_H
+#define NETWORK_INTERNAL_H
+
+#include "network.h"
+
+
+
+/* Internals of network.c shared with the unit tests (tests/precision_test.c), not installed with the public headers */
+
+
+
+// ==========================================
+//             Training
+// ==========================================
+
+/**
+ * Runs the forward and backward pass of a replica on a batch, leaving the gradients of the batch in the d_weights and
+ * d_biases of its layers. The loss gradient is multiplied by weight first (the share of the rows of the whole batch
+ * the replica trains on), which scales every gradient of the replica by it. The workspace of the replica is reset at the end,
+ * whether the step succeeded or not.
+ * Returns 0 if any error.
+ * 
+ * @param net The network.
+ * @param replica The replica (0 for the network itself).
+ * @param x_batch Inputs of the batch.
+ * @param y_batch Targets of the batch.
+ * @param weight Factor of the gradients (1 when a single replica trains on the whole batch).
+ * @param loss Receives the loss of the batch times weight.
+*/
+int _network_step(Network* net, int replica, Tensor* x_batch, Tensor* y_batch, float weight, float* loss);
+
+
+
+#endif
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include "optimiser.h"
+#include "simd.h"
+#include "threadpool.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 
 
@@ -9,9 +13,21 @@
 //             Internal Helpers
 // ==========================================
 
-void _sgd_update(Optimiser* opt, Layer* layer);
-void _sgd_m_update(Optimiser* opt, Layer* layer, int layer_idx);
-void _adam_update(Optimiser* opt, Layer* layer, int layer_idx);
+void _sgd_update(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats);
+void _sgd_m_update(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats);
+void _adam_update(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats);
+void _optimiser_run(const Optimiser* opt, float* parameters, const float* gradients, size_t n_floats, float step, float correction);
+void _optimiser_update_chunks(int begin, int end, void* arg);
+
+/* Shared by the tasks of an update, task c updates floats [c * OPTIMISER_PARALLEL_GRAIN, (c + 1) * OPTIMISER_PARALLEL_GRAIN) */
+typedef struct OptimiserJob {
+    const Optimiser* opt;
+    float* parameters;
+    const float* gradients;
+    size_t n_floats;
+    float step;                 // Learning rate (SGD, SGD+M) or bias corrected step size (Adam)
+    float correction;           // 1 / sqrt(1 - beta2^t), bias correction of v (Adam)
+} OptimiserJob;
 
 
 
@@ -20,26 +36,26 @@ void _adam_update(Optimiser* opt, Layer* layer, int layer_idx);
 // ==========================================
 
 /**
- * Creates the optimizer object with the only the learning rate, will later add methods to set other hyperparameters for SGD+M and Adam.
+ * Creates the optimizer object with the learning rate; beta1, beta2 and epsilon get the OPTIMISER_DEFAULT_* values.
  * Returns NULL if any error.
- * 
+ *
  * @param type Type of the optimiser out of the available in the enum.
  * @param lr Learning rate
  */
 Optimiser* create_optimiser(OptimiserType type, float lr) {
     if (lr < 0.0) {printf("Learning rate cannot be negative\n"); return NULL;}
 
-    Optimiser* new_opt = (Optimiser*) malloc(sizeof(Optimiser));
+    Optimiser* new_opt = (Optimiser*) calloc(1, sizeof(Optimiser));
     if (!new_opt) {printf("malloc for optimiser failed\n"); return NULL;}
 
     new_opt->type = type;
     new_opt->learning_rate = lr;
-    
-    new_opt->beta1 = 0.0;       /* Will later add default value here */
-    new_opt->beta2 = 0.0;       /* Will later add default value here */
-    new_opt->epsilon = 0.0;     /* Will later add default value here */
 
-    new_opt->time_step = 0;
+    new_opt->beta1 = OPTIMISER_DEFAULT_BETA1;
+    new_opt->beta2 = OPTIMISER_DEFAULT_BETA2;
+    new_opt->epsilon = OPTIMISER_DEFAULT_EPSILON;
+
+    new_opt->time_step = 0;     /* The moment buffers come with the first step */
 
     return new_opt;
 }
@@ -47,11 +63,12 @@ Optimiser* create_optimiser(OptimiserType type, float lr) {
 
 
 /**
- * Completely frees the optimiser.
- * Will need to change later for caches
+ * Completely frees the optimiser and its moment buffers.
  */
 void free_optimiser(Optimiser** opt) {
     if (opt && *opt) {
+        free((*opt)->m);
+        free((*opt)->v);
         free(*opt);
         *opt = NULL;
     }
@@ -59,34 +76,98 @@ void free_optimiser(Optimiser** opt) {
 
 
 
+/**
+ * Returns the number of moment buffers the optimiser keeps (0 for SGD, 1 for SGD+M, 2 for Adam).
+ *
+ * @param type Type of the optimiser.
+ */
+int optimiser_moment_count(OptimiserType type) {
+    switch (type) {
+        case SGD_MOMENTUM: return 1;
+        case ADAM: return 2;
+        default: return 0;
+    }
+}
+
+
+
+/**
+ * Makes the moment buffers n_floats long, zeroed, unless they already are that long (optimiser_step does it on the
+ * first step, so the moments start over if the parameters change size).
+ * Returns 0 if any error.
+ *
+ * @param opt The optimizer
+ * @param n_floats Floats of the parameters the optimiser steps
+ */
+int optimiser_prepare(Optimiser* opt, size_t n_floats) {
+    if (!opt) {printf("The optimiser passed is NULL\n"); return 0;}
+
+    int n_moments = optimiser_moment_count(opt->type);
+    if (n_moments == 0 || (opt->m && opt->n_floats == n_floats)) return 1;
+
+    free(opt->m);
+    free(opt->v);
+    opt->m = NULL;
+    opt->v = NULL;
+    opt->n_floats = 0;
+
+    size_t bytes = (n_floats * sizeof(float) + OPTIMISER_ALIGNMENT - 1) & ~((size_t)OPTIMISER_ALIGNMENT - 1);
+    if (bytes == 0) return 1;
+
+    opt->m = (float*) aligned_alloc(OPTIMISER_ALIGNMENT, bytes);
+    if (n_moments > 1) opt->v = (float*) aligned_alloc(OPTIMISER_ALIGNMENT, bytes);
+    if (!opt->m || (n_moments > 1 && !opt->v)) {
+        printf("Moment buffers of the optimiser could not be allocated\n");
+        free(opt->m);
+        free(opt->v);
+        opt->m = NULL;
+        opt->v = NULL;
+        return 0;
+    }
+
+    memset(opt->m, 0, bytes);
+    if (opt->v) memset(opt->v, 0, bytes);
+    opt->n_floats = n_floats;
+
+    return 1;
+}
+
+
+
 // ==========================================
 //             Update Logic
 // ==========================================
 
 /**
- * Performs the weight update on a SINGLE layer.
- * 
+ * Performs the update of all the parameters at once, from gradients laid out the same way. Every update is one fused
+ * SIMD pass over the parameters, the gradients and the moments, spread over the default thread pool for large buffers.
+ * SGD keeps no state, so any part of the parameters can be stepped on its own. SGD+M and Adam keep one moment per
+ * float and count the steps (Adam), so they must be given the whole parameter buffer once per step.
+ *
  * @param opt The optimizer
- * @param layer The layer to update
- * @param layer_idx Index of the layer in the network, used by SGD+M and Adam
+ * @param parameters The parameters to update
+ * @param gradients Their gradients
+ * @param n_floats Floats of both buffers
  */
-void optimiser_update(Optimiser* opt, Layer* layer, int layer_index) {
+void optimiser_step(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats) {
+    if (!opt || !parameters || !gradients) {printf("The optimiser, parameters or gradients passed are NULL\n"); return;}
+
     switch (opt->type)
     {
     case SGD:
-        _sgd_update(opt, layer);
+        _sgd_update(opt, parameters, gradients, n_floats);
         break;
 
     case SGD_MOMENTUM:
-        _sgd_m_update(opt, layer, layer_index);
+        _sgd_m_update(opt, parameters, gradients, n_floats);
         break;
-    
+
     case ADAM:
-        _adam_update(opt, layer, layer_index);
+        _adam_update(opt, parameters, gradients, n_floats);
         break;
-        
+
     default:
-        _sgd_update(opt, layer);
+        _sgd_update(opt, parameters, gradients, n_floats);
         break;
     }
 }
@@ -97,24 +178,73 @@ void optimiser_update(Optimiser* opt, Layer* layer, int layer_index) {
 //         Update Specific to Type
 // ==========================================
 
+/**
+ * w = w - lr * g.
+ */
+void _sgd_update(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats) {
+    _optimiser_run(opt, parameters, gradients, n_floats, opt->learning_rate, 1.0f);
+}
 
-void _sgd_update(Optimiser* opt, Layer* layer) {
-    tensor_add_scaled_inplace(layer->weights, layer->d_weights, -opt->learning_rate);
-    tensor_add_scaled_inplace(layer->biases, layer->d_biases, -opt->learning_rate);
+
+
+/**
+ * v = beta1 * v + g, w = w - lr * v.
+ */
+void _sgd_m_update(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats) {
+    if (!optimiser_prepare(opt, n_floats)) return;
+    _optimiser_run(opt, parameters, gradients, n_floats, opt->learning_rate, 1.0f);
 }
 
 
 
-void _sgd_m_update(Optimiser* opt, Layer* layer, int layer_idx) {
-    (void)opt;
-    (void)layer;
-    (void)layer_idx;
+/**
+ * Adam step. The bias corrections of both moments are folded into two scalars:
+ * w = w - lr / (1 - beta1^t) * m / (sqrt(v) / sqrt(1 - beta2^t) + epsilon), which is lr * m_hat / (sqrt(v_hat) + epsilon).
+ */
+void _adam_update(Optimiser* opt, float* parameters, const float* gradients, size_t n_floats) {
+    if (!optimiser_prepare(opt, n_floats)) return;
+
+    opt->time_step++;
+    float step = (float)(opt->learning_rate / (1.0 - pow(opt->beta1, opt->time_step)));
+    float correction = (float)(1.0 / sqrt(1.0 - pow(opt->beta2, opt->time_step)));
+
+    _optimiser_run(opt, parameters, gradients, n_floats, step, correction);
 }
 
 
 
-void _adam_update(Optimiser* opt, Layer* layer, int layer_idx) {
-    (void)opt;
-    (void)layer;
-    (void)layer_idx;
+/**
+ * Runs the kernel of the optimiser over the whole buffers, cut into chunks of OPTIMISER_PARALLEL_GRAIN floats spread
+ * over the default thread pool.
+ */
+void _optimiser_run(const Optimiser* opt, float* parameters, const float* gradients, size_t n_floats, float step, float correction) {
+    OptimiserJob job = {opt, parameters, gradients, n_floats, step, correction};
+
+    int n_chunks = (int)((n_floats + OPTIMISER_PARALLEL_GRAIN - 1) / OPTIMISER_PARALLEL_GRAIN);
+    threadpool_parallel_for(get_default_threadpool(), 0, n_chunks, 1, _optimiser_update_chunks, &job);
+}
+
+
+
+/**
+ * Task of an update: runs the kernel over chunks [begin, end) of the buffers.
+ */
+void _optimiser_update_chunks(int begin, int end, void* arg) {
+    OptimiserJob* job = (OptimiserJob*) arg;
+    const Optimiser* opt = job->opt;
+    const SimdKernels* k = simd_kernels();
+
+    for (int c = begin; c < end; c++) {
+        size_t first = (size_t)c * OPTIMISER_PARALLEL_GRAIN;
+        int n = (job->n_floats - first < OPTIMISER_PARALLEL_GRAIN) ? (int)(job->n_floats - first) : OPTIMISER_PARALLEL_GRAIN;
+
+        float* w = job->parameters + first;
+        const float* g = job->gradients + first;
+
+        switch (opt->type) {
+            case SGD_MOMENTUM: k->momentum(w, g, opt->m + first, job->step, opt->beta1, n); break;
+            case ADAM: k->adam(w, g, opt->m + first, opt->v + first, opt->beta1, opt->beta2, job->step, job->correction, opt->epsilon, n); break;
+            default: k->axpy(w, -job->step, g, n); break;
+        }
+    }
 }
\ No newline at end of file
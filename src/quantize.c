@@ -0,0 +1,1180 @@
+#include "quantize.h"
+#include "quantize_internal.h"
+#include "simd.h"
+#include "threadpool.h"
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+
+
+#define QUANTIZED_ALIGNMENT     64
+
+/* Below this many multiply-adds a layer is not worth splitting over the thread pool */
+#define QUANTIZED_PARALLEL_MIN_WORK     (64 * 64 * 64)
+
+#define QUANTIZED_FILE_BYTE_ORDER       0x01020304u
+
+
+
+/* The requantization of the activations is written with 4 wide vectors, what the baseline x86-64 target has */
+typedef float v4f __attribute__((vector_size(16)));
+typedef float v4f_unaligned __attribute__((vector_size(16), aligned(4)));
+typedef int v4i __attribute__((vector_size(16)));
+typedef uint8_t v4b __attribute__((vector_size(4)));
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+/* Start of a quantized model file, followed by one QuantizedFileLayer per layer, then the weight scales, biases
+   and packed weights of every layer in turn */
+typedef struct QuantizedFileHeader {
+    char magic[8];                      // QUANTIZED_FILE_MAGIC
+    uint32_t version;                   // QUANTIZED_FILE_VERSION
+    uint32_t byte_order;                // QUANTIZED_FILE_BYTE_ORDER
+    int32_t input_feature_size;
+    int32_t n_layers;
+    int32_t loss_type;
+    int32_t reserved;
+} QuantizedFileHeader;
+
+typedef struct QuantizedFileLayer {
+    int32_t n_neurons;
+    int32_t n_neurons_prev;
+    int32_t activation;
+    int32_t input_zero_point;
+    float input_scale;
+    int32_t reserved;
+} QuantizedFileLayer;
+
+/* Shared by the tasks of one layer of quantized inference, task t computes the rows [t * QUANTIZED_MR, (t + 1) * QUANTIZED_MR) */
+typedef struct QuantizedLayerJob {
+    const QuantizedLayer* layer;
+    const uint8_t* input; int ld_input;     // rows x k_padded of the layer
+    int rows;
+    int fuse;                               // 1 if the activation (RELU, LINEAR) is applied to the float result before it is stored
+    uint8_t* q_out; int ld_q;               // Quantized input of the next layer, NULL to store floats
+    float q_inv_scale; int q_zero_point;    // Quantization of the next layer
+    int q_padded;                           // k_padded of the next layer, the columns past n_neurons get the zero point
+    float* f_out; int ld_f;                 // Float result (if q_out is NULL)
+} QuantizedLayerJob;
+
+/* Tile kernel compiled for the widest instruction set of the host (AVX-512 VNNI if it has it), picked on the first inference */
+static void (*quantized_tile)(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]) = NULL;
+static pthread_once_t quantized_once = PTHREAD_ONCE_INIT;
+
+void _quantized_init();
+int _quantized_layer_alloc(QuantizedLayer* layer, int n_neurons, int n_neurons_prev, activation_function activation);
+void _quantized_layer_free(QuantizedLayer* layer);
+void _quantized_layer_finish(QuantizedLayer* layer);
+void _quantize_weights(QuantizedLayer* layer, const Layer* src);
+void _quantize_choose(float min, float max, float* scale, int* zero_point);
+void _quantize_range(const float* x, int ld, int rows, int cols, float* min, float* max);
+int _quantize_calibrate(const Network* net, const Tensor* calibration, float* mins, float* maxs);
+void _quantize_rows(const float* x, int ld, int rows, int cols, float scale, int zero_point, uint8_t* q, int ldq, int padded);
+void _quantized_activate_rows(float* x, int ld, int rows, int cols, activation_function activation);
+void _quantized_widths(const QuantizedNetwork* qnet, int* width, int* float_width);
+void _quantized_layer_rows(int begin, int end, void* arg);
+void _quantized_run_layer(const QuantizedLayerJob* job);
+int _quantized_argmax(const float* row, int n);
+double _quantized_now();
+size_t _quantized_image(const QuantizedNetwork* qnet, char* image);
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Quantizes a trained network for inference (post-training quantization). The weights of every neuron are rounded
+ * to int8 with a scale of their own. The float network is then run on the calibration samples to record the range
+ * of the input of every layer, which gives the scale of its uint8 activations. The network itself is not changed.
+ * Returns NULL if any error.
+ *
+ * @param net The trained network.
+ * @param calibration A few hundred representative inputs (number_of_samples x features of single input).
+*/
+QuantizedNetwork* network_quantize(const Network* net, const Tensor* calibration) {
+    if (!net || !calibration) {
+        if (!net) printf("The net passed is NULL\n");
+        if (!calibration) printf("The calibration tensor passed is NULL\n");
+        return NULL;
+    }
+
+    if (net->n_layers == 0) {printf("There are no layers in the neural network\n"); return NULL;}
+    if (calibration->cols != net->input_feature_size || calibration->rows == 0) {
+        if (calibration->cols != net->input_feature_size) printf("Mismatch between cols of the calibration tensor and network's input feature size\n");
+        if (calibration->rows == 0) printf("The calibration tensor has no samples\n");
+        return NULL;
+    }
+
+    float* mins = (float*) malloc(2 * net->n_layers * sizeof(float));
+    if (!mins) {printf("Malloc failed for calibration ranges\n"); return NULL;}
+    float* maxs = mins + net->n_layers;
+
+    if (!_quantize_calibrate(net, calibration, mins, maxs)) {free(mins); return NULL;}
+
+    QuantizedNetwork* qnet = (QuantizedNetwork*) calloc(1, sizeof(QuantizedNetwork));
+    if (qnet) qnet->layers = (QuantizedLayer*) calloc(net->n_layers, sizeof(QuantizedLayer));
+    if (qnet) qnet->loss_func = create_loss(net->loss_func->type);
+    if (!qnet || !qnet->layers || !qnet->loss_func) {
+        printf("Malloc failed for quantized network\n");
+        free_quantized_network(&qnet);
+        free(mins);
+        return NULL;
+    }
+
+    qnet->input_feature_size = net->input_feature_size;
+    qnet->n_layers = net->n_layers;
+
+    for (int l = 0; l < net->n_layers; l++) {
+        const Layer* src = net->layers[l];
+        QuantizedLayer* layer = &qnet->layers[l];
+
+        if (!_quantized_layer_alloc(layer, src->n_neurons, src->n_neurons_prev, src->activation->func)) {
+            free_quantized_network(&qnet);
+            free(mins);
+            return NULL;
+        }
+
+        _quantize_choose(mins[l], maxs[l], &layer->input_scale, &layer->input_zero_point);
+        _quantize_weights(layer, src);
+        _quantized_layer_finish(layer);
+    }
+
+    free(mins);
+    return qnet;
+}
+
+
+
+/**
+ * Completely frees a quantized network.
+*/
+void free_quantized_network(QuantizedNetwork** qnet) {
+    if (qnet && *qnet) {
+        if ((*qnet)->layers) {
+            for (int l = 0; l < (*qnet)->n_layers; l++) _quantized_layer_free(&(*qnet)->layers[l]);
+        }
+        free((*qnet)->layers);
+        free_loss(&(*qnet)->loss_func);
+        free(*qnet);
+        *qnet = NULL;
+    }
+}
+
+
+
+/**
+ * Returns the number of bytes of the parameters of the quantized network (int8 weights, padding included, and float scales and biases).
+ *
+ * @param qnet The quantized network.
+*/
+size_t quantized_network_bytes(const QuantizedNetwork* qnet) {
+    if (!qnet) return 0;
+
+    size_t bytes = 0;
+    for (int l = 0; l < qnet->n_layers; l++) {
+        const QuantizedLayer* layer = &qnet->layers[l];
+        bytes += (size_t)layer->k_padded * layer->n_padded;
+        bytes += (2 * (size_t)layer->n_neurons + 2 * (size_t)layer->n_padded) * sizeof(float);
+    }
+
+    return bytes;
+}
+
+
+
+/**
+ * Allocates the buffers of a layer of n_neurons outputs and n_neurons_prev inputs (weights zeroed, padding included).
+ * Returns 0 if any error.
+ */
+int _quantized_layer_alloc(QuantizedLayer* layer, int n_neurons, int n_neurons_prev, activation_function activation) {
+    layer->n_neurons = n_neurons;
+    layer->n_neurons_prev = n_neurons_prev;
+    layer->k_padded = (n_neurons_prev + QUANTIZED_GROUP - 1) / QUANTIZED_GROUP * QUANTIZED_GROUP;
+    layer->n_padded = (n_neurons + QUANTIZED_PANEL_COLS - 1) / QUANTIZED_PANEL_COLS * QUANTIZED_PANEL_COLS;
+    layer->activation = activation;
+
+    size_t weight_bytes = (size_t)layer->k_padded * layer->n_padded;     /* A multiple of QUANTIZED_GROUP * QUANTIZED_PANEL_COLS = 128 */
+    weight_bytes = (weight_bytes + QUANTIZED_ALIGNMENT - 1) & ~((size_t)QUANTIZED_ALIGNMENT - 1);
+
+    layer->weights = (int8_t*) aligned_alloc(QUANTIZED_ALIGNMENT, weight_bytes);
+    layer->weight_scales = (float*) calloc(n_neurons, sizeof(float));
+    layer->float_biases = (float*) calloc(n_neurons, sizeof(float));
+    layer->scales = (float*) calloc(layer->n_padded, sizeof(float));
+    layer->biases = (float*) calloc(layer->n_padded, sizeof(float));
+
+    if (!layer->weights || !layer->weight_scales || !layer->float_biases || !layer->scales || !layer->biases) {
+        printf("Malloc failed for a quantized layer of %d x %d\n", n_neurons_prev, n_neurons);
+        _quantized_layer_free(layer);
+        return 0;
+    }
+
+    memset(layer->weights, 0, weight_bytes);
+    return 1;
+}
+
+
+
+/**
+ * Frees the buffers of a layer (not the layer itself, which lives in the array of its network).
+ */
+void _quantized_layer_free(QuantizedLayer* layer) {
+    free(layer->weights);
+    free(layer->weight_scales);
+    free(layer->float_biases);
+    free(layer->scales);
+    free(layer->biases);
+
+    layer->weights = NULL;
+    layer->weight_scales = NULL;
+    layer->float_biases = NULL;
+    layer->scales = NULL;
+    layer->biases = NULL;
+}
+
+
+
+/**
+ * Derives what inference uses from the weights, weight scales, float biases and input quantization of the layer:
+ * scales[j] = input_scale * weight_scales[j] and biases[j] = float_biases[j] - scales[j] * input_zero_point * sum_k q[k][j].
+ * Padding columns get 0 for both.
+ */
+void _quantized_layer_finish(QuantizedLayer* layer) {
+    int groups = layer->k_padded / QUANTIZED_GROUP;
+
+    for (int j = 0; j < layer->n_padded; j++) {
+        layer->scales[j] = 0.0f;
+        layer->biases[j] = 0.0f;
+    }
+
+    for (int j = 0; j < layer->n_neurons; j++) {
+        const int8_t* panel = layer->weights + (size_t)(j / QUANTIZED_PANEL_COLS) * groups * QUANTIZED_GROUP * QUANTIZED_PANEL_COLS;
+        int col = j % QUANTIZED_PANEL_COLS;
+
+        int sum = 0;
+        for (int g = 0; g < groups; g++) {
+            const int8_t* w = panel + ((size_t)g * QUANTIZED_PANEL_COLS + col) * QUANTIZED_GROUP;
+            for (int t = 0; t < QUANTIZED_GROUP; t++) sum += w[t];
+        }
+
+        layer->scales[j] = layer->input_scale * layer->weight_scales[j];
+        layer->biases[j] = layer->float_biases[j] - layer->scales[j] * (float)layer->input_zero_point * (float)sum;
+    }
+}
+
+
+
+// ==========================================
+//             Quantization
+// ==========================================
+
+/**
+ * Rounds the weights of every neuron (column of the float weights) to int8 with the scale absmax / 127 and packs
+ * them in panels: weights of columns [32p, 32p + 32) sit in panel p, inputs [4g, 4g + 4) of a column are contiguous.
+ * Copies the biases.
+ */
+void _quantize_weights(QuantizedLayer* layer, const Layer* src) {
+    const Tensor* w = src->weights;
+    int groups = layer->k_padded / QUANTIZED_GROUP;
+
+    for (int j = 0; j < layer->n_neurons; j++) {
+        float absmax = 0.0f;
+        for (int k = 0; k < layer->n_neurons_prev; k++) {
+            float v = fabsf(w->data[k * w->stride + j]);
+            if (v > absmax) absmax = v;
+        }
+
+        float scale = (absmax > 0.0f) ? absmax / 127.0f : 1.0f;
+        layer->weight_scales[j] = scale;
+        layer->float_biases[j] = src->biases->data[j];
+
+        int8_t* panel = layer->weights + (size_t)(j / QUANTIZED_PANEL_COLS) * groups * QUANTIZED_GROUP * QUANTIZED_PANEL_COLS;
+        int col = j % QUANTIZED_PANEL_COLS;
+
+        for (int k = 0; k < layer->n_neurons_prev; k++) {
+            float q = rintf(w->data[k * w->stride + j] / scale);
+            if (q > 127.0f) q = 127.0f;
+            if (q < -127.0f) q = -127.0f;
+            panel[((size_t)(k / QUANTIZED_GROUP) * QUANTIZED_PANEL_COLS + col) * QUANTIZED_GROUP + k % QUANTIZED_GROUP] = (int8_t)q;
+        }
+    }
+}
+
+
+
+/**
+ * Picks the quantization of values seen in [min, max]: 256 steps spread over the range widened to contain 0
+ * (so 0, the padding and RELU's floor, is exact). Inputs that were never negative get zero point 0.
+ */
+void _quantize_choose(float min, float max, float* scale, int* zero_point) {
+    if (min > 0.0f) min = 0.0f;
+    if (max < 0.0f) max = 0.0f;
+
+    if (max - min <= 0.0f) {
+        *scale = 1.0f;
+        *zero_point = 0;
+        return;
+    }
+
+    *scale = (max - min) / 255.0f;
+    int zp = (int)rintf(-min / *scale);
+    *zero_point = (zp < 0) ? 0 : (zp > 255) ? 255 : zp;
+}
+
+
+
+/**
+ * Widens [min, max] to the values of a rows x cols matrix.
+ */
+void _quantize_range(const float* x, int ld, int rows, int cols, float* min, float* max) {
+    float lo = *min, hi = *max;
+    for (int i = 0; i < rows; i++) {
+        const float* row = x + (size_t)i * ld;
+        for (int c = 0; c < cols; c++) {
+            lo = (row[c] < lo) ? row[c] : lo;
+            hi = (row[c] > hi) ? row[c] : hi;
+        }
+    }
+    *min = lo;
+    *max = hi;
+}
+
+
+
+/**
+ * Runs the float network over the calibration samples in batches of QUANTIZE_CALIBRATION_BATCH and records the range
+ * of the input of every layer in mins[l] and maxs[l].
+ * Returns 0 if any error.
+ */
+int _quantize_calibrate(const Network* net, const Tensor* calibration, float* mins, float* maxs) {
+    int width = 0;
+    for (int l = 0; l < net->n_layers; l++) {
+        if (net->layers[l]->n_neurons > width) width = net->layers[l]->n_neurons;
+        mins[l] = 0.0f;
+        maxs[l] = 0.0f;
+    }
+
+    float* buffers = (float*) malloc(2 * (size_t)QUANTIZE_CALIBRATION_BATCH * width * sizeof(float));
+    if (!buffers) {printf("Malloc failed for calibration buffers\n"); return 0;}
+
+    for (int start = 0; start < calibration->rows; start += QUANTIZE_CALIBRATION_BATCH) {
+        int rows = (calibration->rows - start < QUANTIZE_CALIBRATION_BATCH) ? calibration->rows - start : QUANTIZE_CALIBRATION_BATCH;
+
+        Tensor current = tensor_slice_rows(calibration, start, rows);
+        _quantize_range(current.data, current.stride, rows, current.cols, &mins[0], &maxs[0]);
+
+        /* The output of the last layer is nobody's input */
+        for (int l = 0; l < net->n_layers - 1; l++) {
+            const Layer* layer = net->layers[l];
+            Tensor out = {buffers + (size_t)(l % 2) * QUANTIZE_CALIBRATION_BATCH * width, rows, layer->n_neurons, layer->n_neurons, 0};
+
+            if (!forward_pass_inference(layer, &current, &out)) {printf("Forward pass failed while calibrating\n"); free(buffers); return 0;}
+
+            _quantize_range(out.data, out.stride, rows, out.cols, &mins[l + 1], &maxs[l + 1]);
+            current = out;
+        }
+    }
+
+    free(buffers);
+    return 1;
+}
+
+
+
+/**
+ * Quantizes 4 floats to uint8 at dst: clamp(round(x * inv_scale) + zero_point, 0, 255), half_zero_point being zero_point + 0.5.
+ * The masks also send NaN to 0.
+ */
+static inline __attribute__((always_inline)) void _quantize_v4(v4f x, v4f inv_scale, v4f half_zero_point, uint8_t* dst) {
+    const v4f top = (v4f){0} + 255.5f;
+
+    x = x * inv_scale + half_zero_point;
+    v4i inside = x > (v4f){0};
+    x = (v4f)(inside & (v4i)x);
+    inside = x < top;
+    x = (v4f)((inside & (v4i)x) | (~inside & (v4i)top));
+
+    v4b q = __builtin_convertvector(__builtin_convertvector(x, v4i), v4b);
+    memcpy(dst, &q, sizeof(v4b));
+}
+
+
+
+/**
+ * Quantizes a rows x cols matrix of floats to uint8 rows of q (ldq bytes apart): q = clamp(round(x / scale) + zero_point, 0, 255).
+ * Columns [cols, padded) get the zero point, which is 0 once dequantized.
+ */
+void _quantize_rows(const float* x, int ld, int rows, int cols, float scale, int zero_point, uint8_t* q, int ldq, int padded) {
+    v4f inv = (v4f){0} + 1.0f / scale;
+    v4f half_zp = (v4f){0} + ((float)zero_point + 0.5f);
+
+    for (int i = 0; i < rows; i++) {
+        const float* src = x + (size_t)i * ld;
+        uint8_t* dst = q + (size_t)i * ldq;
+
+        int c = 0;
+        for (; c + 4 <= cols; c += 4) _quantize_v4(*(const v4f_unaligned*)(src + c), inv, half_zp, dst + c);
+        if (c < cols) {
+            float tail[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            uint8_t bytes[4];
+            memcpy(tail, src + c, (cols - c) * sizeof(float));
+            _quantize_v4(*(const v4f_unaligned*)tail, inv, half_zp, bytes);
+            memcpy(dst + c, bytes, cols - c);
+        }
+        for (c = cols; c < padded; c++) dst[c] = (uint8_t)zero_point;
+    }
+}
+
+
+
+// ==========================================
+//             Inference
+// ==========================================
+
+/**
+ * Returns a new context for quantized inference with qnet, sized for batches of up to max_batch samples (it grows if a larger batch comes).
+ * Returns NULL if any error.
+ *
+ * @param qnet The quantized network the context is used with.
+ * @param max_batch Largest number of samples expected in one call.
+*/
+QuantizedContext* create_quantized_context(const QuantizedNetwork* qnet, int max_batch) {
+    if (!qnet || max_batch <= 0) {
+        if (!qnet) printf("The quantized net passed is NULL\n");
+        if (max_batch <= 0) printf("max_batch needs to be a non zero positive integer\n");
+        return NULL;
+    }
+
+    QuantizedContext* ctx = (QuantizedContext*) calloc(1, sizeof(QuantizedContext));
+    if (!ctx) {printf("Malloc failed for quantized inference context\n"); return NULL;}
+
+    _quantized_widths(qnet, &ctx->width, &ctx->float_width);
+    ctx->rows = max_batch;
+
+    ctx->activations = (uint8_t*) malloc(2 * (size_t)max_batch * ctx->width);
+    if (ctx->float_width > 0) ctx->scratch = (float*) malloc((size_t)max_batch * ctx->float_width * sizeof(float));
+    if (!ctx->activations || (ctx->float_width > 0 && !ctx->scratch)) {
+        printf("Malloc failed for quantized inference buffers\n");
+        free_quantized_context(&ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+
+
+/**
+ * Completely frees a quantized inference context.
+*/
+void free_quantized_context(QuantizedContext** ctx) {
+    if (ctx && *ctx) {
+        free((*ctx)->activations);
+        free((*ctx)->scratch);
+        free(*ctx);
+        *ctx = NULL;
+    }
+}
+
+
+
+/**
+ * Widest k_padded of the layers (a row of quantized activations) and widest hidden layer (a row of float scratch).
+ */
+void _quantized_widths(const QuantizedNetwork* qnet, int* width, int* float_width) {
+    *width = 0;
+    *float_width = 0;
+
+    for (int l = 0; l < qnet->n_layers; l++) {
+        if (qnet->layers[l].k_padded > *width) *width = qnet->layers[l].k_padded;
+        if (l < qnet->n_layers - 1 && qnet->layers[l].n_neurons > *float_width) *float_width = qnet->layers[l].n_neurons;
+    }
+}
+
+
+
+/**
+ * Writes the prediction of the quantized network for input into out. The input is quantized to uint8, every layer is
+ * an int8 x uint8 product summed in int32 (AVX-512 VNNI when the CPU has it), whose result is scaled back, biased,
+ * activated and quantized again for the next layer in the same pass. The last layer writes floats.
+ * The network is read only, so several threads may call this at once with their own context and output.
+ * Returns 0 if any error.
+ *
+ * @param qnet The quantized network.
+ * @param ctx Context of the calling thread (created for qnet).
+ * @param input Input tensor (number_of_inputs x features of single input).
+ * @param out Destination (number_of_inputs x neurons of the last layer).
+*/
+int quantized_network_predict_into(const QuantizedNetwork* qnet, QuantizedContext* ctx, const Tensor* input, Tensor* out) {
+    if (!qnet || !ctx || !input || !out) {
+        if (!qnet) printf("The quantized net passed is NULL\n");
+        if (!ctx) printf("The quantized inference context passed is NULL\n");
+        if (!input) printf("The input tensor passed is NULL\n");
+        if (!out) printf("The output tensor passed is NULL\n");
+        return 0;
+    }
+
+    if (qnet->n_layers == 0) {printf("There are no layers in the quantized network\n"); return 0;}
+
+    const QuantizedLayer* last = &qnet->layers[qnet->n_layers - 1];
+    if (input->cols != qnet->input_feature_size || out->rows != input->rows || out->cols != last->n_neurons) {
+        if (input->cols != qnet->input_feature_size) printf("Mismatch between features of a single input between network and the input tensor passed\n");
+        if (out->rows != input->rows || out->cols != last->n_neurons) printf("The output tensor passed is not (inputs x neurons of the last layer)\n");
+        return 0;
+    }
+
+    int width, float_width;
+    _quantized_widths(qnet, &width, &float_width);
+    if (ctx->width != width || ctx->float_width != float_width) {printf("Quantized inference context was created for another network\n"); return 0;}
+
+    if (input->rows > ctx->rows) {
+        uint8_t* activations = (uint8_t*) realloc(ctx->activations, 2 * (size_t)input->rows * width);
+        if (activations) ctx->activations = activations;
+        float* scratch = ctx->scratch;
+        if (activations && float_width > 0) {
+            scratch = (float*) realloc(ctx->scratch, (size_t)input->rows * float_width * sizeof(float));
+            if (scratch) ctx->scratch = scratch;
+        }
+        if (!activations || !scratch) {printf("Realloc failed for quantized inference buffers\n"); return 0;}
+        ctx->rows = input->rows;
+    }
+
+    pthread_once(&quantized_once, _quantized_init);
+
+    uint8_t* q[2] = {ctx->activations, ctx->activations + (size_t)ctx->rows * width};
+    const QuantizedLayer* first = &qnet->layers[0];
+    _quantize_rows(input->data, input->stride, input->rows, input->cols, first->input_scale, first->input_zero_point, q[0], first->k_padded, first->k_padded);
+
+    for (int l = 0; l < qnet->n_layers; l++) {
+        const QuantizedLayer* layer = &qnet->layers[l];
+        const QuantizedLayer* next = (l < qnet->n_layers - 1) ? &qnet->layers[l + 1] : NULL;
+
+        QuantizedLayerJob job;
+        memset(&job, 0, sizeof(QuantizedLayerJob));
+        job.layer = layer;
+        job.input = q[l % 2];
+        job.ld_input = layer->k_padded;
+        job.rows = input->rows;
+        job.fuse = (layer->activation == RELU || layer->activation == LINEAR);
+
+        if (next && job.fuse) {
+            job.q_out = q[(l + 1) % 2];
+            job.ld_q = next->k_padded;
+            job.q_inv_scale = 1.0f / next->input_scale;
+            job.q_zero_point = next->input_zero_point;
+            job.q_padded = next->k_padded;
+        } else {
+            job.f_out = next ? ctx->scratch : out->data;
+            job.ld_f = next ? layer->n_neurons : out->stride;
+        }
+
+        _quantized_run_layer(&job);
+
+        /* Sigmoid and softmax run on the float result, which the next layer then quantizes */
+        if (!job.fuse) _quantized_activate_rows(job.f_out, job.ld_f, input->rows, layer->n_neurons, layer->activation);
+        if (next && !job.fuse) {
+            _quantize_rows(job.f_out, job.ld_f, input->rows, layer->n_neurons, next->input_scale, next->input_zero_point, q[(l + 1) % 2], next->k_padded, next->k_padded);
+        }
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * Gives new prediction tensor of the quantized network for the input.
+ * Returns NULL if any error.
+ *
+ * @param qnet The quantized network.
+ * @param input Input tensor (number_of_inputs x features of single input).
+*/
+Tensor* quantized_network_predict(const QuantizedNetwork* qnet, const Tensor* input) {
+    if (!qnet || !input) {
+        if (!qnet) printf("The quantized net passed is NULL\n");
+        if (!input) printf("The input tensor passed is NULL\n");
+        return NULL;
+    }
+
+    if (qnet->n_layers == 0) {printf("There are no layers in the quantized network\n"); return NULL;}
+
+    Tensor* res = create_tensor_value(input->rows, qnet->layers[qnet->n_layers - 1].n_neurons, 0.0f);
+    if (!res) {printf("Prediction tensor could not be allocated\n"); return NULL;}
+
+    QuantizedContext* ctx = create_quantized_context(qnet, input->rows);
+    if (!ctx || !quantized_network_predict_into(qnet, ctx, input, res)) free_tensor(&res);
+
+    free_quantized_context(&ctx);
+    return res;
+}
+
+
+
+/**
+ * Applies an activation to a rows x cols matrix of floats in place.
+ */
+void _quantized_activate_rows(float* x, int ld, int rows, int cols, activation_function activation) {
+    const SimdKernels* k = simd_kernels();
+
+    for (int i = 0; i < rows; i++) {
+        float* row = x + (size_t)i * ld;
+        switch (activation) {
+            case RELU: k->relu(row, RELU_NEGATIVE_SLOPE, cols); break;
+            case SIGMOID: k->sigmoid(row, cols); break;
+            case SOFTMAX: k->softmax(row, cols); break;
+            default: break;
+        }
+    }
+}
+
+
+
+/**
+ * Runs one layer over all the rows of the job, spread over the default thread pool by blocks of QUANTIZED_MR rows
+ * when the product is large enough.
+ */
+void _quantized_run_layer(const QuantizedLayerJob* job) {
+    int n_tiles = (job->rows + QUANTIZED_MR - 1) / QUANTIZED_MR;
+    long tile_work = (long)QUANTIZED_MR * job->layer->k_padded * job->layer->n_padded;
+
+    int grain = (int)(QUANTIZED_PARALLEL_MIN_WORK / tile_work) + 1;
+    threadpool_parallel_for(get_default_threadpool(), 0, n_tiles, grain, _quantized_layer_rows, (void*)job);
+}
+
+
+
+/**
+ * Task of a layer: computes the rows of tiles [begin, end) against every panel of weights and runs the epilogue:
+ * y = acc * scales[j] + biases[j], activated if fused, then either quantized for the next layer or stored as floats.
+ */
+void _quantized_layer_rows(int begin, int end, void* arg) {
+    const QuantizedLayerJob* job = (const QuantizedLayerJob*) arg;
+    const QuantizedLayer* layer = job->layer;
+
+    int groups = layer->k_padded / QUANTIZED_GROUP;
+    int n_panels = layer->n_padded / QUANTIZED_PANEL_COLS;
+    v4f slope = (v4f){0} + ((job->fuse && layer->activation == RELU) ? RELU_NEGATIVE_SLOPE : 1.0f);
+    v4f inv = (v4f){0} + job->q_inv_scale;
+    v4f half_zp = (v4f){0} + ((float)job->q_zero_point + 0.5f);
+
+    int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS] __attribute__((aligned(64)));
+
+    for (int t = begin; t < end; t++) {
+        int row = t * QUANTIZED_MR;
+        int mr = (job->rows - row < QUANTIZED_MR) ? job->rows - row : QUANTIZED_MR;
+        const uint8_t* a = job->input + (size_t)row * job->ld_input;
+
+        for (int p = 0; p < n_panels; p++) {
+            quantized_tile(groups, a, job->ld_input, mr, layer->weights + (size_t)p * groups * QUANTIZED_GROUP * QUANTIZED_PANEL_COLS, tile);
+
+            int col = p * QUANTIZED_PANEL_COLS;
+            int nr = (layer->n_neurons - col < QUANTIZED_PANEL_COLS) ? layer->n_neurons - col : QUANTIZED_PANEL_COLS;
+
+            for (int i = 0; i < mr; i++) {
+                float y[QUANTIZED_PANEL_COLS] __attribute__((aligned(16)));
+                uint8_t q[QUANTIZED_PANEL_COLS];
+
+                for (int c = 0; c < QUANTIZED_PANEL_COLS; c += 4) {
+                    v4f v = __builtin_convertvector(*(const v4i*)&tile[i][c], v4f) * *(const v4f_unaligned*)(layer->scales + col + c)
+                          + *(const v4f_unaligned*)(layer->biases + col + c);
+                    v4i positive = v > (v4f){0};
+                    v = (v4f)((positive & (v4i)v) | (~positive & (v4i)(v * slope)));
+
+                    if (job->q_out) _quantize_v4(v, inv, half_zp, q + c);
+                    else *(v4f*)(y + c) = v;
+                }
+
+                if (job->q_out) memcpy(job->q_out + (size_t)(row + i) * job->ld_q + col, q, nr);
+                else memcpy(job->f_out + (size_t)(row + i) * job->ld_f + col, y, nr * sizeof(float));
+            }
+        }
+
+        /* Padding inputs of the next layer, their weights are 0 */
+        if (job->q_out) {
+            for (int i = 0; i < mr; i++) {
+                uint8_t* dst = job->q_out + (size_t)(row + i) * job->ld_q;
+                for (int c = layer->n_neurons; c < job->q_padded; c++) dst[c] = (uint8_t)job->q_zero_point;
+            }
+        }
+    }
+}
+
+
+
+// ==========================================
+//             Kernels
+// ==========================================
+
+/**
+ * Picks the tile kernel for the instruction set of the host. Runs once, on the first inference.
+ */
+void _quantized_init() {
+    quantized_tile = _quantized_tile_generic;
+#if SIMD_X86
+    if (simd_get_level() >= SIMD_AVX2) quantized_tile = _quantized_tile_avx2;
+    if (simd_get_level() == SIMD_AVX512) {
+        __builtin_cpu_init();
+        /* Checked with every extension the kernel is built for, as the AVX-512 level only means AVX-512F */
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) quantized_tile = _quantized_tile_vnni;
+    }
+#endif
+}
+
+
+
+/**
+ * Portable tile: the mr rows of a (groups * QUANTIZED_GROUP uint8 inputs each, lda apart) against one packed panel b,
+ * summed in int32 into tile.
+ */
+void _quantized_tile_generic(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]) {
+    int32_t acc[QUANTIZED_MR][QUANTIZED_PANEL_COLS] __attribute__((aligned(64)));
+    memset(acc, 0, sizeof(acc));
+
+    for (int g = 0; g < groups; g++) {
+        const int8_t* bg = b + (size_t)g * QUANTIZED_PANEL_COLS * QUANTIZED_GROUP;
+
+        for (int i = 0; i < mr; i++) {
+            const uint8_t* x = a + (size_t)i * lda + g * QUANTIZED_GROUP;
+            int32_t x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3];
+
+            for (int c = 0; c < QUANTIZED_PANEL_COLS; c++) {
+                const int8_t* w = bg + c * QUANTIZED_GROUP;
+                acc[i][c] += x0 * w[0] + x1 * w[1] + x2 * w[2] + x3 * w[3];
+            }
+        }
+    }
+
+    memcpy(tile, acc, sizeof(acc));
+}
+
+
+
+#if SIMD_X86
+
+/**
+ * AVX2 tile, for hosts without VNNI: the 16 weights of 4 columns are widened to int16 and vpmaddwd multiplies them by
+ * the 4 inputs of the row (also widened, repeated) and adds pairs of products, leaving two int32 sums per column which
+ * are added at the end. One row at a time (8 accumulators for the 32 columns).
+ */
+__attribute__((target("avx2"))) void _quantized_tile_avx2(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]) {
+    for (int i = 0; i < mr; i++) {
+        const uint8_t* x = a + (size_t)i * lda;
+        const int8_t* bg = b;
+
+        __m256i acc[QUANTIZED_PANEL_COLS / 4];
+        for (int j = 0; j < QUANTIZED_PANEL_COLS / 4; j++) acc[j] = _mm256_setzero_si256();
+
+        for (int g = 0; g < groups; g++) {
+            int32_t xi;
+            memcpy(&xi, x + g * QUANTIZED_GROUP, sizeof(int32_t));
+            __m256i ai = _mm256_set1_epi64x(_mm_cvtsi128_si64(_mm_cvtepu8_epi16(_mm_cvtsi32_si128(xi))));
+
+            for (int j = 0; j < QUANTIZED_PANEL_COLS / 4; j++) {
+                __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(bg + j * 4 * QUANTIZED_GROUP)));
+                acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(w, ai));
+            }
+
+            bg += QUANTIZED_PANEL_COLS * QUANTIZED_GROUP;
+        }
+
+        /* hadd leaves the sums of columns (0, 1, 4, 5 | 2, 3, 6, 7) of the 8 held by two accumulators, the permute orders them */
+        for (int j = 0; j < QUANTIZED_PANEL_COLS / 4; j += 2) {
+            __m256i sums = _mm256_permute4x64_epi64(_mm256_hadd_epi32(acc[j], acc[j + 1]), 0xD8);
+            _mm256_store_si256((__m256i*)&tile[i][j * 4], sums);
+        }
+    }
+}
+
+
+
+/**
+ * AVX-512 VNNI tile: the panel holds QUANTIZED_GROUP inputs of each of its 32 columns contiguously, so one group is two
+ * zmm registers and one vpdpbusd multiplies 4 uint8 inputs (broadcast) by the 4 int8 weights of 16 columns and adds
+ * the 4 products into their int32 sums. Rows past mr repeat the last row (computed, not stored).
+ */
+static inline __attribute__((always_inline, target("avx512f,avx512bw,avx512vnni"))) void _quantized_tile_vnni_body(int rows, int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]) {
+    __m512i acc[QUANTIZED_MR][2];
+    const uint8_t* x[QUANTIZED_MR];
+
+    for (int i = 0; i < rows; i++) {
+        x[i] = a + (size_t)((i < mr) ? i : mr - 1) * lda;
+        acc[i][0] = _mm512_setzero_si512();
+        acc[i][1] = _mm512_setzero_si512();
+    }
+
+    for (int g = 0; g < groups; g++) {
+        __m512i b0 = _mm512_load_si512((const void*)b);
+        __m512i b1 = _mm512_load_si512((const void*)(b + 64));
+
+        for (int i = 0; i < rows; i++) {
+            int32_t xi;
+            memcpy(&xi, x[i] + g * QUANTIZED_GROUP, sizeof(int32_t));
+            __m512i ai = _mm512_set1_epi32(xi);
+            acc[i][0] = _mm512_dpbusd_epi32(acc[i][0], ai, b0);
+            acc[i][1] = _mm512_dpbusd_epi32(acc[i][1], ai, b1);
+        }
+
+        b += QUANTIZED_PANEL_COLS * QUANTIZED_GROUP;
+    }
+
+    for (int i = 0; i < mr; i++) {
+        _mm512_store_si512((void*)&tile[i][0], acc[i][0]);
+        _mm512_store_si512((void*)&tile[i][16], acc[i][1]);
+    }
+}
+
+
+
+/* A batch ending in QUANTIZED_MR / 2 rows or less (a single sample) runs a half tile */
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) void _quantized_tile_vnni(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]) {
+    if (mr > QUANTIZED_MR / 2) _quantized_tile_vnni_body(QUANTIZED_MR, groups, a, lda, mr, b, tile);
+    else _quantized_tile_vnni_body(QUANTIZED_MR / 2, groups, a, lda, mr, b, tile);
+}
+
+#endif
+
+
+
+// ==========================================
+//             Reporting
+// ==========================================
+
+/**
+ * Returns the index of the largest of the n values of row (the first one on ties).
+ */
+int _quantized_argmax(const float* row, int n) {
+    int max_idx = 0;
+    for (int i = 1; i < n; i++) if (row[i] > row[max_idx]) max_idx = i;
+    return max_idx;
+}
+
+
+
+/**
+ * Seconds from a monotonic clock.
+ */
+double _quantized_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+/**
+ * Scores a float network and its quantized copy on the same dataset: accuracy and loss of both, how often they agree,
+ * the largest difference between their outputs, the size of their parameters and the time each takes to predict
+ * the whole dataset in batches of batch_size rows.
+ * Returns 0 if any error.
+ *
+ * @param net The float network.
+ * @param qnet Its quantized copy.
+ * @param x Inputs, one sample per row.
+ * @param y Targets, one sample per row.
+ * @param batch_size Number of samples predicted at once.
+ * @param report Receives the comparison.
+*/
+int quantized_network_report(const Network* net, const QuantizedNetwork* qnet, const Tensor* x, const Tensor* y, int batch_size, QuantizationReport* report) {
+    if (!net || !qnet || !x || !y || !report || batch_size <= 0) {
+        if (!net) printf("The net passed is NULL\n");
+        if (!qnet) printf("The quantized net passed is NULL\n");
+        if (!x) printf("x passed is NULL\n");
+        if (!y) printf("y passed is NULL\n");
+        if (!report) printf("report passed is NULL\n");
+        if (batch_size <= 0) printf("batch_size needs to be a non zero positive integer\n");
+        return 0;
+    }
+
+    if (net->n_layers == 0 || qnet->n_layers == 0) {printf("There are no layers in the neural network\n"); return 0;}
+
+    int n_classes = net->layers[net->n_layers - 1]->n_neurons;
+    if (x->rows != y->rows || x->rows == 0 || y->cols != n_classes || qnet->layers[qnet->n_layers - 1].n_neurons != n_classes) {
+        if (x->rows != y->rows) printf("Mismatch between rows of x and y\n");
+        if (x->rows == 0) printf("x has no samples\n");
+        if (y->cols != n_classes) printf("Mismatch between cols of y and neurons of the last layer\n");
+        if (qnet->layers[qnet->n_layers - 1].n_neurons != n_classes) printf("The quantized network does not have the outputs of the network\n");
+        return 0;
+    }
+
+    if (batch_size > x->rows) batch_size = x->rows;
+
+    InferenceContext* ctx = create_inference_context(net, batch_size);
+    QuantizedContext* qctx = create_quantized_context(qnet, batch_size);
+    Tensor* pred = create_tensor_value(batch_size, n_classes, 0.0f);
+    Tensor* qpred = create_tensor_value(batch_size, n_classes, 0.0f);
+
+    int ok = ctx && qctx && pred && qpred;
+    if (!ok) printf("Malloc failed for the buffers of the report\n");
+
+    /* One untimed batch first, both paths then run warm */
+    if (ok) {
+        Tensor x_batch = tensor_slice_rows(x, 0, batch_size);
+        ok = network_predict_into(net, ctx, &x_batch, pred) && quantized_network_predict_into(qnet, qctx, &x_batch, qpred);
+    }
+
+    memset(report, 0, sizeof(QuantizationReport));
+    double loss = 0.0, qloss = 0.0;
+    int agree = 0;
+
+    for (int start = 0; ok && start < x->rows; start += batch_size) {
+        int rows = (x->rows - start < batch_size) ? x->rows - start : batch_size;
+
+        Tensor x_batch = tensor_slice_rows(x, start, rows);
+        Tensor y_batch = tensor_slice_rows(y, start, rows);
+        Tensor p = tensor_slice_rows(pred, 0, rows);
+        Tensor qp = tensor_slice_rows(qpred, 0, rows);
+
+        double t0 = _quantized_now();
+        ok = network_predict_into(net, ctx, &x_batch, &p);
+        double t1 = _quantized_now();
+        ok = ok && quantized_network_predict_into(qnet, qctx, &x_batch, &qp);
+        double t2 = _quantized_now();
+        if (!ok) break;
+
+        report->fp32_seconds += t1 - t0;
+        report->int8_seconds += t2 - t1;
+
+        loss += (double)net->loss_func->loss(&p, &y_batch) * rows;
+        qloss += (double)net->loss_func->loss(&qp, &y_batch) * rows;
+
+        for (int i = 0; i < rows; i++) {
+            const float* row = &p.data[i * p.stride];
+            const float* qrow = &qp.data[i * qp.stride];
+
+            int target = _quantized_argmax(&y_batch.data[i * y_batch.stride], n_classes);
+            int predicted = _quantized_argmax(row, n_classes);
+            int qpredicted = _quantized_argmax(qrow, n_classes);
+
+            report->fp32.n_correct += (predicted == target);
+            report->int8.n_correct += (qpredicted == target);
+            agree += (predicted == qpredicted);
+
+            for (int c = 0; c < n_classes; c++) {
+                float err = fabsf(row[c] - qrow[c]);
+                if (err > report->max_abs_error) report->max_abs_error = err;
+            }
+        }
+    }
+
+    free_inference_context(&ctx);
+    free_quantized_context(&qctx);
+    free_tensor(&pred);
+    free_tensor(&qpred);
+
+    if (!ok) {printf("The report could not be made\n"); return 0;}
+
+    report->n_samples = x->rows;
+    report->fp32.n_samples = x->rows;
+    report->int8.n_samples = x->rows;
+    report->fp32.accuracy = (float)report->fp32.n_correct / x->rows;
+    report->int8.accuracy = (float)report->int8.n_correct / x->rows;
+    report->fp32.loss = (float)(loss / x->rows);
+    report->int8.loss = (float)(qloss / x->rows);
+    report->accuracy_delta = report->int8.accuracy - report->fp32.accuracy;
+    report->agreement = (float)agree / x->rows;
+    report->fp32_bytes = network_parameter_count(net) * sizeof(float);
+    report->int8_bytes = quantized_network_bytes(qnet);
+
+    return 1;
+}
+
+
+
+/**
+ * Prints a report of quantized_network_report on STDOUT.
+ *
+ * @param report The report.
+*/
+void print_quantization_report(const QuantizationReport* report) {
+    if (!report) {printf("The report passed is NULL\n"); return;}
+
+    printf("Quantization report (%d samples)\n", report->n_samples);
+    printf("            %12s %12s\n", "fp32", "int8");
+    printf("  Accuracy  %11.2f%% %11.2f%%   (delta %+.2f%%)\n", report->fp32.accuracy * 100.0f, report->int8.accuracy * 100.0f, report->accuracy_delta * 100.0f);
+    printf("  Loss      %12f %12f\n", report->fp32.loss, report->int8.loss);
+    printf("  Bytes     %12zu %12zu   (%.2fx smaller)\n", report->fp32_bytes, report->int8_bytes,
+           report->int8_bytes ? (double)report->fp32_bytes / report->int8_bytes : 0.0);
+    printf("  Seconds   %12f %12f   (%.2fx faster)\n", report->fp32_seconds, report->int8_seconds,
+           report->int8_seconds > 0.0 ? report->fp32_seconds / report->int8_seconds : 0.0);
+    printf("  Same class for %.2f%% of the samples, largest output difference %f\n", report->agreement * 100.0f, report->max_abs_error);
+}
+
+
+
+// ==========================================
+//             Saving and Loading
+// ==========================================
+
+/**
+ * Writes the file image of the quantized network into image (if not NULL) and returns its size.
+ * What is derived from the rest (scales and biases of inference) is not stored.
+ */
+size_t _quantized_image(const QuantizedNetwork* qnet, char* image) {
+    size_t offset = sizeof(QuantizedFileHeader) + qnet->n_layers * sizeof(QuantizedFileLayer);
+
+    if (image) {
+        QuantizedFileHeader* header = (QuantizedFileHeader*) image;
+        memset(header, 0, sizeof(QuantizedFileHeader));
+        memcpy(header->magic, QUANTIZED_FILE_MAGIC, sizeof(QUANTIZED_FILE_MAGIC));
+        header->version = QUANTIZED_FILE_VERSION;
+        header->byte_order = QUANTIZED_FILE_BYTE_ORDER;
+        header->input_feature_size = qnet->input_feature_size;
+        header->n_layers = qnet->n_layers;
+        header->loss_type = qnet->loss_func->type;
+    }
+
+    for (int l = 0; l < qnet->n_layers; l++) {
+        const QuantizedLayer* layer = &qnet->layers[l];
+        size_t scale_bytes = layer->n_neurons * sizeof(float);
+        size_t weight_bytes = (size_t)layer->k_padded * layer->n_padded;
+
+        if (image) {
+            QuantizedFileLayer* e = (QuantizedFileLayer*) (image + sizeof(QuantizedFileHeader)) + l;
+            memset(e, 0, sizeof(QuantizedFileLayer));
+            e->n_neurons = layer->n_neurons;
+            e->n_neurons_prev = layer->n_neurons_prev;
+            e->activation = layer->activation;
+            e->input_zero_point = layer->input_zero_point;
+            e->input_scale = layer->input_scale;
+
+            memcpy(image + offset, layer->weight_scales, scale_bytes);
+            memcpy(image + offset + scale_bytes, layer->float_biases, scale_bytes);
+            memcpy(image + offset + 2 * scale_bytes, layer->weights, weight_bytes);
+        }
+
+        offset += 2 * scale_bytes + weight_bytes;
+    }
+
+    return offset;
+}
+
+
+
+/**
+ * Writes the quantized network to a versioned binary file (the int8 weights as packed, a quarter of the float model).
+ * The file is written under a temporary name and renamed, so an existing file is never left half written.
+ * Returns 0 if any error.
+ *
+ * @param qnet The quantized network.
+ * @param path Path of the file.
+*/
+int quantized_network_save(const QuantizedNetwork* qnet, const char* path) {
+    if (!qnet || !path) {
+        if (!qnet) printf("The quantized net passed is NULL\n");
+        if (!path) printf("The path passed is NULL\n");
+        return 0;
+    }
+
+    /* quantized_network_load would refuse the file */
+    if (qnet->loss_func->type != MSE) {printf("The loss of the quantized net is not supported in model files (only MSE is implemented)\n"); return 0;}
+
+    size_t size = _quantized_image(qnet, NULL);
+    char* image = (char*) malloc(size);
+    if (!image) {printf("Malloc failed for a quantized model file of %zu bytes\n", size); return 0;}
+
+    _quantized_image(qnet, image);
+    int ok = checkpoint_write_file(path, image, size);
+
+    free(image);
+    return ok;
+}
+
+
+
+/**
+ * Loads a file written by quantized_network_save.
+ * Returns NULL if any error (bad magic, version or sizes, or a loss other than MSE).
+ *
+ * @param path Path of the file.
+*/
+QuantizedNetwork* quantized_network_load(const char* path) {
+    if (!path) {printf("The path passed is NULL\n"); return NULL;}
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {printf("Error opening %s\n", path); return NULL;}
+
+    char* image = NULL;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+    if (size >= 0 && fseek(file, 0, SEEK_SET) == 0) image = (char*) malloc(size > 0 ? size : 1);
+    int read = image && fread(image, 1, size, file) == (size_t)size;
+    fclose(file);
+
+    if (!read) {printf("Error reading %s\n", path); free(image); return NULL;}
+
+    const QuantizedFileHeader* header = (const QuantizedFileHeader*) image;
+    const char* error = NULL;
+
+    if ((size_t)size < sizeof(QuantizedFileHeader)) error = "too short for a header";
+    else if (memcmp(header->magic, QUANTIZED_FILE_MAGIC, sizeof(QUANTIZED_FILE_MAGIC)) != 0) error = "not a quantized model file (bad magic)";
+    else if (header->byte_order != QUANTIZED_FILE_BYTE_ORDER) error = "written on a host of the other byte order";
+    else if (header->version != QUANTIZED_FILE_VERSION) error = "unsupported version";
+    else if (header->n_layers <= 0 || header->input_feature_size <= 0) error = "no layers or inputs";
+    else if ((size_t)size < sizeof(QuantizedFileHeader) + header->n_layers * sizeof(QuantizedFileLayer)) error = "layer table past the end of the file";
+    else if (header->loss_type < MSE || header->loss_type > CATEGORICAL_CROSSENTROPY) error = "unknown loss";
+    else if (header->loss_type != MSE) error = "unsupported loss (create_loss only implements MSE)";
+
+    QuantizedNetwork* qnet = NULL;
+    if (!error) {
+        qnet = (QuantizedNetwork*) calloc(1, sizeof(QuantizedNetwork));
+        if (qnet) qnet->layers = (QuantizedLayer*) calloc(header->n_layers, sizeof(QuantizedLayer));
+        if (qnet) qnet->loss_func = create_loss((loss_function_type)header->loss_type);
+        if (!qnet || !qnet->layers || !qnet->loss_func) error = "out of memory";
+        else {
+            qnet->input_feature_size = header->input_feature_size;
+            qnet->n_layers = header->n_layers;
+        }
+    }
+
+    size_t offset = sizeof(QuantizedFileHeader) + (error ? 0 : header->n_layers * sizeof(QuantizedFileLayer));
+    int prev = error ? 0 : header->input_feature_size;
+
+    for (int l = 0; !error && l < qnet->n_layers; l++) {
+        const QuantizedFileLayer* e = (const QuantizedFileLayer*) (image + sizeof(QuantizedFileHeader)) + l;
+        QuantizedLayer* layer = &qnet->layers[l];
+
+        if (e->n_neurons <= 0 || e->n_neurons_prev != prev) {error = "layer shapes do not chain"; break;}
+        if (e->activation < RELU || e->activation > LINEAR) {error = "unknown activation"; break;}
+        if (e->input_zero_point < 0 || e->input_zero_point > 255 || !(e->input_scale > 0.0f)) {error = "bad input quantization"; break;}
+        if (!_quantized_layer_alloc(layer, e->n_neurons, e->n_neurons_prev, (activation_function)e->activation)) {error = "out of memory"; break;}
+
+        size_t scale_bytes = layer->n_neurons * sizeof(float);
+        size_t weight_bytes = (size_t)layer->k_padded * layer->n_padded;
+        if (offset + 2 * scale_bytes + weight_bytes > (size_t)size) {error = "parameters past the end of the file"; break;}
+
+        memcpy(layer->weight_scales, image + offset, scale_bytes);
+        memcpy(layer->float_biases, image + offset + scale_bytes, scale_bytes);
+        memcpy(layer->weights, image + offset + 2 * scale_bytes, weight_bytes);
+        layer->input_scale = e->input_scale;
+        layer->input_zero_point = e->input_zero_point;
+        _quantized_layer_finish(layer);
+
+        offset += 2 * scale_bytes + weight_bytes;
+        prev = layer->n_neurons;
+    }
+
+    free(image);
+
+    if (error) {
+        printf("Could not load %s: %s\n", path, error);
+        free_quantized_network(&qnet);
+        return NULL;
+    }
+
+    return qnet;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef QUANTIZE_INTERNAL_H
+#define QUANTIZE_INTERNAL_H
+
+#include "quantize.h"
+#include "simd.h"
+
+#include <stdint.h>
+
+
+
+/* Internals of quantize.c shared with the unit tests (tests/quantize_test.c), not installed with the public headers */
+
+
+
+/* Rows of the input run against one panel of weights at once (the register tile is QUANTIZED_MR x QUANTIZED_PANEL_COLS int32) */
+#define QUANTIZED_MR    8
+
+
+
+// ==========================================
+//             Kernels
+// ==========================================
+
+/**
+ * Portable tile: the mr rows of a (groups * QUANTIZED_GROUP uint8 inputs each, lda apart) against one packed panel b,
+ * summed in int32 into tile.
+ */
+void _quantized_tile_generic(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]);
+
+#if SIMD_X86
+
+/**
+ * AVX2 tile (vpmaddwd on inputs and weights widened to int16), same contract as _quantized_tile_generic.
+ */
+void _quantized_tile_avx2(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]);
+
+/**
+ * AVX-512 VNNI tile (vpdpbusd), same contract as _quantized_tile_generic. b and tile must be 64 byte aligned,
+ * and the host must have AVX-512BW and VNNI.
+ */
+void _quantized_tile_vnni(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]);
+
+#endif
+
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,695 @@
+#include "simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+static SimdKernels simd_table;
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+void _simd_init();
+void _simd_load_time_init() __attribute__((constructor));
+simd_level _simd_detect();
+simd_level _simd_env_cap();
+
+void _simd_add_scalar(float* out, const float* a, const float* b, int n);
+void _simd_sub_scalar(float* out, const float* a, const float* b, int n);
+void _simd_mul_scalar(float* out, const float* a, const float* b, int n);
+void _simd_axpy_scalar(float* y, float alpha, const float* x, int n);
+void _simd_scale_scalar(float* x, float alpha, int n);
+void _simd_momentum_scalar(float* w, const float* g, float* v, float lr, float mu, int n);
+void _simd_adam_scalar(float* w, const float* g, float* m, float* v, float beta1, float beta2, float step, float correction, float epsilon, int n);
+
+float _simd_exp1(float x);
+void _simd_exp_scalar(float* out, const float* x, int n);
+void _simd_relu_scalar(float* x, float slope, int n);
+void _simd_relu_backward_scalar(float* g, const float* z, float slope, float* sums, int n);
+void _simd_sigmoid_scalar(float* x, int n);
+void _simd_sigmoid_backward_scalar(float* g, const float* s, float* sums, int n);
+void _simd_softmax_scalar(float* x, int n);
+void _simd_softmax_backward_scalar(float* g, const float* s, float* sums, int n);
+
+uint16_t _simd_bf16_1(float x);
+uint16_t _simd_fp16_1(float x);
+float _simd_fp16_to_float1(uint16_t h);
+void _simd_to_bf16_scalar(uint16_t* out, const float* x, int n);
+void _simd_from_bf16_scalar(float* out, const uint16_t* x, int n);
+void _simd_to_fp16_scalar(uint16_t* out, const float* x, int n);
+void _simd_from_fp16_scalar(float* out, const uint16_t* x, int n);
+void _simd_to_fp16_sse2(uint16_t* out, const float* x, int n);
+void _simd_from_fp16_sse2(float* out, const uint16_t* x, int n);
+#if SIMD_X86
+void _simd_to_bf16_avx512bf16(uint16_t* out, const float* x, int n);
+#endif
+
+
+
+/**
+ * Returns the widest instruction set supported by both the CPU and the OS (the builtins check CPUID and XGETBV).
+ */
+simd_level _simd_detect() {
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+
+
+/**
+ * Returns the level NEURAL_SIMD caps the dispatch to, SIMD_AVX512 (no cap) if it is not set or not recognised.
+ */
+simd_level _simd_env_cap() {
+    const char* env = getenv(SIMD_ENV_VAR);
+    if (!env) return SIMD_AVX512;
+
+    for (int level = SIMD_SCALAR; level <= SIMD_AVX512; level++) {
+        if (strcmp(env, simd_level_name((simd_level)level)) == 0) return (simd_level)level;
+    }
+
+    printf("%s=%s is not one of scalar, sse2, avx2, avx512. Ignored\n", SIMD_ENV_VAR, env);
+    return SIMD_AVX512;
+}
+
+
+
+// ==========================================
+//             Scalar Kernels
+// ==========================================
+
+void _simd_add_scalar(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+void _simd_sub_scalar(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] - b[i];
+}
+
+void _simd_mul_scalar(float* out, const float* a, const float* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+void _simd_axpy_scalar(float* y, float alpha, const float* x, int n) {
+    for (int i = 0; i < n; i++) y[i] = y[i] + alpha * x[i];
+}
+
+void _simd_scale_scalar(float* x, float alpha, int n) {
+    for (int i = 0; i < n; i++) x[i] = x[i] * alpha;
+}
+
+void _simd_momentum_scalar(float* w, const float* g, float* v, float lr, float mu, int n) {
+    for (int i = 0; i < n; i++) {
+        v[i] = mu * v[i] + g[i];
+        w[i] = w[i] - lr * v[i];
+    }
+}
+
+void _simd_adam_scalar(float* w, const float* g, float* m, float* v, float beta1, float beta2, float step, float correction, float epsilon, int n) {
+    for (int i = 0; i < n; i++) {
+        m[i] = beta1 * m[i] + (1.0f - beta1) * g[i];
+        v[i] = beta2 * v[i] + (1.0f - beta2) * (g[i] * g[i]);
+        w[i] = w[i] - step * (m[i] / (sqrtf(v[i]) * correction + epsilon));
+    }
+}
+
+
+
+/* Cephes style exp: e^x = 2^n * e^r with n = round(x / ln2) and |r| <= ln2 / 2, e^r from a polynomial.
+   The constants are shared by the scalar and the vector versions, and both are compiled without contracting a * b + c
+   into a fused multiply-add (GCC does it by default where FMA is enabled, the AVX2 and AVX-512 copies), so every
+   element of a tensor gets the same result whichever kernel or tail computes it */
+#define SIMD_EXP_HI         88.3762626647949f
+#define SIMD_EXP_LO         -88.3762626647949f
+#define SIMD_LOG2E          1.44269504088896341f
+#define SIMD_LN2_HI         0.693359375f
+#define SIMD_LN2_LO         -2.12194440e-4f
+#define SIMD_EXP_P0         1.9875691500e-4f
+#define SIMD_EXP_P1         1.3981999507e-3f
+#define SIMD_EXP_P2         8.3334519073e-3f
+#define SIMD_EXP_P3         4.1665795894e-2f
+#define SIMD_EXP_P4         1.6666665459e-1f
+#define SIMD_EXP_P5         5.0000001201e-1f
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+/**
+ * Scalar version of the vectorised exp (used for the scalar level and for the tails of the vector kernels).
+ */
+float _simd_exp1(float x) {
+    if (x > SIMD_EXP_HI) x = SIMD_EXP_HI;
+    if (x < SIMD_EXP_LO) x = SIMD_EXP_LO;
+
+    float fx = x * SIMD_LOG2E + 0.5f;
+    int n = (int)fx;
+    if ((float)n > fx) n--;    /* floor */
+    float fn = (float)n;
+
+    float r = x - fn * SIMD_LN2_HI - fn * SIMD_LN2_LO;
+    float y = SIMD_EXP_P0;
+    y = y * r + SIMD_EXP_P1;
+    y = y * r + SIMD_EXP_P2;
+    y = y * r + SIMD_EXP_P3;
+    y = y * r + SIMD_EXP_P4;
+    y = y * r + SIMD_EXP_P5;
+    y = y * r * r + r + 1.0f;
+
+    union { int i; float f; } pow2n = {(n + 127) << 23};
+    return y * pow2n.f;
+}
+
+#pragma GCC pop_options
+
+void _simd_exp_scalar(float* out, const float* x, int n) {
+    for (int i = 0; i < n; i++) out[i] = _simd_exp1(x[i]);
+}
+
+void _simd_relu_scalar(float* x, float slope, int n) {
+    for (int i = 0; i < n; i++) x[i] = (x[i] > 0.0f) ? x[i] : slope * x[i];
+}
+
+void _simd_relu_backward_scalar(float* g, const float* z, float slope, float* sums, int n) {
+    for (int i = 0; i < n; i++) {
+        g[i] *= (z[i] > 0.0f) ? 1.0f : slope;
+        if (sums) sums[i] += g[i];
+    }
+}
+
+void _simd_sigmoid_scalar(float* x, int n) {
+    for (int i = 0; i < n; i++) x[i] = 1.0f / (1.0f + _simd_exp1(-x[i]));
+}
+
+void _simd_sigmoid_backward_scalar(float* g, const float* s, float* sums, int n) {
+    for (int i = 0; i < n; i++) {
+        g[i] *= s[i] * (1.0f - s[i]);
+        if (sums) sums[i] += g[i];
+    }
+}
+
+void _simd_softmax_scalar(float* x, int n) {
+    float max = x[0];
+    for (int i = 1; i < n; i++) if (x[i] > max) max = x[i];
+
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        x[i] = _simd_exp1(x[i] - max);
+        sum += x[i];
+    }
+
+    float inv = 1.0f / sum;
+    for (int i = 0; i < n; i++) x[i] *= inv;
+}
+
+void _simd_softmax_backward_scalar(float* g, const float* s, float* sums, int n) {
+    float dot = 0.0f;
+    for (int i = 0; i < n; i++) dot += g[i] * s[i];
+
+    for (int i = 0; i < n; i++) {
+        g[i] = s[i] * (g[i] - dot);
+        if (sums) sums[i] += g[i];
+    }
+}
+
+
+
+/**
+ * Rounds a float to bf16 (nearest even): its top 16 bits, plus one if the dropped half is past the middle. NaNs stay quiet NaNs.
+ * Denormal floats become a zero of their sign, as AVX512-BF16 does, so every level gives the same bits.
+ */
+uint16_t _simd_bf16_1(float x) {
+    union { float f; uint32_t u; } v = {x};
+    if ((v.u & 0x7FFFFFFF) > 0x7F800000) return (uint16_t)((v.u >> 16) | 0x40);
+    if ((v.u & 0x7F800000) == 0) return (uint16_t)((v.u >> 16) & 0x8000);
+    return (uint16_t)((v.u + 0x7FFF + ((v.u >> 16) & 1)) >> 16);
+}
+
+
+
+/**
+ * Rounds a float to IEEE half precision (nearest even). Halves too small for a normal exponent are rounded by adding
+ * 0.5f, which leaves them in the low mantissa bits; the others by rebiasing the exponent and rounding away 13 mantissa bits.
+ * A NaN keeps the top of its payload and becomes quiet, like F16C.
+ */
+uint16_t _simd_fp16_1(float x) {
+    union { float f; uint32_t u; } v = {x};
+    union { float f; uint32_t u; } denorm_magic = {.u = 126u << 23};     /* 0.5f */
+    uint32_t sign = (v.u >> 16) & 0x8000;
+    v.u &= 0x7FFFFFFF;
+
+    if (v.u >= (143u << 23)) return (uint16_t)(sign | ((v.u > 0x7F800000) ? 0x7E00 | ((v.u >> 13) & 0x3FF) : 0x7C00));    /* 65536 and up: infinity (or NaN) */
+
+    if (v.u < (113u << 23)) {
+        v.f += denorm_magic.f;
+        return (uint16_t)(sign | (v.u - denorm_magic.u));
+    }
+
+    uint32_t mantissa_odd = (v.u >> 13) & 1;
+    v.u += ((uint32_t)(15 - 127) << 23) + 0xFFF + mantissa_odd;
+    return (uint16_t)(sign | (v.u >> 13));
+}
+
+
+
+/**
+ * Widens an IEEE half to a float (exact). A NaN becomes quiet, like F16C.
+ */
+float _simd_fp16_to_float1(uint16_t h) {
+    union { float f; uint32_t u; } o = {.u = (uint32_t)(h & 0x7FFF) << 13};
+    union { float f; uint32_t u; } magic = {.u = 113u << 23};
+    uint32_t exponent = o.u & (0x7C00u << 13);
+
+    o.u += (uint32_t)(127 - 15) << 23;
+    if (exponent == (0x7C00u << 13)) {                                     /* Infinity or NaN */
+        o.u += (uint32_t)(128 - 16) << 23;
+        if (h & 0x03FF) o.u |= 0x400000;
+    }
+    else if (exponent == 0) {                                               /* Zero or subnormal: renormalised by the float unit */
+        o.u += 1u << 23;
+        o.f -= magic.f;
+    }
+
+    o.u |= (uint32_t)(h & 0x8000) << 16;
+    return o.f;
+}
+
+void _simd_to_bf16_scalar(uint16_t* out, const float* x, int n) {
+    for (int i = 0; i < n; i++) out[i] = _simd_bf16_1(x[i]);
+}
+
+void _simd_from_bf16_scalar(float* out, const uint16_t* x, int n) {
+    for (int i = 0; i < n; i++) {
+        union { uint32_t u; float f; } v = {(uint32_t)x[i] << 16};
+        out[i] = v.f;
+    }
+}
+
+void _simd_to_fp16_scalar(uint16_t* out, const float* x, int n) {
+    for (int i = 0; i < n; i++) out[i] = _simd_fp16_1(x[i]);
+}
+
+void _simd_from_fp16_scalar(float* out, const uint16_t* x, int n) {
+    for (int i = 0; i < n; i++) out[i] = _simd_fp16_to_float1(x[i]);
+}
+
+
+
+// ==========================================
+//             Vector Kernels
+// ==========================================
+
+#if SIMD_X86
+
+/*
+ * Defines the element wise kernels of one instruction set. Every function is compiled for that set only
+ * (target attribute), so the library itself is built for the baseline and still runs the wide kernels.
+ * Full vectors are processed with unaligned loads and stores, the remainder (less than a vector) in scalar.
+ */
+#define SIMD_DEFINE_KERNELS(isa, target_isa, vec, width, load, store, add, sub, mul, div, sqrt, set1, madd)  \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_add_##isa(float* out, const float* a, const float* b, int n) { \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) store(out + i, add(load(a + i), load(b + i)));                        \
+    for (; i < n; i++) out[i] = a[i] + b[i];                                                                  \
+}                                                                                                             \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_sub_##isa(float* out, const float* a, const float* b, int n) { \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) store(out + i, sub(load(a + i), load(b + i)));                        \
+    for (; i < n; i++) out[i] = a[i] - b[i];                                                                  \
+}                                                                                                             \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_mul_##isa(float* out, const float* a, const float* b, int n) { \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) store(out + i, mul(load(a + i), load(b + i)));                        \
+    for (; i < n; i++) out[i] = a[i] * b[i];                                                                  \
+}                                                                                                             \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_axpy_##isa(float* y, float alpha, const float* x, int n) {     \
+    vec va = set1(alpha);                                                                                     \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) store(y + i, madd(va, load(x + i), load(y + i)));                     \
+    for (; i < n; i++) y[i] = y[i] + alpha * x[i];                                                            \
+}                                                                                                             \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_scale_##isa(float* x, float alpha, int n) {                   \
+    vec va = set1(alpha);                                                                                     \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) store(x + i, mul(load(x + i), va));                                   \
+    for (; i < n; i++) x[i] = x[i] * alpha;                                                                   \
+}                                                                                                             \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_momentum_##isa(float* w, const float* g, float* v, float lr, float mu, int n) { \
+    vec vlr = set1(-lr), vmu = set1(mu);                                                                      \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) {                                                                      \
+        vec vv = madd(vmu, load(v + i), load(g + i));                                                         \
+        store(v + i, vv);                                                                                     \
+        store(w + i, madd(vlr, vv, load(w + i)));                                                             \
+    }                                                                                                         \
+    _simd_momentum_scalar(w + i, g + i, v + i, lr, mu, n - i);                                                \
+}                                                                                                             \
+                                                                                                              \
+__attribute__((target(target_isa))) void _simd_adam_##isa(float* w, const float* g, float* m, float* v,      \
+                                                          float beta1, float beta2, float step, float correction, float epsilon, int n) { \
+    vec vb1 = set1(beta1), vc1 = set1(1.0f - beta1), vb2 = set1(beta2), vc2 = set1(1.0f - beta2);             \
+    vec vstep = set1(-step), vcorr = set1(correction), veps = set1(epsilon);                                  \
+    int i = 0;                                                                                                \
+    for (; i + width <= n; i += width) {                                                                      \
+        vec gv = load(g + i);                                                                                 \
+        vec mv = madd(vb1, load(m + i), mul(vc1, gv));                                                        \
+        vec vv = madd(vb2, load(v + i), mul(vc2, mul(gv, gv)));                                               \
+        store(m + i, mv);                                                                                     \
+        store(v + i, vv);                                                                                     \
+        store(w + i, madd(vstep, div(mv, madd(sqrt(vv), vcorr, veps)), load(w + i)));                        \
+    }                                                                                                         \
+    _simd_adam_scalar(w + i, g + i, m + i, v + i, beta1, beta2, step, correction, epsilon, n - i);           \
+}
+
+/* SSE2 has no fused multiply-add */
+#define _simd_sse2_madd(a, b, c)    _mm_add_ps(_mm_mul_ps(a, b), c)
+
+SIMD_DEFINE_KERNELS(sse2, "sse2", __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps, _mm_sqrt_ps, _mm_set1_ps, _simd_sse2_madd)
+SIMD_DEFINE_KERNELS(avx2, "avx2,fma", __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps, _mm256_sqrt_ps, _mm256_set1_ps, _mm256_fmadd_ps)
+SIMD_DEFINE_KERNELS(avx512, "avx512f", __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_div_ps, _mm512_sqrt_ps, _mm512_set1_ps, _mm512_fmadd_ps)
+
+
+
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef float f32x8 __attribute__((vector_size(32)));
+typedef float f32x16 __attribute__((vector_size(64)));
+typedef float f32x4u __attribute__((vector_size(16), aligned(4)));
+typedef float f32x8u __attribute__((vector_size(32), aligned(4)));
+typedef float f32x16u __attribute__((vector_size(64), aligned(4)));
+typedef int i32x4 __attribute__((vector_size(16)));
+typedef int i32x8 __attribute__((vector_size(32)));
+typedef int i32x16 __attribute__((vector_size(64)));
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+typedef uint16_t u16x4 __attribute__((vector_size(8)));
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+typedef uint16_t u16x16 __attribute__((vector_size(32)));
+typedef uint16_t u16x4u __attribute__((vector_size(8), aligned(2)));
+typedef uint16_t u16x8u __attribute__((vector_size(16), aligned(2)));
+typedef uint16_t u16x16u __attribute__((vector_size(32), aligned(2)));
+
+/* mask ? a : b, lane by lane (mask lanes are all ones or all zeros) */
+#define SIMD_SELECT(vf, vi, mask, a, b)     ((vf)(((mask) & (vi)(a)) | (~(mask) & (vi)(b))))
+
+/*
+ * Defines the activation kernels of one instruction set with GCC vector extensions of width floats
+ * (vf aligned, vfu unaligned, vi and vu the matching int and unsigned vectors, vh and vhu the 16-bit ones). Same scheme as SIMD_DEFINE_KERNELS: every function
+ * is compiled for target_isa only, full vectors go through the vector code and the tail through the scalar one.
+ * The vector exp is always inlined into each kernel so that it is compiled for the same instruction set.
+ */
+#define SIMD_DEFINE_MATH_KERNELS(isa, target_isa, vf, vfu, vi, vu, vh, vhu, width)                                     \
+                                                                                                                       \
+static inline __attribute__((always_inline, target(target_isa))) void _simd_vexp_##isa(vf* v) {                        \
+    vf x = *v;                                                                                                         \
+    x = SIMD_SELECT(vf, vi, x > SIMD_EXP_HI, (vf){0} + SIMD_EXP_HI, x);                                                \
+    x = SIMD_SELECT(vf, vi, x < SIMD_EXP_LO, (vf){0} + SIMD_EXP_LO, x);                                                \
+                                                                                                                       \
+    vf fx = x * SIMD_LOG2E + 0.5f;                                                                                     \
+    vi n = __builtin_convertvector(fx, vi);                                                                            \
+    n += (__builtin_convertvector(n, vf) > fx);    /* floor: the compare is -1 where truncation rounded up */          \
+    vf fn = __builtin_convertvector(n, vf);                                                                            \
+                                                                                                                       \
+    vf r = x - fn * SIMD_LN2_HI - fn * SIMD_LN2_LO;                                                                    \
+    vf y = (vf){0} + SIMD_EXP_P0;                                                                                      \
+    y = y * r + SIMD_EXP_P1;                                                                                           \
+    y = y * r + SIMD_EXP_P2;                                                                                           \
+    y = y * r + SIMD_EXP_P3;                                                                                           \
+    y = y * r + SIMD_EXP_P4;                                                                                           \
+    y = y * r + SIMD_EXP_P5;                                                                                           \
+    y = y * r * r + r + 1.0f;                                                                                          \
+                                                                                                                       \
+    *v = y * (vf)((n + 127) << 23);                                                                                    \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_exp_##isa(float* out, const float* x, int n) {                          \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) {                                                                               \
+        vf v = *(const vfu*)(x + i);                                                                                   \
+        _simd_vexp_##isa(&v);                                                                                          \
+        *(vfu*)(out + i) = v;                                                                                          \
+    }                                                                                                                  \
+    for (; i < n; i++) out[i] = _simd_exp1(x[i]);                                                                      \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_relu_##isa(float* x, float slope, int n) {                              \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) {                                                                               \
+        vf v = *(const vfu*)(x + i);                                                                                   \
+        *(vfu*)(x + i) = SIMD_SELECT(vf, vi, v > 0.0f, v, v * slope);                                                  \
+    }                                                                                                                  \
+    for (; i < n; i++) x[i] = (x[i] > 0.0f) ? x[i] : slope * x[i];                                                     \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_relu_backward_##isa(float* g, const float* z, float slope, float* sums, int n) { \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) {                                                                               \
+        vf gv = *(const vfu*)(g + i);                                                                                  \
+        vf zv = *(const vfu*)(z + i);                                                                                  \
+        gv = SIMD_SELECT(vf, vi, zv > 0.0f, gv, gv * slope);                                                           \
+        *(vfu*)(g + i) = gv;                                                                                           \
+        if (sums) *(vfu*)(sums + i) += gv;                                                                             \
+    }                                                                                                                  \
+    _simd_relu_backward_scalar(g + i, z + i, slope, sums ? sums + i : NULL, n - i);                                   \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_sigmoid_##isa(float* x, int n) {                                       \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) {                                                                               \
+        vf v = -*(const vfu*)(x + i);                                                                                  \
+        _simd_vexp_##isa(&v);                                                                                          \
+        *(vfu*)(x + i) = 1.0f / (v + 1.0f);                                                                            \
+    }                                                                                                                  \
+    _simd_sigmoid_scalar(x + i, n - i);                                                                                \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_sigmoid_backward_##isa(float* g, const float* s, float* sums, int n) {  \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) {                                                                               \
+        vf sv = *(const vfu*)(s + i);                                                                                  \
+        vf gv = *(const vfu*)(g + i) * sv * (1.0f - sv);                                                               \
+        *(vfu*)(g + i) = gv;                                                                                           \
+        if (sums) *(vfu*)(sums + i) += gv;                                                                             \
+    }                                                                                                                  \
+    _simd_sigmoid_backward_scalar(g + i, s + i, sums ? sums + i : NULL, n - i);                                       \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_softmax_##isa(float* x, int n) {                                        \
+    if (n < width) {_simd_softmax_scalar(x, n); return;}                                                               \
+                                                                                                                       \
+    vf vmax = *(const vfu*)(x);                                                                                        \
+    int i = width;                                                                                                     \
+    for (; i + width <= n; i += width) {                                                                               \
+        vf v = *(const vfu*)(x + i);                                                                                   \
+        vmax = SIMD_SELECT(vf, vi, v > vmax, v, vmax);                                                                 \
+    }                                                                                                                  \
+    float max = vmax[0];                                                                                               \
+    for (int l = 1; l < width; l++) if (vmax[l] > max) max = vmax[l];                                                  \
+    for (; i < n; i++) if (x[i] > max) max = x[i];                                                                     \
+                                                                                                                       \
+    vf vsum = {0};                                                                                                     \
+    for (i = 0; i + width <= n; i += width) {                                                                          \
+        vf v = *(const vfu*)(x + i) - max;                                                                             \
+        _simd_vexp_##isa(&v);                                                                                          \
+        *(vfu*)(x + i) = v;                                                                                            \
+        vsum += v;                                                                                                     \
+    }                                                                                                                  \
+    float sum = 0.0f;                                                                                                  \
+    for (int l = 0; l < width; l++) sum += vsum[l];                                                                    \
+    for (; i < n; i++) {                                                                                               \
+        x[i] = _simd_exp1(x[i] - max);                                                                                 \
+        sum += x[i];                                                                                                   \
+    }                                                                                                                  \
+                                                                                                                       \
+    float inv = 1.0f / sum;                                                                                            \
+    for (i = 0; i + width <= n; i += width) *(vfu*)(x + i) *= inv;                                                     \
+    for (; i < n; i++) x[i] *= inv;                                                                                    \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_softmax_backward_##isa(float* g, const float* s, float* sums, int n) {  \
+    vf vdot = {0};                                                                                                     \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) vdot += *(const vfu*)(g + i) * *(const vfu*)(s + i);                            \
+    float dot = 0.0f;                                                                                                  \
+    for (int l = 0; l < width; l++) dot += vdot[l];                                                                    \
+    for (; i < n; i++) dot += g[i] * s[i];                                                                             \
+                                                                                                                       \
+    for (i = 0; i + width <= n; i += width) {                                                                          \
+        vf gv = *(const vfu*)(s + i) * (*(const vfu*)(g + i) - dot);                                                   \
+        *(vfu*)(g + i) = gv;                                                                                           \
+        if (sums) *(vfu*)(sums + i) += gv;                                                                             \
+    }                                                                                                                  \
+    for (; i < n; i++) {                                                                                               \
+        g[i] = s[i] * (g[i] - dot);                                                                                    \
+        if (sums) sums[i] += g[i];                                                                                     \
+    }                                                                                                                  \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_to_bf16_##isa(uint16_t* out, const float* x, int n) {                   \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) {                                                                               \
+        vu u = (vu)*(const vfu*)(x + i);                                                                               \
+        vu nan = (vu)((u & 0x7FFFFFFF) > 0x7F800000);                                                                  \
+        vu denormal = (vu)((u & 0x7F800000) == 0);                                                                     \
+        vu r = (nan & ((u >> 16) | 0x40)) | (~nan & ((u + 0x7FFF + ((u >> 16) & 1)) >> 16));                           \
+        r = (denormal & ((u >> 16) & 0x8000)) | (~denormal & r);                                                       \
+        *(vhu*)(out + i) = __builtin_convertvector(r, vh);                                                             \
+    }                                                                                                                  \
+    _simd_to_bf16_scalar(out + i, x + i, n - i);                                                                       \
+}                                                                                                                      \
+                                                                                                                       \
+__attribute__((target(target_isa))) void _simd_from_bf16_##isa(float* out, const uint16_t* x, int n) {                 \
+    int i = 0;                                                                                                         \
+    for (; i + width <= n; i += width) *(vfu*)(out + i) = (vf)(__builtin_convertvector(*(const vhu*)(x + i), vu) << 16); \
+    _simd_from_bf16_scalar(out + i, x + i, n - i);                                                                     \
+}
+
+/* No contraction into FMA in these copies either (see _simd_exp1) */
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+SIMD_DEFINE_MATH_KERNELS(sse2, "sse2", f32x4, f32x4u, i32x4, u32x4, u16x4, u16x4u, 4)
+SIMD_DEFINE_MATH_KERNELS(avx2, "avx2,fma", f32x8, f32x8u, i32x8, u32x8, u16x8, u16x8u, 8)
+SIMD_DEFINE_MATH_KERNELS(avx512, "avx512f", f32x16, f32x16u, i32x16, u32x16, u16x16, u16x16u, 16)
+
+#pragma GCC pop_options
+
+
+
+/* SSE2 has no half precision conversion, its table uses the scalar one */
+void _simd_to_fp16_sse2(uint16_t* out, const float* x, int n) {
+    _simd_to_fp16_scalar(out, x, n);
+}
+
+void _simd_from_fp16_sse2(float* out, const uint16_t* x, int n) {
+    _simd_from_fp16_scalar(out, x, n);
+}
+
+/* F16C converts 8 halves per instruction, AVX-512F 16 */
+__attribute__((target("avx2,fma,f16c"))) void _simd_to_fp16_avx2(uint16_t* out, const float* x, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    _simd_to_fp16_scalar(out + i, x + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c"))) void _simd_from_fp16_avx2(float* out, const uint16_t* x, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(x + i))));
+    _simd_from_fp16_scalar(out + i, x + i, n - i);
+}
+
+__attribute__((target("avx512f"))) void _simd_to_fp16_avx512(uint16_t* out, const float* x, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) _mm256_storeu_si256((__m256i*)(out + i), _mm512_cvtps_ph(_mm512_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    _simd_to_fp16_scalar(out + i, x + i, n - i);
+}
+
+__attribute__((target("avx512f"))) void _simd_from_fp16_avx512(float* out, const uint16_t* x, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(x + i))));
+    _simd_from_fp16_scalar(out + i, x + i, n - i);
+}
+
+/* AVX512-BF16 rounds 16 floats to bf16 in one instruction (denormal inputs are flushed to zero, as in _simd_bf16_1) */
+__attribute__((target("avx512f,avx512bf16"))) void _simd_to_bf16_avx512bf16(uint16_t* out, const float* x, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) _mm256_storeu_si256((__m256i*)(out + i), (__m256i)_mm512_cvtneps_pbh(_mm512_loadu_ps(x + i)));
+    _simd_to_bf16_scalar(out + i, x + i, n - i);
+}
+
+#endif
+
+
+
+// ==========================================
+//             Dispatch
+// ==========================================
+
+/**
+ * Fills the kernel table for the detected instruction set. Runs once.
+ */
+void _simd_init() {
+    simd_level level = _simd_detect();
+    simd_level cap = _simd_env_cap();
+    if (level > cap) level = cap;
+
+/* Table of one instruction set, every kernel name being _simd_<kernel>_<isa> */
+#define SIMD_TABLE(level, isa) (SimdKernels){level,                                                        \
+    _simd_add_##isa, _simd_sub_##isa, _simd_mul_##isa, _simd_axpy_##isa, _simd_scale_##isa,                \
+    _simd_momentum_##isa, _simd_adam_##isa,                                                                \
+    _simd_exp_##isa, _simd_relu_##isa, _simd_relu_backward_##isa, _simd_sigmoid_##isa,                     \
+    _simd_sigmoid_backward_##isa, _simd_softmax_##isa, _simd_softmax_backward_##isa,                      \
+    _simd_to_bf16_##isa, _simd_from_bf16_##isa, _simd_to_fp16_##isa, _simd_from_fp16_##isa}
+
+    simd_table = SIMD_TABLE(SIMD_SCALAR, scalar);
+
+#if SIMD_X86
+    if (level == SIMD_SSE2) simd_table = SIMD_TABLE(SIMD_SSE2, sse2);
+    if (level == SIMD_AVX2) simd_table = SIMD_TABLE(SIMD_AVX2, avx2);
+    if (level == SIMD_AVX512) simd_table = SIMD_TABLE(SIMD_AVX512, avx512);
+    if (level == SIMD_AVX512 && __builtin_cpu_supports("avx512bf16")) simd_table.to_bf16 = _simd_to_bf16_avx512bf16;
+#endif
+}
+
+
+
+/**
+ * Selects the kernels when the library is loaded, so no call pays for the detection.
+ */
+void _simd_load_time_init() {
+    pthread_once(&simd_once, _simd_init);
+}
+
+
+
+/**
+ * Returns the kernels of the widest instruction set the CPU (and OS) supports, capped by NEURAL_SIMD if set.
+ * They are selected from CPUID once, when the library is loaded. out may alias a or b in every kernel.
+ */
+const SimdKernels* simd_kernels() {
+    pthread_once(&simd_once, _simd_init);
+    return &simd_table;
+}
+
+
+
+/**
+ * Returns the instruction set the kernels were selected for.
+ */
+simd_level simd_get_level() {
+    return simd_kernels()->level;
+}
+
+
+
+/**
+ * Returns the name of an instruction set ("scalar", "sse2", "avx2" or "avx512").
+ */
+const char* simd_level_name(simd_level level) {
+    switch (level) {
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_AVX512: return "avx512";
+    }
+    return "unknown";
+}
@@ -1,17 +1,29 @@
 #include "tensor.h"
+#include "gemm.h"
+#include "simd.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 
 
+/* State of the random number generator (xorshift64*), never 0. Saved in checkpoints so a resumed run draws the same numbers */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+
+
 // ==========================================
 //             Internal Helpers
 // ==========================================
 
 Tensor* _create_tensor(int rows, int cols);
 float _random_float_range(float min, float max);
+uint64_t _rng_next();
+int _check_destination(const Tensor* out, int rows, int cols);
+int _check_same_shape(const Tensor* t1, const Tensor* t2);
+float* _tensor_row(const Tensor* tensor, int i);
 
 
 
@@ -23,7 +35,44 @@ float _random_float_range(float min, float max);
  * Initialises the API by seeding for the random API calls
 */
 void init_tensor_api() {
-    srand(time(NULL));
+    tensor_rng_seed((uint64_t)time(NULL));
+}
+
+
+
+/**
+ * Seeds the random number generator of the library (weight initialisation, create_tensor_random), for reproducible runs.
+ * 
+ * @param seed Any value, 0 included.
+*/
+void tensor_rng_seed(uint64_t seed) {
+    /* splitmix64 of the seed, so close seeds give unrelated streams and the state is never 0 */
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+
+    rng_state = z ? z : 0x9E3779B97F4A7C15ull;
+}
+
+
+
+/**
+ * Returns the current state of the random number generator (to save it in a checkpoint).
+*/
+uint64_t tensor_rng_get_state() {
+    return rng_state;
+}
+
+
+
+/**
+ * Restores a state returned by tensor_rng_get_state, the generator then continues the same sequence.
+ * 
+ * @param state A state returned by tensor_rng_get_state (0 is not a valid state and is ignored).
+*/
+void tensor_rng_set_state(uint64_t state) {
+    if (state) rng_state = state;
 }
 
 
@@ -51,6 +100,8 @@ Tensor* _create_tensor(int rows, int cols) {
 
     tensor_created->rows = rows;
     tensor_created->cols = cols;
+    tensor_created->stride = cols;
+    tensor_created->owns_data = 1;
 
     tensor_created->data = (float *) malloc(rows * cols * sizeof(float));
     if (!tensor_created->data) {
@@ -115,12 +166,116 @@ Tensor* create_tensor_random(int rows, int cols, float min, float max) {
  * @param max maximum random value (inclusive)
  */
 float _random_float_range(float min, float max) {
-    float scale =  (float)rand() / (float)RAND_MAX;
+    float scale = (float)(_rng_next() >> 40) / (float)((1 << 24) - 1);    /* 24 bits, what a float holds exactly */
     return min + scale * (max - min);
 }
 
 
 
+/**
+ * Advances the random number generator and returns 64 random bits (xorshift64*).
+ */
+uint64_t _rng_next() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+
+
+/**
+ * Returns a (rows x cols) tensor whose data is the given memory, which is neither copied nor freed by free_tensor.
+ * The memory must stay valid for as long as the tensor is used.
+ * Returns NULL if any error.
+ * 
+ * @param data memory holding rows * cols floats, row-major
+ * @param rows number of rows of tensor
+ * @param cols number of cols of tensor 
+ */
+Tensor* create_tensor_view(float* data, int rows, int cols) {
+    if (!data || rows <= 0 || cols <= 0) {
+        if (!data) printf("Data received is NULL\n");
+        if (rows <= 0) printf("Number of rows received is less than 1\n");
+        if (cols <= 0) printf("Number of cols received is less than 1\n");
+        return NULL;
+    }
+
+    Tensor* view = (Tensor*) malloc(sizeof(Tensor));
+    if (!view) {printf("Malloc failed for creating a tensor\n"); return NULL;}
+
+    view->data = data;
+    view->rows = rows;
+    view->cols = cols;
+    view->stride = cols;
+    view->owns_data = 0;
+
+    return view;
+}
+
+
+
+/**
+ * Returns a (rows x cols) view of the block of tensor starting at (row, col): no data is copied, the view keeps the
+ * stride of tensor and is not freed by free_tensor (tensor must outlive it). Writing to the view writes to tensor.
+ * Returns NULL if any error (block out of bounds).
+ * 
+ * @param tensor the tensor sliced (can itself be a view)
+ * @param row first row of the block
+ * @param col first col of the block
+ * @param rows number of rows of the block
+ * @param cols number of cols of the block
+ */
+Tensor* tensor_slice(const Tensor* tensor, int row, int col, int rows, int cols) {
+    if (!tensor) {printf("Tensor given is NULL\n"); return NULL;}
+
+    if (row < 0 || col < 0 || rows <= 0 || cols <= 0 || row + rows > tensor->rows || col + cols > tensor->cols) {
+        printf("Block (%d x %d) at (%d, %d) is out of a (%d x %d) tensor\n", rows, cols, row, col, tensor->rows, tensor->cols);
+        return NULL;
+    }
+
+    Tensor* view = (Tensor*) malloc(sizeof(Tensor));
+    if (!view) {printf("Malloc failed for creating a tensor\n"); return NULL;}
+
+    *view = tensor_slice_rows(tensor, row, rows);
+    view->data += col;
+    view->cols = cols;
+
+    return view;
+}
+
+
+
+/**
+ * Same as tensor_slice for a block of whole rows, returned by value so slicing a batch in a loop allocates nothing.
+ * Returns an empty tensor (0 rows) if any error (block out of bounds).
+ * 
+ * @param tensor the tensor sliced
+ * @param first first row of the block
+ * @param rows number of rows of the block
+ */
+Tensor tensor_slice_rows(const Tensor* tensor, int first, int rows) {
+    if (first < 0 || rows < 0 || first > tensor->rows - rows) {
+        printf("Rows [%d, %d) are out of a (%d x %d) tensor\n", first, first + rows, tensor->rows, tensor->cols);
+        return (Tensor){tensor->data, 0, tensor->cols, tensor->stride, 0};
+    }
+
+    return (Tensor){&tensor->data[(size_t)first * tensor->stride], rows, tensor->cols, tensor->stride, 0};
+}
+
+
+
+/**
+ * Returns 1 if the rows of the tensor follow each other in memory (stride == cols), so it is one block of rows * cols floats.
+ * 
+ * @param tensor the tensor
+ */
+int tensor_is_contiguous(const Tensor* tensor) {
+    return tensor->stride == tensor->cols || tensor->rows == 1;
+}
+
+
+
 /**
  * Creates and returns deepcopy of the tensor input.
  * 
@@ -132,7 +287,7 @@ Tensor* tensor_deepcopy(const Tensor* tensor) {
     Tensor* new_tensor = _create_tensor(tensor->rows, tensor->cols);
     if (!new_tensor) {printf("Unable to create new tensor\n"); return NULL;}
 
-    for (int i = 0; i < new_tensor->rows; i++) for (int j = 0; j < new_tensor->cols; j++) new_tensor->data[i*tensor->cols + j] = tensor->data[i*tensor->cols + j];
+    tensor_copy_into(new_tensor, tensor);
 
     return new_tensor;
 }
@@ -140,12 +295,12 @@ Tensor* tensor_deepcopy(const Tensor* tensor) {
 
 
 /**
- * Frees the tensor pointer and sets it to NULL
+ * Frees the tensor pointer (and its data if the tensor owns it) and sets it to NULL
  */
 void free_tensor(Tensor** tensor) {
     if (tensor && *tensor) {
         Tensor* t = *tensor;
-        if (t->data) free(t->data);
+        if (t->data && t->owns_data) free(t->data);
 
         free(t);
         *tensor = NULL; 
@@ -154,6 +309,28 @@ void free_tensor(Tensor** tensor) {
 
 
 
+/**
+ * Returns *buffer if it is already (rows x cols), otherwise replaces it with a new tensor of that shape.
+ * Used to keep buffers alive across calls, the values are left as they are (garbage for a new tensor).
+ * Returns NULL if any error.
+ * 
+ * @param buffer the buffer, *buffer can be NULL
+ * @param rows number of rows needed
+ * @param cols number of cols needed
+ */
+Tensor* tensor_ensure_shape(Tensor** buffer, int rows, int cols) {
+    if (!buffer) {printf("Buffer pointer is NULL\n"); return NULL;}
+
+    if (*buffer && (*buffer)->rows == rows && (*buffer)->cols == cols) return *buffer;
+
+    free_tensor(buffer);
+    *buffer = _create_tensor(rows, cols);
+
+    return *buffer;
+}
+
+
+
 // ==========================================
 //             Operations (new object)
 // ==========================================
@@ -172,15 +349,10 @@ Tensor* tensor_addition(const Tensor* t1, const Tensor* t2) {
         return NULL;
     }
 
-    if (t1->rows != t2->rows || t1->cols != t2->cols) {
-        if (t1->rows != t2->rows) printf("The number of rows do not match\n");
-        if (t1->cols != t2->cols) printf("The number of cols do not match\n");
-        return NULL;
-    }
-
     Tensor* t_new = _create_tensor(t1->rows, t1->cols);
+    if (!t_new) return NULL;
 
-    for (int i = 0; i < t_new->rows; i++) for (int j = 0; j < t_new->cols; j++) t_new->data[i*t_new->cols + j] = t1->data[i*t1->cols + j] + t2->data[i*t2->cols + j];
+    if (!tensor_addition_into(t_new, t1, t2)) {free_tensor(&t_new); return NULL;}
 
     return t_new;
 }
@@ -201,15 +373,10 @@ Tensor* tensor_subtraction(const Tensor* t1, const Tensor* t2) {
         return NULL;
     }
 
-    if (t1->rows != t2->rows || t1->cols != t2->cols) {
-        if (t1->rows != t2->rows) printf("The number of rows do not match\n");
-        if (t1->cols != t2->cols) printf("The number of cols do not match\n");
-        return NULL;
-    }
-
     Tensor* t_new = _create_tensor(t1->rows, t1->cols);
+    if (!t_new) return NULL;
 
-    for (int i = 0; i < t_new->rows; i++) for (int j = 0; j < t_new->cols; j++) t_new->data[i*t_new->cols + j] = t1->data[i*t1->cols + j] - t2->data[i*t2->cols + j];
+    if (!tensor_subtraction_into(t_new, t1, t2)) {free_tensor(&t_new); return NULL;}
 
     return t_new;
 }
@@ -239,7 +406,7 @@ Tensor* tensor_multiplication_v1(const Tensor* t1, const Tensor* t2) {
     Tensor* t_new = create_tensor_value(t1->rows, t2->cols, 0.0);
 
     for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t2->cols; j++) for (int k = 0; k < t1->cols; k++) {
-        t_new->data[i*t_new->cols + j] += t1->data[i*t1->cols + k] * t2->data[k*t2->cols + j];
+        t_new->data[i*t_new->stride + j] += t1->data[i*t1->stride + k] * t2->data[k*t2->stride + j];
     }  
 
     return t_new;
@@ -250,40 +417,39 @@ Tensor* tensor_multiplication_v1(const Tensor* t1, const Tensor* t2) {
 /**
  * Returns a new Tensor (t1->rows x t2->cols) which is the result of matrix multiplication of t1 and t2 (t1 @ t2).
  * Returns NULL if the number of cols of t1 and rows of t2 do not match.
- * Optimised (still O(n^3) but much better caching, reduced time by 20%!!!)
+ * Uses the cache-blocked, register-tiled gemm kernel (see gemm.h).
  * 
  * @param t1 the first tensor
  * @param t2 the second tensor
  */
 Tensor* tensor_multiplication(const Tensor* t1, const Tensor* t2) {
+    return tensor_multiplication_transposed(t1, 0, t2, 0);
+}
+
+
+
+/**
+ * Returns a new Tensor which is the result of op(t1) @ op(t2), where op(t) is t or its transpose.
+ * The transposes are never materialised, the operands are read in place.
+ * Returns NULL if the inner dimensions of op(t1) and op(t2) do not match.
+ * 
+ * @param t1 the first tensor
+ * @param transpose_t1 non zero to use the transpose of t1
+ * @param t2 the second tensor
+ * @param transpose_t2 non zero to use the transpose of t2
+ */
+Tensor* tensor_multiplication_transposed(const Tensor* t1, int transpose_t1, const Tensor* t2, int transpose_t2) {
     if (!t1 || !t2) {
         if (!t1) printf("t1 is NULL\n");
         if (!t2) printf("t2 is NULL\n");
         return NULL;
     }
 
-    if (t1->cols != t2->rows) {
-        if (t1->cols != t2->rows) printf("The number of cols of t1 and rows of t2 do not match\n");
-        return NULL;
-    }
+    Tensor* result = _create_tensor(transpose_t1 ? t1->cols : t1->rows, transpose_t2 ? t2->rows : t2->cols);
+    if (!result) return NULL;
 
-    Tensor* result = create_tensor_value(t1->rows, t2->cols, 0.0f);
-    
-    // OPTIMISATION: Using transposed copy of t2
-    // This is to traverse both t1 and t2_t in row-major order (sequentially).
-    Tensor* t2_t = tensor_transpose(t2); 
-
-    for (int i = 0; i < t1->rows; i++) {
-        for (int j = 0; j < t2->cols; j++) {
-            float sum = 0.0f;
-            for (int k = 0; k < t1->cols; k++) {
-                sum += t1->data[i * t1->cols + k] * t2_t->data[j * t2_t->cols + k];
-            }
-            result->data[i * result->cols + j] = sum;
-        }
-    }
+    if (!tensor_multiplication_transposed_into(result, t1, transpose_t1, t2, transpose_t2)) {free_tensor(&result); return NULL;}
 
-    free_tensor(&t2_t);
     return result;
 }
 
@@ -303,15 +469,10 @@ Tensor* tensor_multiplication_hadamard(const Tensor* t1, const Tensor* t2) {
         return NULL;
     }
 
-    if (t1->rows != t2->rows || t1->cols != t2->cols) {
-        if (t1->rows != t2->rows) printf("The number of rows do not match\n");
-        if (t1->cols != t2->cols) printf("The number of cols do not match\n");
-        return NULL;
-    }
-
     Tensor* t_new = _create_tensor(t1->rows, t1->cols);
+    if (!t_new) return NULL;
 
-    for (int i = 0; i < t_new->rows; i++) for (int j = 0; j < t_new->cols; j++) t_new->data[i*t_new->cols + j] = t1->data[i*t1->cols + j] * t2->data[i*t2->cols + j];
+    if (!tensor_multiplication_hadamard_into(t_new, t1, t2)) {free_tensor(&t_new); return NULL;}
 
     return t_new;
 }
@@ -331,10 +492,9 @@ Tensor* tensor_transpose(const Tensor* tensor) {
     }
 
     Tensor* t_new = _create_tensor(tensor->cols, tensor->rows);
+    if (!t_new) return NULL;
 
-    for (int i = 0; i < t_new->rows; i++) for (int j = 0; j < t_new->cols; j++) {
-        t_new->data[i*t_new->cols + j] = tensor->data[j*tensor->cols + i];
-    }
+    if (!tensor_transpose_into(t_new, tensor)) {free_tensor(&t_new); return NULL;}
 
     return t_new;
 }
@@ -354,20 +514,287 @@ Tensor* tensor_add_cols(const Tensor* tensor) {
     }
 
     Tensor* t_new = _create_tensor(1, tensor->cols);
+    if (!t_new) return NULL;
 
-    for (int i = 0; i < tensor->cols; i++) {
-        float sum = 0.0;
-        for (int j = 0; j < tensor->rows; j++) {
-            sum += tensor->data[j*tensor->cols + i];
-        }
-        t_new->data[i] = sum;
-    }
+    if (!tensor_add_cols_into(t_new, tensor)) {free_tensor(&t_new); return NULL;}
 
     return t_new;
 }
 
 
 
+// ==========================================
+//     Operations (into a given destination)
+// ==========================================
+
+/**
+ * Returns a pointer to the first element of row i of the tensor.
+ */
+float* _tensor_row(const Tensor* tensor, int i) {
+    return &tensor->data[(size_t)i * tensor->stride];
+}
+
+
+
+/**
+ * Returns 1 if out is not NULL and is (rows x cols), otherwise prints the cause and returns 0.
+ */
+int _check_destination(const Tensor* out, int rows, int cols) {
+    if (!out) {printf("Destination tensor is NULL\n"); return 0;}
+
+    if (out->rows != rows || out->cols != cols) {
+        printf("Destination tensor is (%d x %d), expected (%d x %d)\n", out->rows, out->cols, rows, cols);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * Returns 1 if t1 and t2 are not NULL and have the same shape, otherwise prints the cause and returns 0.
+ */
+int _check_same_shape(const Tensor* t1, const Tensor* t2) {
+    if (!t1 || !t2) {
+        if (!t1) printf("t1 is NULL\n");
+        if (!t2) printf("t2 is NULL\n");
+        return 0;
+    }
+
+    if (t1->rows != t2->rows || t1->cols != t2->cols) {
+        if (t1->rows != t2->rows) printf("The number of rows do not match\n");
+        if (t1->cols != t2->cols) printf("The number of cols do not match\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * out = t1 + t2
+ * out may be t1 or t2.
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination tensor (same shape as t1)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_addition_into(Tensor* out, const Tensor* t1, const Tensor* t2) {
+    if (!_check_same_shape(t1, t2) || !_check_destination(out, t1->rows, t1->cols)) return 0;
+
+    /* One call over the whole block when nothing is strided, otherwise one per row */
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(out) && tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->add(out->data, t1->data, t2->data, out->rows * out->cols);
+    else for (int i = 0; i < out->rows; i++) k->add(_tensor_row(out, i), _tensor_row(t1, i), _tensor_row(t2, i), out->cols);
+
+    return 1;
+}
+
+
+
+/**
+ * out = t1 - t2
+ * out may be t1 or t2.
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination tensor (same shape as t1)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_subtraction_into(Tensor* out, const Tensor* t1, const Tensor* t2) {
+    if (!_check_same_shape(t1, t2) || !_check_destination(out, t1->rows, t1->cols)) return 0;
+
+    /* One call over the whole block when nothing is strided, otherwise one per row */
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(out) && tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->sub(out->data, t1->data, t2->data, out->rows * out->cols);
+    else for (int i = 0; i < out->rows; i++) k->sub(_tensor_row(out, i), _tensor_row(t1, i), _tensor_row(t2, i), out->cols);
+
+    return 1;
+}
+
+
+
+/**
+ * out = t1 @ t2
+ * out must not be t1 or t2.
+ * Returns 0 if the number of cols of t1 and rows of t2 do not match or out is not (t1->rows x t2->cols).
+ * 
+ * @param out the destination tensor
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_multiplication_into(Tensor* out, const Tensor* t1, const Tensor* t2) {
+    return tensor_multiplication_transposed_into(out, t1, 0, t2, 0);
+}
+
+
+
+/**
+ * out = op(t1) @ op(t2), where op(t) is t or its transpose (read in place).
+ * out must not be t1 or t2.
+ * Returns 0 if the inner dimensions of op(t1) and op(t2) do not match or out has the wrong shape.
+ * 
+ * @param out the destination tensor
+ * @param t1 the first tensor
+ * @param transpose_t1 non zero to use the transpose of t1
+ * @param t2 the second tensor
+ * @param transpose_t2 non zero to use the transpose of t2
+ */
+int tensor_multiplication_transposed_into(Tensor* out, const Tensor* t1, int transpose_t1, const Tensor* t2, int transpose_t2) {
+    if (!t1 || !t2) {
+        if (!t1) printf("t1 is NULL\n");
+        if (!t2) printf("t2 is NULL\n");
+        return 0;
+    }
+
+    int m = transpose_t1 ? t1->cols : t1->rows;
+    int k = transpose_t1 ? t1->rows : t1->cols;
+    int k2 = transpose_t2 ? t2->cols : t2->rows;
+    int n = transpose_t2 ? t2->rows : t2->cols;
+
+    if (k != k2) {
+        printf("The inner dimensions of op(t1) and op(t2) do not match\n");
+        return 0;
+    }
+
+    if (!_check_destination(out, m, n)) return 0;
+    if (out == t1 || out == t2) {printf("Destination of a matrix multiplication cannot be one of its operands\n"); return 0;}
+
+    gemm(transpose_t1 ? GEMM_TRANS : GEMM_NO_TRANS, transpose_t2 ? GEMM_TRANS : GEMM_NO_TRANS, m, n, k, t1->data, t1->stride, t2->data, t2->stride, out->data, out->stride);
+
+    return 1;
+}
+
+
+
+/**
+ * out[i][j] = t1[i][j] * t2[i][j]
+ * out may be t1 or t2.
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination tensor (same shape as t1)
+ * @param t1 the first tensor
+ * @param t2 the second tensor
+ */
+int tensor_multiplication_hadamard_into(Tensor* out, const Tensor* t1, const Tensor* t2) {
+    if (!_check_same_shape(t1, t2) || !_check_destination(out, t1->rows, t1->cols)) return 0;
+
+    /* One call over the whole block when nothing is strided, otherwise one per row */
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(out) && tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->mul(out->data, t1->data, t2->data, out->rows * out->cols);
+    else for (int i = 0; i < out->rows; i++) k->mul(_tensor_row(out, i), _tensor_row(t1, i), _tensor_row(t2, i), out->cols);
+
+    return 1;
+}
+
+
+
+/**
+ * out = transpose of tensor
+ * out must not be tensor.
+ * Returns 0 if out is not (tensor->cols x tensor->rows).
+ * 
+ * @param out the destination tensor
+ * @param tensor the tensor
+ */
+int tensor_transpose_into(Tensor* out, const Tensor* tensor) {
+    if (!tensor) {printf("tensor is NULL\n"); return 0;}
+    if (!_check_destination(out, tensor->cols, tensor->rows)) return 0;
+    if (out == tensor) {printf("Destination of a transpose cannot be its operand\n"); return 0;}
+
+    for (int i = 0; i < out->rows; i++) for (int j = 0; j < out->cols; j++) {
+        out->data[i*out->stride + j] = tensor->data[j*tensor->stride + i];
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * out = sum of all rows of tensor (rows x cols ---> 1 x cols)
+ * Returns 0 if out is not (1 x tensor->cols).
+ * 
+ * @param out the destination tensor
+ * @param tensor the tensor
+ */
+int tensor_add_cols_into(Tensor* out, const Tensor* tensor) {
+    if (!tensor) {printf("tensor is NULL\n"); return 0;}
+    if (!_check_destination(out, 1, tensor->cols)) return 0;
+
+    /* Row by row, so that tensor is read sequentially */
+    const SimdKernels* k = simd_kernels();
+    memcpy(out->data, tensor->data, (size_t)tensor->cols * sizeof(float));
+    for (int i = 1; i < tensor->rows; i++) k->add(out->data, out->data, _tensor_row(tensor, i), tensor->cols);
+
+    return 1;
+}
+
+
+
+/**
+ * out = tensor (element by element copy)
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination tensor
+ * @param tensor the tensor copied
+ */
+int tensor_copy_into(Tensor* out, const Tensor* tensor) {
+    if (!tensor) {printf("tensor is NULL\n"); return 0;}
+    if (!_check_destination(out, tensor->rows, tensor->cols)) return 0;
+    if (out == tensor) return 1;
+
+    if (tensor_is_contiguous(out) && tensor_is_contiguous(tensor)) memcpy(out->data, tensor->data, (size_t)tensor->rows * tensor->cols * sizeof(float));
+    else for (int i = 0; i < tensor->rows; i++) memcpy(_tensor_row(out, i), _tensor_row(tensor, i), (size_t)tensor->cols * sizeof(float));
+
+    return 1;
+}
+
+
+
+/**
+ * out = tensor rounded (to nearest even) to the 16-bit format of out, one vectorised pass per row
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination 16-bit tensor
+ * @param tensor the tensor rounded
+ */
+int tensor_to_half(HalfTensor* out, const Tensor* tensor) {
+    if (!out || !tensor) {printf("out or tensor is NULL\n"); return 0;}
+    if (out->rows != tensor->rows || out->cols != tensor->cols) {printf("Shapes do not match (%d x %d) and (%d x %d)\n", out->rows, out->cols, tensor->rows, tensor->cols); return 0;}
+
+    const SimdKernels* k = simd_kernels();
+    void (*round_row)(uint16_t*, const float*, int) = (out->precision == PRECISION_FP16) ? k->to_fp16 : k->to_bf16;
+    for (int i = 0; i < tensor->rows; i++) round_row(&out->data[(size_t)i * out->stride], _tensor_row(tensor, i), tensor->cols);
+
+    return 1;
+}
+
+
+
+/**
+ * out = half widened to floats (exact), one vectorised pass per row
+ * Returns 0 if the shapes do not match.
+ * 
+ * @param out the destination tensor
+ * @param half the 16-bit tensor widened
+ */
+int tensor_from_half(Tensor* out, const HalfTensor* half) {
+    if (!half) {printf("half is NULL\n"); return 0;}
+    if (!_check_destination(out, half->rows, half->cols)) return 0;
+
+    const SimdKernels* k = simd_kernels();
+    void (*widen_row)(float*, const uint16_t*, int) = (half->precision == PRECISION_FP16) ? k->from_fp16 : k->from_bf16;
+    for (int i = 0; i < half->rows; i++) widen_row(_tensor_row(out, i), &half->data[(size_t)i * half->stride], half->cols);
+
+    return 1;
+}
+
+
+
 // ==========================================
 //      Operations (in-place, modify t1)
 // ==========================================
@@ -391,7 +818,9 @@ void tensor_addition_inplace(Tensor* t1, const Tensor* t2) {
         return;
     }
 
-    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->cols + j] = t1->data[i*t1->cols + j] + t2->data[i*t2->cols + j];
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->add(t1->data, t1->data, t2->data, t1->rows * t1->cols);
+    else for (int i = 0; i < t1->rows; i++) k->add(_tensor_row(t1, i), _tensor_row(t1, i), _tensor_row(t2, i), t1->cols);
 }
 
 
@@ -415,7 +844,9 @@ void tensor_subtraction_inplace(Tensor* t1, const Tensor* t2){
         return;
     }
 
-    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->cols + j] = t1->data[i*t1->cols + j] - t2->data[i*t2->cols + j];
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->sub(t1->data, t1->data, t2->data, t1->rows * t1->cols);
+    else for (int i = 0; i < t1->rows; i++) k->sub(_tensor_row(t1, i), _tensor_row(t1, i), _tensor_row(t2, i), t1->cols);
 }
 
 
@@ -439,7 +870,9 @@ void tensor_multiplication_hadamard_inplace(Tensor* t1, const Tensor* t2) {
         return;
     }
 
-    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->cols + j] = t1->data[i*t1->cols + j] * t2->data[i*t2->cols + j];
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->mul(t1->data, t1->data, t2->data, t1->rows * t1->cols);
+    else for (int i = 0; i < t1->rows; i++) k->mul(_tensor_row(t1, i), _tensor_row(t1, i), _tensor_row(t2, i), t1->cols);
 }
 
 
@@ -464,7 +897,9 @@ void tensor_add_scaled_inplace(Tensor* t1, const Tensor* t2, float scaler) {
         return;
     }
 
-    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->cols + j] = t1->data[i*t1->cols + j] + scaler * t2->data[i*t2->cols + j];
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t1) && tensor_is_contiguous(t2)) k->axpy(t1->data, scaler, t2->data, t1->rows * t1->cols);
+    else for (int i = 0; i < t1->rows; i++) k->axpy(_tensor_row(t1, i), scaler, _tensor_row(t2, i), t1->cols);
 }
 
 
@@ -481,7 +916,9 @@ void tensor_scale_inplace(Tensor* t, float scaler) {
         return;
     }
 
-    for (int i = 0; i < t->rows; i++) for (int j = 0; j < t->cols; j++) t->data[i*t->cols + j] = t->data[i*t->cols + j] * scaler;
+    const SimdKernels* k = simd_kernels();
+    if (tensor_is_contiguous(t)) k->scale(t->data, scaler, t->rows * t->cols);
+    else for (int i = 0; i < t->rows; i++) k->scale(_tensor_row(t, i), scaler, t->cols);
 }
 
 
@@ -505,7 +942,8 @@ void tensor_row_addition_inplace(Tensor* t1, Tensor* t2) {
         return;
     }
 
-    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->cols + j] = t1->data[i*t1->cols + j] + t2->data[j];
+    const SimdKernels* k = simd_kernels();
+    for (int i = 0; i < t1->rows; i++) k->add(_tensor_row(t1, i), _tensor_row(t1, i), t2->data, t1->cols);
 }
 
 
@@ -523,7 +961,7 @@ void tensor_apply_func_inplace(Tensor* t1, float (*func)(float)) {
         return;
     }
 
-    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->cols + j] = func(t1->data[i*t1->cols + j]);
+    for (int i = 0; i < t1->rows; i++) for (int j = 0; j < t1->cols; j++) t1->data[i*t1->stride + j] = func(t1->data[i*t1->stride + j]);
 }
 
 
@@ -547,7 +985,7 @@ void print_tensor(const Tensor* tensor) {
         printf("[");
 
         for (int j = 0; j < tensor->cols; j++) {
-            printf("  %8.4f", tensor->data[i*tensor->cols + j]);
+            printf("  %8.4f", tensor->data[i*tensor->stride + j]);
         }
 
         printf(" ]\n");
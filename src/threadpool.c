@@ -0,0 +1,394 @@
+#include "threadpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define DEQUE_CAPACITY          1024
+#define MAX_THREADS             256
+#define CHUNKS_PER_THREAD       4
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+static ThreadPool* default_pool = NULL;
+static pthread_mutex_t default_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread ThreadPool* current_pool = NULL;    // Pool the current thread is a worker of (NULL for other threads)
+static __thread int current_worker = -1;            // Index of the deque owned by the current thread
+
+int _threadpool_resolve_threads(int n_threads);
+void* _threadpool_worker_main(void* arg);
+int _threadpool_push(ThreadPool* pool, int deque_idx, const Task* task);
+int _threadpool_pop(ThreadPool* pool, int deque_idx, Task* task);
+int _threadpool_steal(ThreadPool* pool, int deque_idx, Task* task);
+int _threadpool_take(ThreadPool* pool, Task* task);
+void _threadpool_run(const Task* task);
+
+
+
+/**
+ * Returns n_threads if positive, otherwise NEURAL_NUM_THREADS if set, otherwise the number of online cores.
+ * The result is clamped to [1, MAX_THREADS].
+ */
+int _threadpool_resolve_threads(int n_threads) {
+    if (n_threads <= 0) {
+        const char* env = getenv(THREADPOOL_ENV_VAR);
+        if (env && *env) n_threads = atoi(env);
+        if (n_threads <= 0) {
+            if (env && *env) printf("Invalid %s value '%s', using the number of cores\n", THREADPOOL_ENV_VAR, env);
+            n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+    }
+
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+
+    return n_threads;
+}
+
+
+
+/**
+ * Queues the task at the tail of a deque and wakes an idle worker.
+ * Returns 0 if the deque is full.
+ */
+int _threadpool_push(ThreadPool* pool, int deque_idx, const Task* task) {
+    WorkDeque* dq = &pool->deques[deque_idx];
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail - dq->head == dq->capacity) {
+        pthread_mutex_unlock(&dq->lock);
+        return 0;
+    }
+    dq->tasks[dq->tail % dq->capacity] = *task;
+    dq->tail++;
+    pthread_mutex_unlock(&dq->lock);
+
+    atomic_fetch_add(&pool->queued, 1);
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_signal(&pool->sleep_cond);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    return 1;
+}
+
+
+
+/**
+ * Takes the newest task of a deque (used by its owner).
+ * Returns 0 if the deque is empty.
+ */
+int _threadpool_pop(ThreadPool* pool, int deque_idx, Task* task) {
+    WorkDeque* dq = &pool->deques[deque_idx];
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail != dq->head) {
+        dq->tail--;
+        *task = dq->tasks[dq->tail % dq->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    if (found) atomic_fetch_sub(&pool->queued, 1);
+    return found;
+}
+
+
+
+/**
+ * Takes the oldest task of a deque (used by the other threads).
+ * Returns 0 if the deque is empty.
+ */
+int _threadpool_steal(ThreadPool* pool, int deque_idx, Task* task) {
+    WorkDeque* dq = &pool->deques[deque_idx];
+    int found = 0;
+
+    /* Don't queue up behind the owner, it will be busy with the deque anyway */
+    if (pthread_mutex_trylock(&dq->lock) != 0) return 0;
+    if (dq->tail != dq->head) {
+        *task = dq->tasks[dq->head % dq->capacity];
+        dq->head++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    if (found) atomic_fetch_sub(&pool->queued, 1);
+    return found;
+}
+
+
+
+/**
+ * Finds a task for the current thread: its own deque first (if it owns one), then the others starting from its neighbour.
+ * Returns 0 if nothing was found.
+ */
+int _threadpool_take(ThreadPool* pool, Task* task) {
+    int own = (current_pool == pool) ? current_worker : -1;
+    if (own >= 0 && _threadpool_pop(pool, own, task)) return 1;
+
+    if (atomic_load(&pool->queued) == 0) return 0;
+
+    int first = (own >= 0) ? own + 1 : 0;
+    for (int i = 0; i < pool->n_workers; i++) {
+        int victim = (first + i) % pool->n_workers;
+        if (victim == own) continue;
+        if (_threadpool_steal(pool, victim, task)) return 1;
+    }
+
+    return 0;
+}
+
+
+
+/**
+ * Executes a task and marks it as done for its parallel-for.
+ */
+void _threadpool_run(const Task* task) {
+    task->func(task->begin, task->end, task->arg);
+    atomic_fetch_sub_explicit(task->remaining, 1, memory_order_release);
+}
+
+
+
+/**
+ * Main loop of a worker: run tasks while there are any, sleep otherwise.
+ */
+void* _threadpool_worker_main(void* arg) {
+    ThreadPool* pool = (ThreadPool*) arg;
+
+    /* Workers are numbered by their position in pool->workers, which is complete once create_threadpool releases sleep_lock */
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    pthread_t self = pthread_self();
+    for (int i = 0; i < pool->n_workers; i++) if (pthread_equal(pool->workers[i], self)) current_worker = i;
+    current_pool = pool;
+
+    Task task;
+    while (1) {
+        if (_threadpool_take(pool, &task)) {
+            _threadpool_run(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        while (!atomic_load(&pool->stop) && atomic_load(&pool->queued) == 0) pthread_cond_wait(&pool->sleep_cond, &pool->sleep_lock);
+        int stop = atomic_load(&pool->stop) && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->sleep_lock);
+
+        if (stop) break;
+    }
+
+    return NULL;
+}
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new thread pool in which n_threads threads take part in every parallel-for (n_threads - 1 workers are spawned, the calling thread is the last one).
+ * If n_threads <= 0, the value of NEURAL_NUM_THREADS is used, or the number of online cores if it is not set.
+ * Returns NULL if any error.
+ *
+ * @param n_threads Number of threads of the pool
+ */
+ThreadPool* create_threadpool(int n_threads) {
+    ThreadPool* pool = (ThreadPool*) malloc(sizeof(ThreadPool));
+    if (!pool) {printf("Malloc failed for thread pool\n"); return NULL;}
+
+    pool->n_threads = _threadpool_resolve_threads(n_threads);
+    pool->n_workers = pool->n_threads - 1;
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->next_deque, 0);
+    atomic_init(&pool->stop, 0);
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->sleep_cond, NULL);
+
+    pool->workers = NULL;
+    pool->deques = NULL;
+    if (pool->n_workers == 0) return pool;
+
+    pool->workers = (pthread_t*) malloc(pool->n_workers * sizeof(pthread_t));
+    pool->deques = (WorkDeque*) calloc(pool->n_workers, sizeof(WorkDeque));
+    if (!pool->workers || !pool->deques) {
+        printf("Malloc failed for the workers of the thread pool\n");
+        free(pool->workers);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < pool->n_workers; i++) {
+        WorkDeque* dq = &pool->deques[i];
+        pthread_mutex_init(&dq->lock, NULL);
+        dq->capacity = DEQUE_CAPACITY;
+        dq->head = 0;
+        dq->tail = 0;
+        dq->tasks = (Task*) malloc(DEQUE_CAPACITY * sizeof(Task));
+        if (!dq->tasks) {
+            printf("Malloc failed for a deque of the thread pool\n");
+            for (int j = 0; j <= i; j++) free(pool->deques[j].tasks);
+            free(pool->workers);
+            free(pool->deques);
+            free(pool);
+            return NULL;
+        }
+    }
+
+    /* Workers look themselves up in pool->workers, so hold them back until every handle is stored */
+    pthread_mutex_lock(&pool->sleep_lock);
+    int started = 0;
+    for (; started < pool->n_workers; started++) {
+        if (pthread_create(&pool->workers[started], NULL, _threadpool_worker_main, pool) != 0) break;
+    }
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    if (started != pool->n_workers) {
+        printf("Only %d of %d workers could be started\n", started, pool->n_workers);
+        atomic_store(&pool->stop, 1);
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_broadcast(&pool->sleep_cond);
+        pthread_mutex_unlock(&pool->sleep_lock);
+        for (int i = 0; i < started; i++) pthread_join(pool->workers[i], NULL);
+        for (int i = 0; i < pool->n_workers; i++) free(pool->deques[i].tasks);
+        free(pool->workers);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+
+
+/**
+ * Stops and joins the workers, then completely frees the pool.
+ */
+void free_threadpool(ThreadPool** pool) {
+    if (pool && *pool) {
+        ThreadPool* p = *pool;
+
+        atomic_store(&p->stop, 1);
+        pthread_mutex_lock(&p->sleep_lock);
+        pthread_cond_broadcast(&p->sleep_cond);
+        pthread_mutex_unlock(&p->sleep_lock);
+
+        for (int i = 0; i < p->n_workers; i++) pthread_join(p->workers[i], NULL);
+
+        for (int i = 0; i < p->n_workers; i++) {
+            pthread_mutex_destroy(&p->deques[i].lock);
+            free(p->deques[i].tasks);
+        }
+        free(p->deques);
+        free(p->workers);
+
+        pthread_mutex_destroy(&p->sleep_lock);
+        pthread_cond_destroy(&p->sleep_cond);
+
+        free(p);
+        *pool = NULL;
+    }
+}
+
+
+
+/**
+ * Returns the library-owned pool used by the tensor operations, creating it on the first call.
+ * Its size comes from NEURAL_NUM_THREADS, or the number of online cores if it is not set.
+ */
+ThreadPool* get_default_threadpool() {
+    ThreadPool* pool = __atomic_load_n(&default_pool, __ATOMIC_ACQUIRE);
+    if (pool) return pool;
+
+    pthread_mutex_lock(&default_pool_lock);
+    if (!default_pool) __atomic_store_n(&default_pool, create_threadpool(0), __ATOMIC_RELEASE);
+    pool = default_pool;
+    pthread_mutex_unlock(&default_pool_lock);
+
+    return pool;
+}
+
+
+
+/**
+ * Replaces the library-owned pool with one of n_threads threads (n_threads <= 0 means the same as for create_threadpool).
+ * Must not be called while any tensor operation is running.
+ * Returns 0 if any error.
+ *
+ * @param n_threads Number of threads of the new default pool
+ */
+int set_default_threadpool_threads(int n_threads) {
+    ThreadPool* pool = create_threadpool(n_threads);
+    if (!pool) {printf("New default thread pool could not be created\n"); return 0;}
+
+    pthread_mutex_lock(&default_pool_lock);
+    ThreadPool* old = default_pool;
+    __atomic_store_n(&default_pool, pool, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&default_pool_lock);
+
+    free_threadpool(&old);
+    return 1;
+}
+
+
+
+// ==========================================
+//             Parallel Primitives
+// ==========================================
+
+/**
+ * Calls func(begin, end, arg) over disjoint chunks covering [start, end) and returns once all of them are done.
+ * Chunks are at least grain indices long (except the last one) and are spread over the deques of the workers,
+ * idle threads steal from each other. The calling thread executes chunks too while it waits.
+ * Can be called from inside a chunk (nested parallel-for) and from several threads at once.
+ * Runs inline if pool is NULL, has a single thread or the range is smaller than grain.
+ */
+void threadpool_parallel_for(ThreadPool* pool, int start, int end, int grain, void (*func)(int begin, int end, void* arg), void* arg) {
+    if (!func || end <= start) return;
+    if (grain < 1) grain = 1;
+
+    int range = end - start;
+    if (!pool || pool->n_workers == 0 || range <= grain) {
+        func(start, end, arg);
+        return;
+    }
+
+    int n_chunks = (range + grain - 1) / grain;
+    if (n_chunks > pool->n_threads * CHUNKS_PER_THREAD) n_chunks = pool->n_threads * CHUNKS_PER_THREAD;
+    int chunk = (range + n_chunks - 1) / n_chunks;
+    n_chunks = (range + chunk - 1) / chunk;
+
+    atomic_int remaining;
+    atomic_init(&remaining, n_chunks);
+
+    /* Chunk 0 is kept for the calling thread, the rest are queued */
+    int own = (current_pool == pool) ? current_worker : -1;
+    for (int c = 1; c < n_chunks; c++) {
+        Task task = {func, arg, start + c * chunk, start + (c + 1) * chunk, &remaining};
+        if (task.end > end) task.end = end;
+
+        int deque_idx = (own >= 0) ? own : (int)(atomic_fetch_add(&pool->next_deque, 1) % (unsigned)pool->n_workers);
+        if (!_threadpool_push(pool, deque_idx, &task)) _threadpool_run(&task);
+    }
+
+    Task first = {func, arg, start, (start + chunk < end) ? start + chunk : end, &remaining};
+    _threadpool_run(&first);
+
+    /* Help out until every chunk is done, whoever executes them */
+    Task task;
+    while (atomic_load_explicit(&remaining, memory_order_acquire) > 0) {
+        if (_threadpool_take(pool, &task)) _threadpool_run(&task);
+        else sched_yield();
+    }
+}
@@ -0,0 +1,208 @@
+#include "workspace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+// ==========================================
+//             Internal Helpers
+// ==========================================
+
+size_t _workspace_align(size_t bytes);
+
+
+
+/**
+ * Rounds bytes up to a multiple of WORKSPACE_ALIGNMENT.
+ */
+size_t _workspace_align(size_t bytes) {
+    return (bytes + WORKSPACE_ALIGNMENT - 1) & ~((size_t)WORKSPACE_ALIGNMENT - 1);
+}
+
+
+
+// ==========================================
+//             Object Management
+// ==========================================
+
+/**
+ * Returns a new workspace able to hold capacity bytes of allocations (alignment padding included).
+ * Returns NULL if any error.
+ *
+ * @param capacity Size of the workspace in bytes
+ */
+Workspace* create_workspace(size_t capacity) {
+    if (capacity == 0) {printf("Capacity of a workspace cannot be zero\n"); return NULL;}
+
+    Workspace* ws = (Workspace*) malloc(sizeof(Workspace));
+    if (!ws) {printf("Malloc failed for workspace\n"); return NULL;}
+
+    ws->capacity = _workspace_align(capacity);
+    ws->memory = (char*) aligned_alloc(WORKSPACE_ALIGNMENT, ws->capacity);
+    if (!ws->memory) {
+        printf("Malloc failed for the memory of the workspace (%zu bytes)\n", ws->capacity);
+        free(ws);
+        return NULL;
+    }
+
+    ws->offset = 0;
+    ws->high_water = 0;
+
+    return ws;
+}
+
+
+
+/**
+ * Completely frees the workspace. Every tensor allocated from it becomes invalid.
+ */
+void free_workspace(Workspace** ws) {
+    if (ws && *ws) {
+        free((*ws)->memory);
+        free(*ws);
+        *ws = NULL;
+    }
+}
+
+
+
+// ==========================================
+//             Allocation
+// ==========================================
+
+/**
+ * Returns WORKSPACE_ALIGNMENT aligned memory of the given size taken from the workspace.
+ * Returns NULL if the workspace is full.
+ *
+ * @param ws The workspace
+ * @param bytes Number of bytes needed
+ */
+void* workspace_alloc(Workspace* ws, size_t bytes) {
+    if (!ws) {printf("Workspace is NULL\n"); return NULL;}
+
+    size_t size = _workspace_align(bytes);
+    if (size > ws->capacity - ws->offset) {
+        printf("Workspace is full (%zu of %zu bytes in use, %zu requested)\n", ws->offset, ws->capacity, size);
+        return NULL;
+    }
+
+    void* ptr = ws->memory + ws->offset;
+    ws->offset += size;
+    if (ws->offset > ws->high_water) ws->high_water = ws->offset;
+
+    return ptr;
+}
+
+
+
+/**
+ * Returns an uninitialised (rows x cols) tensor whose header and data both live in the workspace.
+ * It stays valid until the next workspace_reset and must NOT be passed to free_tensor.
+ * Returns NULL if any error.
+ *
+ * @param ws The workspace
+ * @param rows number of rows of tensor
+ * @param cols number of cols of tensor
+ */
+Tensor* workspace_tensor(Workspace* ws, int rows, int cols) {
+    if (rows <= 0 || cols <= 0) {
+        if (rows <= 0) printf("Number of rows received is less than 1\n");
+        if (cols <= 0) printf("Number of cols received is less than 1\n");
+        return NULL;
+    }
+
+    size_t saved_offset = ws ? ws->offset : 0;
+
+    Tensor* t = (Tensor*) workspace_alloc(ws, sizeof(Tensor));
+    if (!t) return NULL;
+
+    t->data = (float*) workspace_alloc(ws, (size_t)rows * cols * sizeof(float));
+    if (!t->data) {
+        ws->offset = saved_offset;
+        return NULL;
+    }
+
+    t->rows = rows;
+    t->cols = cols;
+    t->stride = cols;
+    t->owns_data = 0;
+
+    return t;
+}
+
+
+
+/**
+ * Returns the number of workspace bytes taken by workspace_tensor(ws, rows, cols), padding included.
+ * Used to size a workspace up front.
+ */
+size_t workspace_tensor_bytes(int rows, int cols) {
+    return _workspace_align(sizeof(Tensor)) + _workspace_align((size_t)rows * cols * sizeof(float));
+}
+
+
+
+/**
+ * Returns an uninitialised (rows x cols) 16-bit tensor whose header and data both live in the workspace.
+ * It stays valid until the next workspace_reset.
+ * Returns NULL if any error.
+ *
+ * @param ws The workspace
+ * @param rows number of rows of tensor
+ * @param cols number of cols of tensor
+ * @param precision PRECISION_BF16 or PRECISION_FP16
+ */
+HalfTensor* workspace_half_tensor(Workspace* ws, int rows, int cols, storage_precision precision) {
+    if (rows <= 0 || cols <= 0 || precision == PRECISION_FP32) {
+        if (rows <= 0) printf("Number of rows received is less than 1\n");
+        if (cols <= 0) printf("Number of cols received is less than 1\n");
+        if (precision == PRECISION_FP32) printf("A 16-bit tensor cannot have the float precision\n");
+        return NULL;
+    }
+
+    size_t saved_offset = ws ? ws->offset : 0;
+
+    HalfTensor* t = (HalfTensor*) workspace_alloc(ws, sizeof(HalfTensor));
+    if (!t) return NULL;
+
+    t->data = (uint16_t*) workspace_alloc(ws, (size_t)rows * cols * sizeof(uint16_t));
+    if (!t->data) {
+        ws->offset = saved_offset;
+        return NULL;
+    }
+
+    t->rows = rows;
+    t->cols = cols;
+    t->stride = cols;
+    t->precision = precision;
+
+    return t;
+}
+
+
+
+/**
+ * Returns the number of workspace bytes taken by workspace_half_tensor(ws, rows, cols, precision), padding included.
+ */
+size_t workspace_half_tensor_bytes(int rows, int cols) {
+    return _workspace_align(sizeof(HalfTensor)) + _workspace_align((size_t)rows * cols * sizeof(uint16_t));
+}
+
+
+
+/**
+ * Releases every allocation of the workspace at once (O(1), the memory is kept for reuse).
+ */
+void workspace_reset(Workspace* ws) {
+    if (ws) ws->offset = 0;
+}
+
+
+
+/**
+ * Returns the largest number of bytes that were in use at once since the workspace was created.
+ */
+size_t workspace_high_water(const Workspace* ws) {
+    return ws ? ws->high_water : 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dataloader.h"
+#include "simd.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define SEED 77
+#define N_SAMPLES 103
+#define N_FEATURES 3
+#define N_OUTPUTS 2
+#define BATCH_SIZE 10               // Does not divide the samples, so the last batch of an epoch holds 3
+#define EPOCHS 4
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+int read_epoch(DataLoader* loader, int* order);
+int read_batch(DataLoader* loader, int batch, int* samples);
+int is_permutation(const int* order);
+int check_orders(Tensor* x, Tensor* y);
+int check_seek(Tensor* x, Tensor* y);
+int check_sequential(Tensor* x, Tensor* y);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* Reads epochs of a shuffling loader: every epoch must be a permutation of the samples with x and y rows still paired,
+   and its order must only depend on the seed and the epoch (not on the workers or on the epochs read before).
+   Then dataloader_seek must land on the batch the uninterrupted stream holds there, and a loader that does not
+   shuffle must serve the rows in order */
+int main() {
+    init_tensor_api();
+    const char* level = simd_level_name(simd_get_level());
+
+    /* Every value of row i names sample i, so a batch tells which samples it holds */
+    Tensor* x = create_tensor_value(N_SAMPLES, N_FEATURES, 0.0f);
+    Tensor* y = create_tensor_value(N_SAMPLES, N_OUTPUTS, 0.0f);
+    if (!x || !y) {printf("Tensors could not be created\n"); return 1;}
+
+    for (int i = 0; i < N_SAMPLES; i++) {
+        for (int j = 0; j < N_FEATURES; j++) x->data[(size_t)i * x->stride + j] = (float)(i * N_FEATURES + j);
+        for (int j = 0; j < N_OUTPUTS; j++) y->data[(size_t)i * y->stride + j] = (float)(i * N_OUTPUTS + j);
+    }
+
+    int failures = 0;
+
+    int ok = check_orders(x, y);
+    printf("Shuffled epochs are permutations that depend only on (seed, epoch) [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_seek(x, y);
+    printf("dataloader_seek lands on the right batch [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_sequential(x, y);
+    printf("Unshuffled loader serves the rows in order [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    free_tensor(&x);
+    free_tensor(&y);
+
+    return failures != 0;
+}
+
+
+
+/* Takes the next batch, expected to be batch (within its epoch), and writes the samples it holds. Returns 0 if the
+   batch has the wrong size or a row of y does not belong to the sample of its row of x */
+int read_batch(DataLoader* loader, int batch, int* samples) {
+    Tensor* bx = NULL;
+    Tensor* by = NULL;
+    if (!dataloader_next(loader, &bx, &by)) return 0;
+
+    int expected_rows = (batch == loader->n_batches - 1) ? N_SAMPLES - batch * BATCH_SIZE : BATCH_SIZE;
+    if (bx->rows != expected_rows || by->rows != expected_rows || bx->cols != N_FEATURES || by->cols != N_OUTPUTS) {
+        printf("FAILED: batch %d is %d x %d / %d x %d\n", batch, bx->rows, bx->cols, by->rows, by->cols);
+        return 0;
+    }
+
+    for (int r = 0; r < bx->rows; r++) {
+        int sample = (int)bx->data[(size_t)r * bx->stride] / N_FEATURES;
+        for (int j = 0; j < N_FEATURES; j++) if (bx->data[(size_t)r * bx->stride + j] != (float)(sample * N_FEATURES + j)) return 0;
+        for (int j = 0; j < N_OUTPUTS; j++) if (by->data[(size_t)r * by->stride + j] != (float)(sample * N_OUTPUTS + j)) return 0;
+        samples[r] = sample;
+    }
+
+    return 1;
+}
+
+
+
+/* Reads the n_batches batches of one epoch into order (N_SAMPLES samples). Returns 0 if any batch is wrong */
+int read_epoch(DataLoader* loader, int* order) {
+    for (int b = 0; b < loader->n_batches; b++) if (!read_batch(loader, b, order + b * BATCH_SIZE)) return 0;
+    return 1;
+}
+
+
+
+/* Returns 1 if order holds every sample exactly once */
+int is_permutation(const int* order) {
+    char seen[N_SAMPLES] = {0};
+    for (int i = 0; i < N_SAMPLES; i++) {
+        if (order[i] < 0 || order[i] >= N_SAMPLES || seen[order[i]]) return 0;
+        seen[order[i]] = 1;
+    }
+    return 1;
+}
+
+
+
+/* EPOCHS epochs read in a row by one loader against the same epochs read by loaders with other worker counts, that
+   seek straight to them or read them backwards. A loader with another seed must draw other orders */
+int check_orders(Tensor* x, Tensor* y) {
+    int orders[EPOCHS][N_SAMPLES], again[N_SAMPLES];
+
+    DataLoader* loader = create_dataloader(x, y, BATCH_SIZE, 1, SEED, 1);
+    int ok = loader != NULL;
+    for (int e = 0; ok && e < EPOCHS; e++) ok = read_epoch(loader, orders[e]) && is_permutation(orders[e]);
+    free_dataloader(&loader);
+    if (!ok) {printf("FAILED: an epoch is not a permutation of the samples\n"); return 0;}
+
+    int identity = 1, repeated = 0;
+    for (int i = 0; i < N_SAMPLES; i++) identity &= orders[0][i] == i;
+    for (int e = 1; e < EPOCHS; e++) repeated |= memcmp(orders[e], orders[e - 1], sizeof(orders[e])) == 0;
+    if (identity || repeated) {printf("FAILED: the epochs are not reshuffled\n"); return 0;}
+
+    /* Other workers, epochs visited backwards */
+    loader = create_dataloader(x, y, BATCH_SIZE, 1, SEED, 3);
+    ok = loader != NULL;
+    for (int e = EPOCHS - 1; ok && e >= 0; e--) {
+        ok = dataloader_seek(loader, e, 0) && read_epoch(loader, again) && memcmp(again, orders[e], sizeof(again)) == 0;
+        if (!ok) printf("FAILED: epoch %d differs when read by another loader\n", e);
+    }
+    free_dataloader(&loader);
+    if (!ok) return 0;
+
+    loader = create_dataloader(x, y, BATCH_SIZE, 1, SEED + 1, 1);
+    ok = loader && read_epoch(loader, again) && is_permutation(again) && memcmp(again, orders[0], sizeof(again)) != 0;
+    if (!ok) printf("FAILED: another seed gave the same order\n");
+    free_dataloader(&loader);
+
+    return ok;
+}
+
+
+
+/* Seeks forward, backward, within an epoch and to batch n_batches (the first of the next epoch), then reads on across
+   an epoch boundary. Every batch must hold the samples the uninterrupted stream holds at its position */
+int check_seek(Tensor* x, Tensor* y) {
+    int orders[EPOCHS][N_SAMPLES], samples[BATCH_SIZE];
+
+    DataLoader* loader = create_dataloader(x, y, BATCH_SIZE, 1, SEED, 2);
+    int ok = loader != NULL;
+    for (int e = 0; ok && e < EPOCHS; e++) ok = read_epoch(loader, orders[e]);
+    if (!ok) {free_dataloader(&loader); printf("FAILED: the stream could not be read\n"); return 0;}
+
+    int n_batches = loader->n_batches;
+    int seeks[][2] = {{2, 5}, {0, 3}, {0, 3}, {3, n_batches - 1}, {1, n_batches}, {0, 0}, {2, n_batches - 2}};
+    int n_seeks = sizeof(seeks) / sizeof(seeks[0]);
+
+    for (int s = 0; ok && s < n_seeks; s++) {
+        long position = (long)seeks[s][0] * n_batches + seeks[s][1];
+        ok = dataloader_seek(loader, seeks[s][0], seeks[s][1]);
+
+        /* Three batches from the seek on, crossing into the next epoch for the last seeks */
+        for (int k = 0; ok && k < 3 && position + k < (long)EPOCHS * n_batches; k++) {
+            int epoch = (int)((position + k) / n_batches), batch = (int)((position + k) % n_batches);
+            int rows = (batch == n_batches - 1) ? N_SAMPLES - batch * BATCH_SIZE : BATCH_SIZE;
+
+            ok = read_batch(loader, batch, samples) && memcmp(samples, orders[epoch] + batch * BATCH_SIZE, rows * sizeof(int)) == 0;
+            if (!ok) printf("FAILED: after seeking to epoch %d, batch %d, epoch %d batch %d is wrong\n", seeks[s][0], seeks[s][1], epoch, batch);
+        }
+    }
+
+    int saved = silence_stdout();    /* The refusals print their reason */
+    ok = ok && !dataloader_seek(loader, 0, n_batches + 1) && !dataloader_seek(loader, -1, 0);
+    restore_stdout(saved);
+    free_dataloader(&loader);
+
+    return ok;
+}
+
+
+
+/* Without shuffling every epoch is the rows in order */
+int check_sequential(Tensor* x, Tensor* y) {
+    int order[N_SAMPLES];
+
+    DataLoader* loader = create_dataloader(x, y, BATCH_SIZE, 0, SEED, 1);
+    int ok = loader != NULL;
+    for (int e = 0; ok && e < 2; e++) {
+        ok = read_epoch(loader, order);
+        for (int i = 0; ok && i < N_SAMPLES; i++) ok = order[i] == i;
+    }
+    free_dataloader(&loader);
+
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "dataset.h"
+#include "simd.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define SEED 4242
+#define N_CLASSES 3
+#define SWEEP_ROWS 2000
+#define SWEEP_FEATURES 8
+#define SWEEP_TOLERANCE 2e-7f       // Relative, one float rounding away from strtod
+#define LONG_FEATURES 150000        // About 1.3 MB per row, longer than a chunk of the CSV reader (1 MB)
+#define LONG_ROWS 3
+#define BAD_FILE_ROWS 200000        // About 3 MB, so the malformed line sits in a later chunk
+#define BAD_LINE 150001
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+void temp_path(char* path, size_t size, const char* what);
+int write_text(const char* path, const char* text, size_t n);
+int check_rows(const Dataset* ds, const int* labels, const float* features, int n_samples, int n_features);
+int check_layout();
+int check_numbers();
+int check_long_lines();
+int check_bad_line();
+int check_round_trip();
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* The CSV reader (dataset_load_csv) on headers, CRLF, blank lines and a last line without newline, on the number formats
+   it scans against strtod, on lines longer than one of its chunks and on the line number it reports for a malformed row.
+   Then a dataset saved and mapped back by dataset_load must hold the same bytes */
+int main() {
+    init_tensor_api();
+    srand(SEED);
+    const char* level = simd_level_name(simd_get_level());
+
+    int failures = 0;
+
+    int ok = check_layout();
+    printf("CSV header, CRLF, blank lines and no final newline [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_numbers();
+    printf("CSV numbers (signs, exponents, leading '.') against strtod [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_long_lines();
+    printf("CSV lines longer than a chunk [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_bad_line();
+    printf("CSV malformed line reported with its number [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_round_trip();
+    printf("dataset_save / dataset_load round trip [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    return failures != 0;
+}
+
+
+
+/* A path in /tmp unique to this process */
+void temp_path(char* path, size_t size, const char* what) {
+    snprintf(path, size, "/tmp/dataset_test_%d_%s", (int)getpid(), what);
+}
+
+
+
+/* Writes n bytes of text to path. Returns 0 if any error */
+int write_text(const char* path, const char* text, size_t n) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {printf("Error opening %s\n", path); return 0;}
+
+    int ok = fwrite(text, 1, n, file) == n;
+    ok = (fclose(file) == 0) && ok;
+    return ok;
+}
+
+
+
+/* Checks the shape of ds, the one-hot rows of labels and the features (exactly). Returns 0 if anything differs */
+int check_rows(const Dataset* ds, const int* labels, const float* features, int n_samples, int n_features) {
+    if (!ds) return 0;
+    if (ds->n_samples != n_samples || ds->n_features != n_features || ds->n_outputs != N_CLASSES) {
+        printf("FAILED: %d samples of %d features and %d outputs, expected %d, %d and %d\n", ds->n_samples, ds->n_features, ds->n_outputs, n_samples, n_features, N_CLASSES);
+        return 0;
+    }
+
+    int errors = 0;
+    for (int i = 0; i < n_samples; i++) {
+        for (int c = 0; c < N_CLASSES; c++) errors += ds->y->data[(size_t)i * ds->y->stride + c] != (c == labels[i] ? 1.0f : 0.0f);
+        for (int j = 0; j < n_features; j++) errors += ds->x->data[(size_t)i * ds->x->stride + j] != features[(size_t)i * n_features + j];
+    }
+    if (errors) printf("FAILED: %d values differ\n", errors);
+
+    return errors == 0;
+}
+
+
+
+/* A header, CRLF line ends, blank lines (empty, CR only, blanks only) and a last row without a newline */
+int check_layout() {
+    char path[128];
+    temp_path(path, sizeof(path), "layout.csv");
+
+    const char* text = "label,a,b\r\n1,0.5,2\r\n\r\n\n  \t\r\n0, 1 ,-1\r\n2,3,4";
+    int labels[] = {1, 0, 2};
+    float features[] = {0.5f, 2.0f, 1.0f, -1.0f, 3.0f, 4.0f};
+
+    Dataset* ds = write_text(path, text, strlen(text)) ? dataset_load_csv(path, N_CLASSES, 1.0f) : NULL;
+    int ok = check_rows(ds, labels, features, 3, 2);
+
+    unlink(path);
+    free_dataset(&ds);
+
+    return ok;
+}
+
+
+
+/* Fixed spellings of numbers, then a sweep of random ones printed in plain, exponent and leading '.' form, against strtod */
+int check_numbers() {
+    char path[128];
+    temp_path(path, sizeof(path), "numbers.csv");
+
+    const char* fixed[SWEEP_FEATURES] = {"-2.5", "+3e2", ".25", "-.5e-1", "1E+1", "007", "1.5e-3", "123456789012345678901234"};
+
+    size_t capacity = (size_t)(SWEEP_ROWS + 1) * SWEEP_FEATURES * 40;
+    char* text = (char*) malloc(capacity);
+    int* labels = (int*) malloc((SWEEP_ROWS + 1) * sizeof(int));
+    float* features = (float*) malloc((size_t)(SWEEP_ROWS + 1) * SWEEP_FEATURES * sizeof(float));
+    if (!text || !labels || !features) {printf("Malloc failed for the sweep\n"); free(text); free(labels); free(features); return 0;}
+
+    size_t n = 0;
+    labels[0] = 2;
+    n += snprintf(text + n, capacity - n, "2");
+    for (int j = 0; j < SWEEP_FEATURES; j++) {
+        n += snprintf(text + n, capacity - n, ",%s", fixed[j]);
+        features[j] = (float)strtod(fixed[j], NULL);
+    }
+    n += snprintf(text + n, capacity - n, "\n");
+
+    for (int i = 1; i <= SWEEP_ROWS; i++) {
+        labels[i] = rand() % N_CLASSES;
+        n += snprintf(text + n, capacity - n, "%d", labels[i]);
+
+        for (int j = 0; j < SWEEP_FEATURES; j++) {
+            char number[40];
+            double v = ((double)rand() / RAND_MAX - 0.5) * pow(10.0, rand() % 13 - 6);
+            switch (j % 3) {
+                case 0: snprintf(number, sizeof(number), "%.17g", v); break;
+                case 1: snprintf(number, sizeof(number), "%+.6E", v); break;
+                default: snprintf(number, sizeof(number), "%s.%06d", v < 0 ? "-" : "", rand() % 1000000); break;
+            }
+            n += snprintf(text + n, capacity - n, ",%s", number);
+            features[(size_t)i * SWEEP_FEATURES + j] = (float)strtod(number, NULL);
+        }
+        n += snprintf(text + n, capacity - n, "\n");
+    }
+
+    Dataset* ds = write_text(path, text, n) ? dataset_load_csv(path, N_CLASSES, 1.0f) : NULL;
+    int ok = ds && ds->n_samples == SWEEP_ROWS + 1 && ds->n_features == SWEEP_FEATURES;
+
+    int errors = 0;
+    for (int i = 0; ok && i <= SWEEP_ROWS; i++) {
+        errors += ds->y->data[(size_t)i * ds->y->stride + labels[i]] != 1.0f;
+        for (int j = 0; j < SWEEP_FEATURES; j++) {
+            float expected = features[(size_t)i * SWEEP_FEATURES + j];
+            if (!(fabsf(ds->x->data[(size_t)i * ds->x->stride + j] - expected) <= SWEEP_TOLERANCE * fabsf(expected))) errors++;
+        }
+    }
+    if (!ok) printf("FAILED: the sweep did not load as %d samples of %d features\n", SWEEP_ROWS + 1, SWEEP_FEATURES);
+    if (errors) printf("FAILED: %d numbers differ from strtod\n", errors);
+
+    unlink(path);
+    free_dataset(&ds);
+    free(text);
+    free(labels);
+    free(features);
+
+    return ok && errors == 0;
+}
+
+
+
+/* Rows of LONG_FEATURES features each, every one longer than a chunk, the last without a newline */
+int check_long_lines() {
+    char path[128];
+    temp_path(path, sizeof(path), "long.csv");
+
+    size_t capacity = (size_t)LONG_ROWS * (LONG_FEATURES * 12 + 8);
+    char* text = (char*) malloc(capacity);
+    int labels[LONG_ROWS];
+    float* features = (float*) malloc((size_t)LONG_ROWS * LONG_FEATURES * sizeof(float));
+    if (!text || !features) {printf("Malloc failed for the long lines\n"); free(text); free(features); return 0;}
+
+    size_t n = 0;
+    for (int i = 0; i < LONG_ROWS; i++) {
+        labels[i] = i % N_CLASSES;
+        n += snprintf(text + n, capacity - n, "%d", labels[i]);
+        for (int j = 0; j < LONG_FEATURES; j++) {
+            int v = (i * LONG_FEATURES + j) % 2048 - 1024;
+            n += snprintf(text + n, capacity - n, ",%d.25", v);
+            features[(size_t)i * LONG_FEATURES + j] = (v < 0) ? (float)v - 0.25f : (float)v + 0.25f;
+        }
+        if (i < LONG_ROWS - 1) n += snprintf(text + n, capacity - n, "\n");
+    }
+
+    Dataset* ds = write_text(path, text, n) ? dataset_load_csv(path, N_CLASSES, 1.0f) : NULL;
+    int ok = check_rows(ds, labels, features, LONG_ROWS, LONG_FEATURES);
+
+    unlink(path);
+    free_dataset(&ds);
+    free(text);
+    free(features);
+
+    return ok;
+}
+
+
+
+/* A file of several chunks with two malformed lines: the load must fail and name the first one, counted from 1 with the header */
+int check_bad_line() {
+    char path[128], output[128];
+    temp_path(path, sizeof(path), "bad.csv");
+    temp_path(output, sizeof(output), "bad.out");
+
+    size_t capacity = (size_t)BAD_FILE_ROWS * 16 + 16;
+    char* text = (char*) malloc(capacity);
+    if (!text) {printf("Malloc failed for the malformed file\n"); return 0;}
+
+    size_t n = snprintf(text, capacity, "label,a,b\n");
+    for (int line = 2; line <= BAD_FILE_ROWS + 1; line++) {
+        if (line == BAD_LINE) n += snprintf(text + n, capacity - n, "1,2,x\n");
+        else if (line == BAD_LINE + 1000) n += snprintf(text + n, capacity - n, "7,1,1\n");
+        else n += snprintf(text + n, capacity - n, "%d,%d,0.5\n", line % N_CLASSES, line % 100);
+    }
+
+    Dataset* ds = NULL;
+    int saved = write_text(path, text, n) ? capture_stdout(output) : -1;
+    if (saved >= 0) {
+        ds = dataset_load_csv(path, N_CLASSES, 1.0f);
+        restore_stdout(saved);
+    }
+
+    char printed[512] = {0}, expected[64];
+    FILE* file = fopen(output, "r");
+    if (file) {
+        size_t r = fread(printed, 1, sizeof(printed) - 1, file);
+        printed[r] = '\0';
+        fclose(file);
+    }
+    snprintf(expected, sizeof(expected), "line %d:", BAD_LINE);
+
+    int ok = saved >= 0 && !ds && strstr(printed, expected) != NULL;
+    if (!ok) printf("FAILED: expected an error naming %s, the reader printed: %s\n", expected, printed);
+
+    unlink(path);
+    unlink(output);
+    free_dataset(&ds);
+    free(text);
+
+    return ok;
+}
+
+
+
+/* A loaded CSV saved natively and mapped back by dataset_load: same shape and the same bytes in x and y */
+int check_round_trip() {
+    char csv[128], native[128];
+    temp_path(csv, sizeof(csv), "trip.csv");
+    temp_path(native, sizeof(native), "trip.nnd");
+
+    const char* text = "0,1.5,-2,3\n2,0.25,.5,-7e-3\n1,100,200,300\n";
+    Dataset* ds = write_text(csv, text, strlen(text)) ? dataset_load_csv(csv, N_CLASSES, 0.5f) : NULL;
+    Dataset* loaded = (ds && dataset_save(ds, native)) ? dataset_load(native) : NULL;
+
+    int ok = ds && loaded && loaded->n_samples == ds->n_samples && loaded->n_features == ds->n_features && loaded->n_outputs == ds->n_outputs;
+    for (int i = 0; ok && i < ds->n_samples; i++) {
+        ok = memcmp(loaded->x->data + (size_t)i * loaded->x->stride, ds->x->data + (size_t)i * ds->x->stride, ds->n_features * sizeof(float)) == 0
+          && memcmp(loaded->y->data + (size_t)i * loaded->y->stride, ds->y->data + (size_t)i * ds->y->stride, ds->n_outputs * sizeof(float)) == 0;
+    }
+
+    unlink(csv);
+    unlink(native);
+    free_dataset(&ds);
+    free_dataset(&loaded);
+
+    return ok;
+}
\ No newline at end of file
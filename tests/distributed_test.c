@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "distributed.h"
+#include "network.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define MAX_WORLD_SIZE 4
+#define ALLREDUCE_FLOATS 10007      // Not a multiple of any world size, so the ring chunks differ in size
+#define ALLREDUCE_TOLERANCE 1e-5f
+#define N_FEATURES 12
+#define N_OUTPUTS 3
+#define N_BATCHES 6
+#define BATCH_SIZE 24               // Split evenly between the ranks of every world size trained
+#define EPOCHS 2
+#define LEARNING_RATE 0.05f
+#define WEIGHT_TOLERANCE 1e-5f
+#define SEED 2024
+
+
+
+/* How one process of a check joins its group, rank_main gets its index among the forked processes */
+typedef struct RankArgs {
+
+    const char* name;           // Group joined
+    int world_size;
+    int ranks[MAX_WORLD_SIZE];  // Rank claimed by each forked process
+    int world_sizes[MAX_WORLD_SIZE];
+    size_t n_floats[MAX_WORLD_SIZE];
+
+} RankArgs;
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+int run_processes(int n_processes, int (*rank_main)(int index, const RankArgs* args), const RankArgs* args);
+int allreduce_rank(int index, const RankArgs* args);
+int training_rank(int index, const RankArgs* args);
+int refused_rank(int index, const RankArgs* args);
+float allreduce_value(int rank, size_t i);
+Network* create_test_network();
+int check_refusal(const char* what, int n_processes, const RankArgs* args);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* Forks the ranks of a process group on this host: the all-reduce and data parallel training must match one process
+   doing the same work, and groups whose members disagree or claim the same rank must be refused on every rank */
+int main() {
+    char name[64];
+    int failures = 0;
+
+    /* Nothing of the library runs in this process before the forks, so no thread is lost in a child */
+    for (int world_size = 1; world_size <= MAX_WORLD_SIZE; world_size++) {
+        snprintf(name, sizeof(name), "test_allreduce_%d_%d", (int)getpid(), world_size);
+        RankArgs args = {name, world_size, {0}, {0}, {0}};
+        int ok = run_processes(world_size, allreduce_rank, &args);
+        printf("All-reduce over %d ranks: %s\n", world_size, ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    for (int world_size = 2; world_size <= MAX_WORLD_SIZE; world_size += 2) {
+        snprintf(name, sizeof(name), "test_training_%d_%d", (int)getpid(), world_size);
+        RankArgs args = {name, world_size, {0}, {0}, {0}};
+        int ok = run_processes(world_size, training_rank, &args);
+        printf("Training over %d ranks against one process: %s\n", world_size, ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    snprintf(name, sizeof(name), "test_world_%d", (int)getpid());
+    RankArgs world_mismatch = {name, 0, {0, 1}, {2, 3}, {64, 64}};
+    failures += !check_refusal("Mismatched world sizes", 2, &world_mismatch);
+
+    snprintf(name, sizeof(name), "test_floats_%d", (int)getpid());
+    RankArgs floats_mismatch = {name, 0, {0, 1}, {2, 2}, {64, 65}};
+    failures += !check_refusal("Mismatched buffer sizes", 2, &floats_mismatch);
+
+    snprintf(name, sizeof(name), "test_duplicate_%d", (int)getpid());
+    RankArgs duplicate = {name, 0, {0, 1, 1}, {3, 3, 3}, {64, 64, 64}};
+    failures += !check_refusal("Duplicate rank", 3, &duplicate);
+
+    printf("distributed_test: %s\n", failures ? "FAILED" : "passed");
+
+    return failures != 0;
+}
+
+
+
+/* Forks n_processes children running rank_main(index, args). Returns 1 if every child returned 1 */
+int run_processes(int n_processes, int (*rank_main)(int index, const RankArgs* args), const RankArgs* args) {
+    pid_t children[MAX_WORLD_SIZE];
+    int ok = 1;
+
+    fflush(stdout);
+    for (int i = 0; i < n_processes; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            int passed = rank_main(i, args);
+            fflush(stdout);
+            _exit(passed ? 0 : 1);
+        }
+        if (children[i] < 0) {printf("fork failed\n"); ok = 0;}
+    }
+
+    for (int i = 0; i < n_processes; i++) {
+        int status;
+        if (children[i] > 0 && (waitpid(children[i], &status, 0) != children[i] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) ok = 0;
+    }
+
+    return ok;
+}
+
+
+
+/* Value rank puts at index i of its buffer before the all-reduce */
+float allreduce_value(int rank, size_t i) {
+    return (float)((i * 7919 + (size_t)rank * 104729) % 2001) / 1000.0f - 1.0f;
+}
+
+
+
+/* Sums the buffers of world_size ranks and checks the result against the sum done in order by this process */
+int allreduce_rank(int index, const RankArgs* args) {
+    ProcessGroup* pg = create_process_group(args->name, index, args->world_size, ALLREDUCE_FLOATS);
+    if (!pg) return 0;
+
+    float* buffer = process_group_buffer(pg);
+    for (size_t i = 0; i < ALLREDUCE_FLOATS; i++) buffer[i] = allreduce_value(index, i);
+
+    int ok = process_group_allreduce(pg);
+
+    int errors = 0;
+    for (size_t i = 0; ok && i < ALLREDUCE_FLOATS; i++) {
+        float expected = 0.0f;
+        for (int r = 0; r < args->world_size; r++) expected += allreduce_value(r, i);
+        if (!(fabsf(buffer[i] - expected) <= ALLREDUCE_TOLERANCE * args->world_size)) errors++;
+    }
+    if (errors) printf("Rank %d: %d sums are wrong\n", index, errors);
+
+    free_process_group(&pg);
+    return ok && errors == 0;
+}
+
+
+
+/* The same small network on every rank, seeded so a second copy starts from the same weights */
+Network* create_test_network() {
+    tensor_rng_seed(SEED);
+    Network* net = create_network(N_FEATURES, MSE, SGD, LEARNING_RATE);
+    if (!net) return NULL;
+
+    network_add_layer(net, 16, RELU);
+    network_add_layer(net, N_OUTPUTS, LINEAR);
+
+    return net;
+}
+
+
+
+/* Trains on its share of every batch in a group, then trains a second network alone on the whole batches.
+   The mean of the gradients of equal shares is the gradient of the whole batch, so both must end with the same weights */
+int training_rank(int index, const RankArgs* args) {
+    init_tensor_api();
+    tensor_rng_seed(SEED + 1);
+
+    int share = BATCH_SIZE / args->world_size;
+    Tensor* x[N_BATCHES];
+    Tensor* y[N_BATCHES];
+    Tensor* x_shares[N_BATCHES];
+    Tensor* y_shares[N_BATCHES];
+
+    for (int b = 0; b < N_BATCHES; b++) {
+        x[b] = create_tensor_random(BATCH_SIZE, N_FEATURES, -1.0f, 1.0f);
+        y[b] = create_tensor_random(BATCH_SIZE, N_OUTPUTS, 0.0f, 1.0f);
+        x_shares[b] = tensor_slice(x[b], index * share, 0, share, N_FEATURES);
+        y_shares[b] = tensor_slice(y[b], index * share, 0, share, N_OUTPUTS);
+    }
+
+    Network* distributed = create_test_network();
+    Network* alone = create_test_network();
+
+    int ok = distributed && alone && network_set_process_group(distributed, args->name, index, args->world_size);
+
+    int saved = silence_stdout();    /* The progress of every rank would bury the result */
+    ok = ok && network_train(distributed, x_shares, y_shares, N_BATCHES, EPOCHS);
+    ok = ok && network_train(alone, x, y, N_BATCHES, EPOCHS);
+    restore_stdout(saved);
+    if (!ok) printf("Rank %d: training failed\n", index);
+
+    int errors = 0;
+    for (size_t i = 0; ok && i < distributed->slab_size; i++) {
+        if (!(fabsf(distributed->parameters[i] - alone->parameters[i]) <= WEIGHT_TOLERANCE)) errors++;
+    }
+    if (errors) printf("Rank %d: %d of %zu parameters differ from the single process run\n", index, errors, distributed->slab_size);
+
+    free_network(&distributed);
+    free_network(&alone);
+    for (int b = 0; b < N_BATCHES; b++) {
+        free_tensor(&x[b]);
+        free_tensor(&y[b]);
+        free_tensor(&x_shares[b]);
+        free_tensor(&y_shares[b]);
+    }
+
+    return ok && errors == 0;
+}
+
+
+
+/* Joins with the rank, world size and buffer size given to this process, which the group must refuse */
+int refused_rank(int index, const RankArgs* args) {
+    ProcessGroup* pg = create_process_group(args->name, args->ranks[index], args->world_sizes[index], args->n_floats[index]);
+    if (!pg) return 1;
+
+    printf("Rank %d joined a group it should have been refused from\n", args->ranks[index]);
+    free_process_group(&pg);
+    return 0;
+}
+
+
+
+/* Runs a group that must be refused and prints the outcome. Returns 1 if every process was refused */
+int check_refusal(const char* what, int n_processes, const RankArgs* args) {
+    int ok = run_processes(n_processes, refused_rank, args);
+    printf("%s refused on every rank: %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
\ No newline at end of file
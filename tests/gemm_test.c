@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "gemm.h"
+#include "simd.h"
+#include "tensor.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define SEED 1234
+#define RANDOM_CASES 40
+#define MAX_RANDOM_DIM 100
+#define MAX_RANDOM_DEPTH 700      // Deeper than one KC slice on any usual L1
+#define PADDING 3                 // Extra floats at the end of every stored row, so lda/ldb/ldc/ldz differ from the widths
+#define TOLERANCE 1e-5f           // Per unit of depth, the operands are in [-1, 1]
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+Tensor* tensor_multiplication_v1(const Tensor* t1, const Tensor* t2);
+
+int check_shape(int M, int N, int K);
+int check_case(int M, int N, int K, gemm_transpose trans_a, gemm_transpose trans_b, const Tensor* a, const Tensor* b, const Tensor* reference, const float* bias, const GemmEpilogue* epilogue);
+float* store_operand(const Tensor* t, gemm_transpose trans, int* ld);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* gemm and gemm_fused against the naive product for every transpose of the operands, with and without the epilogue.
+   Run it with NEURAL_SIMD set to each level to test every micro-kernel */
+int main() {
+    init_tensor_api();
+    srand(SEED);
+
+    /* Not multiples of MR (6) or NR (16), single rows and cols, and depths across a KC slice */
+    int edge_shapes[][3] = {
+        {1, 1, 1}, {1, 37, 19}, {37, 1, 19}, {1, 1, 500}, {5, 15, 3}, {6, 16, 8}, {7, 17, 9},
+        {12, 32, 64}, {13, 33, 65}, {1, 200, 300}, {200, 1, 300}, {23, 47, 513}, {61, 29, 700}
+    };
+    int n_edge = sizeof(edge_shapes) / sizeof(edge_shapes[0]);
+
+    int failures = 0, cases = 0;
+
+    for (int s = 0; s < n_edge; s++, cases++) failures += !check_shape(edge_shapes[s][0], edge_shapes[s][1], edge_shapes[s][2]);
+
+    for (int s = 0; s < RANDOM_CASES; s++, cases++) {
+        int M = 1 + rand() % MAX_RANDOM_DIM;
+        int N = 1 + rand() % MAX_RANDOM_DIM;
+        int K = 1 + rand() % MAX_RANDOM_DEPTH;
+        failures += !check_shape(M, N, K);
+    }
+
+    printf("gemm_test [%s]: %d of %d shapes passed\n", simd_level_name(simd_get_level()), cases - failures, cases);
+
+    return failures != 0;
+}
+
+
+
+/* Every transpose combination of one (M x K) @ (K x N) product, plain and fused (bias, leaky RELU, z). Returns 0 if any case is off */
+int check_shape(int M, int N, int K) {
+    Tensor* a = create_tensor_random(M, K, -1.0f, 1.0f);
+    Tensor* b = create_tensor_random(K, N, -1.0f, 1.0f);
+    Tensor* bias = create_tensor_random(1, N, -1.0f, 1.0f);
+    Tensor* reference = (a && b) ? tensor_multiplication_v1(a, b) : NULL;
+
+    if (!a || !b || !bias || !reference) {
+        printf("Tensors could not be created for %d x %d x %d\n", M, N, K);
+        free_tensor(&a); free_tensor(&b); free_tensor(&bias); free_tensor(&reference);
+        return 0;
+    }
+
+    int ok = 1;
+
+    for (int trans_a = GEMM_NO_TRANS; trans_a <= GEMM_TRANS; trans_a++) for (int trans_b = GEMM_NO_TRANS; trans_b <= GEMM_TRANS; trans_b++) {
+        GemmEpilogue linear = {bias->data, NULL, 0, LINEAR};
+        GemmEpilogue relu = {bias->data, NULL, 0, RELU};
+
+        ok &= check_case(M, N, K, trans_a, trans_b, a, b, reference, NULL, NULL);
+        ok &= check_case(M, N, K, trans_a, trans_b, a, b, reference, bias->data, &linear);
+        ok &= check_case(M, N, K, trans_a, trans_b, a, b, reference, bias->data, &relu);
+    }
+
+    free_tensor(&a);
+    free_tensor(&b);
+    free_tensor(&bias);
+    free_tensor(&reference);
+
+    return ok;
+}
+
+
+
+/* One call of gemm (epilogue NULL) or gemm_fused, checked against reference (+ bias, activation) and z. The padding of C and z must stay untouched */
+int check_case(int M, int N, int K, gemm_transpose trans_a, gemm_transpose trans_b, const Tensor* a, const Tensor* b, const Tensor* reference, const float* bias, const GemmEpilogue* epilogue) {
+    int lda, ldb, ldc = N + PADDING;
+    float* A = store_operand(a, trans_a, &lda);
+    float* B = store_operand(b, trans_b, &ldb);
+    float* C = (float*) malloc((size_t)M * ldc * sizeof(float));
+    float* Z = (float*) malloc((size_t)M * ldc * sizeof(float));
+
+    if (!A || !B || !C || !Z) {
+        printf("Malloc failed for %d x %d x %d\n", M, N, K);
+        free(A); free(B); free(C); free(Z);
+        return 0;
+    }
+
+    for (size_t i = 0; i < (size_t)M * ldc; i++) C[i] = Z[i] = NAN;
+
+    GemmEpilogue fused;
+    if (epilogue) {
+        fused = *epilogue;
+        fused.z = Z;
+        fused.ldz = ldc;
+        gemm_fused(trans_a, trans_b, M, N, K, A, lda, B, ldb, C, ldc, &fused);
+    }
+    else gemm(trans_a, trans_b, M, N, K, A, lda, B, ldb, C, ldc);
+
+    float tolerance = TOLERANCE * K;
+    int errors = 0;
+
+    for (int i = 0; i < M; i++) for (int j = 0; j < ldc; j++) {
+        float c = C[(size_t)i * ldc + j], z = Z[(size_t)i * ldc + j];
+
+        if (j >= N) {
+            errors += !isnan(c) || !isnan(z);
+            continue;
+        }
+
+        float expected_z = reference->data[(size_t)i * reference->stride + j] + (bias ? bias[j] : 0.0f);
+        float expected = (epilogue && epilogue->act == RELU && expected_z < 0.0f) ? RELU_NEGATIVE_SLOPE * expected_z : expected_z;
+
+        if (!(fabsf(c - expected) <= tolerance)) errors++;
+        if (epilogue && !(fabsf(z - expected_z) <= tolerance)) errors++;
+        if (!epilogue && !isnan(z)) errors++;
+    }
+
+    if (errors) {
+        printf("FAILED %d x %d x %d, trans_a %d, trans_b %d, %s: %d wrong values\n", M, N, K, trans_a, trans_b,
+            !epilogue ? "gemm" : (epilogue->act == RELU ? "bias + RELU" : "bias"), errors);
+    }
+
+    free(A);
+    free(B);
+    free(C);
+    free(Z);
+
+    return errors == 0;
+}
+
+
+
+/* Copies t as gemm reads it: as is or transposed, with PADDING floats after every stored row. Returns NULL if any error */
+float* store_operand(const Tensor* t, gemm_transpose trans, int* ld) {
+    int rows = (trans == GEMM_TRANS) ? t->cols : t->rows;
+    int cols = (trans == GEMM_TRANS) ? t->rows : t->cols;
+    *ld = cols + PADDING;
+
+    float* stored = (float*) malloc((size_t)rows * (*ld) * sizeof(float));
+    if (!stored) return NULL;
+
+    for (int i = 0; i < rows; i++) for (int j = 0; j < *ld; j++) {
+        float value = NAN;
+        if (j < cols) value = (trans == GEMM_TRANS) ? t->data[(size_t)j * t->stride + i] : t->data[(size_t)i * t->stride + j];
+        stored[(size_t)i * (*ld) + j] = value;
+    }
+
+    return stored;
+}
\ No newline at end of file
@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
 #include "network.h"
+#include "quantize.h"
 #include "tensor.h"
+#include "dataset.h"
 
 
 
@@ -15,6 +17,10 @@
 #define BATCH_SIZE 64
 #define EPOCHS 10
 #define LEARNING_RATE 0.1f
+#define EVAL_BATCH_SIZE 1024
+#define N_CLASSES 10
+#define SHUFFLE_SEED 42
+#define CALIBRATION_SAMPLES 1000
 
 
 
@@ -22,10 +28,7 @@
 //             Helper Prototypes
 // ==========================================
 Network* get_network(int n_features);
-int load_mnist_csv(const char* filename, Tensor*** x_data, Tensor*** y_data, int* num_samples, int* n_features);
-void create_mini_batches(Tensor** x_in, Tensor** y_in, int total_samples, int batch_size, Tensor*** x_out, Tensor*** y_out, int* total_batches);
-void free_mnist_data(Tensor** x_data, Tensor** y_data, int count);
-int get_predicted_class(Tensor* pred);
+Dataset* load_mnist(const char* bin_path, const char* csv_path);
 
 
 
@@ -36,73 +39,70 @@ int get_predicted_class(Tensor* pred);
 int main() {
     init_tensor_api();
 
-    Tensor** x_raw = NULL;
-    Tensor** y_raw = NULL;
-    int raw_count = 0;
-    int n_features = 0;
+    printf("\n[1/7] Loading Training Data...\n");
+    Dataset* train = load_mnist("datasets/MNIST/mnist_train.bin", "datasets/MNIST/mnist_train.csv");
+    if (!train) return 1;
+    printf("Loaded %d samples.\n", train->n_samples);
 
-    printf("\n[1/6] Loading Raw Training Data...\n");
-    if (!load_mnist_csv("datasets/MNIST/mnist_train.csv", &x_raw, &y_raw, &raw_count, &n_features)) {
+    printf("\n[2/7] Creating Data Loader (Batch Size: %d)...\n", BATCH_SIZE);
+    
+    DataLoader* loader = create_dataloader(train->x, train->y, BATCH_SIZE, 1, SHUFFLE_SEED, 0);
+    if (!loader) {
+        free_dataset(&train);
         return 1;
     }
-    printf("Loaded %d raw samples.\n", raw_count);
+    printf("%d batches per epoch, reshuffled every epoch.\n", loader->n_batches);
 
-    printf("\n[2/6] Creating Mini-Batches (Batch Size: %d)...\n", BATCH_SIZE);
+    printf("\n[3/7] Building Network\n");
     
-    Tensor** x_batched = NULL;
-    Tensor** y_batched = NULL;
-    int n_batches = 0;
-
-    create_mini_batches(x_raw, y_raw, raw_count, BATCH_SIZE, &x_batched, &y_batched, &n_batches);
+    Network* net = get_network(train->n_features); 
 
-    free_mnist_data(x_raw, y_raw, raw_count);
-    printf("Created %d batches. Raw data freed.\n", n_batches);
-
-    printf("\n[3/6] Building Network\n");
     
-    Network* net = get_network(n_features); 
-
+    printf("\n[4/7] Training for %d Epochs...\n", EPOCHS);
     
-    printf("\n[4/6] Training for %d Epochs...\n", EPOCHS);
-    
-    network_train(net, x_batched, y_batched, n_batches, EPOCHS);
+    network_train_loader(net, loader, EPOCHS);
+
 
+    /* Calibrated on training samples, the test set stays unseen */
+    Tensor calibration = tensor_slice_rows(train->x, 0, (train->n_samples < CALIBRATION_SAMPLES) ? train->n_samples : CALIBRATION_SAMPLES);
+    QuantizedNetwork* qnet = network_quantize(net, &calibration);
 
-    free_mnist_data(x_batched, y_batched, n_batches);
+    free_dataloader(&loader);
+    free_dataset(&train);
 
     
-    printf("\n[5/6] Loading Test Data...\n");
+    printf("\n[5/7] Loading Test Data...\n");
     
-    Tensor** x_test = NULL;
-    Tensor** y_test = NULL;
-    int test_samples = 0;
-    int f_test = 0;
-
-    if (!load_mnist_csv("datasets/MNIST/mnist_test.csv", &x_test, &y_test, &test_samples, &f_test)) {
+    Dataset* test = load_mnist("datasets/MNIST/mnist_test.bin", "datasets/MNIST/mnist_test.csv");
+    if (!test) {
+        free_quantized_network(&qnet);
         free_network(&net);
         return 1;
     }
 
    
 
-    printf("\n[6/6] Evaluating Accuracy on %d samples...\n", test_samples);
-    
-    int correct = 0;
-    for (int i = 0; i < test_samples; i++) {
-        Tensor* pred = network_predict(net, x_test[i]);
-        
-        if (get_predicted_class(pred) == get_predicted_class(y_test[i])) {
-            correct++;
-        }
-        free_tensor(&pred);
+    printf("\n[6/7] Evaluating Accuracy on %d samples...\n", test->n_samples);
+
+    Evaluation result;
+    if (!network_evaluate(net, test->x, test->y, EVAL_BATCH_SIZE, &result)) {
+        free_dataset(&test);
+        free_quantized_network(&qnet);
+        free_network(&net);
+        return 1;
     }
 
-    float acc = (float)correct / test_samples * 100.0f;
     printf("\n========================================\n");
-    printf("FINAL ACCURACY: %.2f%%\n", acc);
+    printf("FINAL ACCURACY: %.2f%% (Loss: %f)\n", result.accuracy * 100.0f, result.loss);
     printf("========================================\n");
 
-    free_mnist_data(x_test, y_test, test_samples);
+    printf("\n[7/7] Comparing with the INT8 quantized network...\n");
+
+    QuantizationReport report;
+    if (qnet && quantized_network_report(net, qnet, test->x, test->y, EVAL_BATCH_SIZE, &report)) print_quantization_report(&report);
+
+    free_dataset(&test);
+    free_quantized_network(&qnet);
     free_network(&net);
 
     return 0;
@@ -123,103 +123,13 @@ Network* get_network(int n_features) {
 }
 
 
-void create_mini_batches(Tensor** x_in, Tensor** y_in, int total_samples, int batch_size, Tensor*** x_out, Tensor*** y_out, int* total_batches) {
-    int n_batches = total_samples / batch_size;
-    *total_batches = n_batches;
-    int features = x_in[0]->cols;
-    int classes = y_in[0]->cols;
-
-    *x_out = (Tensor**)malloc(n_batches * sizeof(Tensor*));
-    *y_out = (Tensor**)malloc(n_batches * sizeof(Tensor*));
 
-    for (int b = 0; b < n_batches; b++) {
-        Tensor* bx = create_tensor_value(batch_size, features, 0.0f);
-        Tensor* by = create_tensor_value(batch_size, classes, 0.0f);
-
-        for (int i = 0; i < batch_size; i++) {
-            int src_idx = (b * batch_size) + i;
-            
-            // Use memcpy to copy the entire row at once
-            memcpy(&(bx->data[i * features]), x_in[src_idx]->data, features * sizeof(float));
-            memcpy(&(by->data[i * classes]), y_in[src_idx]->data, classes * sizeof(float));
-        }
-
-        (*x_out)[b] = bx;
-        (*y_out)[b] = by;
+/* Maps the binary dataset, converting the CSV to it the first time */
+Dataset* load_mnist(const char* bin_path, const char* csv_path) {
+    if (access(bin_path, F_OK) != 0) {
+        printf("Converting %s to %s (once)...\n", csv_path, bin_path);
+        if (!dataset_convert_csv(csv_path, bin_path, N_CLASSES, 1.0f / 255.0f)) return NULL;
     }
-}
-
 
-
-int get_predicted_class(Tensor* t) {
-    if (!t) return -1;
-    
-    int max_idx = 0;
-    float max_val = t->data[0];
-    for (int i = 1; i < t->cols; i++) {
-        if (t->data[i] > max_val) {
-            max_val = t->data[i];
-            max_idx = i;
-        }
-    }
-    return max_idx;
+    return dataset_load(bin_path);
 }
-
-/* CSV Loader */
-int load_mnist_csv(const char* filename, Tensor*** x_data, Tensor*** y_data, int* num_samples, int* n_features) {
-    FILE* file = fopen(filename, "r");
-    if (!file) { printf("Error opening %s\n", filename); return 0; }
-
-    char line[10000];
-    int row_count = 0;
-    int cols = 0;
-
-    while (fgets(line, sizeof(line), file)) {
-        if (strlen(line) < 5) continue;
-        if (row_count == 0 && !isdigit(line[0])) continue;
-        
-        if (cols == 0) {
-            char* tmp = strdup(line);
-            char* tok = strtok(tmp, ",");
-            while(tok) { cols++; tok = strtok(NULL, ","); }
-            free(tmp);
-        }
-        row_count++;
-    }
-    *n_features = cols - 1;
-    *num_samples = row_count;
-
-    rewind(file);
-    *x_data = (Tensor**)malloc(row_count * sizeof(Tensor*));
-    *y_data = (Tensor**)malloc(row_count * sizeof(Tensor*));
-    int idx = 0;
-
-    while (fgets(line, sizeof(line), file)) {
-        if (strlen(line) < 5) continue;
-        if (idx == 0 && !isdigit(line[0])) continue;
-
-        char* token = strtok(line, ",");
-        int label = atoi(token);
-
-        (*y_data)[idx] = create_tensor_value(1, 10, 0.0f);
-        if(label >=0 && label <= 9) (*y_data)[idx]->data[label] = 1.0f;
-
-        (*x_data)[idx] = create_tensor_value(1, *n_features, 0.0f);
-        for(int i=0; i<*n_features; i++) {
-            token = strtok(NULL, ",");
-            if(token) (*x_data)[idx]->data[i] = (float)atoi(token) / 255.0f;
-        }
-        idx++;
-    }
-    fclose(file);
-    return 1;
-}
-
-void free_mnist_data(Tensor** x_data, Tensor** y_data, int count) {
-    for (int i = 0; i < count; i++) {
-        free_tensor(&(x_data[i]));
-        free_tensor(&(y_data[i]));
-    }
-    free(x_data);
-    free(y_data);
-}
\ No newline at end of file
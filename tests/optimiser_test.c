@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "network.h"
+#include "optimiser.h"
+#include "simd.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define STEPS 5
+#define TOLERANCE 1e-5f             // Relative to the size of the parameter
+#define LEARNING_RATE 0.01f
+#define N_FEATURES 20
+#define N_OUTPUTS 4
+#define N_BATCHES 5
+#define BATCH_SIZE 16
+#define CHECKPOINT_INTERVAL 3       // Does not divide the steps, so the last checkpoint is the one written when training completes
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+int check_update(OptimiserType type, size_t n);
+void reference_step(OptimiserType type, const Optimiser* opt, double* w, const double* g, double* m, double* v, int t, size_t n);
+float test_value(size_t i, int salt);
+int check_checkpoint(OptimiserType type);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* The fused updates of SGD, SGD+M and Adam against the textbook updates in double precision, over a few steps and for
+   sizes leaving every tail of the SSE2 (4), AVX2 (8) and AVX-512 (16) loops, then the moments and step count of a
+   checkpoint against those of the network that wrote it */
+int main() {
+    init_tensor_api();
+
+    size_t sizes[] = {1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 1000, 2 * OPTIMISER_PARALLEL_GRAIN + 13};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    OptimiserType types[] = {SGD, SGD_MOMENTUM, ADAM};
+    const char* names[] = {"SGD", "SGD+M", "Adam"};
+
+    int failures = 0;
+
+    for (int t = 0; t < 3; t++) {
+        int passed = 0;
+        for (int s = 0; s < n_sizes; s++) passed += check_update(types[t], sizes[s]);
+        printf("%s updates [%s]: %d of %d sizes match the reference\n", names[t], simd_level_name(simd_get_level()), passed, n_sizes);
+        failures += n_sizes - passed;
+    }
+
+    for (int t = 1; t < 3; t++) {
+        int ok = check_checkpoint(types[t]);
+        printf("%s checkpoint round trip of the moments: %s\n", names[t], ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    return failures != 0;
+}
+
+
+
+/* Deterministic value in [-1, 1) for index i, salt picks another sequence */
+float test_value(size_t i, int salt) {
+    return (float)((i * 2654435761u + (size_t)salt * 40503u) % 20011u) / 10005.5f - 1.0f;
+}
+
+
+
+/* Step t (from 1) of the textbook update in double precision */
+void reference_step(OptimiserType type, const Optimiser* opt, double* w, const double* g, double* m, double* v, int t, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (type == SGD) {
+            w[i] -= opt->learning_rate * g[i];
+        } else if (type == SGD_MOMENTUM) {
+            m[i] = opt->beta1 * m[i] + g[i];
+            w[i] -= opt->learning_rate * m[i];
+        } else {
+            m[i] = opt->beta1 * m[i] + (1.0 - opt->beta1) * g[i];
+            v[i] = opt->beta2 * v[i] + (1.0 - opt->beta2) * g[i] * g[i];
+            double m_hat = m[i] / (1.0 - pow(opt->beta1, t));
+            double v_hat = v[i] / (1.0 - pow(opt->beta2, t));
+            w[i] -= opt->learning_rate * m_hat / (sqrt(v_hat) + opt->epsilon);
+        }
+    }
+}
+
+
+
+/* STEPS calls of optimiser_step on n floats against reference_step. Returns 0 if a parameter or moment is off */
+int check_update(OptimiserType type, size_t n) {
+    Optimiser* opt = create_optimiser(type, LEARNING_RATE);
+    float* w = (float*) malloc(n * sizeof(float));
+    float* g = (float*) malloc(n * sizeof(float));
+    double* w_ref = (double*) malloc(n * sizeof(double));
+    double* g_ref = (double*) malloc(n * sizeof(double));
+    double* m_ref = (double*) calloc(n, sizeof(double));
+    double* v_ref = (double*) calloc(n, sizeof(double));
+
+    int ok = opt && w && g && w_ref && g_ref && m_ref && v_ref;
+    if (!ok) printf("Malloc failed for %zu floats\n", n);
+
+    for (size_t i = 0; ok && i < n; i++) w[i] = (float)(w_ref[i] = test_value(i, 0));
+
+    for (int t = 1; ok && t <= STEPS; t++) {
+        for (size_t i = 0; i < n; i++) g[i] = (float)(g_ref[i] = test_value(i, t));
+
+        optimiser_step(opt, w, g, n);
+        reference_step(type, opt, w_ref, g_ref, m_ref, v_ref, t, n);
+    }
+
+    int errors = 0;
+    for (size_t i = 0; ok && i < n; i++) {
+        if (!(fabs(w[i] - w_ref[i]) <= TOLERANCE * (1.0 + fabs(w_ref[i])))) errors++;
+        if (type != SGD && !(fabs(opt->m[i] - m_ref[i]) <= TOLERANCE * (1.0 + fabs(m_ref[i])))) errors++;
+        if (type == ADAM && !(fabs(opt->v[i] - v_ref[i]) <= TOLERANCE * (1.0 + fabs(v_ref[i])))) errors++;
+    }
+
+    if (ok && type == ADAM && opt->time_step != STEPS) {printf("Adam counted %d steps instead of %d\n", opt->time_step, STEPS); errors++;}
+    if (errors) printf("FAILED %zu floats: %d values differ from the reference\n", n, errors);
+
+    free_optimiser(&opt);
+    free(w);
+    free(g);
+    free(w_ref);
+    free(g_ref);
+    free(m_ref);
+    free(v_ref);
+
+    return ok && errors == 0;
+}
+
+
+
+/* Trains with checkpoints, then loads the last one: its moments and step count must be those the network ended with */
+int check_checkpoint(OptimiserType type) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/optimiser_test_%d.ckpt", (int)getpid());
+
+    tensor_rng_seed(7);
+    Tensor* x[N_BATCHES];
+    Tensor* y[N_BATCHES];
+    for (int b = 0; b < N_BATCHES; b++) {
+        x[b] = create_tensor_random(BATCH_SIZE, N_FEATURES, -1.0f, 1.0f);
+        y[b] = create_tensor_random(BATCH_SIZE, N_OUTPUTS, 0.0f, 1.0f);
+    }
+
+    Network* net = create_network(N_FEATURES, MSE, type, LEARNING_RATE);
+    int ok = net && network_add_layer(net, 8, RELU) && network_add_layer(net, N_OUTPUTS, LINEAR);
+    ok = ok && network_set_checkpoint(net, path, CHECKPOINT_INTERVAL);
+
+    int saved = silence_stdout();    /* Keeps the progress of training out of the results */
+    ok = ok && network_train(net, x, y, N_BATCHES, 1);
+    restore_stdout(saved);
+
+    Network* loaded = ok ? network_load_checkpoint(path) : NULL;
+    ok = ok && loaded;
+
+    const Optimiser* trained = ok ? net->optimiser : NULL;
+    const Optimiser* restored = ok ? loaded->optimiser : NULL;
+    size_t bytes = ok ? trained->n_floats * sizeof(float) : 0;
+
+    ok = ok && restored->type == type && restored->time_step == trained->time_step && restored->n_floats == trained->n_floats;
+    ok = ok && memcmp(restored->m, trained->m, bytes) == 0;
+    ok = ok && (type != ADAM || memcmp(restored->v, trained->v, bytes) == 0);
+    ok = ok && memcmp(loaded->parameters, net->parameters, net->slab_size * sizeof(float)) == 0;
+
+    unlink(path);
+    free_network(&net);
+    free_network(&loaded);
+    for (int b = 0; b < N_BATCHES; b++) {
+        free_tensor(&x[b]);
+        free_tensor(&y[b]);
+    }
+
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "network.h"
+#include "optimiser.h"
+#include "simd.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define SEED 31
+#define N_REPLICAS 3
+#define N_FEATURES 20
+#define N_OUTPUTS 4
+#define N_BATCHES 6
+#define BATCH_SIZE 32               // Not a multiple of the replicas, so their shares and weights differ
+#define EPOCHS 3
+#define LEARNING_RATE 0.01f
+#define TOLERANCE 1e-5f             // Relative to the size of the parameter, the runs differ by about 1e-7
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+Network* create_test_network(OptimiserType type);
+int check_data_parallel(OptimiserType type, Tensor** x, Tensor** y);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* Data parallel training (network_set_data_parallel) splits every batch over replicas, weights their gradients by
+   their share of the rows and sums them, so it must end with the parameters of serial training up to float rounding */
+int main() {
+    init_tensor_api();
+
+    tensor_rng_seed(SEED);
+    Tensor* x[N_BATCHES];
+    Tensor* y[N_BATCHES];
+    for (int b = 0; b < N_BATCHES; b++) {
+        x[b] = create_tensor_random(BATCH_SIZE, N_FEATURES, -1.0f, 1.0f);
+        y[b] = create_tensor_random(BATCH_SIZE, N_OUTPUTS, 0.0f, 1.0f);
+    }
+
+    OptimiserType types[] = {SGD, SGD_MOMENTUM, ADAM};
+    const char* names[] = {"SGD", "SGD+M", "Adam"};
+    int failures = 0;
+
+    for (int t = 0; t < 3; t++) {
+        int ok = check_data_parallel(types[t], x, y);
+        printf("%s over %d replicas against serial training [%s]: %s\n", names[t], N_REPLICAS, simd_level_name(simd_get_level()), ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    for (int b = 0; b < N_BATCHES; b++) {
+        free_tensor(&x[b]);
+        free_tensor(&y[b]);
+    }
+
+    return failures != 0;
+}
+
+
+
+/* The same small network every time, seeded so a second copy starts from the same weights */
+Network* create_test_network(OptimiserType type) {
+    tensor_rng_seed(SEED + 1);
+    Network* net = create_network(N_FEATURES, MSE, type, LEARNING_RATE);
+    if (!net) return NULL;
+
+    if (!network_add_layer(net, 16, RELU) || !network_add_layer(net, 8, SIGMOID) || !network_add_layer(net, N_OUTPUTS, LINEAR)) free_network(&net);
+
+    return net;
+}
+
+
+
+/* Trains one copy serially and one over N_REPLICAS, then compares their parameter slabs. Returns 0 if any differs */
+int check_data_parallel(OptimiserType type, Tensor** x, Tensor** y) {
+    Network* serial = create_test_network(type);
+    Network* parallel = create_test_network(type);
+
+    int ok = serial && parallel && network_set_data_parallel(parallel, N_REPLICAS);
+
+    int saved = silence_stdout();    /* Keeps the progress of training out of the results */
+    ok = ok && network_train(serial, x, y, N_BATCHES, EPOCHS);
+    ok = ok && network_train(parallel, x, y, N_BATCHES, EPOCHS);
+    restore_stdout(saved);
+    ok = ok && parallel->replicas;    /* Built by the first data parallel step, so the batches were split */
+
+    int errors = 0;
+    float max_error = 0.0f;
+    for (size_t i = 0; ok && i < serial->slab_size; i++) {
+        float error = fabsf(parallel->parameters[i] - serial->parameters[i]);
+        if (error > max_error) max_error = error;
+        if (!(error <= TOLERANCE * (1.0f + fabsf(serial->parameters[i])))) errors++;
+    }
+    if (!ok) printf("Training failed\n");
+    if (errors) printf("%d of %zu parameters differ from serial training (largest difference %g)\n", errors, serial->slab_size, max_error);
+
+    free_network(&serial);
+    free_network(&parallel);
+
+    return ok && errors == 0;
+}
\ No newline at end of file
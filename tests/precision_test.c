@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "network.h"
+#include "network_internal.h"
+#include "simd.h"
+#include "tensor.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define FLOAT_STRIDE 251            // Every 251st float bit pattern is rounded (odd, so every low mantissa bit is hit)
+#define CHUNK 4096                  // Floats converted per kernel call (a multiple of every vector width, plus a tail below)
+#define N_FEATURES 32
+#define BATCH_SIZE 256              // The rounding errors of the caches average out over the rows of the batch in dW
+#define BF16_GRADIENT_TOLERANCE 1e-3
+#define FP16_GRADIENT_TOLERANCE 2e-4
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+uint32_t float_bits(float x);
+float bits_float(uint32_t u);
+uint16_t reference_fp16(float x);
+uint16_t reference_bf16(float x);
+uint32_t reference_fp16_to_float(uint16_t h);
+int check_halves();
+int check_bf16_round_trip();
+int check_rounding(const char* name, void (*convert)(uint16_t* out, const float* x, int n), uint16_t (*reference)(float x));
+int check_ties();
+Network* create_test_network();
+int check_gradients(storage_precision precision, double tolerance);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* The 16-bit conversions of the kernel level picked (NEURAL_SIMD) against a rounding written with doubles: every half
+   and bf16 value, a sweep of the floats and every tie, NaN, infinity and subnormals included, so the software
+   conversions and F16C / AVX512-BF16 must give the same bits. Then the gradients of one mixed precision step against fp32 */
+int main() {
+    init_tensor_api();
+    const SimdKernels* k = simd_kernels();
+    const char* level = simd_level_name(simd_get_level());
+
+    int failures = 0;
+
+    int ok = check_halves();
+    printf("fp16 -> float -> fp16 [%s], all 65536 halves: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_bf16_round_trip();
+    printf("bf16 -> float -> bf16 [%s], all 65536 values: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_rounding("fp16", k->to_fp16, reference_fp16) && check_rounding("bf16", k->to_bf16, reference_bf16);
+    printf("float -> fp16 / bf16 [%s], every %dth float: %s\n", level, FLOAT_STRIDE, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_ties();
+    printf("Ties to even [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    ok = check_gradients(PRECISION_BF16, BF16_GRADIENT_TOLERANCE) && check_gradients(PRECISION_FP16, FP16_GRADIENT_TOLERANCE);
+    printf("Mixed precision gradients against fp32 [%s]: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    return failures != 0;
+}
+
+
+
+uint32_t float_bits(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+float bits_float(uint32_t u) {
+    float x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+
+
+/* Nearest even half of x, found with doubles: NaNs keep the top of their payload and turn quiet (as F16C does) */
+uint16_t reference_fp16(float x) {
+    uint32_t u = float_bits(x);
+    uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+    double a = fabs((double)x);
+
+    if (isnan(x)) return (uint16_t)(sign | 0x7E00 | ((u >> 13) & 0x3FF));
+    if (a >= 65520.0) return (uint16_t)(sign | 0x7C00);                            /* Halfway to 65536 and up round to infinity */
+    if (a < ldexp(1.0, -14)) return (uint16_t)(sign | (uint16_t)nearbyint(ldexp(a, 24)));    /* Subnormal (or the smallest normal) */
+
+    int e;
+    frexp(a, &e);
+    e -= 1;                                                                         /* a is in [2^e, 2^(e + 1)) */
+    double m = nearbyint(ldexp(a, 10 - e));                                         /* 1024 to 2048 */
+    if (m == 2048.0) {m = 1024.0; e++;}
+
+    return (uint16_t)(sign | ((e + 15) << 10) | ((int)m - 1024));
+}
+
+
+
+/* Nearest even bf16 of x, found with doubles: NaNs turn quiet, denormal floats become zero (as AVX512-BF16 does) */
+uint16_t reference_bf16(float x) {
+    uint32_t u = float_bits(x);
+    uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+    double a = fabs((double)x);
+
+    if (isnan(x)) return (uint16_t)((u >> 16) | 0x40);
+    if (isinf(x)) return (uint16_t)(sign | 0x7F80);
+    if ((u & 0x7F800000) == 0) return sign;
+
+    int e;
+    frexp(a, &e);
+    e -= 1;
+    double m = nearbyint(ldexp(a, 7 - e));                                          /* 128 to 256 */
+    if (m == 256.0) {m = 128.0; e++;}
+    if (e + 127 >= 255) return (uint16_t)(sign | 0x7F80);
+
+    return (uint16_t)(sign | ((e + 127) << 7) | ((int)m - 128));
+}
+
+
+
+/* Bits of the float a half stands for, found with doubles: NaNs keep their payload and turn quiet */
+uint32_t reference_fp16_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exponent = (h >> 10) & 0x1F;
+    int mantissa = h & 0x3FF;
+
+    if (exponent == 0x1F) return sign | 0x7F800000 | (mantissa ? 0x400000 | ((uint32_t)mantissa << 13) : 0);
+
+    double value = (exponent == 0) ? ldexp(mantissa, -24) : ldexp(1024 + mantissa, exponent - 25);
+    return sign | float_bits((float)value);
+}
+
+
+
+/* Every half widened against reference_fp16_to_float, then rounded back: it must come back unchanged (a signaling NaN comes back quiet) */
+int check_halves() {
+    const SimdKernels* k = simd_kernels();
+    uint16_t* halves = (uint16_t*) malloc(65536 * sizeof(uint16_t));
+    uint16_t* back = (uint16_t*) malloc(65536 * sizeof(uint16_t));
+    float* floats = (float*) malloc(65536 * sizeof(float));
+    if (!halves || !back || !floats) {printf("Malloc failed for the halves\n"); free(halves); free(back); free(floats); return 0;}
+
+    for (int i = 0; i < 65536; i++) halves[i] = (uint16_t)i;
+
+    k->from_fp16(floats, halves, 65535);    /* 65535, so the last one goes through the tail */
+    k->from_fp16(floats + 65535, halves + 65535, 1);
+    k->to_fp16(back, floats, 65535);
+    k->to_fp16(back + 65535, floats + 65535, 1);
+
+    int errors = 0;
+    for (int i = 0; i < 65536; i++) {
+        uint16_t expected = ((i & 0x7C00) == 0x7C00 && (i & 0x3FF)) ? (uint16_t)(i | 0x200) : (uint16_t)i;
+        uint32_t widened = float_bits(floats[i]);
+
+        if (widened != reference_fp16_to_float((uint16_t)i) || back[i] != expected) {
+            if (errors < 8) printf("Half %04x: widened to %08x (expected %08x), back to %04x (expected %04x)\n", i, widened, reference_fp16_to_float((uint16_t)i), back[i], expected);
+            errors++;
+        }
+    }
+
+    free(halves);
+    free(back);
+    free(floats);
+    return errors == 0;
+}
+
+
+
+/* Every bf16 value widened then rounded back: it comes back unchanged, but for denormals (zero of their sign) and signaling NaNs (quiet) */
+int check_bf16_round_trip() {
+    const SimdKernels* k = simd_kernels();
+    uint16_t* values = (uint16_t*) malloc(65536 * sizeof(uint16_t));
+    uint16_t* back = (uint16_t*) malloc(65536 * sizeof(uint16_t));
+    float* floats = (float*) malloc(65536 * sizeof(float));
+    if (!values || !back || !floats) {printf("Malloc failed for the bf16 values\n"); free(values); free(back); free(floats); return 0;}
+
+    for (int i = 0; i < 65536; i++) values[i] = (uint16_t)i;
+
+    k->from_bf16(floats, values, 65535);
+    k->from_bf16(floats + 65535, values + 65535, 1);
+    k->to_bf16(back, floats, 65535);
+    k->to_bf16(back + 65535, floats + 65535, 1);
+
+    int errors = 0;
+    for (int i = 0; i < 65536; i++) {
+        uint16_t expected = (uint16_t)i;
+        if ((i & 0x7F80) == 0) expected = (uint16_t)(i & 0x8000);
+        else if ((i & 0x7F80) == 0x7F80 && (i & 0x7F)) expected = (uint16_t)(i | 0x40);
+
+        if (float_bits(floats[i]) != (uint32_t)i << 16 || back[i] != expected) {
+            if (errors < 8) printf("bf16 %04x: widened to %08x, back to %04x (expected %04x)\n", i, float_bits(floats[i]), back[i], expected);
+            errors++;
+        }
+    }
+
+    free(values);
+    free(back);
+    free(floats);
+    return errors == 0;
+}
+
+
+
+/* Rounds every FLOAT_STRIDE-th float bit pattern (NaNs, infinities and subnormals of both signs included) against reference */
+int check_rounding(const char* name, void (*convert)(uint16_t* out, const float* x, int n), uint16_t (*reference)(float x)) {
+    float floats[CHUNK + 3];
+    uint16_t rounded[CHUNK + 3];
+    long errors = 0;
+    uint64_t bits = 0;
+
+    while (bits < (1ull << 32)) {
+        int n = 0;
+        for (; n < CHUNK + 3 && bits < (1ull << 32); n++, bits += FLOAT_STRIDE) floats[n] = bits_float((uint32_t)bits);
+
+        convert(rounded, floats, n);
+        for (int i = 0; i < n; i++) {
+            if (rounded[i] == reference(floats[i])) continue;
+            if (errors < 8) printf("%s of %08x: %04x (expected %04x)\n", name, float_bits(floats[i]), rounded[i], reference(floats[i]));
+            errors++;
+        }
+    }
+
+    return errors == 0;
+}
+
+
+
+/* The floats halfway between two neighbouring halves or bf16 values, and one float ulp either side, for every finite value */
+int check_ties() {
+    const SimdKernels* k = simd_kernels();
+    float* floats = (float*) malloc(6 * 0x8000 * sizeof(float));    /* 3 floats per positive finite value, then their negatives */
+    uint16_t* rounded = (uint16_t*) malloc(3 * 0x8000 * sizeof(uint16_t));
+    if (!floats || !rounded) {printf("Malloc failed for the ties\n"); free(floats); free(rounded); return 0;}
+
+    long errors = 0;
+
+    for (int precision = 0; precision < 2; precision++) {
+        int n = 0;
+        int limit = precision ? 0x7F80 : 0x7C00;    /* Positive finite values */
+
+        for (int h = 0; h < limit; h++) {
+            double low, high;
+            if (precision) {
+                if (h < 0x80) continue;             /* Ties between bf16 denormals are denormal floats, flushed to zero */
+                low = bits_float((uint32_t)h << 16);
+                high = bits_float((uint32_t)(h + 1) << 16);
+            } else {
+                low = bits_float(reference_fp16_to_float((uint16_t)h));
+                high = bits_float(reference_fp16_to_float((uint16_t)(h + 1)));
+            }
+            if (isinf(high)) high = precision ? ldexp(1.0, 128) : 65536.0;
+
+            float tie = (float)((low + high) / 2.0);    /* Exact, halves and bf16 values have far fewer bits than floats */
+            floats[n++] = nextafterf(tie, 0.0f);
+            floats[n++] = tie;
+            floats[n++] = nextafterf(tie, INFINITY);
+        }
+
+        for (int i = 0; i < n; i++) floats[n + i] = -floats[i];    /* Same ties, negative */
+
+        for (int pass = 0; pass < 2; pass++) {
+            float* x = floats + pass * n;
+            if (precision) k->to_bf16(rounded, x, n);
+            else k->to_fp16(rounded, x, n);
+
+            for (int i = 0; i < n; i++) {
+                uint16_t expected = precision ? reference_bf16(x[i]) : reference_fp16(x[i]);
+                if (rounded[i] == expected) continue;
+                if (errors < 8) printf("%s of the tie %08x: %04x (expected %04x)\n", precision ? "bf16" : "fp16", float_bits(x[i]), rounded[i], expected);
+                errors++;
+            }
+        }
+    }
+
+    free(floats);
+    free(rounded);
+    return errors == 0;
+}
+
+
+
+/* Small network with every activation a 16-bit cache is read back for, always built with the same weights */
+Network* create_test_network() {
+    tensor_rng_seed(11);
+    Network* net = create_network(N_FEATURES, MSE, SGD, 0.05f);
+    if (!net) return NULL;
+
+    network_add_layer(net, 64, RELU);
+    network_add_layer(net, 32, SIGMOID);
+    network_add_layer(net, 10, SOFTMAX);
+
+    return net;
+}
+
+
+
+/* One step with 16-bit caches against the same step in fp32: the relative error of the gradient slab must be below tolerance */
+int check_gradients(storage_precision precision, double tolerance) {
+    tensor_rng_seed(5);
+    Tensor* x = create_tensor_random(BATCH_SIZE, N_FEATURES, 0.0f, 1.0f);
+    Tensor* y = create_tensor_random(BATCH_SIZE, 10, 0.0f, 1.0f);
+
+    Network* reference = create_test_network();
+    Network* net = create_test_network();
+
+    float loss, reference_loss;
+    int ok = x && y && reference && net && network_set_precision(net, precision);
+    ok = ok && _network_step(reference, 0, x, y, 1.0f, &reference_loss) && _network_step(net, 0, x, y, 1.0f, &loss);
+
+    double error = 0.0, norm = 0.0;
+    for (size_t i = 0; ok && i < net->slab_size; i++) {
+        double d = (double)net->gradients[i] - reference->gradients[i];
+        error += d * d;
+        norm += (double)reference->gradients[i] * reference->gradients[i];
+    }
+
+    double relative = (ok && norm > 0.0) ? sqrt(error / norm) : INFINITY;
+    if (!(relative <= tolerance)) printf("%s gradients: relative error %.2e (tolerance %.0e)\n", (precision == PRECISION_BF16) ? "bf16" : "fp16", relative, tolerance);
+
+    free_network(&reference);
+    free_network(&net);
+    free_tensor(&x);
+    free_tensor(&y);
+
+    return relative <= tolerance;
+}
\ No newline at end of file
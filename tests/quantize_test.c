@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "network.h"
+#include "quantize.h"
+#include "quantize_internal.h"
+#include "simd.h"
+#include "tensor.h"
+
+
+
+// ==========================================
+//             Configuration
+// ==========================================
+#define SEED 99
+#define LDA_PADDING 5               // Extra bytes after every row of inputs of a tile, so the rows are not aligned
+#define N_FEATURES 37               // Not a multiple of QUANTIZED_GROUP
+#define N_OUTPUTS 10
+#define N_CALIBRATION 200
+#define INPUT_RANGE 1.5f            // Wider than the calibration, so the quantization of the input clamps
+#define ROUND_TRIP_ROWS 23
+
+
+
+/* A tile kernel of quantize.c and its name */
+typedef struct TileKernel {
+
+    const char* name;
+    void (*tile)(int groups, const uint8_t* a, int lda, int mr, const int8_t* b, int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS]);
+
+} TileKernel;
+
+
+
+// ==========================================
+//             Helper Prototypes
+// ==========================================
+int check_tile(const TileKernel* kernel, int groups, int mr);
+uint8_t reference_quantize(float x, float inv_scale, float half_zero_point);
+float* reference_predict(const QuantizedNetwork* qnet, const Tensor* input);
+int check_predictions(const QuantizedNetwork* qnet, int rows);
+int check_round_trip(const QuantizedNetwork* qnet);
+
+
+
+// ==========================================
+//                 Main
+// ==========================================
+
+/* Every tile kernel the kernel level picked (NEURAL_SIMD) allows against plain integer sums, for every number of rows
+   of a tile and depths of one to many groups. Then quantized inference, fused requantization included, against the
+   same arithmetic written plainly for batches that end in partial tiles and layers that end in partial panels, and
+   the predictions of a saved and reloaded network against those of the original, bit for bit */
+int main() {
+    init_tensor_api();
+    tensor_rng_seed(SEED);
+    const char* level = simd_level_name(simd_get_level());
+
+    TileKernel kernels[3] = {{"generic", _quantized_tile_generic}};
+    int n_kernels = 1;
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (simd_get_level() >= SIMD_AVX2) kernels[n_kernels++] = (TileKernel){"AVX2", _quantized_tile_avx2};
+    if (simd_get_level() == SIMD_AVX512 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+        kernels[n_kernels++] = (TileKernel){"VNNI", _quantized_tile_vnni};
+    }
+#endif
+
+    int depths[] = {1, 2, 3, 8, 25, 200};
+    int n_depths = sizeof(depths) / sizeof(depths[0]);
+    int failures = 0;
+
+    for (int k = 0; k < n_kernels; k++) {
+        int ok = 1;
+        for (int d = 0; d < n_depths; d++) for (int mr = 1; mr <= QUANTIZED_MR; mr++) ok &= check_tile(&kernels[k], depths[d], mr);
+        printf("%s tile [%s], 1 to %d rows against integer sums: %s\n", kernels[k].name, level, QUANTIZED_MR, ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    /* Layers of 45 and 70 outputs end in partial panels, the last RELU layer feeds its requantized output to a LINEAR one */
+    Network* net = create_network(N_FEATURES, MSE, SGD, 0.01f);
+    int built = net && network_add_layer(net, 45, RELU) && network_add_layer(net, 70, RELU) && network_add_layer(net, N_OUTPUTS, LINEAR);
+
+    Tensor* calibration = create_tensor_random(N_CALIBRATION, N_FEATURES, -1.0f, 1.0f);
+    QuantizedNetwork* qnet = (built && calibration) ? network_quantize(net, calibration) : NULL;
+    if (!qnet) {printf("The quantized network could not be built\n"); failures++;}
+
+    int batches[] = {1, 2, 5, QUANTIZED_MR, QUANTIZED_MR + 1, 2 * QUANTIZED_MR, 23, 100};
+    int n_batches = sizeof(batches) / sizeof(batches[0]);
+    int passed = 0;
+    for (int b = 0; qnet && b < n_batches; b++) passed += check_predictions(qnet, batches[b]);
+    printf("Quantized inference [%s] against the reference, %d of %d batch sizes bit-identical\n", level, passed, n_batches);
+    failures += n_batches - passed;
+
+    int ok = qnet && check_round_trip(qnet);
+    printf("Saved and reloaded quantized network [%s], same predictions: %s\n", level, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    free_quantized_network(&qnet);
+    free_network(&net);
+    free_tensor(&calibration);
+
+    return failures != 0;
+}
+
+
+
+/* One call of a tile kernel on mr rows against integer sums. The extremes of uint8 and int8 are among the values. Returns 0 if a sum is off */
+int check_tile(const TileKernel* kernel, int groups, int mr) {
+    int lda = groups * QUANTIZED_GROUP + LDA_PADDING;
+    size_t b_bytes = (size_t)groups * QUANTIZED_GROUP * QUANTIZED_PANEL_COLS;
+
+    uint8_t* a = (uint8_t*) malloc((size_t)QUANTIZED_MR * lda);
+    int8_t* b = (int8_t*) aligned_alloc(64, b_bytes);
+    int32_t tile[QUANTIZED_MR][QUANTIZED_PANEL_COLS] __attribute__((aligned(64)));
+    if (!a || !b) {printf("Malloc failed for a tile of %d groups\n", groups); free(a); free(b); return 0;}
+
+    for (size_t i = 0; i < (size_t)QUANTIZED_MR * lda; i++) a[i] = (i % 7 == 0) ? 255 : (uint8_t)(i * 2654435761u >> 13);
+    for (size_t i = 0; i < b_bytes; i++) b[i] = (i % 5 == 0) ? -128 : (int8_t)(i * 40503u >> 7);
+
+    kernel->tile(groups, a, lda, mr, b, tile);
+
+    int errors = 0;
+    for (int i = 0; i < mr; i++) for (int c = 0; c < QUANTIZED_PANEL_COLS; c++) {
+        int32_t expected = 0;
+        for (int k = 0; k < groups * QUANTIZED_GROUP; k++) {
+            int g = k / QUANTIZED_GROUP, t = k % QUANTIZED_GROUP;
+            expected += (int32_t)a[(size_t)i * lda + k] * b[((size_t)g * QUANTIZED_PANEL_COLS + c) * QUANTIZED_GROUP + t];
+        }
+        if (tile[i][c] != expected) errors++;
+    }
+    if (errors) printf("FAILED %s tile, %d groups, %d rows: %d wrong sums\n", kernel->name, groups, mr, errors);
+
+    free(a);
+    free(b);
+
+    return errors == 0;
+}
+
+
+
+/* x quantized to uint8 in the float operations of the library: clamp(x * inv_scale + zero_point + 0.5, 0, 255.5) truncated */
+uint8_t reference_quantize(float x, float inv_scale, float half_zero_point) {
+    x = x * inv_scale + half_zero_point;
+    if (!(x > 0.0f)) x = 0.0f;
+    if (!(x < 255.5f)) x = 255.5f;
+    return (uint8_t)(int)x;
+}
+
+
+
+/* Quantized inference written plainly: integer sums over the unpacked weights, then y = sum * scales[j] + biases[j],
+   activated, and quantized for the next layer. Returns the (rows x outputs) floats, NULL if any error */
+float* reference_predict(const QuantizedNetwork* qnet, const Tensor* input) {
+    int rows = input->rows;
+    int width = 0;
+    for (int l = 0; l < qnet->n_layers; l++) if (qnet->layers[l].n_padded > width) width = qnet->layers[l].n_padded;
+    if (qnet->layers[0].k_padded > width) width = qnet->layers[0].k_padded;
+
+    uint8_t* q = (uint8_t*) malloc((size_t)rows * width);
+    uint8_t* next_q = (uint8_t*) malloc((size_t)rows * width);
+    float* out = (float*) malloc((size_t)rows * qnet->layers[qnet->n_layers - 1].n_neurons * sizeof(float));
+    if (!q || !next_q || !out) {printf("Malloc failed for the reference of %d rows\n", rows); free(q); free(next_q); free(out); return NULL;}
+
+    const QuantizedLayer* first = &qnet->layers[0];
+    for (int i = 0; i < rows; i++) for (int k = 0; k < first->k_padded; k++) {
+        q[(size_t)i * width + k] = (k < first->n_neurons_prev)
+            ? reference_quantize(input->data[(size_t)i * input->stride + k], 1.0f / first->input_scale, (float)first->input_zero_point + 0.5f)
+            : (uint8_t)first->input_zero_point;
+    }
+
+    for (int l = 0; l < qnet->n_layers; l++) {
+        const QuantizedLayer* layer = &qnet->layers[l];
+        const QuantizedLayer* next = (l < qnet->n_layers - 1) ? &qnet->layers[l + 1] : NULL;
+        int groups = layer->k_padded / QUANTIZED_GROUP;
+
+        for (int i = 0; i < rows; i++) for (int j = 0; j < layer->n_neurons; j++) {
+            const int8_t* panel = layer->weights + (size_t)(j / QUANTIZED_PANEL_COLS) * groups * QUANTIZED_GROUP * QUANTIZED_PANEL_COLS;
+            int32_t sum = 0;
+            for (int k = 0; k < layer->k_padded; k++) {
+                int8_t w = panel[((size_t)(k / QUANTIZED_GROUP) * QUANTIZED_PANEL_COLS + j % QUANTIZED_PANEL_COLS) * QUANTIZED_GROUP + k % QUANTIZED_GROUP];
+                sum += (int32_t)q[(size_t)i * width + k] * w;
+            }
+
+            float y = (float)sum * layer->scales[j] + layer->biases[j];
+            if (layer->activation == RELU && !(y > 0.0f)) y = y * RELU_NEGATIVE_SLOPE;
+
+            if (next) next_q[(size_t)i * width + j] = reference_quantize(y, 1.0f / next->input_scale, (float)next->input_zero_point + 0.5f);
+            else out[(size_t)i * layer->n_neurons + j] = y;
+        }
+
+        if (next) {
+            for (int i = 0; i < rows; i++) for (int k = layer->n_neurons; k < next->k_padded; k++) next_q[(size_t)i * width + k] = (uint8_t)next->input_zero_point;
+            uint8_t* swap = q;
+            q = next_q;
+            next_q = swap;
+        }
+    }
+
+    free(q);
+    free(next_q);
+
+    return out;
+}
+
+
+
+/* Predicts rows random samples and compares with reference_predict. Returns 0 if an output differs in any bit */
+int check_predictions(const QuantizedNetwork* qnet, int rows) {
+    Tensor* x = create_tensor_random(rows, N_FEATURES, -INPUT_RANGE, INPUT_RANGE);
+    Tensor* prediction = x ? quantized_network_predict(qnet, x) : NULL;
+    float* expected = x ? reference_predict(qnet, x) : NULL;
+
+    int errors = 0;
+    for (int i = 0; prediction && expected && i < rows; i++) {
+        if (memcmp(prediction->data + (size_t)i * prediction->stride, expected + (size_t)i * N_OUTPUTS, N_OUTPUTS * sizeof(float)) != 0) errors++;
+    }
+
+    int ok = prediction && expected && errors == 0;
+    if (!ok) printf("FAILED batch of %d rows: %d rows differ from the reference\n", rows, errors);
+
+    free_tensor(&x);
+    free_tensor(&prediction);
+    free(expected);
+
+    return ok;
+}
+
+
+
+/* Saves qnet, loads it back and predicts the same samples with both. Returns 1 if the predictions are bit-identical */
+int check_round_trip(const QuantizedNetwork* qnet) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/quantize_test_%d.qnn", (int)getpid());
+
+    QuantizedNetwork* loaded = quantized_network_save(qnet, path) ? quantized_network_load(path) : NULL;
+    Tensor* x = create_tensor_random(ROUND_TRIP_ROWS, N_FEATURES, -INPUT_RANGE, INPUT_RANGE);
+    Tensor* original = (loaded && x) ? quantized_network_predict(qnet, x) : NULL;
+    Tensor* reloaded = (loaded && x) ? quantized_network_predict(loaded, x) : NULL;
+
+    int ok = original && reloaded;
+    for (int i = 0; ok && i < ROUND_TRIP_ROWS; i++) {
+        ok = memcmp(original->data + (size_t)i * original->stride, reloaded->data + (size_t)i * reloaded->stride, N_OUTPUTS * sizeof(float)) == 0;
+    }
+
+    unlink(path);
+    free_quantized_network(&loaded);
+    free_tensor(&x);
+    free_tensor(&original);
+    free_tensor(&reloaded);
+
+    return ok;
+}
\ No newline at end of file
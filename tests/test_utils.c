@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "test_utils.h"
+
+
+
+// ==========================================
+//             Output of the Library
+// ==========================================
+
+/**
+ * Sends STDOUT to /dev/null, so the progress printed by training does not bury the results of a test.
+ * Returns a copy of the previous STDOUT for restore_stdout, -1 if it could not be silenced.
+*/
+int silence_stdout() {
+    return capture_stdout("/dev/null");
+}
+
+
+
+/**
+ * Sends STDOUT to the file at path (created or truncated), so a test can read what the library printed.
+ * Returns a copy of the previous STDOUT for restore_stdout, -1 if it could not be redirected.
+ *
+ * @param path Path of the file receiving the output.
+*/
+int capture_stdout(const char* path) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    if (saved >= 0 && fd < 0) {close(saved); saved = -1;}
+    if (saved >= 0) dup2(fd, STDOUT_FILENO);
+    if (fd >= 0) close(fd);
+
+    return saved;
+}
+
+
+
+/**
+ * Puts back the STDOUT saved by silence_stdout or capture_stdout.
+ *
+ * @param saved The value silence_stdout or capture_stdout returned.
+*/
+void restore_stdout(int saved) {
+    if (saved < 0) return;
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+
+
+// ==========================================
+//             Output of the Library
+// ==========================================
+
+/**
+ * Sends STDOUT to /dev/null, so the progress printed by training does not bury the results of a test.
+ * Returns a copy of the previous STDOUT for restore_stdout, -1 if it could not be silenced.
+*/
+int silence_stdout();
+
+
+
+/**
+ * Sends STDOUT to the file at path (created or truncated), so a test can read what the library printed.
+ * Returns a copy of the previous STDOUT for restore_stdout, -1 if it could not be redirected.
+ *
+ * @param path Path of the file receiving the output.
+*/
+int capture_stdout(const char* path);
+
+
+
+/**
+ * Puts back the STDOUT saved by silence_stdout or capture_stdout.
+ *
+ * @param saved The value silence_stdout or capture_stdout returned.
+*/
+void restore_stdout(int saved);
+
+
+
+#endif
\ No newline at end of file